@@ -0,0 +1,130 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <gtest/gtest.h>
+#include "conf.h"
+#include "threading.h"
+
+// the config is shared by all tests, so each test uses its own keys under "conftests."
+class ConfTests: public ::testing::Test {
+protected:
+    void TearDown() override {
+        conf_remove_items ("conftests.");
+    }
+};
+
+TEST_F(ConfTests, test_SetStr_GetReturnsValueIgnoringKeyCase) {
+    conf_set_str ("conftests.Key", "value");
+    char buffer[100];
+    conf_get_str ("CONFTESTS.KEY", "default", buffer, sizeof (buffer));
+    EXPECT_STREQ(buffer, "value");
+}
+
+TEST_F(ConfTests, test_SetStrNull_RemovesItem) {
+    conf_set_str ("conftests.key", "value");
+    conf_set_str ("conftests.key", NULL);
+    char buffer[100];
+    conf_get_str ("conftests.key", "default", buffer, sizeof (buffer));
+    EXPECT_STREQ(buffer, "default");
+    EXPECT_EQ(NULL, conf_find ("conftests.", NULL));
+}
+
+TEST_F(ConfTests, test_ReplaceValue_GetReturnsNewValue) {
+    conf_set_int ("conftests.int", 1);
+    conf_set_int ("conftests.int", 2);
+    EXPECT_EQ(2, conf_get_int ("conftests.int", 0));
+    EXPECT_EQ(7, conf_get_int ("conftests.missing", 7));
+}
+
+TEST_F(ConfTests, test_ManyKeys_AllFoundAndSorted) {
+    char key[100];
+    for (int i = 2999; i >= 0; i--) {
+        snprintf (key, sizeof (key), "conftests.many.%04d", i);
+        conf_set_int (key, i);
+    }
+    for (int i = 0; i < 3000; i++) {
+        snprintf (key, sizeof (key), "conftests.many.%04d", i);
+        EXPECT_EQ(i, conf_get_int (key, -1));
+    }
+
+    int count = 0;
+    conf_lock ();
+    for (DB_conf_item_t *it = conf_find ("conftests.many.", NULL); it; it = conf_find ("conftests.many.", it)) {
+        snprintf (key, sizeof (key), "conftests.many.%04d", count);
+        EXPECT_STREQ(key, it->key);
+        count++;
+    }
+    conf_unlock ();
+    EXPECT_EQ(3000, count);
+}
+
+TEST_F(ConfTests, test_FindPrefix_ReturnsOnlyMatchingItems) {
+    conf_set_str ("conftests.a", "1");
+    conf_set_str ("conftests.b.x", "2");
+    conf_set_str ("conftests.B.y", "3");
+    conf_set_str ("conftests.c", "4");
+
+    conf_lock ();
+    DB_conf_item_t *it = conf_find ("conftests.b.", NULL);
+    ASSERT_TRUE(it != NULL);
+    EXPECT_STREQ(it->value, "2");
+    it = conf_find ("conftests.b.", it);
+    ASSERT_TRUE(it != NULL);
+    EXPECT_STREQ(it->value, "3");
+    EXPECT_EQ(NULL, conf_find ("conftests.b.", it));
+    conf_unlock ();
+}
+
+TEST_F(ConfTests, test_RemoveItems_RemovesOnlyPrefix) {
+    conf_set_str ("conftests.a", "1");
+    conf_set_str ("conftests.b.x", "2");
+    conf_set_str ("conftests.b.y", "3");
+    conf_set_str ("conftests.c", "4");
+    conf_remove_items ("conftests.b.");
+
+    EXPECT_EQ(1, conf_get_int ("conftests.a", 0));
+    EXPECT_EQ(0, conf_get_int ("conftests.b.x", 0));
+    EXPECT_EQ(0, conf_get_int ("conftests.b.y", 0));
+    EXPECT_EQ(4, conf_get_int ("conftests.c", 0));
+}
+
+static void
+_writer (void *ctx) {
+    char key[100];
+    for (int i = 0; i < 2000; i++) {
+        snprintf (key, sizeof (key), "conftests.writer.%d", i);
+        conf_set_int (key, i);
+        conf_set_int ("conftests.shared", i % 2 ? 1 : 3);
+    }
+}
+
+TEST_F(ConfTests, test_ReadWhileWriting_ReturnsConsistentValues) {
+    conf_set_int ("conftests.shared", 1);
+    intptr_t tid = thread_start (_writer, NULL);
+    for (int i = 0; i < 20000; i++) {
+        int v = conf_get_int ("conftests.shared", 0);
+        ASSERT_TRUE(v == 1 || v == 3);
+    }
+    thread_join (tid);
+    EXPECT_EQ(1999, conf_get_int ("conftests.writer.1999", 0));
+}
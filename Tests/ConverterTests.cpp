@@ -0,0 +1,231 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <deadbeef/deadbeef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "playlist.h"
+#include "plugins.h"
+#include "../plugins/converter/converter.h"
+#include <gtest/gtest.h>
+
+extern "C" DB_plugin_t * fakein_load (DB_functions_t *api);
+extern "C" DB_plugin_t * converter_load (DB_functions_t *api);
+
+#define TRACK_COUNT 4
+
+// Replaces the samples with the number of frames processed so far,
+// so that the output of each track is a ramp starting from 0 only if the track has its own DSP state
+typedef struct {
+    ddb_dsp_context_t ctx;
+    int64_t frame;
+} counterdsp_t;
+
+static ddb_dsp_context_t *
+counterdsp_open (void);
+
+static void
+counterdsp_close (ddb_dsp_context_t *ctx) {
+    free (ctx);
+}
+
+static int
+counterdsp_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxframes, ddb_waveformat_t *fmt, float *ratio) {
+    counterdsp_t *dsp = (counterdsp_t *)ctx;
+    for (int f = 0; f < frames; f++) {
+        for (int c = 0; c < fmt->channels; c++) {
+            samples[f * fmt->channels + c] = (float)dsp->frame;
+        }
+        dsp->frame++;
+    }
+    return frames;
+}
+
+static DB_dsp_t counterdsp_plugin = {
+    .plugin = {
+        .type = DB_PLUGIN_DSP,
+        .api_vmajor = 1,
+        .api_vminor = 0,
+        .id = "counterdsp",
+        .name = "Counter DSP",
+    },
+    .open = counterdsp_open,
+    .close = counterdsp_close,
+    .process = counterdsp_process,
+};
+
+static ddb_dsp_context_t *
+counterdsp_open (void) {
+    counterdsp_t *dsp = (counterdsp_t *)calloc (1, sizeof (counterdsp_t));
+    dsp->ctx.plugin = &counterdsp_plugin;
+    dsp->ctx.enabled = 1;
+    return &dsp->ctx;
+}
+
+class ConverterTests: public ::testing::Test {
+protected:
+    void SetUp() override {
+        plug_init_plugin (fakein_load, NULL);
+        plug_register_in (fakein_load (plug_get_api ()));
+        _converter = (ddb_converter_t *)converter_load (plug_get_api ());
+
+        _plt = plt_alloc ("testplt");
+        playItem_t *after = NULL;
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            after = (playItem_t *)deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)_plt, (DB_playItem_t *)after, i & 1 ? "/square.fake" : "/sine.fake", NULL, NULL, NULL);
+        }
+
+        _encoder_preset = _converter->encoder_preset_alloc ();
+        _encoder_preset->title = strdup ("wav");
+        _encoder_preset->ext = strdup ("wav");
+        _encoder_preset->encoder = strdup ("");
+        _encoder_preset->method = DDB_ENCODER_METHOD_FILE;
+
+        _dsp_preset = _converter->dsp_preset_alloc ();
+        _dsp_preset->title = strdup ("counter");
+        _dsp_preset->chain = counterdsp_open ();
+
+        strcpy (_folder, "/tmp/ddb_converter_XXXXXX");
+        ASSERT_TRUE(mkdtemp (_folder) != NULL);
+    }
+
+    void TearDown() override {
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            unlink (outputPath (i).c_str ());
+        }
+        rmdir (_folder);
+        _converter->dsp_preset_free (_dsp_preset);
+        _converter->encoder_preset_free (_encoder_preset);
+        plt_unref (_plt);
+    }
+
+    std::string outputPath (int idx) {
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/%d.wav", _folder, idx);
+        return path;
+    }
+
+    // Returns the float samples of the wave file data chunk
+    std::vector<float> readSamples (int idx) {
+        std::vector<float> samples;
+        FILE *fp = fopen (outputPath (idx).c_str (), "rb");
+        if (!fp) {
+            return samples;
+        }
+        char header[44];
+        if (fread (header, sizeof (header), 1, fp) == 1 && !memcmp (header + 36, "data", 4)) {
+            float buffer[1024];
+            size_t n;
+            while ((n = fread (buffer, sizeof (float), 1024, fp)) > 0) {
+                samples.insert (samples.end (), buffer, buffer + n);
+            }
+        }
+        fclose (fp);
+        return samples;
+    }
+
+    ddb_converter_t *_converter;
+    playlist_t *_plt;
+    ddb_encoder_preset_t *_encoder_preset;
+    ddb_dsp_preset_t *_dsp_preset;
+    char _folder[PATH_MAX];
+};
+
+TEST_F(ConverterTests, test_Job_TwoThreadsStatefulDSP_EachTrackHasOwnDSPState) {
+    ddb_converter_settings_t settings = {
+        .output_bps = -1,
+        .encoder_preset = _encoder_preset,
+        .dsp_preset = _dsp_preset,
+    };
+
+    int abort = 0;
+    ddb_converter_job_t *job = _converter->job_alloc (&settings, 2, &abort);
+    playItem_t *it = plt_get_first (_plt, PL_MAIN);
+    for (int i = 0; i < TRACK_COUNT; i++) {
+        EXPECT_EQ(0, _converter->job_add (job, (DB_playItem_t *)it, outputPath (i).c_str ()));
+        playItem_t *next = pl_get_next (it, PL_MAIN);
+        pl_item_unref (it);
+        it = next;
+    }
+
+    EXPECT_EQ(0, _converter->job_start (job, NULL, NULL));
+    EXPECT_EQ(0, _converter->job_wait (job));
+
+    ddb_converter_job_stats_t stats = { ._size = sizeof (stats) };
+    _converter->job_get_stats (job, &stats);
+    _converter->job_free (job);
+
+    EXPECT_EQ(TRACK_COUNT, stats.tracks_done);
+    EXPECT_EQ(0, stats.tracks_failed);
+
+    for (int i = 0; i < TRACK_COUNT; i++) {
+        std::vector<float> samples = readSamples (i);
+        ASSERT_GT(samples.size (), 0);
+        EXPECT_EQ(0, samples.size () % 2);
+        int64_t wrong = 0;
+        for (size_t s = 0; s < samples.size (); s++) {
+            if (samples[s] != (float)(s / 2)) {
+                wrong++;
+            }
+        }
+        EXPECT_EQ(0, wrong) << "track " << i;
+    }
+
+    // the chain of the preset itself is left untouched
+    EXPECT_EQ(0, ((counterdsp_t *)_dsp_preset->chain)->frame);
+}
+
+static intptr_t
+_failingThreadStart (void (*fn)(void *ctx), void *ctx) {
+    return 0;
+}
+
+TEST_F(ConverterTests, test_Job_ThreadsFailToStart_JobFails) {
+    ddb_converter_settings_t settings = {
+        .output_bps = -1,
+        .encoder_preset = _encoder_preset,
+    };
+
+    ddb_converter_job_t *job = _converter->job_alloc (&settings, 2, NULL);
+    playItem_t *it = plt_get_first (_plt, PL_MAIN);
+    EXPECT_EQ(0, _converter->job_add (job, (DB_playItem_t *)it, outputPath (0).c_str ()));
+    pl_item_unref (it);
+
+    DB_functions_t *api = plug_get_api ();
+    intptr_t (*thread_start) (void (*fn)(void *ctx), void *ctx) = api->thread_start;
+    api->thread_start = _failingThreadStart;
+    EXPECT_EQ(-1, _converter->job_start (job, NULL, NULL));
+    api->thread_start = thread_start;
+
+    // doesn't wait for threads which never started
+    EXPECT_EQ(1, _converter->job_wait (job));
+    ddb_converter_job_stats_t stats = { ._size = sizeof (stats) };
+    _converter->job_get_stats (job, &stats);
+    _converter->job_free (job);
+
+    EXPECT_EQ(0, stats.tracks_done);
+    EXPECT_EQ(1, stats.tracks_failed);
+}
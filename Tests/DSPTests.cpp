@@ -0,0 +1,241 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <deadbeef/deadbeef.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "conf.h"
+#include "dsp.h"
+#include "messagepump.h"
+#include "plugins.h"
+#include "streamer.h"
+#include "fakeout.h"
+#include <gtest/gtest.h>
+
+extern "C" DB_plugin_t * fakeout_load (DB_functions_t *api);
+
+#define FAKEDSP_MAX_CHANNELS 8
+#define FAKEDSP_DELAY 37
+
+enum {
+    FAKEDSP_LOWPASS,
+    FAKEDSP_UPSAMPLE,
+    FAKEDSP_DELAYLINE,
+};
+
+// stateful DSPs, so that the output depends on the blocks being processed in order
+typedef struct {
+    ddb_dsp_context_t ctx;
+    int type;
+    float state[FAKEDSP_MAX_CHANNELS];
+    float delay[FAKEDSP_DELAY * FAKEDSP_MAX_CHANNELS];
+    int delay_pos;
+    std::thread::id thread;
+} fakedsp_t;
+
+static void
+fakedsp_close (ddb_dsp_context_t *ctx) {
+    delete (fakedsp_t *)ctx;
+}
+
+static int
+fakedsp_process (ddb_dsp_context_t *ctx, float *samples, int frames, int maxframes, ddb_waveformat_t *fmt, float *ratio) {
+    fakedsp_t *dsp = (fakedsp_t *)ctx;
+    int nch = fmt->channels;
+    if (samples) {
+        dsp->thread = std::this_thread::get_id ();
+    }
+    switch (dsp->type) {
+    case FAKEDSP_LOWPASS:
+        for (int i = 0; i < frames * nch; i++) {
+            float *y = &dsp->state[i % nch];
+            *y += (samples[i] - *y) * 0.1f;
+            samples[i] = *y;
+        }
+        return frames;
+    case FAKEDSP_UPSAMPLE:
+        fmt->samplerate *= 2;
+        *ratio = 0.5f;
+        if (frames * 2 > maxframes) {
+            frames = maxframes / 2;
+        }
+        for (int f = frames - 1; f >= 0; f--) {
+            for (int c = 0; c < nch; c++) {
+                samples[(f * 2 + 1) * nch + c] = samples[(f * 2) * nch + c] = samples[f * nch + c];
+            }
+        }
+        return frames * 2;
+    case FAKEDSP_DELAYLINE:
+        for (int f = 0; f < frames; f++) {
+            for (int c = 0; c < nch; c++) {
+                float *d = &dsp->delay[dsp->delay_pos * nch + c];
+                float v = *d;
+                *d = samples[f * nch + c];
+                samples[f * nch + c] = v;
+            }
+            dsp->delay_pos = (dsp->delay_pos + 1) % FAKEDSP_DELAY;
+        }
+        return frames;
+    }
+    return frames;
+}
+
+static ddb_dsp_context_t *
+fakedsp_open (void);
+
+static DB_dsp_t fakedsp_plugin = {
+    .plugin = {
+        .type = DB_PLUGIN_DSP,
+        .api_vmajor = 1,
+        .api_vminor = 0,
+        .id = "fakedsp",
+        .name = "Fake DSP",
+    },
+    .open = fakedsp_open,
+    .close = fakedsp_close,
+    .process = fakedsp_process,
+};
+
+static ddb_dsp_context_t *
+fakedsp_open_type (int type) {
+    fakedsp_t *dsp = new fakedsp_t ();
+    dsp->ctx.plugin = &fakedsp_plugin;
+    dsp->ctx.enabled = 1;
+    dsp->type = type;
+    return &dsp->ctx;
+}
+
+static ddb_dsp_context_t *
+fakedsp_open (void) {
+    return fakedsp_open_type (FAKEDSP_LOWPASS);
+}
+
+class DSPTests: public ::testing::Test {
+protected:
+    void SetUp() override {
+        messagepump_init ();
+        plug_init_plugin (fakeout_load, NULL);
+        _fakeout = (DB_output_t *)fakeout_load (plug_get_api ());
+        plug_register_out ((DB_plugin_t *)_fakeout);
+        plug_set_output (_fakeout);
+        streamer_init ();
+    }
+
+    void TearDown() override {
+        conf_set_int ("streamer.dsp_pipeline", 0);
+        dsp_configchanged ();
+        streamer_set_dsp_chain_real (NULL);
+        streamer_free ();
+        messagepump_free ();
+    }
+
+    // Runs the blocks of 16 bit stereo audio through a new chain of the given DSPs,
+    // and returns the concatenated float output.
+    std::vector<float> runChain (int pipeline, const std::vector<int> &types, const std::vector<int> &disabled, const std::vector<int> &block_sizes, float *ratio, ddb_waveformat_t *outfmt) {
+        conf_set_int ("streamer.dsp_pipeline", pipeline);
+        dsp_configchanged ();
+
+        ddb_dsp_context_t *chain = NULL, *tail = NULL;
+        for (size_t i = 0; i < types.size (); i++) {
+            ddb_dsp_context_t *dsp = fakedsp_open_type (types[i]);
+            dsp->enabled = !disabled[i];
+            if (tail) {
+                tail->next = dsp;
+            }
+            else {
+                chain = dsp;
+            }
+            tail = dsp;
+        }
+        streamer_set_dsp_chain_real (chain);
+
+        ddb_waveformat_t fmt = {
+            .bps = 16,
+            .channels = 2,
+            .samplerate = 44100,
+            .channelmask = 3,
+        };
+
+        std::vector<float> output;
+        int sample = 0;
+        for (size_t b = 0; b < block_sizes.size (); b++) {
+            std::vector<int16_t> input (block_sizes[b] * 2);
+            for (size_t i = 0; i < input.size (); i++, sample++) {
+                input[i] = (int16_t)((sample * 7919) % 65536 - 32768);
+            }
+
+            char *out_bytes = NULL;
+            int out_size = 0;
+            streamer_lock ();
+            int res = dsp_apply (&fmt, (char *)input.data (), (int)(input.size () * sizeof (int16_t)), outfmt, &out_bytes, &out_size, ratio);
+            EXPECT_EQ(1, res);
+            output.insert (output.end (), (float *)out_bytes, (float *)(out_bytes + out_size));
+            streamer_unlock ();
+        }
+
+        // the DSPs ran on the worker threads only in pipelined mode
+        std::thread::id this_thread = std::this_thread::get_id ();
+        for (ddb_dsp_context_t *dsp = chain; dsp; dsp = dsp->next) {
+            fakedsp_t *fake = (fakedsp_t *)dsp;
+            if (dsp->enabled) {
+                EXPECT_EQ(!pipeline, fake->thread == this_thread);
+            }
+        }
+        return output;
+    }
+
+    void expectPipelinedSameAsSequential (const std::vector<int> &types, const std::vector<int> &disabled, const std::vector<int> &block_sizes) {
+        float seq_ratio, pipe_ratio;
+        ddb_waveformat_t seq_fmt, pipe_fmt;
+        std::vector<float> expected = runChain (0, types, disabled, block_sizes, &seq_ratio, &seq_fmt);
+        std::vector<float> actual = runChain (1, types, disabled, block_sizes, &pipe_ratio, &pipe_fmt);
+
+        EXPECT_EQ(seq_ratio, pipe_ratio);
+        EXPECT_EQ(0, memcmp (&seq_fmt, &pipe_fmt, sizeof (ddb_waveformat_t)));
+        ASSERT_EQ(expected.size (), actual.size ());
+        EXPECT_EQ(0, memcmp (expected.data (), actual.data (), expected.size () * sizeof (float)));
+    }
+
+    DB_output_t *_fakeout;
+};
+
+TEST_F(DSPTests, test_PipelinedChain_SameOutputAsSequential) {
+    expectPipelinedSameAsSequential ({ FAKEDSP_LOWPASS, FAKEDSP_UPSAMPLE, FAKEDSP_DELAYLINE },
+                                     { 0, 0, 0 },
+                                     { 4096, 4096, 1000, 4096, 8192 });
+}
+
+TEST_F(DSPTests, test_PipelinedChainWithDisabledDSPs_SameOutputAsSequential) {
+    expectPipelinedSameAsSequential ({ FAKEDSP_DELAYLINE, FAKEDSP_LOWPASS, FAKEDSP_UPSAMPLE, FAKEDSP_LOWPASS, FAKEDSP_DELAYLINE },
+                                     { 0, 1, 0, 0, 1 },
+                                     { 4096, 2048, 4096 });
+}
+
+TEST_F(DSPTests, test_PipelinedChainLongerThanMaxStages_SameOutputAsSequential) {
+    std::vector<int> types;
+    for (int i = 0; i < 11; i++) {
+        types.push_back (i % 2 ? FAKEDSP_DELAYLINE : FAKEDSP_LOWPASS);
+    }
+    expectPipelinedSameAsSequential (types, std::vector<int> (11, 0), { 4096, 4096, 4096 });
+}
@@ -0,0 +1,119 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include "fft.h"
+
+class FFTTests: public ::testing::Test {
+protected:
+    void TearDown() override {
+        fft_free ();
+    }
+};
+
+// fft_size * 2 samples of a sine wave, with the given number of periods
+static std::vector<float>
+_sine (int fft_size, double periods) {
+    std::vector<float> data (fft_size * 2);
+    for (size_t i = 0; i < data.size (); i++) {
+        data[i] = (float)sin (2 * M_PI * periods * i / data.size ());
+    }
+    return data;
+}
+
+static int
+_peak (const float *freq, int fft_size) {
+    int peak = 0;
+    for (int i = 1; i < fft_size; i++) {
+        if (freq[i] > freq[peak]) {
+            peak = i;
+        }
+    }
+    return peak;
+}
+
+TEST_F(FFTTests, test_Sine_PeakAtSineFrequency) {
+    static const int sizes[] = { 512, 4096, 32768 };
+    for (int si = 0; si < 3; si++) {
+        int fft_size = sizes[si];
+        for (int periods = 10; periods < fft_size; periods *= 7) {
+            std::vector<float> data = _sine (fft_size, periods);
+            std::vector<float> freq (fft_size);
+            fft_calculate (data.data (), freq.data (), fft_size);
+            // the implementations differ in whether the first bin is DC
+            EXPECT_NEAR(periods, _peak (freq.data (), fft_size), 1) << "fft_size " << fft_size;
+        }
+    }
+}
+
+TEST_F(FFTTests, test_Silence_AllBinsZero) {
+    std::vector<float> data (4096 * 2);
+    std::vector<float> freq (4096, 1.f);
+    fft_calculate (data.data (), freq.data (), 4096);
+    for (int i = 0; i < 4096; i++) {
+        ASSERT_EQ(0.f, freq[i]);
+    }
+}
+
+TEST_F(FFTTests, test_CalculateChannels_SameAsEachChannel) {
+    const int fft_size = 2048;
+    const int channels = 3;
+    std::vector<float> data;
+    for (int c = 0; c < channels; c++) {
+        std::vector<float> channel = _sine (fft_size, 33 * (c + 1) + 0.5);
+        data.insert (data.end (), channel.begin (), channel.end ());
+    }
+
+    std::vector<float> batched (fft_size * channels);
+    fft_calculate_channels (data.data (), batched.data (), fft_size, channels);
+
+    for (int c = 0; c < channels; c++) {
+        std::vector<float> single (fft_size);
+        fft_calculate (&data[fft_size * 2 * c], single.data (), fft_size);
+        for (int i = 0; i < fft_size; i++) {
+            ASSERT_EQ(single[i], batched[fft_size * c + i]);
+        }
+    }
+}
+
+TEST_F(FFTTests, DISABLED_benchmarkCalculate_StereoSizes512To32768) {
+    for (int fft_size = 512; fft_size <= 32768; fft_size *= 2) {
+        std::vector<float> data = _sine (fft_size, 100.5);
+        data.insert (data.end (), data.begin (), data.end ());
+        std::vector<float> freq (fft_size * 2);
+
+        // 10 seconds of spectrum updates at 25 frames per second
+        const int iterations = 10 * 25;
+        struct timeval tm1, tm2;
+        gettimeofday (&tm1, NULL);
+        for (int i = 0; i < iterations; i++) {
+            fft_calculate_channels (data.data (), freq.data (), fft_size, 2);
+        }
+        gettimeofday (&tm2, NULL);
+        double ms = (tm2.tv_sec - tm1.tv_sec) * 1000.0 + (tm2.tv_usec - tm1.tv_usec) / 1000.0;
+        printf ("fft_size %d, stereo: %.2f ms total, %.1f us per frame\n", fft_size, ms, ms * 1000 / iterations);
+    }
+}
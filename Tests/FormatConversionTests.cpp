@@ -24,6 +24,12 @@
 #include <deadbeef/deadbeef.h>
 #include "premix.h"
 #include <gtest/gtest.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
 
 TEST(FormatConversionTests, testConvertFromStereoToBackLeftBackRight_AllSamplesDiscarded) {
     int16_t samples[4] = { 0x1000, 0x2000, 0x3000, 0x4000 };
@@ -76,3 +82,366 @@ TEST(FormatConversionTests, testConvertFromStereoToBackLeftFrontRight_LeftChanne
     EXPECT_TRUE(outsamples[2] == 0);
     EXPECT_TRUE(outsamples[3] == 0x4000);
 }
+
+static ddb_waveformat_t
+_format (int bps, int is_float, int channels) {
+    ddb_waveformat_t fmt = {
+        .bps = bps,
+        .channels = channels,
+        .samplerate = 44100,
+        .channelmask = (uint32_t)((1ULL << channels) - 1),
+        .is_float = is_float
+    };
+    return fmt;
+}
+
+// Converts the input with the scalar code, and with each supported vectorized instruction set,
+// for several channel counts, buffer sizes and alignments.
+// A non-negative variant selects only one of the 12 combinations of them.
+static void
+_expectConversionMatchesScalar (const std::vector<char> &input, int inbps, int infloat, int outbps, int outfloat, int variant = -1) {
+    int level = pcm_get_simd_level ();
+    static const int channels[] = { 1, 2, 3, 6 };
+
+    for (int ci = 0; ci < 4; ci++) {
+        ddb_waveformat_t inputfmt = _format (inbps, infloat, channels[ci]);
+        ddb_waveformat_t outputfmt = _format (outbps, outfloat, channels[ci]);
+        int inputsamplesize = inbps / 8 * channels[ci];
+        int outputsamplesize = outbps / 8 * channels[ci];
+
+        // odd sizes and unaligned buffers exercise the scalar tails and the unaligned loads
+        for (int trim = 0; trim < 3; trim++) {
+            if (variant >= 0 && variant != ci * 3 + trim) {
+                continue;
+            }
+            int nsamples = (int)input.size () / inputsamplesize - trim * 7;
+            int inputsize = nsamples * inputsamplesize;
+            std::vector<char> inbuf (inputsize + 1);
+            memcpy (inbuf.data () + trim % 2, input.data (), inputsize);
+
+            std::vector<char> expected (nsamples * outputsamplesize);
+            pcm_set_max_simd_level (PCM_SIMD_LEVEL_NONE);
+            int expected_size = pcm_convert (&inputfmt, inbuf.data () + trim % 2, &outputfmt, expected.data (), inputsize);
+
+            for (int l = PCM_SIMD_LEVEL_BASE; l <= level; l++) {
+                std::vector<char> actual (nsamples * outputsamplesize + 1);
+                pcm_set_max_simd_level (l);
+                int actual_size = pcm_convert (&inputfmt, inbuf.data () + trim % 2, &outputfmt, actual.data () + trim % 2, inputsize);
+
+                EXPECT_EQ(expected_size, actual_size);
+                EXPECT_EQ(0, memcmp (expected.data (), actual.data () + trim % 2, expected.size ())) << "level " << l << ", channels " << channels[ci] << ", " << inbps << (infloat ? "f" : "") << " to " << outbps << (outfloat ? "f" : "");
+            }
+        }
+    }
+    pcm_set_max_simd_level (INT_MAX);
+}
+
+// All 16 bit values
+static std::vector<char>
+_allInt16Samples (void) {
+    std::vector<char> samples (0x10000 * 2);
+    for (int i = 0; i < 0x10000; i++) {
+        int16_t s = (int16_t)i;
+        memcpy (samples.data () + i * 2, &s, 2);
+    }
+    return samples;
+}
+
+// 24 bit values, from first to first+count
+static std::vector<char>
+_int24Samples (int first, int count) {
+    std::vector<char> samples (count * 3);
+    for (int i = 0; i < count; i++) {
+        int s = first + i;
+        samples[i*3+0] = (char)(s & 0xff);
+        samples[i*3+1] = (char)((s >> 8) & 0xff);
+        samples[i*3+2] = (char)((s >> 16) & 0xff);
+    }
+    return samples;
+}
+
+// Pseudo-random 32 bit values, including the extremes
+static std::vector<char>
+_int32Samples (void) {
+    std::vector<int32_t> values;
+    values.push_back (INT32_MIN);
+    values.push_back (INT32_MIN + 1);
+    values.push_back (INT32_MAX);
+    values.push_back (0);
+    values.push_back (-1);
+    values.push_back (1);
+    uint32_t x = 2463534242;
+    while (values.size () < 0x20000) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        values.push_back ((int32_t)x);
+    }
+    std::vector<char> samples (values.size () * 4);
+    memcpy (samples.data (), values.data (), samples.size ());
+    return samples;
+}
+
+// Every int16 step boundary and its neighbours, values out of the [-1, 1] range,
+// and a sweep over all float bit patterns, including infinities and NaNs.
+static std::vector<char>
+_floatSamples (void) {
+    std::vector<float> values;
+    for (int i = -0x8001; i <= 0x8001; i++) {
+        float f = i / (float)0x8000;
+        values.push_back (f);
+        values.push_back (nextafterf (f, -INFINITY));
+        values.push_back (nextafterf (f, INFINITY));
+        values.push_back ((i + 0.5f) / (float)0x8000);
+    }
+    for (uint64_t bits = 0; bits <= 0xffffffffULL; bits += 65521) {
+        uint32_t b = (uint32_t)bits;
+        float f;
+        memcpy (&f, &b, 4);
+        values.push_back (f);
+    }
+    values.push_back (INFINITY);
+    values.push_back (-INFINITY);
+    values.push_back (NAN);
+    values.push_back (2.f);
+    values.push_back (-2.f);
+    values.push_back (1e10f);
+    values.push_back (-1e10f);
+    std::vector<char> samples (values.size () * 4);
+    memcpy (samples.data (), values.data (), samples.size ());
+    return samples;
+}
+
+TEST(FormatConversionTests, testConvert16ToFloat_AllValues_MatchesScalar) {
+    _expectConversionMatchesScalar (_allInt16Samples (), 16, 0, 32, 1);
+}
+
+TEST(FormatConversionTests, testConvert16To32_AllValues_MatchesScalar) {
+    _expectConversionMatchesScalar (_allInt16Samples (), 16, 0, 32, 0);
+}
+
+TEST(FormatConversionTests, testConvert24ToFloat_AllValues_MatchesScalar) {
+    for (int first = -0x800000, variant = 0; first < 0x800000; first += 0x100000, variant++) {
+        _expectConversionMatchesScalar (_int24Samples (first, 0x100000), 24, 0, 32, 1, variant % 12);
+    }
+}
+
+TEST(FormatConversionTests, testConvert24To32_AllValues_MatchesScalar) {
+    for (int first = -0x800000, variant = 0; first < 0x800000; first += 0x100000, variant++) {
+        _expectConversionMatchesScalar (_int24Samples (first, 0x100000), 24, 0, 32, 0, variant % 12);
+    }
+}
+
+TEST(FormatConversionTests, testConvert32ToFloat_MatchesScalar) {
+    _expectConversionMatchesScalar (_int32Samples (), 32, 0, 32, 1);
+}
+
+TEST(FormatConversionTests, testConvert32To16_MatchesScalar) {
+    _expectConversionMatchesScalar (_int32Samples (), 32, 0, 16, 0);
+}
+
+TEST(FormatConversionTests, testConvertFloatTo16_MatchesScalar) {
+    _expectConversionMatchesScalar (_floatSamples (), 32, 1, 16, 0);
+}
+
+TEST(FormatConversionTests, testConvertSameFormat_MatchesScalar) {
+    _expectConversionMatchesScalar (_int32Samples (), 32, 1, 32, 1);
+    _expectConversionMatchesScalar (_int24Samples (0, 0x1000), 24, 0, 24, 0);
+}
+
+static double
+_benchmarkConversion (const ddb_waveformat_t *inputfmt, const std::vector<char> &input, const ddb_waveformat_t *outputfmt, std::vector<char> &output) {
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+    for (int i = 0; i < 20; i++) {
+        pcm_convert (inputfmt, input.data (), outputfmt, output.data (), (int)input.size ());
+    }
+    gettimeofday (&tm2, NULL);
+    return (tm2.tv_sec - tm1.tv_sec) * 1000.0 + (tm2.tv_usec - tm1.tv_usec) / 1000.0;
+}
+
+TEST(FormatConversionTests, DISABLED_benchmarkConvert_ScalarVsVectorized) {
+    static const struct {
+        int inbps, infloat, outbps, outfloat;
+    } conversions[] = {
+        { 16, 0, 32, 1 },
+        { 24, 0, 32, 1 },
+        { 24, 0, 32, 0 },
+        { 32, 0, 32, 1 },
+        { 32, 1, 16, 0 },
+    };
+
+    const int nsamples = 192000; // 1 second of 192kHz
+    int level = pcm_get_simd_level ();
+    for (size_t i = 0; i < sizeof (conversions) / sizeof (conversions[0]); i++) {
+        ddb_waveformat_t inputfmt = _format (conversions[i].inbps, conversions[i].infloat, 6);
+        ddb_waveformat_t outputfmt = _format (conversions[i].outbps, conversions[i].outfloat, 6);
+        std::vector<char> input (nsamples * inputfmt.bps / 8 * inputfmt.channels);
+        std::vector<char> output (nsamples * outputfmt.bps / 8 * outputfmt.channels);
+
+        pcm_set_max_simd_level (PCM_SIMD_LEVEL_NONE);
+        double scalar_ms = _benchmarkConversion (&inputfmt, input, &outputfmt, output);
+        pcm_set_max_simd_level (INT_MAX);
+        double simd_ms = _benchmarkConversion (&inputfmt, input, &outputfmt, output);
+
+        printf ("%d%s -> %d%s, 6ch: scalar %.2f ms, simd level %d %.2f ms\n",
+                inputfmt.bps, inputfmt.is_float ? "f" : "",
+                outputfmt.bps, outputfmt.is_float ? "f" : "",
+                scalar_ms, level, simd_ms);
+    }
+}
+
+// Applies the gain with the scalar code, and with each supported vectorized instruction set,
+// for several gains, ramps, channel counts and alignments.
+static void
+_expectGainMatchesScalar (const std::vector<char> &input, int bps, int is_float) {
+    int level = pcm_get_simd_level ();
+    static const int channels[] = { 1, 2, 6 };
+    static const float gains[] = { 0.f, 0.25f, 0.501187f, 0.999f, 1.f, 1.5f };
+    static const int ramps[] = { 0, 101 };
+
+    for (int ci = 0; ci < 3; ci++) {
+        ddb_waveformat_t fmt = _format (bps, is_float, channels[ci]);
+        int framesize = bps / 8 * channels[ci];
+        for (int trim = 0; trim < 2; trim++) {
+            int size = ((int)input.size () / framesize - trim * 7) * framesize;
+            for (size_t gi = 0; gi < sizeof (gains) / sizeof (gains[0]); gi++) {
+                for (int ri = 0; ri < 2; ri++) {
+                    std::vector<char> expected (input.begin (), input.begin () + size);
+                    pcm_set_max_simd_level (PCM_SIMD_LEVEL_NONE);
+                    pcm_apply_gain (&fmt, expected.data (), size, 1.f, gains[gi], ramps[ri]);
+
+                    for (int l = PCM_SIMD_LEVEL_BASE; l <= level; l++) {
+                        std::vector<char> actual (size + 1);
+                        memcpy (actual.data () + trim, input.data (), size);
+                        pcm_set_max_simd_level (l);
+                        pcm_apply_gain (&fmt, actual.data () + trim, size, 1.f, gains[gi], ramps[ri]);
+                        EXPECT_EQ(0, memcmp (expected.data (), actual.data () + trim, size)) << "level " << l << ", channels " << channels[ci] << ", " << bps << (is_float ? "f" : "") << ", gain " << gains[gi] << ", ramp " << ramps[ri];
+                    }
+                }
+            }
+        }
+    }
+    pcm_set_max_simd_level (INT_MAX);
+}
+
+TEST(FormatConversionTests, testGain8_AllValues_MatchesScalar) {
+    // each value repeated, to fill the vectors
+    std::vector<char> input (0x100 * 16);
+    for (size_t i = 0; i < input.size (); i++) {
+        input[i] = (char)(i / 16);
+    }
+    _expectGainMatchesScalar (input, 8, 0);
+}
+
+TEST(FormatConversionTests, testGain16_AllValues_MatchesScalar) {
+    _expectGainMatchesScalar (_allInt16Samples (), 16, 0);
+}
+
+TEST(FormatConversionTests, testGain24_MatchesScalar) {
+    _expectGainMatchesScalar (_int24Samples (-0x800000, 0x10000), 24, 0);
+    _expectGainMatchesScalar (_int24Samples (0x7f0000, 0x10000), 24, 0);
+}
+
+TEST(FormatConversionTests, testGain32_MatchesScalar) {
+    _expectGainMatchesScalar (_int32Samples (), 32, 0);
+}
+
+TEST(FormatConversionTests, testGainFloat_MatchesScalar) {
+    _expectGainMatchesScalar (_floatSamples (), 32, 1);
+}
+
+TEST(FormatConversionTests, testGain16_HalfGain_RoundsToNearest) {
+    ddb_waveformat_t fmt = _format (16, 0, 1);
+    int16_t samples[] = { 3, -3, 0x7fff, -0x8000, 1000 };
+    pcm_apply_gain (&fmt, (char *)samples, sizeof (samples), 0.5f, 0.5f, 0);
+    EXPECT_EQ(2, samples[0]); // 1.5 rounds to even
+    EXPECT_EQ(-2, samples[1]);
+    EXPECT_EQ(0x4000, samples[2]);
+    EXPECT_EQ(-0x4000, samples[3]);
+    EXPECT_EQ(500, samples[4]);
+}
+
+TEST(FormatConversionTests, testGain16_Ramp_ReachesTargetAtLastRampFrame) {
+    ddb_waveformat_t fmt = _format (16, 0, 2);
+    std::vector<int16_t> samples (200 * 2, 10000);
+    pcm_apply_gain (&fmt, (char *)samples.data (), (int)samples.size () * 2, 0.f, 1.f, 100);
+    EXPECT_EQ(100, samples[0]);
+    EXPECT_EQ(100, samples[1]);
+    EXPECT_EQ(5000, samples[49*2]);
+    EXPECT_EQ(10000, samples[99*2]);
+    EXPECT_EQ(10000, samples[199*2+1]);
+    for (int i = 1; i < 100; i++) {
+        EXPECT_LT(samples[(i-1)*2], samples[i*2]);
+    }
+}
+
+TEST(FormatConversionTests, testGainFloat_UnityGain_KeepsSamples) {
+    ddb_waveformat_t fmt = _format (32, 1, 2);
+    std::vector<char> input = _floatSamples ();
+    std::vector<char> output = input;
+    pcm_apply_gain (&fmt, output.data (), (int)output.size (), 1.f, 1.f, 100);
+    EXPECT_EQ(0, memcmp (input.data (), output.data (), input.size ()));
+}
+
+TEST(FormatConversionTests, testClipFloat_MatchesScalar) {
+    std::vector<char> input = _floatSamples ();
+    int count = (int)input.size () / 4;
+    int level = pcm_get_simd_level ();
+
+    std::vector<char> expected = input;
+    pcm_set_max_simd_level (PCM_SIMD_LEVEL_NONE);
+    pcm_clip_float ((float *)expected.data (), count, 1.f);
+    for (int i = 0; i < count; i++) {
+        float f = ((float *)expected.data ())[i];
+        EXPECT_TRUE(isnan (f) || (f >= -1.f && f <= 1.f));
+    }
+
+    for (int l = PCM_SIMD_LEVEL_BASE; l <= level; l++) {
+        std::vector<char> actual = input;
+        pcm_set_max_simd_level (l);
+        pcm_clip_float ((float *)actual.data () + 1, count - 1, 1.f);
+        pcm_clip_float ((float *)actual.data (), 1, 1.f);
+        for (int i = 0; i < count; i++) {
+            float e = ((float *)expected.data ())[i];
+            float a = ((float *)actual.data ())[i];
+            if (!isnan (e)) {
+                EXPECT_EQ(e, a) << "level " << l << ", sample " << i;
+            }
+        }
+    }
+    pcm_set_max_simd_level (INT_MAX);
+}
+
+TEST(FormatConversionTests, DISABLED_benchmarkGain_ScalarVsVectorized) {
+    static const struct {
+        int bps, is_float;
+    } formats[] = {
+        { 8, 0 },
+        { 16, 0 },
+        { 24, 0 },
+        { 32, 0 },
+        { 32, 1 },
+    };
+
+    const int nsamples = 192000; // 1 second of 192kHz
+    int level = pcm_get_simd_level ();
+    for (size_t i = 0; i < sizeof (formats) / sizeof (formats[0]); i++) {
+        ddb_waveformat_t fmt = _format (formats[i].bps, formats[i].is_float, 6);
+        std::vector<char> buffer (nsamples * fmt.bps / 8 * fmt.channels);
+        double ms[2];
+        for (int simd = 0; simd < 2; simd++) {
+            pcm_set_max_simd_level (simd ? INT_MAX : PCM_SIMD_LEVEL_NONE);
+            struct timeval tm1, tm2;
+            gettimeofday (&tm1, NULL);
+            for (int n = 0; n < 20; n++) {
+                pcm_apply_gain (&fmt, buffer.data (), (int)buffer.size (), 0.5f, 0.5f, 0);
+            }
+            gettimeofday (&tm2, NULL);
+            ms[simd] = (tm2.tv_sec - tm1.tv_sec) * 1000.0 + (tm2.tv_usec - tm1.tv_usec) / 1000.0;
+        }
+        printf ("gain %d%s, 6ch: scalar %.2f ms, simd level %d %.2f ms\n",
+                fmt.bps, fmt.is_float ? "f" : "", ms[0], level, ms[1]);
+    }
+    pcm_set_max_simd_level (INT_MAX);
+}
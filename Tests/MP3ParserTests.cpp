@@ -188,3 +188,72 @@ TEST(MP3ParserTests, test_FiniteVBRLameHdrNetworkStream_ReportsAccurateDuration)
     EXPECT_EQ_WITH_ACCURACY(info.npackets, 890, 10);
     EXPECT_LT(info.valid_packets, info.npackets);
 }
+
+static void
+_expectIndexedSeeksMatchFullScans (const char *fname, int64_t step, int min_speedup) {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/%s", dbplugindir, fname);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+
+    mp3info_t info;
+    int res = mp3_parse_file (&info, 0, fp, fsize, 0, 0, -1);
+    EXPECT_TRUE(!res);
+    int64_t totalsamples = info.totalsamples;
+
+    mp3_seek_index_t *index = mp3_seek_index_alloc ();
+    uint64_t indexed_reads = 0;
+    uint64_t full_reads = 0;
+    // backwards first, so that the index gets built by the first seek, and is used by the rest
+    for (int64_t sample = totalsamples - 1; sample >= 0; sample -= step) {
+        mp3info_t expected;
+        res = mp3_parse_file (&expected, 0, fp, fsize, 0, 0, sample);
+        EXPECT_TRUE(!res);
+        full_reads += expected.num_reads;
+
+        res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, sample, index);
+        EXPECT_TRUE(!res);
+        indexed_reads += info.num_reads;
+
+        EXPECT_EQ(expected.packet_offs, info.packet_offs);
+        EXPECT_EQ(expected.pcmsample, info.pcmsample);
+    }
+    EXPECT_GT(index->count, 1);
+    EXPECT_LE(indexed_reads * min_speedup, full_reads);
+    mp3_seek_index_free (index);
+    vfs_fclose (fp);
+}
+
+TEST(MP3ParserTests, test_VBRLameHdrIndexedSeeks_SameAsFullScans) {
+    _expectIndexedSeeksMatchFullScans ("vbr_rhytm_30sec_lamehdr.mp3", 9973, 4);
+}
+
+TEST(MP3ParserTests, test_CBRIndexedSeeks_SameAsFullScans) {
+    _expectIndexedSeeksMatchFullScans ("cbr_rhytm_30sec.mp3", 9973, 4);
+}
+
+// resyncing over the garbage takes most of the reads, with or without the index
+TEST(MP3ParserTests, test_2secSquareWithGarbageIndexedSeeks_SameAsFullScans) {
+    _expectIndexedSeeksMatchFullScans ("2sec-square-nolamehdr-garbage.mp3", 1009, 1);
+}
+
+TEST(MP3ParserTests, test_VBRInitialScan_IndexesWholeFile) {
+    mp3info_t info;
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    mp3_seek_index_t *index = mp3_seek_index_alloc ();
+    int res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, -1, index);
+    EXPECT_TRUE(!res);
+    EXPECT_EQ(0, index->points[0].sample);
+    EXPECT_EQ(info.valid_packets / MP3_SEEK_INDEX_INTERVAL + 1, index->count);
+
+    // seeking to the end only scans the packets after the last seek point, and the bit reservoir
+    int64_t sample = info.totalsamples - 1;
+    res = mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, sample, index);
+    EXPECT_TRUE(!res);
+    EXPECT_LT(info.num_reads, MP3_SEEK_INDEX_INTERVAL + 2);
+    mp3_seek_index_free (index);
+    vfs_fclose (fp);
+}
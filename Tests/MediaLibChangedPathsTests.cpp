@@ -0,0 +1,116 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "../plugins/medialib/medialibcommon.h"
+}
+
+class MediaLibChangedPathsTests: public ::testing::Test {
+protected:
+    void TearDown() override {
+        ml_changed_paths_free (&_changes);
+    }
+
+    ml_changed_paths_t _changes = {0};
+};
+
+TEST_F(MediaLibChangedPathsTests, test_SameFolderTwice_AddedOnce) {
+    ml_changed_paths_add (&_changes, "/music/a", 0);
+    ml_changed_paths_add (&_changes, "/music/a", 0);
+    ml_changed_paths_add (&_changes, "/music/b", 1);
+    ml_changed_paths_add (&_changes, "/music/b", 1);
+
+    EXPECT_EQ(1, _changes.folders_count);
+    EXPECT_STREQ("/music/a", _changes.folders[0]);
+    EXPECT_EQ(1, _changes.paths_count);
+    EXPECT_STREQ("/music/b", _changes.paths[0]);
+}
+
+TEST_F(MediaLibChangedPathsTests, test_FolderInsideOfRecursivePath_Skipped) {
+    ml_changed_paths_add (&_changes, "/music/a", 1);
+    ml_changed_paths_add (&_changes, "/music/a", 0);
+    ml_changed_paths_add (&_changes, "/music/a/b/c", 0);
+    ml_changed_paths_add (&_changes, "/music/a/b", 1);
+
+    EXPECT_EQ(0, _changes.folders_count);
+    EXPECT_EQ(1, _changes.paths_count);
+    EXPECT_STREQ("/music/a", _changes.paths[0]);
+}
+
+TEST_F(MediaLibChangedPathsTests, test_RecursivePath_ReplacesItsSubfolders) {
+    ml_changed_paths_add (&_changes, "/music/a", 0);
+    ml_changed_paths_add (&_changes, "/music/a/b", 0);
+    ml_changed_paths_add (&_changes, "/music/a/c", 1);
+    ml_changed_paths_add (&_changes, "/music/d", 0);
+    ml_changed_paths_add (&_changes, "/music/a", 1);
+
+    EXPECT_EQ(1, _changes.folders_count);
+    EXPECT_STREQ("/music/d", _changes.folders[0]);
+    EXPECT_EQ(1, _changes.paths_count);
+    EXPECT_STREQ("/music/a", _changes.paths[0]);
+}
+
+TEST_F(MediaLibChangedPathsTests, test_ParentFolderWithoutSubfolders_KeepsRecursiveSubfolder) {
+    // e.g. a file and a new subfolder were added to the same folder
+    ml_changed_paths_add (&_changes, "/music/a/new", 1);
+    ml_changed_paths_add (&_changes, "/music/a", 0);
+
+    EXPECT_EQ(1, _changes.folders_count);
+    EXPECT_STREQ("/music/a", _changes.folders[0]);
+    EXPECT_EQ(1, _changes.paths_count);
+    EXPECT_STREQ("/music/a/new", _changes.paths[0]);
+}
+
+TEST_F(MediaLibChangedPathsTests, test_SimilarPrefix_NotASubfolder) {
+    ml_changed_paths_add (&_changes, "/music/a", 1);
+    ml_changed_paths_add (&_changes, "/music/ab", 0);
+    ml_changed_paths_add (&_changes, "/music/ab/c", 1);
+
+    EXPECT_EQ(1, _changes.folders_count);
+    EXPECT_EQ(2, _changes.paths_count);
+}
+
+TEST_F(MediaLibChangedPathsTests, test_TooManyFolders_FullRescan) {
+    char path[100];
+    for (int i = 0; i < ML_MAX_CHANGED_PATHS; i++) {
+        snprintf (path, sizeof (path), "/music/%d", i);
+        ml_changed_paths_add (&_changes, path, i & 1);
+    }
+    EXPECT_FALSE(_changes.full_rescan);
+    EXPECT_EQ(ML_MAX_CHANGED_PATHS, _changes.paths_count + _changes.folders_count);
+
+    ml_changed_paths_add (&_changes, "/music/more", 0);
+    EXPECT_TRUE(_changes.full_rescan);
+    EXPECT_EQ(0, _changes.paths_count);
+    EXPECT_EQ(0, _changes.folders_count);
+    EXPECT_TRUE(_changes.paths == NULL);
+    EXPECT_TRUE(_changes.folders == NULL);
+
+    // further changes are covered by the full rescan
+    ml_changed_paths_add (&_changes, "/music/0", 1);
+    EXPECT_EQ(0, _changes.paths_count);
+}
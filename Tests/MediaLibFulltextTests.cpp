@@ -0,0 +1,177 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <deadbeef/deadbeef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "playlist.h"
+#include "plmeta.h"
+#include "plugins.h"
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "../plugins/medialib/medialibfulltext.h"
+}
+
+#define TRACK_COUNT 100
+
+static DB_mediasource_t _plugin;
+
+class MediaLibFulltextTests: public ::testing::Test {
+protected:
+    void SetUp() override {
+        ml_fulltext_init (&_plugin, plug_get_api ());
+
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            char value[100];
+            _tracks[i] = pl_item_alloc ();
+            snprintf (value, sizeof (value), "/music/Artist %d/track%03d.flac", i % 10, i);
+            pl_add_meta (_tracks[i], ":URI", value);
+            snprintf (value, sizeof (value), "Title %d", i);
+            pl_add_meta (_tracks[i], "title", value);
+            snprintf (value, sizeof (value), "Artist %d", i % 10);
+            pl_add_meta (_tracks[i], "artist", value);
+            pl_add_meta (_tracks[i], ":MEDIALIB_SCAN_TIME", "1");
+        }
+
+        strcpy (_path, "/tmp/ddb_fulltext_XXXXXX");
+        int fd = mkstemp (_path);
+        close (fd);
+    }
+
+    void TearDown() override {
+        unlink (_path);
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            pl_item_unref (_tracks[i]);
+        }
+    }
+
+    // Returns the number of selected tracks, and the index of the last one in @c last
+    int selectedCount (int *last) {
+        int count = 0;
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            if (pl_is_selected (_tracks[i])) {
+                *last = i;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    playItem_t *_tracks[TRACK_COUNT];
+    char _path[PATH_MAX];
+};
+
+TEST_F(MediaLibFulltextTests, test_SaveLoad_RoundTrip_SameIndex) {
+    ml_fulltext_index_t index;
+    ml_fulltext_build (&index, (ddb_playItem_t **)_tracks, TRACK_COUNT, NULL);
+    EXPECT_EQ(0, ml_fulltext_save (&index, _path));
+
+    ml_fulltext_index_t loaded;
+    EXPECT_EQ(0, ml_fulltext_load (&loaded, _path));
+
+    EXPECT_TRUE(loaded.tracks == NULL);
+    EXPECT_EQ(index.track_count, loaded.track_count);
+    EXPECT_EQ(index.posting_count, loaded.posting_count);
+    EXPECT_EQ(0, memcmp (index.track_ids, loaded.track_ids, TRACK_COUNT * sizeof (uint64_t)));
+    EXPECT_EQ(0, memcmp (index.offsets, loaded.offsets, (ML_FT_TRIGRAM_COUNT + 1) * sizeof (uint32_t)));
+    EXPECT_EQ(0, memcmp (index.postings, loaded.postings, index.posting_count * sizeof (uint32_t)));
+
+    // the temp file is renamed over the target
+    char tempname[PATH_MAX + 5];
+    snprintf (tempname, sizeof (tempname), "%s.part", _path);
+    EXPECT_NE(0, access (tempname, F_OK));
+
+    ml_fulltext_free (&loaded);
+    ml_fulltext_free (&index);
+}
+
+TEST_F(MediaLibFulltextTests, test_Load_TruncatedFile_Fails) {
+    ml_fulltext_index_t index;
+    ml_fulltext_build (&index, (ddb_playItem_t **)_tracks, TRACK_COUNT, NULL);
+    EXPECT_EQ(0, ml_fulltext_save (&index, _path));
+    ml_fulltext_free (&index);
+
+    FILE *fp = fopen (_path, "r+b");
+    fseek (fp, 0, SEEK_END);
+    long size = ftell (fp);
+    fclose (fp);
+    EXPECT_EQ(0, truncate (_path, size - 4));
+
+    ml_fulltext_index_t loaded;
+    EXPECT_EQ(-1, ml_fulltext_load (&loaded, _path));
+    EXPECT_TRUE(loaded.offsets == NULL);
+    EXPECT_TRUE(loaded.postings == NULL);
+}
+
+TEST_F(MediaLibFulltextTests, test_BuildFromLoaded_SameIndexAsFullBuild) {
+    ml_fulltext_index_t index;
+    ml_fulltext_build (&index, (ddb_playItem_t **)_tracks, TRACK_COUNT, NULL);
+    EXPECT_EQ(0, ml_fulltext_save (&index, _path));
+
+    ml_fulltext_index_t loaded;
+    EXPECT_EQ(0, ml_fulltext_load (&loaded, _path));
+
+    ml_fulltext_index_t rebuilt;
+    ml_fulltext_build (&rebuilt, (ddb_playItem_t **)_tracks, TRACK_COUNT, &loaded);
+
+    EXPECT_EQ(index.posting_count, rebuilt.posting_count);
+    EXPECT_EQ(0, memcmp (index.offsets, rebuilt.offsets, (ML_FT_TRIGRAM_COUNT + 1) * sizeof (uint32_t)));
+    EXPECT_EQ(0, memcmp (index.postings, rebuilt.postings, index.posting_count * sizeof (uint32_t)));
+
+    ml_fulltext_free (&rebuilt);
+    ml_fulltext_free (&loaded);
+    ml_fulltext_free (&index);
+}
+
+TEST_F(MediaLibFulltextTests, test_BuildFromLoaded_TrigramsReusedUntilRescan) {
+    ml_fulltext_index_t index;
+    ml_fulltext_build (&index, (ddb_playItem_t **)_tracks, TRACK_COUNT, NULL);
+    EXPECT_EQ(0, ml_fulltext_save (&index, _path));
+    ml_fulltext_free (&index);
+
+    ml_fulltext_index_t loaded;
+    EXPECT_EQ(0, ml_fulltext_load (&loaded, _path));
+
+    // Same scan time means the same metadata, so the stale trigrams of track 3 are reused,
+    // while track 5 is indexed again.
+    pl_replace_meta (_tracks[3], "title", "Zebra");
+    pl_replace_meta (_tracks[5], "title", "Zebra");
+    pl_replace_meta (_tracks[5], ":MEDIALIB_SCAN_TIME", "2");
+
+    ml_fulltext_index_t rebuilt;
+    ml_fulltext_build (&rebuilt, (ddb_playItem_t **)_tracks, TRACK_COUNT, &loaded);
+    ml_fulltext_free (&loaded);
+
+    EXPECT_EQ(0, ml_fulltext_select (&rebuilt, "zebra"));
+    int last = -1;
+    EXPECT_EQ(1, selectedCount (&last));
+    EXPECT_EQ(5, last);
+
+    EXPECT_EQ(0, ml_fulltext_select (&rebuilt, "title 7"));
+    EXPECT_EQ(11, selectedCount (&last));
+    EXPECT_EQ(79, last);
+
+    ml_fulltext_free (&rebuilt);
+}
@@ -0,0 +1,249 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <deadbeef/deadbeef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "playlist.h"
+#include "plmeta.h"
+#include "plugins.h"
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "metacache.h"
+#include "../plugins/medialib/medialibsnapshot.h"
+}
+
+#define TRACK_COUNT 40
+
+static char _music_path[] = "/music";
+static char *_music_paths[] = { _music_path };
+
+class MediaLibSnapshotTests: public ::testing::Test {
+protected:
+    void SetUp() override {
+        ml_db_init (plug_get_api ());
+        ml_snapshot_init (plug_get_api ());
+
+        _db = (ml_db_t *)calloc (1, sizeof (ml_db_t));
+        _loaded = (ml_db_t *)calloc (1, sizeof (ml_db_t));
+        _empty = (ml_db_t *)calloc (1, sizeof (ml_db_t));
+        ml_db_set_music_paths (_db, _music_paths, 1);
+
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            char value[100];
+            _tracks[i] = pl_item_alloc ();
+            snprintf (value, sizeof (value), "/music/Artist %d/Album %d/track%02d.flac", i % 3, i % 7, i);
+            pl_add_meta (_tracks[i], ":URI", value);
+            snprintf (value, sizeof (value), "Artist %d", i % 3);
+            pl_add_meta (_tracks[i], "artist", value);
+            snprintf (value, sizeof (value), "Album %d", i % 7);
+            pl_add_meta (_tracks[i], "album", value);
+            snprintf (value, sizeof (value), "Genre %d", i % 4);
+            pl_add_meta (_tracks[i], "genre", value);
+            snprintf (value, sizeof (value), "Artist %d/Album %d", i % 3, i % 7);
+            indexTrack (_tracks[i], value);
+        }
+
+        strcpy (_path, "/tmp/ddb_snapshot_XXXXXX");
+        int fd = mkstemp (_path);
+        close (fd);
+    }
+
+    void TearDown() override {
+        unlink (_path);
+        ml_db_free (_db);
+        ml_db_free (_loaded);
+        free (_db);
+        free (_loaded);
+        free (_empty);
+        for (int i = 0; i < TRACK_COUNT; i++) {
+            pl_item_unref (_tracks[i]);
+        }
+    }
+
+    // Adds the track to the collections, the same way as the medialib scanner does
+    void indexTrack (playItem_t *it, const char *folder_path) {
+        ddb_playItem_t *item = (ddb_playItem_t *)it;
+        const char *album = metacache_add_string (pl_find_meta (it, "album"));
+        const char *artist = metacache_add_string (pl_find_meta (it, "artist"));
+        const char *genre = metacache_add_string (pl_find_meta (it, "genre"));
+        const char *uri = metacache_add_string (pl_find_meta (it, ":URI"));
+        const char *folder = metacache_add_string (folder_path);
+
+        ml_collection_add_item (_db, &_db->albums, album, item, UINT64_MAX, UINT64_MAX);
+        ml_collection_add_item (_db, &_db->artists, artist, item, UINT64_MAX, UINT64_MAX);
+        ml_collection_add_item (_db, &_db->genres, genre, item, UINT64_MAX, UINT64_MAX);
+        ml_collection_add_item (_db, &_db->track_uris, uri, item, UINT64_MAX, UINT64_MAX);
+        ml_collection_add_tree_item (_db, _empty, &_db->folders.root, folder, 0, item, &_db->state, &_empty->state);
+        ml_db_add_track_keys (_db, item, album, artist, genre, uri, folder);
+
+        uint32_t hash = ml_collection_hash_for_ptr ((void *)uri);
+        ml_filename_hash_item_t *en = (ml_filename_hash_item_t *)calloc (1, sizeof (ml_filename_hash_item_t));
+        en->file = metacache_add_string (uri);
+        en->bucket_next = _db->filename_hash[hash];
+        _db->filename_hash[hash] = en;
+
+        metacache_remove_string (album);
+        metacache_remove_string (artist);
+        metacache_remove_string (genre);
+        metacache_remove_string (uri);
+        metacache_remove_string (folder);
+    }
+
+    void writeSnapshot () {
+        void *data;
+        size_t size;
+        EXPECT_EQ(0, ml_snapshot_build (_db, (ddb_playItem_t **)_tracks, TRACK_COUNT, &data, &size));
+        EXPECT_EQ(0, ml_snapshot_write (data, size, _path));
+        free (data);
+    }
+
+    int loadSnapshot () {
+        ml_db_free (_loaded);
+        return ml_snapshot_load (_loaded, (ddb_playItem_t **)_tracks, TRACK_COUNT, _music_paths, 1, _path);
+    }
+
+    long fileSize () {
+        FILE *fp = fopen (_path, "rb");
+        fseek (fp, 0, SEEK_END);
+        long size = ftell (fp);
+        fclose (fp);
+        return size;
+    }
+
+    void expectSameTree (const ml_collection_tree_node_t *a, const ml_collection_tree_node_t *b) {
+        EXPECT_EQ(a->row_id, b->row_id);
+        EXPECT_STREQ(a->text, b->text);
+        EXPECT_STREQ(a->path, b->path);
+        EXPECT_EQ(a->items_count, b->items_count);
+
+        const ml_collection_track_ref_t *ia = a->items;
+        const ml_collection_track_ref_t *ib = b->items;
+        for (; ia && ib; ia = ia->next, ib = ib->next) {
+            EXPECT_EQ(ia->it, ib->it);
+            EXPECT_EQ(ia->row_id, ib->row_id);
+        }
+        EXPECT_TRUE(ia == NULL && ib == NULL);
+
+        const ml_collection_tree_node_t *ca = a->children;
+        const ml_collection_tree_node_t *cb = b->children;
+        for (; ca && cb; ca = ca->next, cb = cb->next) {
+            expectSameTree (ca, cb);
+        }
+        EXPECT_TRUE(ca == NULL && cb == NULL);
+    }
+
+    playItem_t *_tracks[TRACK_COUNT];
+    ml_db_t *_db;
+    ml_db_t *_loaded;
+    ml_db_t *_empty;
+    char _path[PATH_MAX];
+};
+
+TEST_F(MediaLibSnapshotTests, test_WriteLoad_RoundTrip_SameTrees) {
+    writeSnapshot ();
+    EXPECT_EQ(0, loadSnapshot ());
+
+    expectSameTree (&_db->albums.root, &_loaded->albums.root);
+    expectSameTree (&_db->artists.root, &_loaded->artists.root);
+    expectSameTree (&_db->genres.root, &_loaded->genres.root);
+    expectSameTree (&_db->folders.root, &_loaded->folders.root);
+    expectSameTree (&_db->track_uris.root, &_loaded->track_uris.root);
+    EXPECT_EQ(_db->row_id, _loaded->row_id);
+
+    EXPECT_TRUE(ml_db_has_music_paths (_loaded, _music_paths, 1));
+
+    // the hashes are rebuilt, so that the db can be updated in place
+    for (int i = 0; i < TRACK_COUNT; i++) {
+        ml_track_keys_t *keys = ml_db_find_track_keys (_db, (ddb_playItem_t *)_tracks[i]);
+        ml_track_keys_t *loaded_keys = ml_db_find_track_keys (_loaded, (ddb_playItem_t *)_tracks[i]);
+        ASSERT_TRUE(loaded_keys != NULL);
+        EXPECT_STREQ(keys->album, loaded_keys->album);
+        EXPECT_STREQ(keys->artist, loaded_keys->artist);
+        EXPECT_STREQ(keys->genre, loaded_keys->genre);
+        EXPECT_STREQ(keys->uri, loaded_keys->uri);
+        EXPECT_STREQ(keys->folder, loaded_keys->folder);
+    }
+    const char *album = _db->albums.root.children->text;
+    EXPECT_TRUE(ml_collection_hash_find (_loaded->albums.hash, album) != NULL);
+}
+
+TEST_F(MediaLibSnapshotTests, test_Load_DifferentTracksOrFolders_Fails) {
+    writeSnapshot ();
+
+    EXPECT_EQ(-1, ml_snapshot_load (_loaded, (ddb_playItem_t **)_tracks, TRACK_COUNT - 1, _music_paths, 1, _path));
+    EXPECT_TRUE(_loaded->albums.root.children == NULL);
+
+    char other_path[] = "/other";
+    char *other_paths[] = { other_path };
+    EXPECT_EQ(-1, ml_snapshot_load (_loaded, (ddb_playItem_t **)_tracks, TRACK_COUNT, other_paths, 1, _path));
+    EXPECT_TRUE(_loaded->albums.root.children == NULL);
+}
+
+TEST_F(MediaLibSnapshotTests, test_Load_TruncatedFile_Fails) {
+    writeSnapshot ();
+    long size = fileSize ();
+
+    for (long truncated_size = size - 1; truncated_size >= 0; truncated_size -= 61) {
+        EXPECT_EQ(0, truncate (_path, truncated_size));
+        EXPECT_EQ(-1, loadSnapshot ());
+        EXPECT_TRUE(_loaded->albums.root.children == NULL);
+    }
+}
+
+TEST_F(MediaLibSnapshotTests, test_Load_CorruptFile_NoCrash) {
+    writeSnapshot ();
+    long size = fileSize ();
+
+    FILE *fp = fopen (_path, "rb");
+    uint8_t *data = (uint8_t *)malloc (size);
+    EXPECT_EQ(1, fread (data, size, 1, fp));
+    fclose (fp);
+
+    // Overwrite each 32 bit word with values which are out of range when used as a count or an index.
+    // Loading may succeed when the word was unused, e.g. the padding, but must not crash.
+    const uint32_t values[] = { 0xffffffff, 0x7fffffff, TRACK_COUNT };
+    int failed = 0;
+    for (long offs = 0; offs + 4 <= size; offs += 4) {
+        for (size_t v = 0; v < sizeof (values) / sizeof (values[0]); v++) {
+            uint32_t saved;
+            memcpy (&saved, data + offs, 4);
+            memcpy (data + offs, &values[v], 4);
+
+            fp = fopen (_path, "wb");
+            fwrite (data, size, 1, fp);
+            fclose (fp);
+            if (loadSnapshot ()) {
+                failed++;
+            }
+
+            memcpy (data + offs, &saved, 4);
+        }
+    }
+    free (data);
+
+    EXPECT_GT(failed, 0);
+}
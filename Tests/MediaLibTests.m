@@ -74,4 +74,33 @@ _listener(ddb_mediasource_event_type_t event, void *user_data) {
     XCTAssertEqual(count, 1);
 }
 
+- (void)test_FilterByFileName_MultiArtistSingleTrack_1TrackMatches {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/MediaLibrary/MultiArtist", dbplugindir);
+    const char *folders[] = { path };
+
+    ddb_mediasource_source_t *source;
+    source = self.plugin->create_source("IntegrationTest");
+    self.medialib->enable_file_operations(source, 0);
+    self.plugin->add_listener(source, _listener, (__bridge void *)(self));
+    self.medialib->set_folders(source, folders, 1);
+    self.plugin->refresh(source);
+
+    [self waitForExpectations:@[self.scanCompletedExpectation] timeout:5];
+
+    int counts[2] = {0};
+    const char *filters[] = { "noalbumARTIST", "noalbumartists" };
+    for (int i = 0; i < 2; i++) {
+        ddb_medialib_item_t *tree = self.plugin->create_item_tree(source, (ddb_mediasource_source_t)2, filters[i]); // FIXME: hardcoded selector
+        const ddb_medialib_item_t *children = self.plugin->tree_item_get_children(tree);
+        for (const ddb_medialib_item_t *child = children; child; child = self.plugin->tree_item_get_next(child), counts[i] += 1);
+        self.plugin->free_item_tree(source, tree);
+    }
+
+    self.plugin->free_source(source);
+
+    XCTAssertEqual(counts[0], 1);
+    XCTAssertEqual(counts[1], 0);
+}
+
 @end
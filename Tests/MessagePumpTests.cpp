@@ -0,0 +1,184 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <gtest/gtest.h>
+#include "messagepump.h"
+#include "playlist.h"
+#include "threading.h"
+
+class MessagePumpTests: public ::testing::Test {
+protected:
+    void SetUp() override {
+        messagepump_init ();
+    }
+
+    void TearDown() override {
+        uint32_t id;
+        uintptr_t ctx;
+        uint32_t p1;
+        uint32_t p2;
+        while (messagepump_pop (&id, &ctx, &p1, &p2) != -1) {
+            if (id >= DB_EV_FIRST && ctx) {
+                messagepump_event_free ((ddb_event_t *)ctx);
+            }
+        }
+        messagepump_free ();
+    }
+
+    ddb_messagepump_stats_t stats () {
+        ddb_messagepump_stats_t s = {0};
+        s._size = sizeof (s);
+        messagepump_get_stats (&s);
+        return s;
+    }
+};
+
+TEST_F(MessagePumpTests, test_GetStatsWithInvalidSize_NothingWritten) {
+    messagepump_push (DB_EV_SEEK, 0, 0, 0);
+    ddb_messagepump_stats_t s = {0};
+    s._size = -1;
+    s.queued = 12345;
+    messagepump_get_stats (&s);
+    EXPECT_EQ(-1, s._size);
+    EXPECT_EQ(12345, s.queued);
+}
+
+TEST_F(MessagePumpTests, test_PushManyMessages_AllPoppedInOrder) {
+    for (uint32_t i = 0; i < 10000; i++) {
+        EXPECT_EQ(0, messagepump_push (DB_EV_SEEK, 0, i, 0));
+    }
+    EXPECT_EQ(10000, stats ().queued);
+    EXPECT_EQ(10000, stats ().peak);
+
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    for (uint32_t i = 0; i < 10000; i++) {
+        ASSERT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+        EXPECT_EQ(DB_EV_SEEK, id);
+        EXPECT_EQ(i, p1);
+    }
+    EXPECT_EQ(-1, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(0, stats ().queued);
+    EXPECT_EQ(0, stats ().dropped);
+}
+
+TEST_F(MessagePumpTests, test_RepeatedPlaylistChanged_PoppedOnce) {
+    for (int i = 0; i < 5; i++) {
+        messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+    }
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
+
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    ASSERT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(DB_EV_PLAYLISTCHANGED, id);
+    EXPECT_EQ(DDB_PLAYLIST_CHANGE_CONTENT, p1);
+    ASSERT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(DB_EV_PLAYLISTCHANGED, id);
+    EXPECT_EQ(DDB_PLAYLIST_CHANGE_SELECTION, p1);
+    EXPECT_EQ(-1, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(4, stats ().coalesced);
+}
+
+TEST_F(MessagePumpTests, test_InterleavedRepeatedMessages_OrderPreserved) {
+    messagepump_push (DB_EV_CONFIGCHANGED, 0, 0, 0);
+    messagepump_push (DB_EV_VOLUMECHANGED, 0, 0, 0);
+    messagepump_push (DB_EV_CONFIGCHANGED, 0, 0, 0);
+
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    static const uint32_t expected[] = { DB_EV_CONFIGCHANGED, DB_EV_VOLUMECHANGED, DB_EV_CONFIGCHANGED };
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+        EXPECT_EQ(expected[i], id);
+    }
+    EXPECT_EQ(0, stats ().coalesced);
+}
+
+TEST_F(MessagePumpTests, test_RepeatedCommands_NotCoalesced) {
+    messagepump_push (DB_EV_NEXT, 0, 0, 0);
+    messagepump_push (DB_EV_NEXT, 0, 0, 0);
+
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    EXPECT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(-1, messagepump_pop (&id, &ctx, &p1, &p2));
+}
+
+TEST_F(MessagePumpTests, test_RepeatedTrackInfoChangedForSameTrack_PoppedOnceAndReleased) {
+    playItem_t *it = pl_item_alloc ();
+    for (int i = 0; i < 3; i++) {
+        ddb_event_track_t *ev = (ddb_event_track_t *)messagepump_event_alloc (DB_EV_TRACKINFOCHANGED);
+        ev->track = (DB_playItem_t *)it;
+        pl_item_ref (it);
+        messagepump_push_event ((ddb_event_t *)ev, 0, 0);
+    }
+
+    uint32_t id, p1, p2;
+    uintptr_t ctx;
+    ASSERT_EQ(0, messagepump_pop (&id, &ctx, &p1, &p2));
+    EXPECT_EQ(DB_EV_TRACKINFOCHANGED, id);
+    EXPECT_EQ(-1, messagepump_pop (&id, &ctx, &p1, &p2));
+    messagepump_event_free ((ddb_event_t *)ctx);
+
+    EXPECT_EQ(1, it->_refc);
+    pl_item_unref (it);
+}
+
+#define PRODUCER_COUNT 4
+#define MESSAGES_PER_PRODUCER 20000
+
+static void
+_producer (void *ctx) {
+    uint32_t producer = (uint32_t)(uintptr_t)ctx;
+    for (uint32_t i = 0; i < MESSAGES_PER_PRODUCER; i++) {
+        messagepump_push (DB_EV_SEEK, 0, producer, i);
+    }
+}
+
+TEST_F(MessagePumpTests, test_ConcurrentProducers_AllPoppedInPerProducerOrder) {
+    intptr_t tids[PRODUCER_COUNT];
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        tids[i] = thread_start (_producer, (void *)(uintptr_t)i);
+    }
+
+    uint32_t next[PRODUCER_COUNT] = {0};
+    int total = 0;
+    while (total < PRODUCER_COUNT * MESSAGES_PER_PRODUCER) {
+        uint32_t id, p1, p2;
+        uintptr_t ctx;
+        if (messagepump_pop (&id, &ctx, &p1, &p2) == -1) {
+            continue;
+        }
+        ASSERT_LT(p1, PRODUCER_COUNT);
+        EXPECT_EQ(next[p1], p2);
+        next[p1] = p2 + 1;
+        total++;
+    }
+
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        thread_join (tids[i]);
+    }
+    EXPECT_EQ(0, stats ().dropped);
+}
@@ -10,7 +10,10 @@
 #include <deadbeef/common.h>
 #include "plmeta.h"
 #include "plugins.h"
+#include "sort.h"
+#include "threading.h"
 #include <gtest/gtest.h>
+#include <vector>
 
 TEST(PlaylistTests, test_SearchForValueInSingleValueItems_FindsTheItem) {
     playlist_t *plt = plt_alloc("test");
@@ -46,6 +49,489 @@ TEST(PlaylistTests, test_SearchFor2ndValueInMultiValueItems_FindsTheItem) {
     plt_unref (plt);
 }
 
+TEST(PlaylistTests, test_SearchInLargePlaylist_FindsAllMatchesInPlaylistOrder) {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *after = NULL;
+    for (int i = 0; i < 12000; i++) {
+        playItem_t *it = pl_item_alloc();
+        char title[100];
+        snprintf (title, sizeof (title), i % 100 == 42 ? "Needle %d" : "Hay %d", i);
+        pl_add_meta(it, "title", title);
+        plt_insert_item(plt, after, it);
+        pl_item_unref(it);
+        after = it;
+    }
+
+    plt_search_process(plt, "needle");
+
+    EXPECT_EQ(plt->count[PL_SEARCH], 120);
+    int i = 42;
+    for (playItem_t *it = plt->head[PL_SEARCH]; it; it = it->next[PL_SEARCH], i += 100) {
+        char title[100];
+        snprintf (title, sizeof (title), "Needle %d", i);
+        pl_lock ();
+        EXPECT_STREQ(pl_find_meta(it, "title"), title);
+        pl_unlock ();
+        EXPECT_TRUE(it->selected);
+    }
+
+    plt_unref (plt);
+}
+
+static void
+_modifySearchedPlaylist (void *ctx) {
+    playlist_t *plt = (playlist_t *)ctx;
+    for (int i = 0; i < 12000; i += 7) {
+        playItem_t *it = plt_get_item_for_idx(plt, i, PL_MAIN);
+        if (!it) {
+            break;
+        }
+        char title[100];
+        snprintf (title, sizeof (title), "Renamed %d", i);
+        pl_replace_meta(it, "title", title);
+        if (i % 5 == 0) {
+            plt_remove_item(plt, it);
+        }
+        pl_item_unref(it);
+    }
+}
+
+TEST(PlaylistTests, test_SearchWhileModifyingTracks_ResultsStillInPlaylist) {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *after = NULL;
+    for (int i = 0; i < 12000; i++) {
+        playItem_t *it = pl_item_alloc();
+        char title[100];
+        snprintf (title, sizeof (title), "Needle %d", i);
+        pl_add_meta(it, "title", title);
+        plt_insert_item(plt, after, it);
+        pl_item_unref(it);
+        after = it;
+    }
+
+    // the tracks are only locked while taking the snapshot and publishing the results,
+    // so the other thread can change them during the comparisons
+    intptr_t tid = thread_start (_modifySearchedPlaylist, plt);
+    for (int n = 0; n < 20; n++) {
+        plt_search_process(plt, "needle");
+        pl_lock ();
+        for (playItem_t *it = plt->head[PL_SEARCH]; it; it = it->next[PL_SEARCH]) {
+            EXPECT_GE(plt_get_item_idx(plt, it, PL_MAIN), 0);
+        }
+        pl_unlock ();
+    }
+    thread_join (tid);
+
+    plt_search_process(plt, "needle");
+    int expected = 0;
+    pl_lock ();
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        expected += !strncmp (pl_find_meta(it, "title"), "Needle", 6);
+    }
+    pl_unlock ();
+    EXPECT_LT(expected, 12000);
+    EXPECT_EQ(plt->count[PL_SEARCH], expected);
+
+    plt_unref (plt);
+}
+
+#pragma mark - Item index
+
+TEST(PlaylistTests, test_InsertInTheMiddle_IndexLookupsMatchListOrder) {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *items[3];
+    for (int i = 0; i < 3; i++) {
+        items[i] = pl_item_alloc();
+    }
+
+    plt_insert_item(plt, NULL, items[0]);
+    plt_insert_item(plt, items[0], items[2]);
+    plt_insert_item(plt, items[0], items[1]);
+
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = plt_get_item_for_idx(plt, i, PL_MAIN);
+        EXPECT_EQ(it, items[i]);
+        pl_item_unref(it);
+        EXPECT_EQ(plt_get_item_idx(plt, items[i], PL_MAIN), i);
+    }
+    EXPECT_TRUE(plt_get_item_for_idx(plt, 3, PL_MAIN) == NULL);
+    EXPECT_TRUE(plt_get_item_for_idx(plt, -1, PL_MAIN) == NULL);
+
+    for (int i = 0; i < 3; i++) {
+        pl_item_unref(items[i]);
+    }
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_RemoveItem_IndexLookupsSkipRemovedItem) {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *items[3];
+    playItem_t *after = NULL;
+    for (int i = 0; i < 3; i++) {
+        items[i] = pl_item_alloc();
+        plt_insert_item(plt, after, items[i]);
+        after = items[i];
+    }
+
+    plt_remove_item(plt, items[1]);
+
+    EXPECT_EQ(plt_get_item_idx(plt, items[0], PL_MAIN), 0);
+    EXPECT_EQ(plt_get_item_idx(plt, items[1], PL_MAIN), -1);
+    EXPECT_EQ(plt_get_item_idx(plt, items[2], PL_MAIN), 1);
+
+    playItem_t *it = plt_get_item_for_idx(plt, 1, PL_MAIN);
+    EXPECT_EQ(it, items[2]);
+    pl_item_unref(it);
+
+    for (int i = 0; i < 3; i++) {
+        pl_item_unref(items[i]);
+    }
+    plt_unref (plt);
+}
+
+#pragma mark - Sorting
+
+static playlist_t *
+_playlistWithTitles (const char **titles, int count) {
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *after = NULL;
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc();
+        pl_add_meta(it, "title", titles[i]);
+        plt_insert_item(plt, after, it);
+        pl_item_unref(it);
+        after = it;
+    }
+    return plt;
+}
+
+static void
+_expectTitles (playlist_t *plt, const char **titles, int count) {
+    int i = 0;
+    pl_lock ();
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        ASSERT_LT(i, count);
+        EXPECT_STREQ(pl_find_meta(it, "title"), titles[i]);
+    }
+    pl_unlock ();
+    EXPECT_EQ(i, count);
+}
+
+TEST(PlaylistTests, test_SortByTitleAscending_CaseInsensitiveWithLeadingNumbersStable) {
+    const char *titles[] = { "track 2", "Banana", "Track 10", "10 Apples", "banana", "9 apples", "apple" };
+    playlist_t *plt = _playlistWithTitles(titles, 7);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_ASCENDING);
+
+    const char *expected[] = { "9 apples", "10 Apples", "apple", "Banana", "banana", "Track 10", "track 2" };
+    _expectTitles(plt, expected, 7);
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_SortByTitleDescending_EqualTitlesKeepOrder) {
+    const char *titles[] = { "track 2", "Banana", "Track 10", "10 Apples", "banana", "9 apples", "apple" };
+    playlist_t *plt = _playlistWithTitles(titles, 7);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_DESCENDING);
+
+    const char *expected[] = { "track 2", "Track 10", "Banana", "banana", "apple", "10 Apples", "9 apples" };
+    _expectTitles(plt, expected, 7);
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_SortByTitle_NonAsciiCaseInsensitive) {
+    const char *titles[] = { "Яблоко", "абв", "яблоко", "Абв" };
+    playlist_t *plt = _playlistWithTitles(titles, 4);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_ASCENDING);
+
+    const char *expected[] = { "абв", "Абв", "Яблоко", "яблоко" };
+    _expectTitles(plt, expected, 4);
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_SortByTrackNumber_NumericOrderMissingFirstNonNumericLast) {
+    const char *titles[] = { "a", "b", "c", "d", "e" };
+    const char *tracks[] = { "10", "x", NULL, "2", "1" };
+    playlist_t *plt = _playlistWithTitles(titles, 5);
+    int i = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        if (tracks[i]) {
+            pl_add_meta(it, "track", tracks[i]);
+        }
+    }
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%tracknumber%", DDB_SORT_ASCENDING);
+
+    const char *expected[] = { "c", "e", "d", "a", "b" };
+    _expectTitles(plt, expected, 5);
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_SortTrackArray_SortsByFormat) {
+    const char *titles[] = { "c", "A", "b" };
+    playlist_t *plt = _playlistWithTitles(titles, 3);
+    playItem_t *tracks[3];
+    int i = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        tracks[i] = it;
+    }
+
+    sort_track_array (plt, tracks, 3, "%title%", DDB_SORT_ASCENDING);
+
+    pl_lock ();
+    EXPECT_STREQ(pl_find_meta(tracks[0], "title"), "A");
+    EXPECT_STREQ(pl_find_meta(tracks[1], "title"), "b");
+    EXPECT_STREQ(pl_find_meta(tracks[2], "title"), "c");
+    pl_unlock ();
+    plt_unref (plt);
+}
+
+static playlist_t *
+_largePlaylistForSorting (int count) {
+    static const char *words[] = { "Song", "song", "Ärger", "ärger", "Яблоко", "яблоко", "10 Songs", "9 songs", "b", "", "007" };
+    playlist_t *plt = plt_alloc("test");
+    playItem_t *after = NULL;
+    uint32_t x = 2463534242;
+    for (int i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        playItem_t *it = pl_item_alloc();
+        char title[100];
+        snprintf (title, sizeof (title), "%s %d", words[x % 11], (int)(x >> 8) % 50);
+        pl_add_meta(it, "title", title);
+        pl_set_meta_int(it, "n", i);
+        plt_insert_item(plt, after, it);
+        plt_set_item_duration(plt, it, (float)(x % 600));
+        pl_item_unref(it);
+        after = it;
+    }
+    return plt;
+}
+
+static void
+_expectSameOrderWithThreads (const char *format, int order) {
+    const int count = 30000;
+    playlist_t *serial = _largePlaylistForSorting(count);
+    playlist_t *parallel = _largePlaylistForSorting(count);
+
+    sort_set_thread_count (1);
+    plt_sort_v2 (serial, PL_MAIN, -1, format, order);
+    sort_set_thread_count (4);
+    plt_sort_v2 (parallel, PL_MAIN, -1, format, order);
+    sort_set_thread_count (0);
+
+    pl_lock ();
+    playItem_t *a = serial->head[PL_MAIN];
+    playItem_t *b = parallel->head[PL_MAIN];
+    int mismatches = 0;
+    for (; a && b; a = a->next[PL_MAIN], b = b->next[PL_MAIN]) {
+        if (strcmp (pl_find_meta(a, "n"), pl_find_meta(b, "n"))) {
+            mismatches++;
+        }
+    }
+    EXPECT_TRUE(a == NULL && b == NULL);
+    pl_unlock ();
+    EXPECT_EQ(mismatches, 0) << format;
+
+    plt_unref (serial);
+    plt_unref (parallel);
+}
+
+TEST(PlaylistTests, test_SortLargePlaylistOnThreads_SameOrderAsSerial) {
+    _expectSameOrderWithThreads("%title%", DDB_SORT_ASCENDING);
+    _expectSameOrderWithThreads("%title%", DDB_SORT_DESCENDING);
+}
+
+TEST(PlaylistTests, test_SortLargePlaylistOnThreadsWithLockingFields_SameOrderAsSerial) {
+    _expectSameOrderWithThreads("%title% %length%", DDB_SORT_ASCENDING);
+    _expectSameOrderWithThreads("%length%", DDB_SORT_DESCENDING);
+}
+
+TEST(PlaylistTests, test_SortLargePlaylistOnThreads_IsSorted) {
+    playlist_t *plt = _largePlaylistForSorting(30000);
+    sort_set_thread_count (4);
+    plt_sort_v2 (plt, PL_MAIN, -1, "%length%", DDB_SORT_ASCENDING);
+    sort_set_thread_count (0);
+
+    int unsorted = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it && it->next[PL_MAIN]; it = it->next[PL_MAIN]) {
+        float d1 = pl_get_item_duration(it);
+        float d2 = pl_get_item_duration(it->next[PL_MAIN]);
+        if (d1 > d2 || (d1 == d2 && pl_find_meta_int(it, "n", 0) > pl_find_meta_int(it->next[PL_MAIN], "n", 0))) {
+            unsorted++;
+        }
+    }
+    EXPECT_EQ(unsorted, 0);
+    plt_unref (plt);
+}
+
+#pragma mark - Metadata keys
+
+TEST(PlaylistTests, test_FindMetaWithDifferentKeyCase_FindsTheValue) {
+    playItem_t *it = pl_item_alloc();
+
+    pl_add_meta(it, "TITLE", "value");
+
+    pl_lock ();
+    EXPECT_STREQ(pl_find_meta(it, "title"), "value");
+    EXPECT_STREQ(pl_find_meta(it, "Title"), "value");
+    EXPECT_TRUE(pl_find_meta(it, "titl") == NULL);
+    pl_unlock ();
+
+    pl_item_unref (it);
+}
+
+TEST(PlaylistTests, test_AddMetaWithDifferentKeyCase_IsRejectedAsDuplicate) {
+    playItem_t *it = pl_item_alloc();
+
+    pl_add_meta(it, "artist", "value1");
+    pl_add_meta(it, "ARTIST", "value2");
+
+    pl_lock ();
+    EXPECT_STREQ(pl_find_meta(it, "Artist"), "value1");
+    pl_unlock ();
+
+    pl_delete_meta(it, "Artist");
+
+    pl_lock ();
+    EXPECT_TRUE(pl_find_meta(it, "artist") == NULL);
+    pl_unlock ();
+
+    pl_item_unref (it);
+}
+
+TEST(PlaylistTests, test_FindMetaWithOverride_ReturnsOverrideValue) {
+    playItem_t *it = pl_item_alloc();
+
+    pl_add_meta(it, ":FILETYPE", "MP3");
+    pl_add_meta(it, "!FileType", "Override");
+
+    pl_lock ();
+    EXPECT_STREQ(pl_find_meta(it, ":FILETYPE"), "Override");
+    EXPECT_STREQ(pl_find_meta_raw(it, ":FILETYPE"), "MP3");
+    pl_unlock ();
+
+    pl_item_unref (it);
+}
+
+TEST(PlaylistTests, test_EditsInTheMiddle_IndexUpdatedWithoutRebuild) {
+    playlist_t *plt = plt_alloc("test");
+    std::vector<playItem_t *> expected;
+    for (int i = 0; i < 200; i++) {
+        playItem_t *it = pl_item_alloc();
+        plt_insert_item(plt, expected.empty() ? NULL : expected.back(), it);
+        expected.push_back(it);
+        pl_item_unref(it);
+    }
+    // warm up the index
+    EXPECT_EQ(plt_get_item_idx(plt, expected[0], PL_MAIN), 0);
+
+    srand(1);
+    for (int n = 0; n < 500; n++) {
+        int pos = rand() % (int)expected.size();
+        if (n % 2) {
+            playItem_t *it = pl_item_alloc();
+            plt_insert_item(plt, pos ? expected[pos - 1] : NULL, it);
+            expected.insert(expected.begin() + pos, it);
+            pl_item_unref(it);
+        }
+        else {
+            plt_remove_item(plt, expected[pos]);
+            expected.erase(expected.begin() + pos);
+        }
+        ASSERT_EQ(0, plt->index[PL_MAIN].dirty);
+    }
+
+    ASSERT_EQ(plt->count[PL_MAIN], (int)expected.size());
+    for (int i = 0; i < (int)expected.size(); i++) {
+        EXPECT_EQ(plt_get_item_idx(plt, expected[i], PL_MAIN), i);
+        playItem_t *it = plt_get_item_for_idx(plt, i, PL_MAIN);
+        EXPECT_EQ(it, expected[i]);
+        pl_item_unref(it);
+    }
+    plt_unref (plt);
+}
+
+static void
+_expectIndexMatches(playlist_t *plt, const std::vector<playItem_t *> &expected) {
+    ASSERT_EQ(plt->count[PL_MAIN], (int)expected.size());
+    for (int i = 0; i < (int)expected.size(); i++) {
+        ASSERT_EQ(plt_get_item_idx(plt, expected[i], PL_MAIN), i);
+        playItem_t *it = plt_get_item_for_idx(plt, i, PL_MAIN);
+        ASSERT_EQ(it, expected[i]);
+        pl_item_unref(it);
+    }
+}
+
+TEST(PlaylistTests, test_EditsAcrossManyChunks_IndexUpdatedWithoutRebuild) {
+    playlist_t *plt = plt_alloc("test");
+    std::vector<playItem_t *> expected;
+    for (int i = 0; i < PLT_INDEX_CHUNK_SIZE * 20; i++) {
+        playItem_t *it = pl_item_alloc();
+        plt_insert_item(plt, expected.empty() ? NULL : expected.back(), it);
+        expected.push_back(it);
+        pl_item_unref(it);
+    }
+    EXPECT_EQ(plt_get_item_idx(plt, expected[0], PL_MAIN), 0);
+
+    // grow the list in the middle and at the head, so that the chunks are split,
+    // then shrink it to a few items, so that they are merged
+    srand(2);
+    for (int n = 0; n < PLT_INDEX_CHUNK_SIZE * 40; n++) {
+        int grow = n < PLT_INDEX_CHUNK_SIZE * 10 ? rand() % 4 != 0 : rand() % 4 == 0;
+        int pos = rand() % 8 == 0 ? 0 : rand() % (int)expected.size();
+        if (grow || expected.size() < 2) {
+            playItem_t *it = pl_item_alloc();
+            plt_insert_item(plt, pos ? expected[pos - 1] : NULL, it);
+            expected.insert(expected.begin() + pos, it);
+            pl_item_unref(it);
+        }
+        else {
+            plt_remove_item(plt, expected[pos]);
+            expected.erase(expected.begin() + pos);
+        }
+        ASSERT_EQ(0, plt->index[PL_MAIN].dirty);
+        if (n % 1000 == 0) {
+            _expectIndexMatches(plt, expected);
+        }
+    }
+    _expectIndexMatches(plt, expected);
+    // every chunk but the last is at least a quarter full
+    for (int i = 0; i < plt->index[PL_MAIN].nchunks - 1; i++) {
+        EXPECT_GE(plt->index[PL_MAIN].chunks[i]->count, PLT_INDEX_CHUNK_SIZE / 4);
+    }
+
+    plt_clear(plt);
+    EXPECT_EQ(0, plt->index[PL_MAIN].nchunks);
+    EXPECT_EQ(-1, plt_get_item_idx(plt, expected[0], PL_MAIN));
+    plt_unref (plt);
+}
+
+TEST(PlaylistTests, test_DeleteManySelected_IndexRebuiltOnce) {
+    playlist_t *plt = plt_alloc("test");
+    std::vector<playItem_t *> expected;
+    for (int i = 0; i < PLT_INDEX_CHUNK_SIZE * 4; i++) {
+        playItem_t *it = pl_item_alloc();
+        plt_insert_item(plt, expected.empty() ? NULL : expected.back(), it);
+        if (i % 3 == 0) {
+            pl_set_selected(it, 1);
+        }
+        else {
+            expected.push_back(it);
+        }
+        pl_item_unref(it);
+    }
+    EXPECT_EQ(plt_get_item_idx(plt, expected[0], PL_MAIN), 0);
+
+    plt_delete_selected(plt);
+    EXPECT_EQ(1, plt->index[PL_MAIN].dirty);
+    _expectIndexMatches(plt, expected);
+    EXPECT_EQ(0, plt->index[PL_MAIN].dirty);
+    plt_unref (plt);
+}
+
 #pragma mark - IsRelativePathPosix
 
 TEST(PlaylistTests, test_IsRelativePathPosix_AbsolutePath_False) {
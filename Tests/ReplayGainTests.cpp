@@ -0,0 +1,337 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <gtest/gtest.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include <vector>
+#include "conf.h"
+#include "premix.h"
+#include "replaygain.h"
+
+static ddb_waveformat_t
+_format (int bps, int is_float, int channels) {
+    ddb_waveformat_t fmt = {0};
+    fmt.bps = bps;
+    fmt.is_float = is_float;
+    fmt.channels = channels;
+    fmt.samplerate = 44100;
+    fmt.channelmask = (1u << channels) - 1;
+    return fmt;
+}
+
+static ddb_replaygain_settings_t
+_settings (float trackgain_db, float trackpeak, uint32_t processing_flags) {
+    ddb_replaygain_settings_t settings = {0};
+    settings._size = sizeof (settings);
+    settings.source_mode = DDB_RG_SOURCE_MODE_TRACK;
+    settings.processing_flags = processing_flags;
+    settings.preamp_with_rg = 1;
+    settings.preamp_without_rg = 1;
+    settings.has_track_gain = 1;
+    settings.trackgain = powf (10, trackgain_db / 20);
+    settings.trackpeak = trackpeak;
+    settings.albumgain = 1;
+    settings.albumpeak = 1;
+    return settings;
+}
+
+// The integer implementation which was used before, as the baseline for the benchmark
+static void
+_legacyApplyInt16 (float gain, char *bytes, int size) {
+    int vol = (int)(gain * 1000);
+    int16_t *s = (int16_t*)bytes;
+    for (int j = 0; j < size/2; j++) {
+        int32_t sample = ((int32_t)(*s)) * vol / 1000;
+        if (sample > 0x7fff) {
+            sample = 0x7fff;
+        }
+        else if (sample < -0x8000) {
+            sample = -0x8000;
+        }
+        *s = (int16_t)sample;
+        s++;
+    }
+}
+
+static void
+_legacyApplyInt24 (float gain, char *bytes, int size) {
+    int64_t vol = (int)(gain * 1000);
+    char *s = (char*)bytes;
+    for (int j = 0; j < size/3; j++) {
+        int32_t sample = ((unsigned char)s[0]) | ((unsigned char)s[1]<<8) | ((signed char)s[2]<<16);
+        sample = (int32_t)(sample * vol / 1000);
+        if (sample > 0x7fffff) {
+            sample = 0x7fffff;
+        }
+        else if (sample < -0x800000) {
+            sample = -0x800000;
+        }
+        s[0] = (sample&0x0000ff);
+        s[1] = (sample&0x00ff00)>>8;
+        s[2] = (sample&0xff0000)>>16;
+        s += 3;
+    }
+}
+
+static int32_t
+_readSample (const char *bytes, int bps, int i) {
+    switch (bps) {
+    case 8:
+        return ((int8_t *)bytes)[i];
+    case 16:
+        return ((int16_t *)bytes)[i];
+    case 24: {
+        const char *s = bytes + 3 * i;
+        return ((unsigned char)s[0]) | ((unsigned char)s[1]<<8) | ((signed char)s[2]<<16);
+    }
+    default:
+        return ((int32_t *)bytes)[i];
+    }
+}
+
+static std::vector<char>
+_sineSamples (const ddb_waveformat_t &fmt, int nframes, float amplitude, float freq) {
+    std::vector<float> f (nframes * fmt.channels);
+    for (int i = 0; i < nframes; i++) {
+        for (int c = 0; c < fmt.channels; c++) {
+            f[i * fmt.channels + c] = amplitude * sinf (2 * (float)M_PI * freq * i / fmt.samplerate + c);
+        }
+    }
+    ddb_waveformat_t floatfmt = _format (32, 1, fmt.channels);
+    std::vector<char> samples (nframes * fmt.channels * fmt.bps / 8);
+    pcm_convert (&floatfmt, (const char *)f.data (), &fmt, samples.data (), (int)f.size () * 4);
+    return samples;
+}
+
+class ReplayGainTests: public ::testing::Test {
+protected:
+    void TearDown() override {
+        conf_remove_items ("replaygain.limiter");
+        ddb_replaygain_settings_t settings = _settings (0, 1, 0);
+        replaygain_set_current (&settings);
+    }
+
+    // Apply the current settings to the samples, block by block, like the streamer does
+    void apply (const ddb_waveformat_t &fmt, std::vector<char> &samples, int blockframes) {
+        int blocksize = blockframes * fmt.channels * fmt.bps / 8;
+        for (size_t pos = 0; pos < samples.size (); pos += blocksize) {
+            int size = (int)std::min (samples.size () - pos, (size_t)blocksize);
+            replaygain_apply ((ddb_waveformat_t *)&fmt, samples.data () + pos, size);
+        }
+    }
+};
+
+TEST_F(ReplayGainTests, test_GetGain_PreventClipping_LimitedByPeak) {
+    ddb_replaygain_settings_t settings = _settings (6, 0.8f, DDB_RG_PROCESSING_GAIN);
+    EXPECT_NEAR(1.99526f, replaygain_get_gain (&settings), 1e-4f);
+    settings.processing_flags |= DDB_RG_PROCESSING_PREVENT_CLIPPING;
+    EXPECT_NEAR(1.25f, replaygain_get_gain (&settings), 1e-6f);
+    settings.has_track_gain = 0;
+    settings.preamp_without_rg = 0.5f;
+    EXPECT_EQ(0.5f, replaygain_get_gain (&settings));
+}
+
+TEST_F(ReplayGainTests, test_ApplyAllFormats_RoundsToNearest) {
+    static const int bps[] = { 8, 16, 24, 32 };
+    ddb_replaygain_settings_t settings = _settings (-3.3f, 1, DDB_RG_PROCESSING_GAIN);
+    float gain = replaygain_get_gain (&settings);
+
+    for (int b = 0; b < 4; b++) {
+        ddb_waveformat_t fmt = _format (bps[b], 0, 2);
+        std::vector<char> input = _sineSamples (fmt, 1000, 0.99f, 997);
+        std::vector<char> output = input;
+        replaygain_apply_with_settings (&settings, &fmt, output.data (), (int)output.size ());
+        for (int i = 0; i < 2000; i++) {
+            double expected = _readSample (input.data (), bps[b], i) * (double)gain;
+            int32_t actual = _readSample (output.data (), bps[b], i);
+            // rounded to nearest, after the multiplication in single precision (double for 32 bit)
+            double tolerance = bps[b] == 32 ? 0.5 + 1e-6 : 0.5 + fabs (expected) / (1 << 24);
+            ASSERT_LE(fabs (actual - expected), tolerance) << bps[b] << " bit, sample " << i;
+        }
+    }
+}
+
+TEST_F(ReplayGainTests, test_ApplyFloat_ClipsToFullScale) {
+    ddb_replaygain_settings_t settings = _settings (6, 1, DDB_RG_PROCESSING_GAIN);
+    ddb_waveformat_t fmt = _format (32, 1, 1);
+    float samples[] = { 0.25f, -0.25f, 0.75f, -0.75f, 1.5f };
+    replaygain_apply_with_settings (&settings, &fmt, (char *)samples, sizeof (samples));
+    EXPECT_NEAR(0.498816f, samples[0], 1e-5f);
+    EXPECT_NEAR(-0.498816f, samples[1], 1e-5f);
+    EXPECT_EQ(1.f, samples[2]);
+    EXPECT_EQ(-1.f, samples[3]);
+    EXPECT_EQ(1.f, samples[4]);
+}
+
+TEST_F(ReplayGainTests, test_ApplyInt16_SameAsSingleFormatFunction) {
+    ddb_replaygain_settings_t settings = _settings (4.5f, 0.7f, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    ddb_waveformat_t fmt = _format (16, 0, 2);
+    std::vector<char> expected = _sineSamples (fmt, 1000, 0.9f, 440);
+    std::vector<char> actual = expected;
+    replaygain_apply_with_settings (&settings, &fmt, expected.data (), (int)expected.size ());
+    apply_replay_gain_int16 (&settings, actual.data (), (int)actual.size ());
+    EXPECT_EQ(0, memcmp (expected.data (), actual.data (), expected.size ()));
+}
+
+TEST_F(ReplayGainTests, test_BlockLimiterDisabled_PreventClippingUsesPeak) {
+    ddb_replaygain_settings_t settings = _settings (12, 0.5f, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    replaygain_set_current (&settings);
+    ddb_waveformat_t fmt = _format (32, 1, 2);
+    std::vector<char> samples = _sineSamples (fmt, 44100, 0.5f, 1000);
+    std::vector<char> input = samples;
+    apply (fmt, samples, 4096);
+    for (int i = 0; i < 44100 * 2; i++) {
+        EXPECT_NEAR(((float *)input.data ())[i] * 2, ((float *)samples.data ())[i], 1e-6f);
+    }
+}
+
+TEST_F(ReplayGainTests, test_BlockLimiter_PeaksStayUnderCeiling) {
+    conf_set_int ("replaygain.limiter", 1);
+    ddb_replaygain_settings_t settings = _settings (12, 0.5f, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    replaygain_set_current (&settings);
+
+    static const int bps[] = { 16, 24, 32 };
+    for (int b = 0; b < 3; b++) {
+        for (int is_float = 0; is_float < (bps[b] == 32 ? 2 : 1); is_float++) {
+            ddb_waveformat_t fmt = _format (bps[b], is_float, 2);
+            std::vector<char> samples = _sineSamples (fmt, 44100, 0.5f, 3001);
+            apply (fmt, samples, 4096);
+
+            ddb_waveformat_t floatfmt = _format (32, 1, 2);
+            std::vector<float> output (44100 * 2);
+            pcm_convert (&fmt, samples.data (), &floatfmt, (char *)output.data (), (int)samples.size ());
+            float peak = 0;
+            for (size_t i = 0; i < output.size (); i++) {
+                peak = std::max (peak, fabsf (output[i]));
+            }
+            EXPECT_LE(peak, LIMITER_CEILING + 1e-4f) << bps[b] << (is_float ? "f" : "");
+            // the limiter only reduces the gain as much as needed
+            EXPECT_GT(peak, LIMITER_CEILING * 0.97f) << bps[b] << (is_float ? "f" : "");
+        }
+    }
+}
+
+TEST_F(ReplayGainTests, test_BlockLimiter_InterSamplePeaksReduced) {
+    conf_set_int ("replaygain.limiter", 1);
+    ddb_replaygain_settings_t settings = _settings (0, 1, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    replaygain_set_current (&settings);
+
+    // fs/4 sine at 45 degrees phase: the samples are at full scale, and the sine peaks between them
+    ddb_waveformat_t fmt = _format (32, 1, 1);
+    std::vector<float> samples (4096);
+    for (size_t i = 0; i < samples.size (); i++) {
+        samples[i] = sqrtf (2) * sinf ((float)M_PI / 2 * i + (float)M_PI / 4);
+    }
+    replaygain_apply (&fmt, (char *)samples.data (), (int)samples.size () * 4);
+    // the gain changes between the frames, while it goes down, which slightly moves the midpoints
+    for (size_t i = 2; i + 2 < samples.size (); i++) {
+        float mid = (9 * (samples[i] + samples[i+1]) - (samples[i-1] + samples[i+2])) / 16;
+        EXPECT_LE(fabsf (mid), LIMITER_CEILING * 1.001f) << i;
+    }
+    // the cubic estimate of the peak between two full scale samples is 1.25
+    EXPECT_NEAR(LIMITER_CEILING / 1.25f, fabsf (samples[4000]), 1e-3f);
+}
+
+TEST_F(ReplayGainTests, test_BlockLimiter_GainRecoversAfterPeak) {
+    conf_set_int ("replaygain.limiter", 1);
+    ddb_replaygain_settings_t settings = _settings (6, 1, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    replaygain_set_current (&settings);
+    float gain = powf (10, 6 / 20.f);
+
+    // a loud burst, followed by 2 seconds of a quiet signal
+    ddb_waveformat_t fmt = _format (16, 0, 2);
+    std::vector<char> loud = _sineSamples (fmt, 4410, 0.9f, 440);
+    std::vector<char> quiet = _sineSamples (fmt, 88200, 0.1f, 440);
+    std::vector<char> samples = loud;
+    samples.insert (samples.end (), quiet.begin (), quiet.end ());
+    apply (fmt, samples, 1024);
+
+    int16_t *out = (int16_t *)(samples.data () + loud.size ());
+    int16_t *in = (int16_t *)quiet.data ();
+    // attenuated right after the burst
+    float sum_in = 0;
+    float sum_out = 0;
+    for (int i = 0; i < 441 * 2; i++) {
+        sum_in += abs (in[i]);
+        sum_out += abs (out[i]);
+    }
+    EXPECT_LT(sum_out, sum_in * gain * 0.9f);
+    // the full gain at the end
+    for (int i = 88200 * 2 - 1000; i < 88200 * 2; i++) {
+        EXPECT_NEAR(in[i] * gain, out[i], 1.f) << i;
+    }
+}
+
+TEST_F(ReplayGainTests, DISABLED_benchmarkApply_IntegerVsFloat) {
+    static const int bps[] = { 16, 24 };
+    const int nframes = 192000; // 1 second of 192kHz
+    ddb_replaygain_settings_t settings = _settings (-6, 1, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+    float gain = replaygain_get_gain (&settings);
+
+    for (int b = 0; b < 2; b++) {
+        ddb_waveformat_t fmt = _format (bps[b], 0, 6);
+        std::vector<char> input = _sineSamples (fmt, nframes, 0.5f, 440);
+        std::vector<char> buffer (input.size ());
+        double ms[4];
+        for (int variant = 0; variant < 4; variant++) {
+            if (variant == 3) {
+                conf_set_int ("replaygain.limiter", 1);
+                // loud enough for the limiter to engage
+                settings = _settings (12, 1, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+                replaygain_set_current (&settings);
+            }
+            pcm_set_max_simd_level (variant == 1 ? PCM_SIMD_LEVEL_NONE : INT_MAX);
+            ms[variant] = 0;
+            for (int n = 0; n < 20; n++) {
+                memcpy (buffer.data (), input.data (), input.size ());
+                struct timeval tm1, tm2;
+                gettimeofday (&tm1, NULL);
+                if (variant == 0) {
+                    if (bps[b] == 16) {
+                        _legacyApplyInt16 (gain, buffer.data (), (int)buffer.size ());
+                    }
+                    else {
+                        _legacyApplyInt24 (gain, buffer.data (), (int)buffer.size ());
+                    }
+                }
+                else if (variant < 3) {
+                    replaygain_apply_with_settings (&settings, &fmt, buffer.data (), (int)buffer.size ());
+                }
+                else {
+                    apply (fmt, buffer, 4096);
+                }
+                gettimeofday (&tm2, NULL);
+                ms[variant] += (tm2.tv_sec - tm1.tv_sec) * 1000.0 + (tm2.tv_usec - tm1.tv_usec) / 1000.0;
+            }
+        }
+        pcm_set_max_simd_level (INT_MAX);
+        conf_remove_items ("replaygain.limiter");
+        settings = _settings (-6, 1, DDB_RG_PROCESSING_GAIN|DDB_RG_PROCESSING_PREVENT_CLIPPING);
+
+        printf ("replaygain %d, 6ch: integer %.2f ms, float scalar %.2f ms, simd level %d %.2f ms, limiter %.2f ms\n",
+                bps[b], ms[0], ms[1], pcm_get_simd_level (), ms[2], ms[3]);
+    }
+}
@@ -21,6 +21,7 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <unistd.h>
 #include <deadbeef/deadbeef.h>
 #include "playlist.h"
 #include "plugins.h"
@@ -321,3 +322,41 @@ TEST_F(StreamerTests, test_nextTrack_currentWasDeleted_picksNextTrack) {
     deadbeef->plt_unref(plt);
 }
 
+
+TEST_F(StreamerTests, test_PlayNextTrack_DecoderOpenedAheadOnce) {
+    // the fake tracks are very long, so the window must cover the whole track
+    conf_set_int ("streamer.prefetch_seconds", 1000000);
+    streamer_configchanged ();
+
+    playlist_t *plt = plt_alloc ("testplt");
+    DB_playItem_t *first = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, first, "/square.fake", NULL, NULL, NULL);
+    plt_set_curr (plt);
+
+    int init_count = fakein_get_init_count ();
+    int init_ahead_count = fakein_get_init_ahead_count ();
+
+    fakein_set_sleep (0);
+    fakeout_set_manual (0);
+    fakeout_set_realtime (0);
+
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+    // the message may be taken from the queue before the track starts
+    int timeout = 5000;
+    while (fakein_get_init_count () == init_count && timeout > 0) {
+        usleep (1000);
+        timeout--;
+    }
+    ASSERT_NE(init_count, fakein_get_init_count ());
+    wait_until_stopped ();
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    conf_set_str ("streamer.prefetch_seconds", NULL);
+    streamer_configchanged ();
+
+    EXPECT_EQ(2, fakein_get_init_count () - init_count);
+    EXPECT_EQ(1, fakein_get_init_ahead_count () - init_ahead_count);
+}
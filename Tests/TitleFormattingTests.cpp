@@ -30,6 +30,7 @@
 #include "tftintutil.h"
 #include <dispatch/dispatch.h>
 #include <gtest/gtest.h>
+#include <sys/time.h>
 
 static ddb_playback_state_t fake_out_state_value = DDB_PLAYBACK_STATE_STOPPED;
 
@@ -2764,3 +2765,211 @@ TEST_F(TitleFormattingTests, test_meta_bufferTooShortWithMultibyteCharsInput_ret
     tf_free (bc);
     EXPECT_STREQ(buffer, "ΘΘΘ");
 }
+
+TEST_F(TitleFormattingTests, test_CachedResult_MetaReplaced_ReturnsNewValue) {
+    char *bc = tf_compile("%title%");
+    pl_add_meta (it, "title", "One");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "One");
+    pl_replace_meta (it, "title", "Two");
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "Two");
+}
+
+TEST_F(TitleFormattingTests, test_CachedResult_MetaAddedAndDeleted_ReturnsNewValue) {
+    char *bc = tf_compile("[%artist% - ]%title%");
+    pl_add_meta (it, "title", "Title");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "Title");
+    pl_add_meta (it, "artist", "Artist");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "Artist - Title");
+    pl_delete_meta (it, "artist");
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "Title");
+}
+
+TEST_F(TitleFormattingTests, test_CachedResult_DurationChanged_ReturnsNewLength) {
+    char *bc = tf_compile("%length%");
+    plt_set_item_duration (NULL, it, 60);
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "1:00");
+    plt_set_item_duration (NULL, it, 120);
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "2:00");
+}
+
+TEST_F(TitleFormattingTests, test_CachedResult_ShorterBuffer_ReturnsTruncatedValue) {
+    char *bc = tf_compile("%title%");
+    pl_add_meta (it, "title", "abcdef");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "abcdef");
+    tf_eval (&ctx, bc, buffer, 4);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "abc");
+}
+
+TEST_F(TitleFormattingTests, test_CachedResult_DifferentTracks_ReturnsValueOfEachTrack) {
+    char *bc = tf_compile("%title%");
+    playItem_t *it2 = pl_item_alloc ();
+    pl_add_meta (it, "title", "First");
+    pl_add_meta (it2, "title", "Second");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "First");
+    ctx.it = (DB_playItem_t *)it2;
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "Second");
+    ctx.it = (DB_playItem_t *)it;
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    pl_item_unref (it2);
+    EXPECT_STREQ(buffer, "First");
+}
+
+TEST_F(TitleFormattingTests, test_CachedResult_PlaybackStateChanged_ReturnsNewIsPlaying) {
+    char *bc = tf_compile("%title% $if(%isplaying%,YES,NO)");
+    pl_add_meta (it, "title", "Title");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "Title NO");
+    streamer_set_playing_track (it);
+    fake_out_state_value = DDB_PLAYBACK_STATE_PLAYING;
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "Title YES");
+}
+
+static const char *optimizerScripts[] = {
+    "$upper(abc) %genre%",
+    "$if($upper(a),yes,no)",
+    "$if($strcmp(a,b),yes,no)",
+    "$if2($left(,2),fallback)",
+    "[$upper(%comment%)]",
+    "[$lower(ABC)]",
+    "$pad($num(7,3),6,-)|%genre%|",
+    "$if($and($greater(3,2),$not($strcmp(x,y))),$repeat(ab,4),nope)",
+    "$add(1,$mul(2,3)) $crlf()",
+    "[%Genre% ]$caps(hello world)",
+    "<<$upper(dim)>> %composer%",
+    "$meta(genre) $channels()",
+    "$abbr(Some Long Name) %performer%",
+    NULL
+};
+
+// Evaluates every script in optimized and unoptimized form, in normal and truncated buffers
+static void
+_expectOptimizedMatchesUnoptimized (ddb_tf_context_t *ctx) {
+    static const int outlens[] = { 1000, 6, 2, 1 };
+    for (int i = 0; optimizerScripts[i]; i++) {
+        char *optimized = tf_compile (optimizerScripts[i]);
+        tf_set_optimize (0);
+        char *plain = tf_compile (optimizerScripts[i]);
+        tf_set_optimize (1);
+        for (size_t j = 0; j < sizeof (outlens) / sizeof (outlens[0]); j++) {
+            char expected[1000];
+            char actual[1000];
+            for (int flags = 0; flags <= DDB_TF_CONTEXT_TEXT_DIM; flags += DDB_TF_CONTEXT_TEXT_DIM) {
+                ctx->flags = flags;
+                int expected_len = tf_eval (ctx, plain, expected, outlens[j]);
+                int actual_len = tf_eval (ctx, optimized, actual, outlens[j]);
+                EXPECT_EQ(expected_len, actual_len) << optimizerScripts[i] << " outlen " << outlens[j];
+                EXPECT_STREQ(expected, actual) << optimizerScripts[i] << " outlen " << outlens[j];
+            }
+        }
+        ctx->flags = 0;
+        tf_free (optimized);
+        tf_free (plain);
+    }
+}
+
+static int
+_needsLock (const char *script, int optimize) {
+    tf_set_optimize (optimize);
+    char *bc = tf_compile (script);
+    tf_set_optimize (1);
+    int res = tf_code_needs_lock (bc);
+    tf_free (bc);
+    return res;
+}
+
+TEST_F(TitleFormattingTests, test_NeedsLock_FieldsAndQuotedText_DecidedFromBytecode) {
+    for (int optimize = 0; optimize < 2; optimize++) {
+        EXPECT_FALSE(_needsLock ("%title% - %artist%", optimize));
+        EXPECT_FALSE(_needsLock ("'%length%' %title%", optimize));
+        EXPECT_FALSE(_needsLock ("$upper(abc) %%length%%", optimize));
+        EXPECT_TRUE(_needsLock ("%length%", optimize));
+        EXPECT_TRUE(_needsLock ("'%' %length%", optimize));
+        EXPECT_TRUE(_needsLock ("'100%' $if(%isplaying%,a,b)", optimize));
+        EXPECT_TRUE(_needsLock ("[%codec%]", optimize));
+        EXPECT_TRUE(_needsLock ("<<%playback_time%>>", optimize));
+    }
+}
+
+TEST_F(TitleFormattingTests, test_Optimizer_EmptyTrack_MatchesUnoptimized) {
+    _expectOptimizedMatchesUnoptimized (&ctx);
+}
+
+TEST_F(TitleFormattingTests, test_Optimizer_TrackWithMeta_MatchesUnoptimized) {
+    pl_add_meta (it, "genre", "Rock");
+    pl_add_meta (it, "comment", "mixed Case");
+    pl_append_meta (it, "composer", "First");
+    pl_append_meta (it, "composer", "Second");
+    _expectOptimizedMatchesUnoptimized (&ctx);
+}
+
+TEST_F(TitleFormattingTests, test_Optimizer_FieldWithOverride_ReturnsOverride) {
+    char *bc = tf_compile("%genre%");
+    pl_add_meta (it, "genre", "Rock");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "Rock");
+    pl_add_meta (it, "!GENRE", "Jazz");
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "Jazz");
+}
+
+TEST_F(TitleFormattingTests, test_Optimizer_FieldCompiledBeforeAnyTrackHasKey_ReturnsValue) {
+    char *bc = tf_compile("[%optimizer_test_unique_key%]");
+    tf_eval (&ctx, bc, buffer, 1000);
+    EXPECT_STREQ(buffer, "");
+    pl_add_meta (it, "Optimizer_Test_Unique_Key", "value");
+    tf_eval (&ctx, bc, buffer, 1000);
+    tf_free (bc);
+    EXPECT_STREQ(buffer, "value");
+}
+
+static double
+_benchmarkEval (ddb_tf_context_t *ctx, const char *bc, char *buffer, int count) {
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+    for (int i = 0; i < count; i++) {
+        // invalidate the cached result, to measure the evaluation
+        pl_item_bump_modification_idx ((playItem_t *)ctx->it);
+        tf_eval (ctx, bc, buffer, 1000);
+    }
+    gettimeofday (&tm2, NULL);
+    return ((tm2.tv_sec - tm1.tv_sec) * 1000000.0 + (tm2.tv_usec - tm1.tv_usec)) * 1000.0 / count;
+}
+
+TEST_F(TitleFormattingTests, benchmarkEval_OptimizedVsUnoptimized) {
+    const char *script = "$if($strcmp(%genre%,Rock),$upper(rock),$lower(OTHER)) - %comment% - %composer% - %label% $repeat(-,3)";
+    pl_add_meta (it, "genre", "Rock");
+    pl_add_meta (it, "comment", "Comment");
+    pl_add_meta (it, "composer", "Composer");
+    pl_add_meta (it, "label", "Label");
+
+    const int count = 100000;
+    tf_set_optimize (0);
+    char *plain = tf_compile (script);
+    tf_set_optimize (1);
+    char *optimized = tf_compile (script);
+    double plain_ns = _benchmarkEval (&ctx, plain, buffer, count);
+    double optimized_ns = _benchmarkEval (&ctx, optimized, buffer, count);
+    tf_free (plain);
+    tf_free (optimized);
+
+    printf ("tf_eval: unoptimized %.1f ns/eval, optimized %.1f ns/eval\n", plain_ns, optimized_ns);
+    EXPECT_STREQ(buffer, "ROCK - Comment - Composer - Label ---");
+}
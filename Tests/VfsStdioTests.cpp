@@ -0,0 +1,295 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <deadbeef/common.h>
+#include "conf.h"
+#include "junklib.h"
+#include "playlist.h"
+#include "vfs.h"
+
+extern "C" {
+    uint64_t
+    vfs_stdio_get_syscall_count (void);
+}
+
+static const char *corpus[] = {
+    "artist_multiline_apev2.mp3",
+    "artist_multivalue_apev2.mp3",
+    "chirp-1sec.mp3",
+    "comm_id3v2.3.mp3",
+    "tone1sec_apev2.mp3",
+    "tone1sec_id3v1.mp3",
+    "tone1sec_id3v1_apev2.mp3",
+    "tpe1_multiline.mp3",
+    "tpe1_multivalue_id3v2.3.mp3",
+    "tpe1_multivalue_id3v2.4.mp3",
+    "trck_num_with_total_id3v2.3.mp3",
+    "txxx_album_artist_id3v2.3.mp3",
+    NULL
+};
+
+// each test runs in both vfs.stdio.mode settings: 0 is read-ahead, 1 is mmap
+class VfsStdioTests: public ::testing::Test {
+protected:
+    void TearDown() override {
+        conf_set_str ("vfs.stdio.mode", NULL);
+    }
+
+    DB_FILE *open (const char *name) {
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/TestData/%s", dbplugindir, name);
+        return vfs_fopen (path);
+    }
+
+    std::vector<uint8_t> reference (const char *name) {
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/TestData/%s", dbplugindir, name);
+        std::vector<uint8_t> data;
+        FILE *fp = fopen (path, "rb");
+        int c;
+        while ((c = fgetc (fp)) != EOF) {
+            data.push_back ((uint8_t)c);
+        }
+        fclose (fp);
+        return data;
+    }
+
+    void readInSmallChunks () {
+        std::vector<uint8_t> ref = reference ("chirp-1sec.mp3");
+        DB_FILE *fp = open ("chirp-1sec.mp3");
+        ASSERT_TRUE(fp != NULL);
+        EXPECT_EQ(ref.size (), vfs_fgetlength (fp));
+
+        std::vector<uint8_t> data;
+        uint8_t buffer[333];
+        size_t res;
+        while ((res = vfs_fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+            data.insert (data.end (), buffer, buffer + res);
+        }
+        vfs_fclose (fp);
+        EXPECT_TRUE(data == ref);
+    }
+
+    void randomSeeks () {
+        std::vector<uint8_t> ref = reference ("chirp-1sec.mp3");
+        int64_t size = (int64_t)ref.size ();
+        DB_FILE *fp = open ("chirp-1sec.mp3");
+        ASSERT_TRUE(fp != NULL);
+
+        srand (1);
+        for (int i = 0; i < 1000; i++) {
+            int64_t offs = rand () % size;
+            switch (i % 3) {
+            case 0:
+                ASSERT_EQ(0, vfs_fseek (fp, offs, SEEK_SET));
+                break;
+            case 1:
+                ASSERT_EQ(0, vfs_fseek (fp, offs - vfs_ftell (fp), SEEK_CUR));
+                break;
+            case 2:
+                ASSERT_EQ(0, vfs_fseek (fp, offs - size, SEEK_END));
+                break;
+            }
+            ASSERT_EQ(offs, vfs_ftell (fp));
+
+            uint8_t buffer[2000];
+            size_t expected = (size_t)min ((int64_t)sizeof (buffer), size - offs);
+            ASSERT_EQ(expected, vfs_fread (buffer, 1, sizeof (buffer), fp));
+            ASSERT_EQ(0, memcmp (buffer, ref.data () + offs, expected));
+        }
+
+        EXPECT_EQ(-1, vfs_fseek (fp, -1, SEEK_SET));
+        EXPECT_EQ(0, vfs_fseek (fp, 10, SEEK_END));
+        uint8_t byte;
+        EXPECT_EQ(0, vfs_fread (&byte, 1, 1, fp));
+        vfs_fclose (fp);
+    }
+
+    void emptyFile () {
+        char path[] = "/tmp/ddb_vfs_stdio_XXXXXX";
+        int fd = mkstemp (path);
+        ASSERT_NE(-1, fd);
+        close (fd);
+
+        DB_FILE *fp = vfs_fopen (path);
+        ASSERT_TRUE(fp != NULL);
+        EXPECT_EQ(0, vfs_fgetlength (fp));
+        uint8_t buffer[100];
+        EXPECT_EQ(0, vfs_fread (buffer, 1, sizeof (buffer), fp));
+        vfs_fclose (fp);
+        unlink (path);
+    }
+
+    // pipes don't support pread and mmap, so they are read sequentially
+    void fifo () {
+        std::vector<uint8_t> ref = reference ("chirp-1sec.mp3");
+        char path[] = "/tmp/ddb_vfs_stdio_XXXXXX";
+        ASSERT_TRUE(mkdtemp (path) != NULL);
+        char fifopath[PATH_MAX];
+        snprintf (fifopath, sizeof (fifopath), "%s/fifo", path);
+        ASSERT_EQ(0, mkfifo (fifopath, 0600));
+
+        // opening blocks until both ends are open
+        std::thread writer ([&] {
+            int fd = ::open (fifopath, O_WRONLY);
+            for (size_t offs = 0; fd != -1 && offs < ref.size (); ) {
+                ssize_t res = write (fd, ref.data () + offs, min ((size_t)1000, ref.size () - offs));
+                if (res <= 0) {
+                    break;
+                }
+                offs += res;
+            }
+            close (fd);
+        });
+
+        DB_FILE *fp = vfs_fopen (fifopath);
+        ASSERT_TRUE(fp != NULL);
+        EXPECT_EQ(-1, vfs_fgetlength (fp));
+
+        std::vector<uint8_t> data;
+        uint8_t buffer[333];
+        size_t res = vfs_fread (buffer, 1, sizeof (buffer), fp);
+        data.insert (data.end (), buffer, buffer + res);
+
+        // seeking back within the buffered data works, the rest can't be done on a pipe
+        EXPECT_EQ(0, vfs_fseek (fp, 0, SEEK_SET));
+        EXPECT_EQ(res, vfs_fread (buffer, 1, res, fp));
+        EXPECT_EQ(0, memcmp (buffer, ref.data (), res));
+        EXPECT_EQ(-1, vfs_fseek (fp, (int64_t)ref.size () / 2, SEEK_SET));
+        EXPECT_EQ(-1, vfs_fseek (fp, 0, SEEK_END));
+        EXPECT_EQ(res, vfs_ftell (fp));
+
+        while ((res = vfs_fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+            data.insert (data.end (), buffer, buffer + res);
+        }
+        vfs_fclose (fp);
+        writer.join ();
+
+        unlink (fifopath);
+        rmdir (path);
+        EXPECT_TRUE(data == ref);
+    }
+
+    // reads the tags, then the whole file the way a decoder would, counting system calls;
+    // the corpus is the tagged test files, plus a long one made of repeated frames
+    void scanCorpus () {
+        std::vector<uint8_t> chirp = reference ("chirp-1sec.mp3");
+        char longpath[] = "/tmp/ddb_vfs_stdio_XXXXXX";
+        int fd = mkstemp (longpath);
+        ASSERT_NE(-1, fd);
+        for (int i = 0; i < 500; i++) {
+            ASSERT_EQ(chirp.size (), write (fd, chirp.data (), chirp.size ()));
+        }
+        close (fd);
+
+        uint64_t syscalls = vfs_stdio_get_syscall_count ();
+        struct timeval tm1, tm2;
+        gettimeofday (&tm1, NULL);
+        size_t total = 0;
+        for (int i = 0; i == 0 || corpus[i-1]; i++) {
+            playItem_t *it = pl_item_alloc ();
+            DB_FILE *fp = corpus[i] ? open (corpus[i]) : vfs_fopen (longpath);
+            ASSERT_TRUE(fp != NULL);
+            junk_id3v2_read (it, fp);
+            junk_apev2_read (it, fp);
+            junk_id3v1_read (it, fp);
+            vfs_fseek (fp, junk_get_leading_size (fp), SEEK_SET);
+            uint8_t buffer[4096];
+            size_t res;
+            while ((res = vfs_fread (buffer, 1, sizeof (buffer), fp)) > 0) {
+                total += res;
+            }
+            vfs_fclose (fp);
+            pl_item_unref (it);
+        }
+        gettimeofday (&tm2, NULL);
+        syscalls = vfs_stdio_get_syscall_count () - syscalls;
+        long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+        printf ("vfs.stdio.mode=%d: %d syscalls, %d bytes, %ld ms\n", conf_get_int ("vfs.stdio.mode", 0), (int)syscalls, (int)total, ms);
+
+        unlink (longpath);
+
+        EXPECT_GT(total, 0);
+        // a 1KB buffer needs at least one read per KB
+        EXPECT_LT(syscalls, total / 8192);
+    }
+};
+
+TEST_F(VfsStdioTests, test_ReadAhead_ReadInSmallChunks_MatchesFileContents) {
+    conf_set_int ("vfs.stdio.mode", 0);
+    readInSmallChunks ();
+}
+
+TEST_F(VfsStdioTests, test_Mmap_ReadInSmallChunks_MatchesFileContents) {
+    conf_set_int ("vfs.stdio.mode", 1);
+    readInSmallChunks ();
+}
+
+TEST_F(VfsStdioTests, test_ReadAhead_RandomSeeks_ReadMatchesFileContents) {
+    conf_set_int ("vfs.stdio.mode", 0);
+    randomSeeks ();
+}
+
+TEST_F(VfsStdioTests, test_Mmap_RandomSeeks_ReadMatchesFileContents) {
+    conf_set_int ("vfs.stdio.mode", 1);
+    randomSeeks ();
+}
+
+TEST_F(VfsStdioTests, test_ReadAhead_EmptyFile_ReadsNothing) {
+    conf_set_int ("vfs.stdio.mode", 0);
+    emptyFile ();
+}
+
+TEST_F(VfsStdioTests, test_Mmap_EmptyFile_ReadsNothing) {
+    conf_set_int ("vfs.stdio.mode", 1);
+    emptyFile ();
+}
+
+TEST_F(VfsStdioTests, test_ReadAhead_ScanTaggedCorpus_Benchmark) {
+    conf_set_int ("vfs.stdio.mode", 0);
+    scanCorpus ();
+}
+
+TEST_F(VfsStdioTests, test_Mmap_ScanTaggedCorpus_Benchmark) {
+    conf_set_int ("vfs.stdio.mode", 1);
+    scanCorpus ();
+}
+
+TEST_F(VfsStdioTests, test_ReadAhead_Fifo_ReadsSequentially) {
+    conf_set_int ("vfs.stdio.mode", 0);
+    fifo ();
+}
+
+TEST_F(VfsStdioTests, test_Mmap_Fifo_ReadsSequentially) {
+    conf_set_int ("vfs.stdio.mode", 1);
+    fifo ();
+}
@@ -31,6 +31,8 @@
 
 #define FAKEIN_NUMSAMPLES 44100 * 5 // 5 sec
 static int _sleep;
+static int _init_count;
+static int _init_ahead_count;
 
 static DB_decoder_t plugin;
 static DB_functions_t *deadbeef;
@@ -71,6 +73,15 @@ fakein_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     info->startsample = 0;
     info->endsample = FAKEIN_NUMSAMPLES - 1;
 
+    __atomic_add_fetch (&_init_count, 1, __ATOMIC_RELAXED);
+    DB_playItem_t *streaming = deadbeef->streamer_get_streaming_track ();
+    if (streaming) {
+        if (streaming != it) {
+            __atomic_add_fetch (&_init_ahead_count, 1, __ATOMIC_RELAXED);
+        }
+        deadbeef->pl_item_unref (streaming);
+    }
+
     info->samples = calloc (FAKEIN_NUMSAMPLES,  2 * sizeof (float));
 
     const char *type = deadbeef->pl_find_meta (it, "title");
@@ -191,3 +202,13 @@ void
 fakein_set_sleep (int sleep) {
     _sleep = sleep;
 }
+
+int
+fakein_get_init_count (void) {
+    return __atomic_load_n (&_init_count, __ATOMIC_RELAXED);
+}
+
+int
+fakein_get_init_ahead_count (void) {
+    return __atomic_load_n (&_init_ahead_count, __ATOMIC_RELAXED);
+}
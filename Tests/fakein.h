@@ -32,6 +32,14 @@ extern "C" {
 void
 fakein_set_sleep (int sleep);
 
+// number of decoder instances initialized so far
+int
+fakein_get_init_count (void);
+
+// number of decoder instances initialized while another track was streaming
+int
+fakein_get_init_ahead_count (void);
+
 #ifdef __cplusplus
 }
 #endif
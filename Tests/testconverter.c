@@ -0,0 +1,31 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// The converter plugin built into the tests, with the symbols which clash with the core renamed.
+// converter.h is included after the renames, so the plugin struct layout stays the same.
+#define deadbeef converter_deadbeef
+#define dsp_preset_free converter_dsp_preset_free
+#define dsp_preset_load converter_dsp_preset_load
+#define dsp_preset_save converter_dsp_preset_save
+
+#include "../plugins/converter/converter.c"
@@ -71,6 +71,8 @@ extern "C" {
 // that there's a better replacement in the newer deadbeef versions.
 
 // API version history:
+// 1.18 -- deadbeef-1.10.0
+//   adds messagepump_get_stats and DDB_TF_CONTEXT_NO_CACHE
 // 1.17 -- deadbeef-1.9.6
 // 1.16 -- deadbeef-1.9.4
 // 1.15 -- deadbeef-1.9.0
@@ -101,7 +103,7 @@ extern "C" {
 // 0.1 -- deadbeef-0.2.0
 
 #define DB_API_VERSION_MAJOR 1
-#define DB_API_VERSION_MINOR 17
+#define DB_API_VERSION_MINOR 18
 
 #if defined(__clang__)
 
@@ -138,6 +140,12 @@ extern "C" {
 #define DDB_API_LEVEL DB_API_VERSION_MINOR
 #endif
 
+#if (DDB_WARN_DEPRECATED && DDB_API_LEVEL >= 18)
+#define DEPRECATED_118 DDB_DEPRECATED("since deadbeef API 1.18")
+#else
+#define DEPRECATED_118
+#endif
+
 #if (DDB_WARN_DEPRECATED && DDB_API_LEVEL >= 17)
 #define DEPRECATED_117 DDB_DEPRECATED("since deadbeef API 1.17")
 #else
@@ -683,6 +691,17 @@ enum {
 };
 #endif
 
+#if (DDB_API_LEVEL >= 18)
+// Message queue counters, see messagepump_get_stats
+typedef struct {
+    int _size; // set to sizeof (ddb_messagepump_stats_t) before the call
+    uint32_t queued; // messages waiting to be processed
+    uint32_t peak; // the largest number of waiting messages
+    uint64_t dropped; // messages dropped because the queue was full
+    uint64_t coalesced; // messages skipped because the same message followed
+} ddb_messagepump_stats_t;
+#endif
+
 // since 1.5
 #if (DDB_API_LEVEL >= 5)
 
@@ -729,6 +748,11 @@ enum {
 #if (DDB_API_LEVEL >= 13)
     // the caller guarantees that metadata access is thread safe
     DDB_TF_CONTEXT_NO_MUTEX_LOCK = 32,
+#endif
+    // since 1.18
+#if (DDB_API_LEVEL >= 18)
+    // don't use the result cache of the script, e.g. when each track is evaluated only once
+    DDB_TF_CONTEXT_NO_CACHE = 64,
 #endif
 };
 
@@ -1704,6 +1728,12 @@ typedef struct {
     /// since this function internally uses streamer_lock, which may cause a deadlock against pl_lock.
     ddb_playItem_t * (*streamer_get_playing_track_safe) (void);
 #endif
+
+#if (DDB_API_LEVEL >= 18)
+    /// Get the message queue counters
+    /// @param stats Its @c _size must be set by the caller, nothing is written if it is too small
+    void (*messagepump_get_stats) (ddb_messagepump_stats_t *stats);
+#endif
 } DB_functions_t;
 
 // NOTE: an item placement must be selected like this
@@ -117,8 +117,15 @@ static artwork_query_t *query_tail;
 static int64_t last_job_idx;
 static int64_t cancellation_idx;
 
-#define MAX_COVERS_IN_CACHE 20
-static ddb_cover_info_t *cover_cache[MAX_COVERS_IN_CACHE];
+// In-memory cache of the recent query results, indexed by track file path.
+// The least recently used covers are evicted when the total size exceeds artwork.cache.memory_size (MB).
+#define COVER_CACHE_HASH_SIZE 4096
+#define DEFAULT_COVER_CACHE_MEMORY_SIZE 32
+static ddb_cover_info_t *cover_cache_hash[COVER_CACHE_HASH_SIZE];
+static ddb_cover_info_t *cover_cache_head; // most recently used
+static ddb_cover_info_t *cover_cache_tail;
+static size_t cover_cache_size;
+static size_t cover_cache_max_size = DEFAULT_COVER_CACHE_MEMORY_SIZE * 1024 * 1024;
 
 #define DEFAULT_SAVE_TO_MUSIC_FOLDERS_FILENAME "cover.jpg"
 
@@ -791,6 +798,31 @@ _free_blob (ddb_cover_info_t *cover) {
     cover->priv->blob_image_size = 0;
 }
 
+// Embedded images are stored once per content in the blob cache,
+// and the track/album cache files are hard links to them.
+static void
+_write_blob (const char *cache_path, const char *data, size_t size) {
+#ifndef _WIN32
+    char blob_path[PATH_MAX];
+    if (!make_blob_cache_path (data, size, blob_path, sizeof (blob_path))) {
+        struct stat stat_struct;
+        if (stat (blob_path, &stat_struct) || stat_struct.st_size == 0) {
+            write_file (blob_path, data, size);
+        }
+        else {
+            // the cache cleaner expires the links together with the blob
+            _touch (blob_path);
+        }
+
+        (void)unlink (cache_path);
+        if (ensure_dir (cache_path) && !link (blob_path, cache_path)) {
+            return;
+        }
+    }
+#endif
+    write_file (cache_path, data, size);
+}
+
 static void
 _consume_blob (ddb_cover_info_t *cover, const char *cache_path) {
     if (cover->image_filename != NULL) {
@@ -798,7 +830,7 @@ _consume_blob (ddb_cover_info_t *cover, const char *cache_path) {
         return;
     }
     if (cover->priv->blob != NULL) {
-        write_file(cache_path, cover->priv->blob + cover->priv->blob_image_offset, cover->priv->blob_image_size);
+        _write_blob (cache_path, cover->priv->blob + cover->priv->blob_image_offset, cover->priv->blob_image_size);
         cover->image_filename = strdup (cache_path);
         _free_blob(cover);
     }
@@ -1004,55 +1036,68 @@ process_query (ddb_cover_info_t *cover) {
 
 #pragma mark - In memory cache
 
-static void
-cover_update_cache (ddb_cover_info_t *cover) {
-    // any empty items?
-    time_t minTimestamp = INT64_MAX;
-    int minTimestampIdx = -1;
-    int emptyIdx = -1;
-    for (int i = 0; i < MAX_COVERS_IN_CACHE; i++) {
-        if (!cover_cache[i]) {
-            emptyIdx = i;
-            break;
-        }
+static uint32_t
+cover_cache_hash_path (const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
 
-        if (cover_cache[i]->priv->timestamp < minTimestamp || emptyIdx == -1) {
-            minTimestamp = cover_cache[i]->priv->timestamp;
-            minTimestampIdx = i;
-        }
+static size_t
+cover_cache_item_size (ddb_cover_info_t *cover) {
+    size_t size = sizeof (ddb_cover_info_t) + sizeof (ddb_cover_info_priv_t) + cover->priv->blob_size;
+    if (cover->image_filename) {
+        size += strlen (cover->image_filename) + 1;
     }
+    return size;
+}
 
-    if (emptyIdx < 0) {
-        cover_info_release(cover_cache[minTimestampIdx]);
-        cover_cache[minTimestampIdx] = NULL;
-        emptyIdx = minTimestampIdx;
+static void
+cover_cache_unlink (ddb_cover_info_t *cover) {
+    ddb_cover_info_t **pp = &cover_cache_hash[cover->priv->cache_hash % COVER_CACHE_HASH_SIZE];
+    while (*pp != cover) {
+        pp = &(*pp)->priv->cache_hash_next;
     }
-    cover_cache[emptyIdx] = cover;
-    cover->priv->timestamp = time(NULL);
-    cover_info_ref (cover);
+    *pp = cover->priv->cache_hash_next;
+    cover->priv->cache_hash_next = NULL;
+
+    if (cover->priv->cache_prev) {
+        cover->priv->cache_prev->priv->cache_next = cover->priv->cache_next;
+    }
+    else {
+        cover_cache_head = cover->priv->cache_next;
+    }
+    if (cover->priv->cache_next) {
+        cover->priv->cache_next->priv->cache_prev = cover->priv->cache_prev;
+    }
+    else {
+        cover_cache_tail = cover->priv->cache_prev;
+    }
+    cover->priv->cache_prev = cover->priv->cache_next = NULL;
+
+    cover_cache_size -= cover->priv->cache_size;
 }
 
 static void
-cover_cache_free (void) {
-    for (int i = 0; i < MAX_COVERS_IN_CACHE; i++) {
-        if (!cover_cache[i]) {
-            continue;
-        }
-        cover_info_release(cover_cache[i]);
-        cover_cache[i] = NULL;
+cover_cache_link_head (ddb_cover_info_t *cover) {
+    cover->priv->cache_prev = NULL;
+    cover->priv->cache_next = cover_cache_head;
+    if (cover_cache_head) {
+        cover_cache_head->priv->cache_prev = cover;
+    }
+    else {
+        cover_cache_tail = cover;
     }
+    cover_cache_head = cover;
 }
 
 static ddb_cover_info_t *
 cover_cache_find (ddb_cover_info_t *cover) {
-    for (int i = 0; i < MAX_COVERS_IN_CACHE; i++) {
-        if (!cover_cache[i]) {
-            continue;
-        }
-
-        ddb_cover_info_t *cached_cover = cover_cache[i];
-
-        if (!strcmp (cover->priv->filepath, cached_cover->priv->filepath)) {
+    uint32_t hash = cover_cache_hash_path (cover->priv->filepath);
+    for (ddb_cover_info_t *cached_cover = cover_cache_hash[hash % COVER_CACHE_HASH_SIZE]; cached_cover; cached_cover = cached_cover->priv->cache_hash_next) {
+        if (cached_cover->priv->cache_hash == hash && !strcmp (cover->priv->filepath, cached_cover->priv->filepath)) {
             return cached_cover;
         }
     }
@@ -1062,18 +1107,69 @@ cover_cache_find (ddb_cover_info_t *cover) {
 
 static void
 cover_cache_remove (ddb_cover_info_t *cover) {
-    for (int i = 0; i < MAX_COVERS_IN_CACHE; i++) {
-        if (!cover_cache[i]) {
-            continue;
-        }
+    ddb_cover_info_t *cached_cover = cover_cache_find (cover);
+    if (cached_cover) {
+        cover_cache_unlink (cached_cover);
+        cover_info_release (cached_cover);
+    }
+}
 
-        ddb_cover_info_t *cached_cover = cover_cache[i];
+// marks the cover as the most recently used
+static void
+cover_cache_touch (ddb_cover_info_t *cover) {
+    if (cover == cover_cache_head) {
+        return;
+    }
+    cover->priv->cache_prev->priv->cache_next = cover->priv->cache_next;
+    if (cover->priv->cache_next) {
+        cover->priv->cache_next->priv->cache_prev = cover->priv->cache_prev;
+    }
+    else {
+        cover_cache_tail = cover->priv->cache_prev;
+    }
+    cover_cache_link_head (cover);
+}
 
-        if (!strcmp (cover->priv->filepath, cached_cover->priv->filepath)) {
-            cover_info_release(cached_cover);
-            cover_cache[i] = NULL;
-            break;
-        }
+static void
+cover_cache_evict (void) {
+    // the most recent cover is kept regardless of the size
+    while (cover_cache_size > cover_cache_max_size && cover_cache_tail != cover_cache_head) {
+        ddb_cover_info_t *cover = cover_cache_tail;
+        cover_cache_unlink (cover);
+        cover_info_release (cover);
+    }
+}
+
+static void
+cover_update_cache (ddb_cover_info_t *cover) {
+    ddb_cover_info_t *cached_cover = cover_cache_find (cover);
+    if (cached_cover == cover) {
+        cover_cache_touch (cover);
+        return;
+    }
+    if (cached_cover) {
+        cover_cache_unlink (cached_cover);
+        cover_info_release (cached_cover);
+    }
+
+    cover_info_ref (cover);
+    cover->priv->cache_hash = cover_cache_hash_path (cover->priv->filepath);
+    ddb_cover_info_t **bucket = &cover_cache_hash[cover->priv->cache_hash % COVER_CACHE_HASH_SIZE];
+    cover->priv->cache_hash_next = *bucket;
+    *bucket = cover;
+    cover_cache_link_head (cover);
+
+    cover->priv->cache_size = cover_cache_item_size (cover);
+    cover_cache_size += cover->priv->cache_size;
+    cover_cache_evict ();
+}
+
+static void
+cover_cache_free (void) {
+    while (cover_cache_head) {
+        ddb_cover_info_t *cover = cover_cache_head;
+        cover_cache_unlink (cover);
+        cover_info_release (cover);
     }
 }
 
@@ -1473,7 +1569,7 @@ cover_get (ddb_cover_query_t *query, ddb_cover_callback_t callback) {
             ddb_cover_info_t *cached_cover = cover_cache_find (cover);
             if (cached_cover) {
                 found_in_cache = 1;
-                cached_cover->priv->timestamp = time(NULL);
+                cover_cache_touch (cached_cover);
                 cover_info_release(cover);
                 cover = cached_cover;
             }
@@ -1651,6 +1747,13 @@ _get_fetcher_preferences (void) {
 
     simplified_cache = deadbeef->conf_get_int ("artwork.cache.simplified", 0);
 
+    int memory_size = deadbeef->conf_get_int ("artwork.cache.memory_size", DEFAULT_COVER_CACHE_MEMORY_SIZE);
+    if (memory_size < 1) {
+        memory_size = 1;
+    }
+    cover_cache_max_size = (size_t)memory_size * 1024 * 1024;
+    cover_cache_evict ();
+
     deadbeef->conf_lock ();
     if (missing_artwork == 0) {
         free(nocover_path);
@@ -1773,10 +1876,9 @@ invalidate_playitem_cache (DB_plugin_action_t *action, ddb_action_context_t ctx)
             if (deadbeef->pl_is_selected (it)) {
                 ddb_cover_info_t *cover = sync_cover_info_alloc();
                 _init_cover_metadata(cover, it);
-                ddb_cover_info_t *cached_cover = cover_cache_find (cover);
-                if (cached_cover) {
+                dispatch_sync(sync_queue, ^{
                     cover_cache_remove (cover);
-                }
+                });
 
                 if (cover->priv->album_cache_path[0]) {
                     remove_cache_item (cover->priv->album_cache_path);
@@ -1956,6 +2058,7 @@ static const char settings_dlg[] =
     "property \"Cache refresh (hrs)\" spinbtn[0,1000,1] artwork.cache.expiration_time 0;\n"
 #endif
     "property \"Simplified cache file names\" checkbox artwork.cache.simplified 0;\n"
+    "property \"Memory cache size (MB)\" spinbtn[1,1024,1] artwork.cache.memory_size 32;\n"
     "property \"Image size\" spinbtn[64,2048,1] artwork.image_size 256;\n"
 ;
 
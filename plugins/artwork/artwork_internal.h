@@ -34,7 +34,6 @@
 
 struct ddb_cover_info_priv_s {
     // query info
-    time_t timestamp; // Last time when the info was used last time
     char filepath[PATH_MAX];
     char album[1000];
     char artist[1000];
@@ -54,6 +53,13 @@ struct ddb_cover_info_priv_s {
     // prev/next in the list of all alive cover_info_t objects
     struct ddb_cover_info_s *prev;
     struct ddb_cover_info_s *next;
+
+    // in-memory cache: hash chain, and prev/next in the LRU list
+    struct ddb_cover_info_s *cache_hash_next;
+    struct ddb_cover_info_s *cache_prev;
+    struct ddb_cover_info_s *cache_next;
+    uint32_t cache_hash;
+    size_t cache_size;
 };
 
 size_t artwork_http_request(const char *url, char *buffer, const size_t max_bytes);
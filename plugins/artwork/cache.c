@@ -62,6 +62,27 @@ make_cache_root_path (char *path, const size_t size) {
     return 0;
 }
 
+// Path of the file in the blobs folder, named by the md5 of the image data
+int
+make_blob_cache_path (const char *data, const size_t data_size, char *path, const size_t size) {
+    char root_path[PATH_MAX];
+    if (make_cache_root_path (root_path, sizeof (root_path)) < 0) {
+        return -1;
+    }
+
+    uint8_t sig[16];
+    char sig_str[33];
+    deadbeef->md5 (sig, data, (int)data_size);
+    deadbeef->md5_to_str (sig_str, sig);
+
+    size_t res = snprintf (path, size, "%s/blobs/%s.jpg", root_path, sig_str);
+    if (res >= size) {
+        trace ("artwork: blob cache path truncated at %d bytes\n", (int)size);
+        return -1;
+    }
+    return 0;
+}
+
 void
 remove_cache_item (const char *cache_path) {
     // Unlink the expired file, and the artist directory if it is empty
@@ -108,7 +129,7 @@ cache_cleaner_worker (void) {
 
             // Test against the cache expiry time
             struct stat stat_buf;
-            if (!stat (entry_path, &stat_buf)) {
+            if (!stat (entry_path, &stat_buf) && !S_ISDIR (stat_buf.st_mode)) {
                 if (stat_buf.st_mtime <= cache_expiry) {
                     trace ("%s expired from cache\n", entry_path);
                     remove_cache_item (entry_path);
@@ -120,6 +141,30 @@ cache_cleaner_worker (void) {
         closedir (covers_dir);
         covers_dir = NULL;
     }
+
+    // remove the blobs which are no longer linked from any cache file
+    char blobs_path[PATH_MAX];
+    if (sizeof (blobs_path) <= snprintf (blobs_path, sizeof (blobs_path), "%s/blobs", covers_path)) {
+        return;
+    }
+    DIR *blobs_dir = opendir (blobs_path);
+    if (blobs_dir == NULL) {
+        return;
+    }
+    while (!should_terminate() && (entry = readdir (blobs_dir))) {
+        if (path_ok (entry->d_name)) {
+            if (sizeof (entry_path) <= snprintf (entry_path, sizeof(entry_path), "%s/%s", blobs_path, entry->d_name)) {
+                continue;
+            }
+
+            struct stat stat_buf;
+            if (!stat (entry_path, &stat_buf) && stat_buf.st_nlink <= 1 && stat_buf.st_mtime <= cache_expiry) {
+                trace ("%s is no longer used\n", entry_path);
+                remove_cache_item (entry_path);
+            }
+        }
+    }
+    closedir (blobs_dir);
 }
 
 void
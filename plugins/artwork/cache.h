@@ -25,6 +25,7 @@
 #define __ARTWORK_CACHE_H
 
 int make_cache_root_path(char *path, const size_t size);
+int make_blob_cache_path(const char *data, const size_t data_size, char *path, const size_t size);
 void remove_cache_item(const char *entry_path);
 void cache_configchanged(void);
 void start_cache_cleaner(void);
@@ -38,7 +38,6 @@ cover_info_alloc (void) {
 
     info->_size = sizeof (ddb_cover_info_t);
     info->priv->refc = 1;
-    info->priv->timestamp = time(NULL);
 
     info->priv->prev = NULL;
 
@@ -40,6 +40,8 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <dispatch/dispatch.h>
 #include <deadbeef/deadbeef.h>
 #include "converter.h"
 #include <deadbeef/strdupa.h>
@@ -325,7 +327,7 @@ dsp_preset_free (ddb_dsp_preset_t *p) {
 
 void
 dsp_preset_copy (ddb_dsp_preset_t *to, ddb_dsp_preset_t *from) {
-    to->title = strdup (from->title);
+    to->title = from->title ? strdup (from->title) : NULL;
     ddb_dsp_context_t *tail = NULL;
     ddb_dsp_context_t *dsp = from->chain;
     while (dsp) {
@@ -855,11 +857,120 @@ static const unsigned char format_id_pcm[] = {
     0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
 };
 
+// Decoded blocks are handed to a writer thread, so that decoding and DSP
+// of the next block overlap with the encoder consuming the previous one.
+// The number of blocks in flight is fixed, which bounds memory per track.
+#define WAV_WRITER_BLOCKS 4
+
+typedef struct {
+    char *data;
+    int size;
+    int capacity;
+} wav_block_t;
+
+// Single producer / single consumer ring.
+// Each block is passed through the semaphores, and the writer gets one more signal when finished.
+typedef struct {
+    int fd;
+    intptr_t tid;
+    wav_block_t blocks[WAV_WRITER_BLOCKS];
+    int head; // next block to write, owned by the writer thread
+    int tail; // next block to fill, owned by the decoding thread
+    int count;
+    dispatch_semaphore_t filled; // signaled for each block ready to write
+    dispatch_semaphore_t empty; // signaled for each block ready to fill
+    int error;
+    int64_t *pcm_bytes;
+} wav_writer_t;
+
+static void
+_wav_writer_thread (void *ctx) {
+    wav_writer_t *w = ctx;
+    for (;;) {
+        dispatch_semaphore_wait (w->filled, DISPATCH_TIME_FOREVER);
+        if (!__atomic_load_n (&w->count, __ATOMIC_ACQUIRE)) {
+            // all blocks are written, and no more will come
+            break;
+        }
+
+        // after an error, the blocks are dropped, so that the decoding thread doesn't block
+        wav_block_t *b = &w->blocks[w->head];
+        if (!__atomic_load_n (&w->error, __ATOMIC_ACQUIRE)) {
+            ssize_t res = write (w->fd, b->data, b->size);
+            if (res != b->size) {
+                trace ("Write error (%d bytes written out of %d)\n", (int)res, b->size);
+                __atomic_store_n (&w->error, 1, __ATOMIC_RELEASE);
+            }
+            else if (w->pcm_bytes) {
+                __atomic_add_fetch (w->pcm_bytes, b->size, __ATOMIC_RELAXED);
+            }
+        }
+        w->head = (w->head + 1) % WAV_WRITER_BLOCKS;
+        __atomic_sub_fetch (&w->count, 1, __ATOMIC_RELEASE);
+        dispatch_semaphore_signal (w->empty);
+    }
+}
+
+static int
+_wav_writer_start (wav_writer_t *w, int fd, int64_t *pcm_bytes) {
+    memset (w, 0, sizeof (wav_writer_t));
+    w->fd = fd;
+    w->pcm_bytes = pcm_bytes;
+    w->filled = dispatch_semaphore_create (0);
+    w->empty = dispatch_semaphore_create (WAV_WRITER_BLOCKS);
+    w->tid = deadbeef->thread_start (_wav_writer_thread, w);
+    if (!w->tid) {
+        dispatch_release (w->filled);
+        dispatch_release (w->empty);
+        return -1;
+    }
+    return 0;
+}
+
+// blocks while all the blocks are in flight, @return -1 on write error
+static int
+_wav_writer_push (wav_writer_t *w, const char *data, int size) {
+    dispatch_semaphore_wait (w->empty, DISPATCH_TIME_FOREVER);
+    if (__atomic_load_n (&w->error, __ATOMIC_ACQUIRE)) {
+        dispatch_semaphore_signal (w->empty);
+        return -1;
+    }
+
+    wav_block_t *b = &w->blocks[w->tail];
+    if (b->capacity < size) {
+        free (b->data);
+        b->data = malloc (size);
+        b->capacity = size;
+    }
+    memcpy (b->data, data, size);
+    b->size = size;
+    w->tail = (w->tail + 1) % WAV_WRITER_BLOCKS;
+    __atomic_add_fetch (&w->count, 1, __ATOMIC_RELEASE);
+    dispatch_semaphore_signal (w->filled);
+    return 0;
+}
+
+// waits until the queued blocks are written, @return -1 on write error
+static int
+_wav_writer_finish (wav_writer_t *w) {
+    dispatch_semaphore_signal (w->filled);
+    deadbeef->thread_join (w->tid);
+
+    dispatch_release (w->filled);
+    dispatch_release (w->empty);
+    for (int i = 0; i < WAV_WRITER_BLOCKS; i++) {
+        free (w->blocks[i].data);
+    }
+    return w->error ? -1 : 0;
+}
+
 static int64_t
-_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, int fd, int output_bps, int output_is_float) {
+_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, int fd, int output_bps, int output_is_float, int64_t *pcm_bytes) {
     int64_t res = -1;
     char *buffer = NULL;
     char *dspbuffer = NULL;
+    wav_writer_t writer;
+    int writer_started = 0;
 
     // write wave header
     int exheader = output_bps > 16 && !output_is_float;
@@ -1019,6 +1130,12 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
                 goto error;
             }
             header_written = 1;
+
+            if (_wav_writer_start (&writer, fd, pcm_bytes)) {
+                trace ("Failed to start the wave writer thread\n");
+                goto error;
+            }
+            writer_started = 1;
         }
 
         if (output_bps == 8) {
@@ -1029,13 +1146,16 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
             }
         }
 
-        int64_t res = write (fd, buffer, sz);
-        if (sz != res) {
-            trace ("Write error (%"PRId64" bytes written out of %d)\n", res, sz);
+        if (sz > 0 && _wav_writer_push (&writer, buffer, sz)) {
             goto error;
         }
     }
 
+    writer_started = 0;
+    if (_wav_writer_finish (&writer)) {
+        goto error;
+    }
+
     res = outsize;
 
     // rewrite wave data size
@@ -1072,6 +1192,9 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
 
 error:
 
+    if (writer_started) {
+        _wav_writer_finish (&writer);
+    }
     if (buffer) {
         free (buffer);
         buffer = NULL;
@@ -1343,7 +1466,7 @@ ddb_mktemp(char *template, size_t template_size, char *suffix) {
 }
 
 static int
-convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+_convert_track (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort, int64_t *pcm_bytes) {
     int output_bps = settings->output_bps;
     int output_is_float = settings->output_is_float;
     ddb_encoder_preset_t *encoder_preset = settings->encoder_preset;
@@ -1482,7 +1605,15 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                 }
 
                 if (temp_file > 0) {
-                    int64_t outsize = _write_wav (it, dec, fileinfo, dsp_preset, encoder_preset, pabort, temp_file, output_bps, output_is_float);
+                    // DSP plugins keep state between blocks, so each track gets its own copy of the chain,
+                    // which also lets the job threads convert with the same preset at the same time
+                    ddb_dsp_preset_t *track_dsp_preset = NULL;
+                    if (dsp_preset) {
+                        track_dsp_preset = dsp_preset_alloc ();
+                        dsp_preset_copy (track_dsp_preset, dsp_preset);
+                    }
+                    int64_t outsize = _write_wav (it, dec, fileinfo, track_dsp_preset, encoder_preset, pabort, temp_file, output_bps, output_is_float, pcm_bytes);
+                    dsp_preset_free (track_dsp_preset);
 
                     if (outsize < 0) {
                         goto error;
@@ -1546,6 +1677,213 @@ error:
     return err;
 }
 
+static int
+convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+    return _convert_track (settings, it, out, pabort, NULL);
+}
+
+typedef struct {
+    DB_playItem_t *it;
+    char *outpath;
+} converter_job_track_t;
+
+struct ddb_converter_job_s {
+    ddb_converter_settings_t settings;
+    int num_threads;
+    int *pabort;
+    ddb_converter_job_callback_t callback;
+    void *user_data;
+
+    converter_job_track_t *tracks;
+    int count;
+    int capacity;
+    int next_track;
+
+    intptr_t *tids;
+    int started;
+
+    int tracks_done;
+    int tracks_failed;
+    int64_t pcm_bytes;
+    int64_t audio_msec;
+    struct timeval start_time;
+    struct timeval finish_time;
+    int finished;
+};
+
+static int
+_cpu_count (void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n > 0) {
+        return (int)n;
+    }
+#endif
+    return 1;
+}
+
+static ddb_converter_job_t *
+job_alloc (ddb_converter_settings_t *settings, int num_threads, int *pabort) {
+    ddb_converter_job_t *job = calloc (1, sizeof (ddb_converter_job_t));
+    job->settings = *settings;
+    if (num_threads <= 0) {
+        num_threads = deadbeef->conf_get_int ("converter.threads", 0);
+    }
+    if (num_threads <= 0) {
+        num_threads = _cpu_count ();
+    }
+    job->num_threads = num_threads;
+    job->pabort = pabort;
+    return job;
+}
+
+static int
+job_add (ddb_converter_job_t *job, DB_playItem_t *it, const char *outpath) {
+    if (job->started) {
+        return -1;
+    }
+    if (job->count == job->capacity) {
+        int capacity = job->capacity ? job->capacity * 2 : 16;
+        converter_job_track_t *tracks = realloc (job->tracks, capacity * sizeof (converter_job_track_t));
+        if (!tracks) {
+            return -1;
+        }
+        job->tracks = tracks;
+        job->capacity = capacity;
+    }
+    deadbeef->pl_item_ref (it);
+    job->tracks[job->count].it = it;
+    job->tracks[job->count].outpath = strdup (outpath);
+    job->count++;
+    return 0;
+}
+
+static void
+_job_worker (void *ctx) {
+    ddb_converter_job_t *job = ctx;
+    for (;;) {
+        if (job->pabort && *job->pabort) {
+            break;
+        }
+        int idx = __atomic_fetch_add (&job->next_track, 1, __ATOMIC_SEQ_CST);
+        if (idx >= job->count) {
+            break;
+        }
+        converter_job_track_t *t = &job->tracks[idx];
+        if (job->callback) {
+            job->callback (job, DDB_CONVERTER_JOB_TRACK_STARTED, t->it, t->outpath, 0, job->user_data);
+        }
+
+        int res = _convert_track (&job->settings, t->it, t->outpath, job->pabort, &job->pcm_bytes);
+        if (res == 0) {
+            int64_t msec = (int64_t)(deadbeef->pl_get_item_duration (t->it) * 1000);
+            __atomic_add_fetch (&job->audio_msec, msec, __ATOMIC_RELAXED);
+        }
+        else {
+            __atomic_add_fetch (&job->tracks_failed, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch (&job->tracks_done, 1, __ATOMIC_SEQ_CST);
+
+        if (job->callback) {
+            job->callback (job, DDB_CONVERTER_JOB_TRACK_FINISHED, t->it, t->outpath, res, job->user_data);
+        }
+    }
+}
+
+static int
+job_start (ddb_converter_job_t *job, ddb_converter_job_callback_t callback, void *user_data) {
+    if (job->started) {
+        return -1;
+    }
+    job->callback = callback;
+    job->user_data = user_data;
+    job->started = 1;
+    gettimeofday (&job->start_time, NULL);
+
+    // no point in having more threads than tracks
+    job->num_threads = min (job->num_threads, job->count);
+    if (job->num_threads > 0) {
+        job->tids = calloc (job->num_threads, sizeof (intptr_t));
+    }
+    int nstarted = 0;
+    for (int i = 0; i < job->num_threads; i++) {
+        job->tids[i] = deadbeef->thread_start (_job_worker, job);
+        if (!job->tids[i]) {
+            break;
+        }
+        nstarted++;
+    }
+
+    // the threads which did start convert all the tracks, without them the job fails
+    if (job->num_threads > 0 && nstarted == 0) {
+        trace_err ("converter: failed to start the conversion threads\n");
+        job->tracks_failed = job->count;
+        gettimeofday (&job->finish_time, NULL);
+        __atomic_store_n (&job->finished, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+    job->num_threads = nstarted;
+    return 0;
+}
+
+static double
+_job_elapsed (ddb_converter_job_t *job) {
+    struct timeval tm;
+    if (__atomic_load_n (&job->finished, __ATOMIC_SEQ_CST)) {
+        tm = job->finish_time;
+    }
+    else {
+        gettimeofday (&tm, NULL);
+    }
+    return (tm.tv_sec - job->start_time.tv_sec) + (tm.tv_usec - job->start_time.tv_usec) / 1000000.0;
+}
+
+static void
+job_get_stats (ddb_converter_job_t *job, ddb_converter_job_stats_t *stats) {
+    if (stats->_size < (int)sizeof (ddb_converter_job_stats_t)) {
+        return;
+    }
+    stats->tracks_total = job->count;
+    stats->tracks_done = __atomic_load_n (&job->tracks_done, __ATOMIC_SEQ_CST);
+    stats->tracks_failed = __atomic_load_n (&job->tracks_failed, __ATOMIC_SEQ_CST);
+    stats->pcm_bytes = __atomic_load_n (&job->pcm_bytes, __ATOMIC_SEQ_CST);
+    stats->audio_seconds = __atomic_load_n (&job->audio_msec, __ATOMIC_SEQ_CST) / 1000.0;
+    stats->elapsed = job->started ? _job_elapsed (job) : 0;
+}
+
+static int
+job_wait (ddb_converter_job_t *job) {
+    if (!job->started || job->finished) {
+        return job->tracks_failed;
+    }
+    for (int i = 0; i < job->num_threads; i++) {
+        if (job->tids[i]) {
+            deadbeef->thread_join (job->tids[i]);
+        }
+    }
+    gettimeofday (&job->finish_time, NULL);
+    __atomic_store_n (&job->finished, 1, __ATOMIC_SEQ_CST);
+
+    ddb_converter_job_stats_t stats = { ._size = sizeof (stats) };
+    job_get_stats (job, &stats);
+    double elapsed = stats.elapsed > 0 ? stats.elapsed : 0.001;
+    deadbeef->log_detailed (&plugin.misc.plugin, DDB_LOG_LAYER_INFO, "converter: %d of %d tracks converted (%d failed) on %d threads in %.1f sec, %.1fx realtime, %.1f MB/s\n", stats.tracks_done, stats.tracks_total, stats.tracks_failed, job->num_threads, stats.elapsed, stats.audio_seconds / elapsed, stats.pcm_bytes / elapsed / (1024 * 1024));
+
+    return job->tracks_failed;
+}
+
+static void
+job_free (ddb_converter_job_t *job) {
+    job_wait (job);
+    for (int i = 0; i < job->count; i++) {
+        deadbeef->pl_item_unref (job->tracks[i].it);
+        free (job->tracks[i].outpath);
+    }
+    free (job->tracks);
+    free (job->tids);
+    free (job);
+}
+
 static int
 convert (DB_playItem_t *it, const char *out, int output_bps, int output_is_float, ddb_encoder_preset_t *encoder_preset, ddb_dsp_preset_t *dsp_preset, int *abort) {
     ddb_converter_settings_t settings = {
@@ -1590,7 +1928,7 @@ static ddb_converter_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 5,
+    .misc.plugin.version_minor = 6,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "Converter",
@@ -1657,6 +1995,13 @@ static ddb_converter_t plugin = {
     .get_output_path2 = get_output_path2,
     // 1.5 entry points
     .convert2 = convert2,
+    // 1.6 entry points
+    .job_alloc = job_alloc,
+    .job_add = job_add,
+    .job_start = job_start,
+    .job_wait = job_wait,
+    .job_get_stats = job_get_stats,
+    .job_free = job_free,
 };
 
 DB_plugin_t *
@@ -25,6 +25,8 @@
 
 #include <stdint.h>
 
+// changes in 1.6:
+//   added conversion jobs, which convert multiple tracks in parallel
 // changes in 1.5:
 //   added mp4 tagging support
 //   added converter option to copy files without conversion, if file format isn't changing
@@ -101,6 +103,27 @@ typedef struct ddb_converter_settings_s {
     int rewrite_tags_after_copy;
 } ddb_converter_settings_t;
 
+// added in converter-1.6
+typedef struct ddb_converter_job_s ddb_converter_job_t;
+
+enum {
+    DDB_CONVERTER_JOB_TRACK_STARTED = 0,
+    DDB_CONVERTER_JOB_TRACK_FINISHED = 1, // result is the convert2 return value
+};
+
+// called from the job worker threads
+typedef void (*ddb_converter_job_callback_t) (ddb_converter_job_t *job, int event, DB_playItem_t *it, const char *outpath, int result, void *user_data);
+
+typedef struct {
+    int _size; // set to sizeof (ddb_converter_job_stats_t) before the call
+    int tracks_total;
+    int tracks_done; // including failed
+    int tracks_failed;
+    int64_t pcm_bytes; // decoded audio bytes passed to the encoders
+    double audio_seconds; // duration of the successfully converted tracks
+    double elapsed; // seconds since job_start, until job_wait returned
+} ddb_converter_job_stats_t;
+
 typedef struct {
     DB_misc_t misc;
 
@@ -265,6 +288,44 @@ typedef struct {
          // *pabort will be checked regularly, conversion will be interrupted if it's non-zero
          int *pabort
     );
+
+    /////////////////////////////
+    // since 1.6
+    /////////////////////////////
+
+    // Conversion jobs convert a list of tracks on several threads, without any UI.
+    // Each thread decodes and processes one track at a time, while a separate
+    // writer thread feeds the encoder, through a fixed number of blocks,
+    // so memory use is bounded by the number of threads.
+    // Usage: job_alloc, job_add for each track, job_start, job_wait, job_free.
+
+    // settings are copied, but the presets must stay valid until job_free.
+    // num_threads: 0 means use the "converter.threads" setting,
+    //              or the number of CPUs if that is 0 as well.
+    // pabort: may be NULL; the job stops picking up tracks when *pabort is non-zero.
+    ddb_converter_job_t *
+    (*job_alloc) (ddb_converter_settings_t *settings, int num_threads, int *pabort);
+
+    // must be called before job_start; the track is referenced until job_free
+    int
+    (*job_add) (ddb_converter_job_t *job, DB_playItem_t *it, const char *outpath);
+
+    // callback may be NULL
+    // @return -1 if no conversion thread could be started, then all the tracks count as failed
+    int
+    (*job_start) (ddb_converter_job_t *job, ddb_converter_job_callback_t callback, void *user_data);
+
+    // blocks until all the tracks are converted or the job is aborted
+    // @return the number of tracks which failed to convert
+    int
+    (*job_wait) (ddb_converter_job_t *job);
+
+    // safe to call from any thread, including the callback
+    void
+    (*job_get_stats) (ddb_converter_job_t *job, ddb_converter_job_stats_t *stats);
+
+    void
+    (*job_free) (ddb_converter_job_t *job);
 } ddb_converter_t;
 
 #endif
@@ -169,6 +169,28 @@ overwrite_prompt (const char *outpath) {
     return ctl.result;
 }
 
+// called from the converter job threads
+static void
+converter_job_callback (ddb_converter_job_t *job, int event, DB_playItem_t *it, const char *outpath, int result, void *user_data) {
+    if (event != DDB_CONVERTER_JOB_TRACK_STARTED) {
+        return;
+    }
+    converter_ctx_t *conv = user_data;
+    ddb_converter_job_stats_t stats = { ._size = sizeof (stats) };
+    converter_plugin->job_get_stats (job, &stats);
+
+    char text[2000];
+    deadbeef->pl_lock ();
+    snprintf (text, sizeof (text), "%d/%d: %s", stats.tracks_done + 1, stats.tracks_total, deadbeef->pl_find_meta (it, ":URI"));
+    deadbeef->pl_unlock ();
+
+    update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
+    info->entry = conv->progress_entry;
+    g_object_ref (info->entry);
+    info->text = strdup (text);
+    g_idle_add (update_progress_cb, info);
+}
+
 static void
 converter_worker (void *ctx) {
     deadbeef->background_job_increment ();
@@ -219,15 +241,9 @@ converter_worker (void *ctx) {
         .rewrite_tags_after_copy = conv->retag_after_copy,
     };
 
-    for (int n = 0; n < conv->convert_items_count; n++) {
-        update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
-        info->entry = conv->progress_entry;
-        g_object_ref (info->entry);
-        deadbeef->pl_lock ();
-        info->text = strdup (deadbeef->pl_find_meta (conv->convert_items[n], ":URI"));
-        deadbeef->pl_unlock ();
-        g_idle_add (update_progress_cb, info);
+    ddb_converter_job_t *job = converter_plugin->job_alloc (&settings, 0, &conv->cancelled);
 
+    for (int n = 0; n < conv->convert_items_count && !conv->cancelled; n++) {
         char outpath[2000];
         converter_plugin->get_output_path2 (conv->convert_items[n], conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpath, sizeof (outpath));
 
@@ -251,16 +267,21 @@ converter_worker (void *ctx) {
         }
 
         if (!skip) {
-            converter_plugin->convert2 (&settings, conv->convert_items[n], outpath, &conv->cancelled);
-        }
-        if (conv->cancelled) {
-            for (; n < conv->convert_items_count; n++) {
-                deadbeef->pl_item_unref (conv->convert_items[n]);
-            }
-            break;
+            converter_plugin->job_add (job, conv->convert_items[n], outpath);
         }
+    }
+
+    // the job holds its own references
+    for (int n = 0; n < conv->convert_items_count; n++) {
         deadbeef->pl_item_unref (conv->convert_items[n]);
     }
+
+    if (!conv->cancelled) {
+        converter_plugin->job_start (job, converter_job_callback, conv);
+        converter_plugin->job_wait (job);
+    }
+    converter_plugin->job_free (job);
+
     g_idle_add (destroy_progress_cb, conv->progress);
     if (conv->convert_items) {
         free (conv->convert_items);
@@ -628,6 +649,9 @@ converter_show_cb (void *data) {
     combo = GTK_COMBO_BOX (lookup_widget (conv->converter, "overwrite_action"));
     gtk_combo_box_set_active (combo, deadbeef->conf_get_int ("converter.overwrite_action", 0));
 
+    // number of tracks converted in parallel, 0 = number of CPUs
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (lookup_widget (conv->converter, "numthreads")), deadbeef->conf_get_int ("converter.threads", 0));
+
 
     for (;;) {
         int response = gtk_dialog_run (GTK_DIALOG (conv->converter));
@@ -1827,7 +1851,7 @@ convgui_connect (void) {
         fprintf (stderr, "convgui: converter plugin not found\n");
         return -1;
     }
-#define REQ_CONV_VERSION 4
+#define REQ_CONV_VERSION 6
     if (!PLUG_TEST_COMPAT(&converter_plugin->misc.plugin, 1, REQ_CONV_VERSION)) {
         fprintf (stderr, "convgui: need converter>=1.%d, but found %d.%d\n", REQ_CONV_VERSION, converter_plugin->misc.plugin.version_major, converter_plugin->misc.plugin.version_minor);
         return -1;
@@ -32,6 +32,7 @@
 #include "medialibcommon.h"
 #include "medialibfilesystem.h"
 #include "medialibscanner.h"
+#include "medialibsnapshot.h"
 #include "medialibsource.h"
 #include "medialibtree.h"
 
@@ -47,6 +48,8 @@ static int
 ml_start (void) {
     ml_source_init(deadbeef);
     ml_db_init(deadbeef);
+    ml_fulltext_init(&plugin, deadbeef);
+    ml_snapshot_init(deadbeef);
     ml_scanner_init(&plugin, deadbeef);
     ml_tree_init(deadbeef);
 
@@ -21,6 +21,10 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "medialibcommon.h"
 #include "medialibsource.h"
 
@@ -44,3 +48,102 @@ ml_free_music_paths (char **medialib_paths, size_t medialib_paths_count) {
     }
     free (medialib_paths);
 }
+
+// Returns 1 if path is the same folder as parent, or is inside of it
+static int
+_is_same_or_subpath (const char *parent, const char *path) {
+    size_t len = strlen (parent);
+    return !strncmp (parent, path, len) && (path[len] == 0 || path[len] == '/');
+}
+
+// Removes the entries for which the path is the same folder or a subfolder
+static void
+_remove_subpaths (char **list, size_t *count, const char *path) {
+    for (size_t i = *count; i > 0; i--) {
+        if (_is_same_or_subpath (path, list[i-1])) {
+            free (list[i-1]);
+            list[i-1] = list[--(*count)];
+        }
+    }
+}
+
+void
+ml_changed_paths_add (ml_changed_paths_t *changes, const char *path, int recursive) {
+    if (changes->full_rescan) {
+        return;
+    }
+
+    for (size_t i = 0; i < changes->paths_count; i++) {
+        if (_is_same_or_subpath (changes->paths[i], path)) {
+            return;
+        }
+    }
+
+    if (recursive) {
+        // the new path replaces its subfolders
+        _remove_subpaths (changes->paths, &changes->paths_count, path);
+        _remove_subpaths (changes->folders, &changes->folders_count, path);
+    }
+    else {
+        for (size_t i = 0; i < changes->folders_count; i++) {
+            if (!strcmp (changes->folders[i], path)) {
+                return;
+            }
+        }
+    }
+
+    if (changes->paths_count + changes->folders_count == ML_MAX_CHANGED_PATHS) {
+        ml_changed_paths_set_full_rescan (changes);
+        return;
+    }
+
+    char ***list = recursive ? &changes->paths : &changes->folders;
+    size_t *count = recursive ? &changes->paths_count : &changes->folders_count;
+    if (*list == NULL) {
+        *list = calloc (ML_MAX_CHANGED_PATHS, sizeof (char *));
+    }
+    (*list)[(*count)++] = strdup (path);
+}
+
+void
+ml_changed_paths_set_full_rescan (ml_changed_paths_t *changes) {
+    ml_changed_paths_free (changes);
+    changes->full_rescan = 1;
+}
+
+void
+ml_changed_paths_free (ml_changed_paths_t *changes) {
+    ml_free_music_paths (changes->paths, changes->paths_count);
+    ml_free_music_paths (changes->folders, changes->folders_count);
+    memset (changes, 0, sizeof (ml_changed_paths_t));
+}
+
+int
+ml_write_file_atomic (const char *fname, int (*write_func) (FILE *fp, void *user_data), void *user_data) {
+    char tempname[PATH_MAX];
+    if (snprintf (tempname, sizeof (tempname), "%s.part", fname) >= (int)sizeof (tempname)) {
+        return -1;
+    }
+
+    FILE *fp = fopen (tempname, "w+b");
+    if (!fp) {
+        return -1;
+    }
+
+    if (write_func (fp, user_data)) {
+        fclose (fp);
+        unlink (tempname);
+        return -1;
+    }
+
+    if (fclose (fp)) {
+        unlink (tempname);
+        return -1;
+    }
+
+    if (rename (tempname, fname)) {
+        unlink (tempname);
+        return -1;
+    }
+    return 0;
+}
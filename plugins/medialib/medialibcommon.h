@@ -24,6 +24,7 @@
 #ifndef medialibcommon_h
 #define medialibcommon_h
 
+#include <stdio.h>
 #include "medialibsource.h"
 
 void
@@ -32,4 +33,35 @@ ml_notify_listeners (medialib_source_t *source, int event);
 void
 ml_free_music_paths (char **medialib_paths, size_t medialib_paths_count);
 
+// When more folders than this have changed, the whole library is rescanned
+#define ML_MAX_CHANGED_PATHS 64
+
+// Coalesced folders to rescan, none of which is inside of a folder rescanned with subfolders
+typedef struct {
+    char **paths; // rescanned with subfolders
+    size_t paths_count;
+    char **folders; // rescanned without subfolders
+    size_t folders_count;
+    int full_rescan;
+} ml_changed_paths_t;
+
+/// Add the folder to rescan, with or without its subfolders.
+/// Switches to the full rescan when there are more than ML_MAX_CHANGED_PATHS folders.
+void
+ml_changed_paths_add (ml_changed_paths_t *changes, const char *path, int recursive);
+
+/// Drop the folders, and rescan the whole library instead
+void
+ml_changed_paths_set_full_rescan (ml_changed_paths_t *changes);
+
+void
+ml_changed_paths_free (ml_changed_paths_t *changes);
+
+/// Write the file via a temporary file, which is renamed to @c fname when @c write_func succeeds,
+/// so that a partially written file is never loaded.
+/// @c write_func returns 0 on success.
+/// Returns 0 on success
+int
+ml_write_file_atomic (const char *fname, int (*write_func) (FILE *fp, void *user_data), void *user_data);
+
 #endif /* medialibcommon_h */
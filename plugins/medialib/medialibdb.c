@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "medialibcommon.h"
 #include "medialibdb.h"
 
 static DB_functions_t *deadbeef;
@@ -298,6 +299,233 @@ ml_collection_add_tree_item (
     ml_collection_add_tree_item (db, source_db, n, path, depth + 1, it, state, saved_state);
 }
 
+uint32_t
+ml_db_hash_for_track (ddb_playItem_t *it) {
+    uint64_t scrambled = 1181783497276652981ULL * (uintptr_t)it;
+    return (uint32_t)(scrambled >> 32);
+}
+
+void
+ml_db_add_track_keys (ml_db_t *db, ddb_playItem_t *it, const char *album, const char *artist, const char *genre, const char *uri, const char *folder) {
+    if (db->track_keys == NULL) {
+        db->track_keys = calloc (ML_TRACK_KEYS_HASH_SIZE, sizeof (ml_track_keys_t *));
+    }
+
+    ml_track_keys_t *keys = calloc (1, sizeof (ml_track_keys_t));
+    keys->it = it;
+    keys->album = deadbeef->metacache_add_string (album);
+    keys->artist = deadbeef->metacache_add_string (artist);
+    keys->genre = deadbeef->metacache_add_string (genre);
+    keys->uri = deadbeef->metacache_add_string (uri);
+    keys->folder = deadbeef->metacache_add_string (folder);
+
+    uint32_t h = ml_db_hash_for_track (it) & (ML_TRACK_KEYS_HASH_SIZE-1);
+    keys->bucket_next = db->track_keys[h];
+    db->track_keys[h] = keys;
+}
+
+ml_track_keys_t *
+ml_db_find_track_keys (ml_db_t *db, ddb_playItem_t *it) {
+    if (db->track_keys == NULL) {
+        return NULL;
+    }
+    uint32_t h = ml_db_hash_for_track (it) & (ML_TRACK_KEYS_HASH_SIZE-1);
+    ml_track_keys_t *keys;
+    for (keys = db->track_keys[h]; keys && keys->it != it; keys = keys->bucket_next);
+    return keys;
+}
+
+static void
+_track_keys_free (ml_track_keys_t *keys) {
+    deadbeef->metacache_remove_string (keys->album);
+    deadbeef->metacache_remove_string (keys->artist);
+    deadbeef->metacache_remove_string (keys->genre);
+    deadbeef->metacache_remove_string (keys->uri);
+    deadbeef->metacache_remove_string (keys->folder);
+    free (keys);
+}
+
+// Unlinks the track from the node items, returns 1 if it was found
+static int
+_node_remove_item (ml_db_t *db, ml_collection_tree_node_t *node, ddb_playItem_t *it) {
+    ml_collection_track_ref_t *prev = NULL;
+    for (ml_collection_track_ref_t *item = node->items; item; prev = item, item = item->next) {
+        if (item->it != it) {
+            continue;
+        }
+        if (prev) {
+            prev->next = item->next;
+        }
+        else {
+            node->items = item->next;
+        }
+        if (node->items_tail == item) {
+            node->items_tail = prev;
+        }
+        node->items_count--;
+        deadbeef->pl_item_unref (item->it);
+        _collection_item_free (db, item);
+        return 1;
+    }
+    return 0;
+}
+
+// Unlinks the node from the parent and the hash, and frees it
+static void
+_node_remove (ml_db_t *db, ml_collection_t *coll, ml_collection_tree_node_t *parent, ml_collection_tree_node_t *node) {
+    ml_collection_tree_node_t *prev = NULL;
+    for (ml_collection_tree_node_t *c = parent->children; c; prev = c, c = c->next) {
+        if (c != node) {
+            continue;
+        }
+        if (prev) {
+            prev->next = c->next;
+        }
+        else {
+            parent->children = c->next;
+        }
+        if (parent->children_tail == c) {
+            parent->children_tail = prev;
+        }
+        break;
+    }
+
+    const char *key = node->path ? node->path : node->text;
+    uint32_t h = ml_collection_hash_for_ptr ((void *)key);
+    ml_collection_tree_node_t **pnext;
+    for (pnext = &coll->hash[h]; *pnext && *pnext != node; pnext = &(*pnext)->bucket_next);
+    if (*pnext) {
+        *pnext = node->bucket_next;
+    }
+
+    _ml_string_free (db, node);
+}
+
+static void
+_collection_remove_item (ml_db_t *db, ml_collection_t *coll, const char *text, ddb_playItem_t *it) {
+    ml_collection_tree_node_t *node = ml_collection_hash_find (coll->hash, text);
+    if (node == NULL || !_node_remove_item (db, node, it)) {
+        return;
+    }
+    // the unknown artist / album / genre nodes are always present
+    if (node->items == NULL && strcmp (node->text, "<?>")) {
+        _node_remove (db, coll, &coll->root, node);
+    }
+}
+
+static void
+_folder_tree_remove_item (ml_db_t *db, const char *folder, ddb_playItem_t *it) {
+    ml_collection_tree_node_t *node = ml_collection_hash_find (db->folders.hash, folder);
+    if (node == NULL || !_node_remove_item (db, node, it)) {
+        return;
+    }
+
+    // remove the folders which became empty, up to the root
+    while (node && node->items == NULL && node->children == NULL) {
+        ml_collection_tree_node_t *parent = &db->folders.root;
+        const char *slash = strrchr (node->path, '/');
+        if (slash) {
+            char *parent_path = strndup (node->path, slash - node->path);
+            const char *cached_parent_path = deadbeef->metacache_get_string (parent_path);
+            free (parent_path);
+            if (cached_parent_path) {
+                ml_collection_tree_node_t *p = ml_collection_hash_find (db->folders.hash, cached_parent_path);
+                deadbeef->metacache_remove_string (cached_parent_path);
+                if (p) {
+                    parent = p;
+                }
+            }
+        }
+        _node_remove (db, &db->folders, parent, node);
+        node = parent != &db->folders.root ? parent : NULL;
+    }
+}
+
+static void
+_filename_hash_remove (ml_db_t *db, const char *uri) {
+    uint32_t h = ml_collection_hash_for_ptr ((void *)uri);
+    for (ml_filename_hash_item_t **pnext = &db->filename_hash[h]; *pnext; pnext = &(*pnext)->bucket_next) {
+        ml_filename_hash_item_t *en = *pnext;
+        if (en->file == uri) {
+            *pnext = en->bucket_next;
+            deadbeef->metacache_remove_string (en->file);
+            free (en);
+            return;
+        }
+    }
+}
+
+static int
+_track_set_contains (ddb_playItem_t **track_set, uint32_t mask, ddb_playItem_t *it) {
+    uint32_t h = ml_db_hash_for_track (it) & mask;
+    while (track_set[h]) {
+        if (track_set[h] == it) {
+            return 1;
+        }
+        h = (h + 1) & mask;
+    }
+    return 0;
+}
+
+int
+ml_db_remove_tracks_not_in_set (ml_db_t *db, ddb_playItem_t **track_set, uint32_t mask) {
+    if (db->track_keys == NULL) {
+        return 0;
+    }
+
+    int removed = 0;
+    for (int i = 0; i < ML_TRACK_KEYS_HASH_SIZE; i++) {
+        ml_track_keys_t **pnext = &db->track_keys[i];
+        while (*pnext) {
+            ml_track_keys_t *keys = *pnext;
+            if (_track_set_contains (track_set, mask, keys->it)) {
+                pnext = &keys->bucket_next;
+                continue;
+            }
+            *pnext = keys->bucket_next;
+
+            _collection_remove_item (db, &db->albums, keys->album, keys->it);
+            _collection_remove_item (db, &db->artists, keys->artist, keys->it);
+            _collection_remove_item (db, &db->genres, keys->genre, keys->it);
+            _folder_tree_remove_item (db, keys->folder, keys->it);
+            _collection_remove_item (db, &db->track_uris, keys->uri, keys->it);
+            if (ml_collection_hash_find (db->track_uris.hash, keys->uri) == NULL) {
+                // no other tracks reference this file
+                _filename_hash_remove (db, keys->uri);
+            }
+
+            _track_keys_free (keys);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+void
+ml_db_set_music_paths (ml_db_t *db, char **medialib_paths, size_t medialib_paths_count) {
+    ml_free_music_paths (db->medialib_paths, db->medialib_paths_count);
+    db->medialib_paths = calloc (medialib_paths_count ? medialib_paths_count : 1, sizeof (char *));
+    for (size_t i = 0; i < medialib_paths_count; i++) {
+        db->medialib_paths[i] = medialib_paths[i] ? strdup (medialib_paths[i]) : NULL;
+    }
+    db->medialib_paths_count = medialib_paths_count;
+}
+
+int
+ml_db_has_music_paths (ml_db_t *db, char **medialib_paths, size_t medialib_paths_count) {
+    if (db->medialib_paths == NULL || db->medialib_paths_count != medialib_paths_count) {
+        return 0;
+    }
+    for (size_t i = 0; i < medialib_paths_count; i++) {
+        const char *a = db->medialib_paths[i];
+        const char *b = medialib_paths[i];
+        if ((a == NULL) != (b == NULL) || (a && strcmp (a, b))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 void
 ml_db_free (ml_db_t *db) {
     fprintf (stderr, "clearing index...\n");
@@ -308,6 +536,7 @@ ml_db_free (ml_db_t *db) {
     ml_collection_free(db, &db->genres);
     ml_collection_free(db, &db->track_uris);
     ml_collection_free(db, &db->folders);
+    ml_fulltext_free(&db->fulltext);
 
     for (int i = 0; i < ML_HASH_SIZE; i++) {
         ml_filename_hash_item_t *en = db->filename_hash[i];
@@ -322,6 +551,20 @@ ml_db_free (ml_db_t *db) {
         db->filename_hash[i] = NULL;
     }
 
+    if (db->track_keys) {
+        for (int i = 0; i < ML_TRACK_KEYS_HASH_SIZE; i++) {
+            ml_track_keys_t *keys = db->track_keys[i];
+            while (keys) {
+                ml_track_keys_t *next = keys->bucket_next;
+                _track_keys_free (keys);
+                keys = next;
+            }
+        }
+        free (db->track_keys);
+    }
+
+    ml_free_music_paths (db->medialib_paths, db->medialib_paths_count);
+
     memset (db, 0, sizeof (ml_db_t));
 }
 
@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <deadbeef/deadbeef.h>
+#include "medialibfulltext.h"
 #include "medialibstate.h"
 
 // This struct represents a leaf node (track) in the tree of a collection.
@@ -76,6 +77,20 @@ typedef struct ml_entry_s {
     struct ml_entry_s *bucket_next;
 } ml_filename_hash_item_t;
 
+#define ML_TRACK_KEYS_HASH_SIZE 65536
+
+// The keys which the track was added to the collections with.
+// All strings are metacache references.
+typedef struct ml_track_keys_s {
+    ddb_playItem_t *it;
+    const char *album;
+    const char *artist;
+    const char *genre;
+    const char *uri;
+    const char *folder;
+    struct ml_track_keys_s *bucket_next;
+} ml_track_keys_t;
+
 typedef struct {
     // A hash formed by filename pointer.
     // This hash purpose is to quickly check whether the filename is in the library already.
@@ -98,6 +113,17 @@ typedef struct {
     /// State is associated with IDs, therefore it survives updates/scans, as long as IDs are reused correctly.
     ml_collection_state_t state;
 
+    /// Trigram index of the track metadata, used to filter the trees.
+    ml_fulltext_index_t fulltext;
+
+    /// Hash of ML_TRACK_KEYS_HASH_SIZE buckets, formed by track pointer.
+    /// Allows to remove the tracks from the collections, when updating the db in place.
+    ml_track_keys_t **track_keys;
+
+    /// The music folders, which the folder tree was built relative to.
+    char **medialib_paths;
+    size_t medialib_paths_count;
+
     /// Current row ID used by the above collections.
     /// Incremented for each new node.
     uint64_t row_id;
@@ -148,6 +174,28 @@ ml_collection_add_tree_item (
                        ml_collection_state_t *saved_state
                        );
 
+uint32_t
+ml_db_hash_for_track (ddb_playItem_t *it);
+
+/// Remember the keys which the track was added to the collections with.
+void
+ml_db_add_track_keys (ml_db_t *db, ddb_playItem_t *it, const char *album, const char *artist, const char *genre, const char *uri, const char *folder);
+
+ml_track_keys_t *
+ml_db_find_track_keys (ml_db_t *db, ddb_playItem_t *it);
+
+/// Remove all tracks, which are not in the @c track_set, from all collections.
+/// @c track_set is an open addressing hash table of @c mask+1 track pointers, indexed by @c ml_db_hash_for_track.
+/// Returns the number of removed tracks.
+int
+ml_db_remove_tracks_not_in_set (ml_db_t *db, ddb_playItem_t **track_set, uint32_t mask);
+
+void
+ml_db_set_music_paths (ml_db_t *db, char **medialib_paths, size_t medialib_paths_count);
+
+int
+ml_db_has_music_paths (ml_db_t *db, char **medialib_paths, size_t medialib_paths_count);
+
 void
 ml_db_free (ml_db_t *db);
 
@@ -24,6 +24,308 @@
 #include <stdio.h>
 #include "medialibsource.h"
 
+#ifdef __linux__
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <jansson.h>
+#include "medialibcommon.h"
+#include "medialibfilesystem.h"
+
+// The changes are sent to the scanner when no new events arrived for ML_WATCH_DEBOUNCE_MS,
+// or when the events keep coming for ML_WATCH_MAX_DELAY_MS.
+#define ML_WATCH_DEBOUNCE_MS 1000
+#define ML_WATCH_MAX_DELAY_MS 5000
+
+#define ML_WATCH_MASK (IN_CREATE|IN_DELETE|IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+typedef struct {
+    medialib_source_t *source;
+    int fd;
+    int wakeup_pipe[2];
+    pthread_t tid;
+    int terminate;
+
+    char **music_paths;
+    size_t music_paths_count;
+
+    // watched folder paths, indexed by watch descriptor
+    char **wd_paths;
+    int wd_paths_size;
+
+    ml_changed_paths_t changes;
+
+    int64_t first_event_time;
+    int64_t last_event_time;
+} ml_inotify_watcher_t;
+
+static int64_t
+_time_ms (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+_add_watch_recursive (ml_inotify_watcher_t *watcher, const char *path) {
+    if (__atomic_load_n (&watcher->terminate, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+
+    int wd = inotify_add_watch (watcher->fd, path, ML_WATCH_MASK);
+    if (wd < 0) {
+        return;
+    }
+
+    if (wd >= watcher->wd_paths_size) {
+        int size = watcher->wd_paths_size ? watcher->wd_paths_size : 256;
+        while (size <= wd) {
+            size *= 2;
+        }
+        watcher->wd_paths = realloc (watcher->wd_paths, size * sizeof (char *));
+        memset (watcher->wd_paths + watcher->wd_paths_size, 0, (size - watcher->wd_paths_size) * sizeof (char *));
+        watcher->wd_paths_size = size;
+    }
+
+    // The same folder gets the same wd, e.g. after it was moved within the library
+    if (watcher->wd_paths[wd]) {
+        if (!strcmp (watcher->wd_paths[wd], path)) {
+            return;
+        }
+        free (watcher->wd_paths[wd]);
+    }
+    watcher->wd_paths[wd] = strdup (path);
+
+    DIR *dir = opendir (path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir (dir))) {
+        if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, "..")) {
+            continue;
+        }
+
+        char subpath[PATH_MAX];
+        if (snprintf (subpath, sizeof (subpath), "%s/%s", path, entry->d_name) >= (int)sizeof (subpath)) {
+            continue;
+        }
+
+        // Symlinks are not followed, to avoid loops
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = !lstat (subpath, &st) && S_ISDIR (st.st_mode);
+        }
+        if (is_dir) {
+            _add_watch_recursive (watcher, subpath);
+        }
+    }
+    closedir (dir);
+}
+
+static void
+_process_event (ml_inotify_watcher_t *watcher, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // some events were lost
+        ml_changed_paths_set_full_rescan (&watcher->changes);
+        return;
+    }
+
+    if (event->wd < 0 || event->wd >= watcher->wd_paths_size || watcher->wd_paths[event->wd] == NULL) {
+        return;
+    }
+
+    const char *path = watcher->wd_paths[event->wd];
+
+    if (event->mask & IN_IGNORED) {
+        free (watcher->wd_paths[event->wd]);
+        watcher->wd_paths[event->wd] = NULL;
+        return;
+    }
+
+    // A deleted or moved watched folder rescans itself, which removes its tracks
+    char subpath[PATH_MAX];
+    if (event->len == 0 || snprintf (subpath, sizeof (subpath), "%s/%s", path, event->name) >= (int)sizeof (subpath)) {
+        ml_changed_paths_add (&watcher->changes, path, 1);
+        return;
+    }
+
+    if (event->mask & IN_ISDIR) {
+        // A new subfolder is scanned with its subfolders,
+        // and a deleted or moved one loses its tracks the same way.
+        if (event->mask & (IN_CREATE|IN_MOVED_TO)) {
+            _add_watch_recursive (watcher, subpath);
+        }
+        ml_changed_paths_add (&watcher->changes, subpath, 1);
+    }
+    else {
+        // A change of a file rescans only the folder which contains it
+        ml_changed_paths_add (&watcher->changes, path, 0);
+    }
+}
+
+static void
+_flush_changes (ml_inotify_watcher_t *watcher) {
+    ml_changed_paths_t *changes = &watcher->changes;
+    if (changes->full_rescan) {
+        ml_rescan_paths (watcher->source, NULL, 0, NULL, 0);
+    }
+    else if (changes->paths_count > 0 || changes->folders_count > 0) {
+        // the scanner takes ownership of the paths
+        ml_rescan_paths (watcher->source, changes->paths, changes->paths_count, changes->folders, changes->folders_count);
+    }
+    memset (changes, 0, sizeof (ml_changed_paths_t));
+    watcher->first_event_time = 0;
+    watcher->last_event_time = 0;
+}
+
+static void *
+_watcher_thread (void *ctx) {
+    ml_inotify_watcher_t *watcher = ctx;
+
+    for (size_t i = 0; i < watcher->music_paths_count; i++) {
+        _add_watch_recursive (watcher, watcher->music_paths[i]);
+    }
+
+    char buffer[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    while (!__atomic_load_n (&watcher->terminate, __ATOMIC_SEQ_CST)) {
+        int timeout = -1;
+        if (watcher->first_event_time) {
+            int64_t deadline = watcher->last_event_time + ML_WATCH_DEBOUNCE_MS;
+            if (deadline > watcher->first_event_time + ML_WATCH_MAX_DELAY_MS) {
+                deadline = watcher->first_event_time + ML_WATCH_MAX_DELAY_MS;
+            }
+            int64_t now = _time_ms ();
+            if (now >= deadline) {
+                _flush_changes (watcher);
+                continue;
+            }
+            timeout = (int)(deadline - now);
+        }
+
+        struct pollfd fds[2] = {
+            { .fd = watcher->fd, .events = POLLIN },
+            { .fd = watcher->wakeup_pipe[0], .events = POLLIN },
+        };
+        int res = poll (fds, 2, timeout);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        ssize_t len = read (watcher->fd, buffer, sizeof (buffer));
+        if (len <= 0) {
+            if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break;
+        }
+
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            _process_event (watcher, event);
+            p += sizeof (struct inotify_event) + event->len;
+        }
+
+        if (watcher->changes.full_rescan || watcher->changes.paths_count > 0 || watcher->changes.folders_count > 0) {
+            int64_t now = _time_ms ();
+            if (!watcher->first_event_time) {
+                watcher->first_event_time = now;
+            }
+            watcher->last_event_time = now;
+        }
+    }
+
+    return NULL;
+}
+
+void
+ml_watch_fs_start (medialib_source_t *source) {
+    ml_watch_fs_stop (source);
+
+    ml_inotify_watcher_t *watcher = calloc (1, sizeof (ml_inotify_watcher_t));
+    watcher->source = source;
+    watcher->fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
+    if (watcher->fd < 0) {
+        free (watcher);
+        return;
+    }
+    if (pipe (watcher->wakeup_pipe)) {
+        close (watcher->fd);
+        free (watcher);
+        return;
+    }
+
+    size_t count = json_array_size (source->musicpaths_json);
+    watcher->music_paths = calloc (count ? count : 1, sizeof (char *));
+    for (size_t i = 0; i < count; i++) {
+        json_t *data = json_array_get (source->musicpaths_json, i);
+        if (json_is_string (data)) {
+            watcher->music_paths[watcher->music_paths_count++] = strdup (json_string_value (data));
+        }
+    }
+
+    // Adding the watches can take a while for large libraries, so it's done on the watcher thread
+    if (pthread_create (&watcher->tid, NULL, _watcher_thread, watcher)) {
+        close (watcher->fd);
+        close (watcher->wakeup_pipe[0]);
+        close (watcher->wakeup_pipe[1]);
+        ml_free_music_paths (watcher->music_paths, watcher->music_paths_count);
+        free (watcher);
+        return;
+    }
+
+    source->fs_watcher = watcher;
+}
+
+void
+ml_watch_fs_stop (medialib_source_t *source) {
+    if (source->fs_watcher == NULL) {
+        return;
+    }
+
+    ml_inotify_watcher_t *watcher = source->fs_watcher;
+    __atomic_store_n (&watcher->terminate, 1, __ATOMIC_SEQ_CST);
+    ssize_t res = write (watcher->wakeup_pipe[1], "", 1);
+    (void)res;
+    pthread_join (watcher->tid, NULL);
+
+    close (watcher->fd);
+    close (watcher->wakeup_pipe[0]);
+    close (watcher->wakeup_pipe[1]);
+
+    for (int i = 0; i < watcher->wd_paths_size; i++) {
+        free (watcher->wd_paths[i]);
+    }
+    free (watcher->wd_paths);
+    ml_free_music_paths (watcher->music_paths, watcher->music_paths_count);
+    ml_changed_paths_free (&watcher->changes);
+    free (watcher);
+    source->fs_watcher = NULL;
+}
+
+#else
+
 void
 ml_watch_fs_start (medialib_source_t *source) {
 }
@@ -32,3 +334,4 @@ void
 ml_watch_fs_stop (medialib_source_t *source) {
 }
 
+#endif
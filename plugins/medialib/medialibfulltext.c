@@ -0,0 +1,490 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "medialibcommon.h"
+#include "medialibfulltext.h"
+
+// The index is saved in native byte order, next to medialib.dbpl
+#define ML_FT_FILE_MAGIC "DBFT"
+#define ML_FT_FILE_VERSION 1
+
+#define trace(...) { deadbeef->log_detailed (&plugin->plugin, 0, __VA_ARGS__); }
+
+static DB_functions_t *deadbeef;
+static DB_mediasource_t *plugin;
+
+typedef struct {
+    uint32_t *data;
+    size_t count;
+    size_t size;
+} ml_ft_buffer_t;
+
+static void
+_ft_buffer_append (ml_ft_buffer_t *buffer, uint32_t value) {
+    if (buffer->count == buffer->size) {
+        buffer->size = buffer->size ? buffer->size * 2 : 256;
+        buffer->data = realloc (buffer->data, buffer->size * sizeof (uint32_t));
+    }
+    buffer->data[buffer->count++] = value;
+}
+
+// Returns 6 bit code of the case-folded character, or -1 if the character is not indexed
+static int
+_ft_char_code (unsigned char c) {
+    if (c >= 'a' && c <= 'z') {
+        c -= 'a' - 'A';
+    }
+    if (c >= 0x20 && c < 0x60) {
+        return c - 0x20;
+    }
+    return -1;
+}
+
+// Calls the callback with each of the values which plt_search_process2 compares with the filter,
+// until the callback returns non-zero.
+// Must be called within pl_lock.
+static int
+_ft_foreach_searchable_value (ddb_playItem_t *it, int (*callback) (const char *value, void *ctx), void *ctx) {
+    for (DB_metaInfo_t *m = deadbeef->pl_get_metadata_head (it); m; m = m->next) {
+        int is_uri = !strcmp (m->key, ":URI");
+        if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+            break;
+        }
+        if (!strcasecmp (m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+            continue;
+        }
+
+        const char *value = m->value;
+        const char *end = value + m->valuesize;
+
+        if (is_uri) {
+            value = strrchr (value, '/');
+            if (value) {
+                value++;
+            }
+            else {
+                value = m->value;
+            }
+        }
+
+        do {
+            if (callback (value, ctx)) {
+                return 1;
+            }
+            value += strlen (value) + 1;
+        } while (value < end);
+    }
+    return 0;
+}
+
+static int
+_ft_append_trigrams (const char *value, void *ctx) {
+    ml_ft_buffer_t *buffer = ctx;
+    uint32_t trigram = 0;
+    int run = 0; // number of consecutive indexed characters
+    for (const unsigned char *p = (const unsigned char *)value; *p; p++) {
+        int code = _ft_char_code (*p);
+        if (code < 0) {
+            run = 0;
+            continue;
+        }
+        trigram = ((trigram << 6) | (uint32_t)code) & (ML_FT_TRIGRAM_COUNT-1);
+        if (++run >= 3) {
+            _ft_buffer_append (buffer, trigram);
+        }
+    }
+    return 0;
+}
+
+static int
+_ft_uint32_cmp (const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts the buffer and removes duplicates
+static void
+_ft_buffer_sort_unique (ml_ft_buffer_t *buffer) {
+    if (buffer->count < 2) {
+        return;
+    }
+    qsort (buffer->data, buffer->count, sizeof (uint32_t), _ft_uint32_cmp);
+    size_t n = 1;
+    for (size_t i = 1; i < buffer->count; i++) {
+        if (buffer->data[i] != buffer->data[n-1]) {
+            buffer->data[n++] = buffer->data[i];
+        }
+    }
+    buffer->count = n;
+}
+
+static uint64_t
+_ft_hash_string (uint64_t h, const char *s) {
+    // FNV-1a, including the terminating 0
+    if (s) {
+        for (; *s; s++) {
+            h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+        }
+    }
+    return h * 1099511628211ULL;
+}
+
+// Tracks get new scan time whenever they're rescanned,
+// so the same id means the same metadata.
+// Must be called within pl_lock.
+static uint64_t
+_ft_track_id (ddb_playItem_t *it) {
+    uint64_t h = 14695981039346656037ULL;
+    h = _ft_hash_string (h, deadbeef->pl_find_meta (it, ":URI"));
+    h = _ft_hash_string (h, deadbeef->pl_find_meta (it, ":TRACKNUM"));
+    h = _ft_hash_string (h, deadbeef->pl_find_meta (it, ":MEDIALIB_SCAN_TIME"));
+    return h;
+}
+
+void
+ml_fulltext_build (ml_fulltext_index_t *index, ddb_playItem_t **tracks, int track_count, const ml_fulltext_index_t *prev) {
+    memset (index, 0, sizeof (ml_fulltext_index_t));
+
+    // trigrams of each track, in a single buffer
+    ml_ft_buffer_t trigrams = {0};
+    size_t *track_offsets = calloc (track_count + 1, sizeof (size_t));
+
+    // id -> track index hash of the previous index, and the trigrams of its tracks
+    int *prev_hash = NULL;
+    uint32_t prev_hash_mask = 0;
+    uint32_t *prev_track_offsets = NULL;
+    uint32_t *prev_trigrams = NULL;
+    if (prev && prev->track_count > 0 && prev->offsets) {
+        prev_hash_mask = 1;
+        while (prev_hash_mask < (uint32_t)prev->track_count * 2) {
+            prev_hash_mask <<= 1;
+        }
+        prev_hash = calloc (prev_hash_mask, sizeof (int));
+        prev_hash_mask -= 1;
+        for (int i = 0; i < prev->track_count; i++) {
+            uint32_t h = (uint32_t)prev->track_ids[i] & prev_hash_mask;
+            while (prev_hash[h]) {
+                h = (h + 1) & prev_hash_mask;
+            }
+            prev_hash[h] = i + 1;
+        }
+
+        // invert the postings, which gives sorted trigrams of each track
+        prev_track_offsets = calloc (prev->track_count + 1, sizeof (uint32_t));
+        prev_trigrams = malloc (prev->posting_count * sizeof (uint32_t));
+        for (uint32_t p = 0; p < prev->posting_count; p++) {
+            prev_track_offsets[prev->postings[p] + 1]++;
+        }
+        for (int i = 0; i < prev->track_count; i++) {
+            prev_track_offsets[i+1] += prev_track_offsets[i];
+        }
+        uint32_t *pos = malloc (prev->track_count * sizeof (uint32_t));
+        memcpy (pos, prev_track_offsets, prev->track_count * sizeof (uint32_t));
+        for (uint32_t t = 0; t < ML_FT_TRIGRAM_COUNT; t++) {
+            for (uint32_t p = prev->offsets[t]; p < prev->offsets[t+1]; p++) {
+                prev_trigrams[pos[prev->postings[p]]++] = t;
+            }
+        }
+        free (pos);
+    }
+
+    index->track_count = track_count;
+    index->tracks = calloc (track_count, sizeof (ddb_playItem_t *));
+    index->track_ids = calloc (track_count, sizeof (uint64_t));
+
+    int reused = 0;
+    for (int i = 0; i < track_count; i++) {
+        ddb_playItem_t *it = tracks[i];
+        deadbeef->pl_item_ref (it);
+        index->tracks[i] = it;
+
+        deadbeef->pl_lock ();
+        uint64_t id = _ft_track_id (it);
+        index->track_ids[i] = id;
+
+        int prev_idx = -1;
+        if (prev_hash) {
+            uint32_t h = (uint32_t)id & prev_hash_mask;
+            while (prev_hash[h]) {
+                if (prev->track_ids[prev_hash[h]-1] == id) {
+                    prev_idx = prev_hash[h]-1;
+                    break;
+                }
+                h = (h + 1) & prev_hash_mask;
+            }
+        }
+
+        if (prev_idx >= 0) {
+            for (uint32_t p = prev_track_offsets[prev_idx]; p < prev_track_offsets[prev_idx+1]; p++) {
+                _ft_buffer_append (&trigrams, prev_trigrams[p]);
+            }
+            reused++;
+        }
+        else {
+            ml_ft_buffer_t track_trigrams = {0};
+            _ft_foreach_searchable_value (it, _ft_append_trigrams, &track_trigrams);
+            _ft_buffer_sort_unique (&track_trigrams);
+            for (size_t p = 0; p < track_trigrams.count; p++) {
+                _ft_buffer_append (&trigrams, track_trigrams.data[p]);
+            }
+            free (track_trigrams.data);
+        }
+        deadbeef->pl_unlock ();
+
+        track_offsets[i+1] = trigrams.count;
+    }
+
+    free (prev_hash);
+    free (prev_track_offsets);
+    free (prev_trigrams);
+
+    // counting sort by trigram; postings of each trigram end up sorted by track index
+    index->posting_count = (uint32_t)trigrams.count;
+    index->offsets = calloc (ML_FT_TRIGRAM_COUNT + 1, sizeof (uint32_t));
+    index->postings = malloc ((trigrams.count ? trigrams.count : 1) * sizeof (uint32_t));
+    for (size_t p = 0; p < trigrams.count; p++) {
+        index->offsets[trigrams.data[p] + 1]++;
+    }
+    for (uint32_t t = 0; t < ML_FT_TRIGRAM_COUNT; t++) {
+        index->offsets[t+1] += index->offsets[t];
+    }
+    uint32_t *pos = malloc (ML_FT_TRIGRAM_COUNT * sizeof (uint32_t));
+    memcpy (pos, index->offsets, ML_FT_TRIGRAM_COUNT * sizeof (uint32_t));
+    for (int i = 0; i < track_count; i++) {
+        for (size_t p = track_offsets[i]; p < track_offsets[i+1]; p++) {
+            index->postings[pos[trigrams.data[p]]++] = (uint32_t)i;
+        }
+    }
+    free (pos);
+    free (track_offsets);
+    free (trigrams.data);
+
+    trace ("fulltext index: %d tracks (%d reused), %u postings\n", track_count, reused, index->posting_count);
+}
+
+void
+ml_fulltext_free (ml_fulltext_index_t *index) {
+    if (index->tracks) {
+        for (int i = 0; i < index->track_count; i++) {
+            deadbeef->pl_item_unref (index->tracks[i]);
+        }
+        free (index->tracks);
+    }
+    free (index->track_ids);
+    free (index->offsets);
+    free (index->postings);
+    memset (index, 0, sizeof (ml_fulltext_index_t));
+}
+
+static int
+_ft_write (FILE *fp, void *user_data) {
+    const ml_fulltext_index_t *index = user_data;
+    uint32_t header[3] = { ML_FT_FILE_VERSION, (uint32_t)index->track_count, index->posting_count };
+    if (fwrite (ML_FT_FILE_MAGIC, 4, 1, fp) != 1
+        || fwrite (header, sizeof (header), 1, fp) != 1
+        || fwrite (index->track_ids, sizeof (uint64_t), index->track_count, fp) != (size_t)index->track_count
+        || fwrite (index->offsets, sizeof (uint32_t), ML_FT_TRIGRAM_COUNT + 1, fp) != ML_FT_TRIGRAM_COUNT + 1
+        || fwrite (index->postings, sizeof (uint32_t), index->posting_count, fp) != index->posting_count) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+ml_fulltext_save (const ml_fulltext_index_t *index, const char *fname) {
+    if (!index->offsets) {
+        return -1;
+    }
+    return ml_write_file_atomic (fname, _ft_write, (void *)index);
+}
+
+int
+ml_fulltext_load (ml_fulltext_index_t *index, const char *fname) {
+    memset (index, 0, sizeof (ml_fulltext_index_t));
+
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return -1;
+    }
+
+    char magic[4];
+    uint32_t header[3];
+    if (fread (magic, 4, 1, fp) != 1
+        || memcmp (magic, ML_FT_FILE_MAGIC, 4)
+        || fread (header, sizeof (header), 1, fp) != 1
+        || header[0] != ML_FT_FILE_VERSION
+        || header[1] > INT_MAX) {
+        goto error;
+    }
+
+    index->track_count = (int)header[1];
+    index->posting_count = header[2];
+    index->track_ids = malloc ((index->track_count ? index->track_count : 1) * sizeof (uint64_t));
+    index->offsets = malloc ((ML_FT_TRIGRAM_COUNT + 1) * sizeof (uint32_t));
+    index->postings = malloc ((index->posting_count ? index->posting_count : 1) * sizeof (uint32_t));
+    if (!index->track_ids || !index->offsets || !index->postings
+        || fread (index->track_ids, sizeof (uint64_t), index->track_count, fp) != (size_t)index->track_count
+        || fread (index->offsets, sizeof (uint32_t), ML_FT_TRIGRAM_COUNT + 1, fp) != ML_FT_TRIGRAM_COUNT + 1
+        || fread (index->postings, sizeof (uint32_t), index->posting_count, fp) != index->posting_count) {
+        goto error;
+    }
+
+    // validate, since the postings are used as array indexes
+    if (index->offsets[0] != 0 || index->offsets[ML_FT_TRIGRAM_COUNT] != index->posting_count) {
+        goto error;
+    }
+    for (uint32_t t = 0; t < ML_FT_TRIGRAM_COUNT; t++) {
+        if (index->offsets[t] > index->offsets[t+1]) {
+            goto error;
+        }
+    }
+    for (uint32_t p = 0; p < index->posting_count; p++) {
+        if (index->postings[p] >= (uint32_t)index->track_count) {
+            goto error;
+        }
+    }
+
+    fclose (fp);
+    return 0;
+
+error:
+    fclose (fp);
+    ml_fulltext_free (index);
+    return -1;
+}
+
+typedef struct {
+    const char *lc;
+    size_t len;
+} ml_ft_match_t;
+
+static int
+_ft_value_matches (const char *value, void *ctx) {
+    ml_ft_match_t *match = ctx;
+    for (const char *p = value; *p; p++) {
+        size_t i = 0;
+        while (i < match->len && p[i] && (p[i] >= 'A' && p[i] <= 'Z' ? p[i] - 'A' + 'a' : p[i]) == match->lc[i]) {
+            i++;
+        }
+        if (i == match->len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+ml_fulltext_select (ml_fulltext_index_t *index, const char *filter) {
+    if (!index->tracks) {
+        return -1;
+    }
+
+    // Only ASCII filters are handled, since the metadata is not case-folded beyond ASCII.
+    size_t len = strlen (filter);
+    char *lc = malloc (len + 1);
+    for (size_t i = 0; i <= len; i++) {
+        char c = filter[i];
+        if ((unsigned char)c >= 0x80) {
+            free (lc);
+            return -1;
+        }
+        lc[i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    ml_ft_buffer_t query = {0};
+    _ft_append_trigrams (lc, &query);
+    _ft_buffer_sort_unique (&query);
+
+    // Intersect the posting lists, starting from the shortest one.
+    // Without any trigrams in the filter, all tracks are the candidates.
+    uint32_t *candidates = NULL;
+    size_t candidate_count = 0;
+    if (query.count > 0) {
+        size_t shortest = 0;
+        for (size_t q = 1; q < query.count; q++) {
+            uint32_t t = query.data[q];
+            uint32_t s = query.data[shortest];
+            if (index->offsets[t+1] - index->offsets[t] < index->offsets[s+1] - index->offsets[s]) {
+                shortest = q;
+            }
+        }
+        uint32_t s = query.data[shortest];
+        candidate_count = index->offsets[s+1] - index->offsets[s];
+        candidates = malloc ((candidate_count ? candidate_count : 1) * sizeof (uint32_t));
+        memcpy (candidates, index->postings + index->offsets[s], candidate_count * sizeof (uint32_t));
+
+        for (size_t q = 0; q < query.count && candidate_count > 0; q++) {
+            if (q == shortest) {
+                continue;
+            }
+            uint32_t t = query.data[q];
+            const uint32_t *posting = index->postings + index->offsets[t];
+            const uint32_t *posting_end = index->postings + index->offsets[t+1];
+            size_t n = 0;
+            for (size_t c = 0; c < candidate_count && posting < posting_end; c++) {
+                while (posting < posting_end && *posting < candidates[c]) {
+                    posting++;
+                }
+                if (posting < posting_end && *posting == candidates[c]) {
+                    candidates[n++] = candidates[c];
+                }
+            }
+            candidate_count = n;
+        }
+    }
+    free (query.data);
+
+    // The candidates contain all trigrams of the filter, check them for the actual substring match.
+    // Empty filter matches nothing.
+    ml_ft_match_t match = { .lc = lc, .len = len };
+    size_t c = 0;
+    deadbeef->pl_lock ();
+    for (int i = 0; i < index->track_count; i++) {
+        int selected = 0;
+        if ((len > 0 && !candidates) || (c < candidate_count && candidates[c] == (uint32_t)i)) {
+            if (candidates) {
+                c++;
+            }
+            selected = _ft_foreach_searchable_value (index->tracks[i], _ft_value_matches, &match);
+        }
+        deadbeef->pl_set_selected (index->tracks[i], selected);
+    }
+    deadbeef->pl_unlock ();
+
+    free (candidates);
+    free (lc);
+    return 0;
+}
+
+void
+ml_fulltext_init (DB_mediasource_t *_plugin, DB_functions_t *_deadbeef) {
+    plugin = _plugin;
+    deadbeef = _deadbeef;
+}
@@ -0,0 +1,70 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef medialibfulltext_h
+#define medialibfulltext_h
+
+#include <stdint.h>
+#include <deadbeef/deadbeef.h>
+
+// Trigrams are formed from case-folded printable ASCII characters (6 bits each)
+#define ML_FT_TRIGRAM_COUNT (1<<18)
+
+// Inverted trigram index of the searchable metadata of medialib tracks.
+// Track indexes match the order of tracks in the medialib playlist.
+typedef struct {
+    int track_count;
+    ddb_playItem_t **tracks; // referenced, NULL when the index was loaded from disk
+    uint64_t *track_ids; // identity of each track, used to reuse trigrams of unchanged tracks
+
+    uint32_t *offsets; // ML_FT_TRIGRAM_COUNT+1 offsets into postings
+    uint32_t *postings; // sorted track indexes for each trigram
+    uint32_t posting_count;
+} ml_fulltext_index_t;
+
+/// Build the index for the tracks.
+/// The trigrams of the tracks which are present in @c prev are reused, instead of extracting them from metadata.
+void
+ml_fulltext_build (ml_fulltext_index_t *index, ddb_playItem_t **tracks, int track_count, const ml_fulltext_index_t *prev);
+
+void
+ml_fulltext_free (ml_fulltext_index_t *index);
+
+/// Returns 0 on success
+int
+ml_fulltext_save (const ml_fulltext_index_t *index, const char *fname);
+
+/// Load the index saved by @c ml_fulltext_save, which can be only used as @c prev for @c ml_fulltext_build.
+/// Returns 0 on success
+int
+ml_fulltext_load (ml_fulltext_index_t *index, const char *fname);
+
+/// Select the tracks matching the filter, the same way as @c plt_search_process2 does.
+/// Returns -1 if the index can't be used for this filter, and the full search needs to be performed instead.
+int
+ml_fulltext_select (ml_fulltext_index_t *index, const char *filter);
+
+void
+ml_fulltext_init (DB_mediasource_t *_plugin, DB_functions_t *_deadbeef);
+
+#endif /* medialibfulltext_h */
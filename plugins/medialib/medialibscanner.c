@@ -21,209 +21,309 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <dirent.h>
 #include <jansson.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include "medialib.h"
 #include "medialibcommon.h"
 #include "medialibdb.h"
 #include "medialibscanner.h"
+#include "medialibsnapshot.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin->plugin, 0, __VA_ARGS__); }
 
 //#define FILTER_PERF 1 // measure / log file add filtering performance
 
+// Upper limit of medialib.scan_threads
+#define ML_SCAN_MAX_THREADS 32
+
 static DB_functions_t *deadbeef;
 static DB_mediasource_t *plugin;
 
 static char *artist_album_id_bc;
 
-// This should be called only on pre-existing ml playlist.
-// Subsequent indexing should be done on the fly, using fileadd listener.
-void
-ml_index (scanner_state_t *scanner, const ml_scanner_configuration_t *conf, int can_terminate) {
-    fprintf (stderr, "building index...\n");
-
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
-
-    char folder[PATH_MAX];
-
-    int has_unknown_artist = 0;
-    int has_unknown_album = 0;
-    int has_unknown_genre = 0;
+typedef struct {
+    ml_db_t *db; // The db which gets the tracks added
+    ml_db_t *source_db; // The db to reuse the row ids and states from
+    const ml_scanner_configuration_t *conf;
 
     // NOTE: these are searched by content when creating item trees,
     // so the values must be the same, as the ones that actually get to the collections.
-    const char *unknown_artist = deadbeef->metacache_add_string("<?>");
-    const char *unknown_album = deadbeef->metacache_add_string("<?>");
-    const char *unknown_genre = deadbeef->metacache_add_string("<?>");
-
-    for (int i = 0; i < scanner->track_count && (!can_terminate || !scanner->source->scanner_terminate); i++) {
-        ddb_playItem_t *it = scanner->tracks[i];
-
-        const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    const char *unknown_artist;
+    const char *unknown_album;
+    const char *unknown_genre;
+
+    int has_unknown_artist;
+    int has_unknown_album;
+    int has_unknown_genre;
+} ml_index_context_t;
+
+static void
+_ml_index_context_init (ml_index_context_t *ctx, ml_db_t *db, ml_db_t *source_db, const ml_scanner_configuration_t *conf) {
+    memset (ctx, 0, sizeof (ml_index_context_t));
+    ctx->db = db;
+    ctx->source_db = source_db;
+    ctx->conf = conf;
+    ctx->unknown_artist = deadbeef->metacache_add_string("<?>");
+    ctx->unknown_album = deadbeef->metacache_add_string("<?>");
+    ctx->unknown_genre = deadbeef->metacache_add_string("<?>");
+}
 
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
+static void
+_ml_index_context_deinit (ml_index_context_t *ctx) {
+    deadbeef->metacache_remove_string (ctx->unknown_artist);
+    deadbeef->metacache_remove_string (ctx->unknown_album);
+    deadbeef->metacache_remove_string (ctx->unknown_genre);
+}
 
-        if (!artist) {
-            artist = unknown_artist;
-        }
+// Adds the track to all collections of the db, and remembers the keys it was added with
+static void
+_ml_index_track (ml_index_context_t *ctx, ddb_playItem_t *it) {
+    ml_db_t *db = ctx->db;
+    ml_db_t *source_db = ctx->source_db;
+    const ml_scanner_configuration_t *conf = ctx->conf;
+    char folder[PATH_MAX];
 
-        // This is necessary to reference a single value from multivalue fields
-        artist = deadbeef->metacache_add_string(artist);
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
 
-        if (artist == unknown_artist) {
-            has_unknown_artist = 1;
-        }
+    // find relative uri, or discard from library
+    const char *reluri = NULL;
+    for (int i = 0; i < conf->medialib_paths_count; i++) {
+        const char *musicdir = conf->medialib_paths[i];
+        if (!strncmp (musicdir, uri, strlen (musicdir))) {
+            reluri = uri + strlen (musicdir);
+            if (*reluri == '/') {
+                reluri += 1;
+            }
 
-        // find relative uri, or discard from library
-        const char *reluri = NULL;
-        for (int i = 0; i < conf->medialib_paths_count; i++) {
-            const char *musicdir = conf->medialib_paths[i];
-            if (!strncmp (musicdir, uri, strlen (musicdir))) {
-                reluri = uri + strlen (musicdir);
+            // ensure at least one parent folder
+            if (!strchr (reluri, '/')) {
+                if (reluri > uri+1) {
+                    reluri -= 2;
+                }
+                while (reluri > uri && *reluri != '/') {
+                    reluri -= 1;
+                }
                 if (*reluri == '/') {
                     reluri += 1;
                 }
-
-                // ensure at least one parent folder
-                if (!strchr (reluri, '/')) {
-                    if (reluri > uri+1) {
-                        reluri -= 2;
-                    }
-                    while (reluri > uri && *reluri != '/') {
-                        reluri -= 1;
-                    }
-                    if (*reluri == '/') {
-                        reluri += 1;
-                    }
-                }
-
-                break;
             }
+
+            break;
         }
-        if (!reluri) {
-            // uri doesn't match musicdir, skip
-            continue;
-        }
-        // Get a combined cached artist/album string
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        if (!album) {
-            has_unknown_album = 1;
-        }
+    }
+    if (!reluri) {
+        // uri doesn't match musicdir, skip
+        return;
+    }
 
-        char artistalbum[1000] = "";
-        ddb_tf_context_t ctx = {
-            ._size = sizeof (ddb_tf_context_t),
-            .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
-            .it = it,
-        };
+    const char *artist = deadbeef->pl_find_meta (it, "artist");
 
-        deadbeef->tf_eval (&ctx, artist_album_id_bc, artistalbum, sizeof (artistalbum));
-        album = deadbeef->metacache_add_string (artistalbum);
+    if (!artist) {
+        artist = ctx->unknown_artist;
+    }
 
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
+    // This is necessary to reference a single value from multivalue fields
+    artist = deadbeef->metacache_add_string(artist);
 
-        if (!genre) {
-            genre = unknown_genre;
-        }
+    if (artist == ctx->unknown_artist) {
+        ctx->has_unknown_artist = 1;
+    }
 
-        // This is necessary to reference a single value from multivalue fields
-        genre = deadbeef->metacache_add_string(genre);
+    // Get a combined cached artist/album string
+    const char *album = deadbeef->pl_find_meta (it, "album");
+    if (!album) {
+        ctx->has_unknown_album = 1;
+    }
 
-        if (genre == unknown_genre) {
-            has_unknown_genre = 1;
-        }
+    char artistalbum[1000] = "";
+    ddb_tf_context_t tf_ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK,
+        .it = it,
+    };
 
-        uint64_t coll_row_id, item_row_id;
-        ml_collection_reuse_row_ids(&scanner->source->db.albums, album, it, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.albums, album, it, coll_row_id, item_row_id);
+    deadbeef->tf_eval (&tf_ctx, artist_album_id_bc, artistalbum, sizeof (artistalbum));
+    album = deadbeef->metacache_add_string (artistalbum);
 
-        deadbeef->metacache_remove_string (album);
-        album = NULL;
+    const char *genre = deadbeef->pl_find_meta (it, "genre");
 
-        ml_collection_reuse_row_ids(&scanner->source->db.artists, artist, it, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.artists, artist, it, coll_row_id, item_row_id);
+    if (!genre) {
+        genre = ctx->unknown_genre;
+    }
 
-        deadbeef->metacache_remove_string (artist);
-        artist = NULL;
+    // This is necessary to reference a single value from multivalue fields
+    genre = deadbeef->metacache_add_string(genre);
 
-        ml_collection_reuse_row_ids(&scanner->source->db.genres, genre, it, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.genres, genre, it, coll_row_id, item_row_id);
+    if (genre == ctx->unknown_genre) {
+        ctx->has_unknown_genre = 1;
+    }
 
-        deadbeef->metacache_remove_string (genre);
-        genre = NULL;
+    uint64_t coll_row_id, item_row_id;
+    ml_collection_reuse_row_ids(&source_db->albums, album, it, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+    ml_collection_add_item (db, &db->albums, album, it, coll_row_id, item_row_id);
 
-        const char *cached_string = deadbeef->metacache_add_string (uri);
+    ml_collection_reuse_row_ids(&source_db->artists, artist, it, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+    ml_collection_add_item (db, &db->artists, artist, it, coll_row_id, item_row_id);
 
-        ml_collection_reuse_row_ids(&scanner->source->db.track_uris, cached_string, it, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.track_uris, cached_string, it, coll_row_id, item_row_id);
+    ml_collection_reuse_row_ids(&source_db->genres, genre, it, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+    ml_collection_add_item (db, &db->genres, genre, it, coll_row_id, item_row_id);
 
-        deadbeef->metacache_remove_string (cached_string);
-        cached_string = NULL;
+    const char *cached_string = deadbeef->metacache_add_string (uri);
 
-        char *fn = strrchr (reluri, '/');
-        if (fn) {
-            memcpy (folder, reluri, fn-reluri);
-            folder[fn-reluri] = 0;
-        }
-        else {
-            strcpy (folder, "/");
-        }
-        const char *s = deadbeef->metacache_add_string (folder);
+    ml_collection_reuse_row_ids(&source_db->track_uris, cached_string, it, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+    ml_collection_add_item (db, &db->track_uris, cached_string, it, coll_row_id, item_row_id);
 
-        // Add to folder tree
-        ml_collection_add_tree_item (&scanner->db, &scanner->source->db, &scanner->db.folders.root, s, 0, it, &scanner->db.state, &scanner->source->db.state);
-        // uri is not indexed, but referenced by the filename hash
-        // that's why they have an extra ref for each entry
-        deadbeef->metacache_add_string (uri);
-        ml_filename_hash_item_t *en = calloc (1, sizeof (ml_filename_hash_item_t));
-        en->file = uri;
+    char *fn = strrchr (reluri, '/');
+    if (fn) {
+        memcpy (folder, reluri, fn-reluri);
+        folder[fn-reluri] = 0;
+    }
+    else {
+        strcpy (folder, "/");
+    }
+    const char *s = deadbeef->metacache_add_string (folder);
+
+    // Add to folder tree
+    ml_collection_add_tree_item (db, source_db, &db->folders.root, s, 0, it, &db->state, &source_db->state);
+
+    ml_db_add_track_keys (db, it, album, artist, genre, cached_string, s);
 
-        // add to the hash table
-        // at this point, we only have unique pointers, and don't need a duplicate check
-        uint32_t hash = ml_collection_hash_for_ptr ((void *)en->file);
-        en->bucket_next = scanner->db.filename_hash[hash];
-        scanner->db.filename_hash[hash] = en;
+    deadbeef->metacache_remove_string (album);
+    deadbeef->metacache_remove_string (artist);
+    deadbeef->metacache_remove_string (genre);
+    deadbeef->metacache_remove_string (cached_string);
+    deadbeef->metacache_remove_string (s);
 
-        ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
-        it = next;
+    // The uri is not already in the filename hash if this is the first track of the file.
+    // The entries have an extra ref of the uri.
+    uint32_t hash = ml_collection_hash_for_ptr ((void *)uri);
+    ml_filename_hash_item_t *en;
+    for (en = db->filename_hash[hash]; en && en->file != uri; en = en->bucket_next);
+    if (en == NULL) {
+        deadbeef->metacache_add_string (uri);
+        en = calloc (1, sizeof (ml_filename_hash_item_t));
+        en->file = uri;
+        en->bucket_next = db->filename_hash[hash];
+        db->filename_hash[hash] = en;
     }
+}
 
-    // Add unknown artist / album / genre, if necessary
-    if (!has_unknown_artist) {
+// Add unknown artist / album / genre, if necessary
+static void
+_ml_index_add_unknown (ml_index_context_t *ctx) {
+    ml_db_t *db = ctx->db;
+    ml_db_t *source_db = ctx->source_db;
+    if (!ctx->has_unknown_artist) {
         uint64_t coll_row_id, item_row_id;
-        ml_collection_reuse_row_ids(&scanner->source->db.artists, unknown_artist, NULL, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.artists, unknown_artist, NULL, coll_row_id, item_row_id);
+        ml_collection_reuse_row_ids(&source_db->artists, ctx->unknown_artist, NULL, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+        ml_collection_add_item (db, &db->artists, ctx->unknown_artist, NULL, coll_row_id, item_row_id);
     }
-    if (!has_unknown_album) {
+    if (!ctx->has_unknown_album) {
         uint64_t coll_row_id, item_row_id;
-        ml_collection_reuse_row_ids(&scanner->source->db.albums, unknown_album, NULL, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.albums, unknown_album, NULL, coll_row_id, item_row_id);
+        ml_collection_reuse_row_ids(&source_db->albums, ctx->unknown_album, NULL, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+        ml_collection_add_item (db, &db->albums, ctx->unknown_album, NULL, coll_row_id, item_row_id);
     }
-    if (!has_unknown_genre) {
+    if (!ctx->has_unknown_genre) {
         uint64_t coll_row_id, item_row_id;
-        ml_collection_reuse_row_ids(&scanner->source->db.genres, unknown_genre, NULL, &scanner->db.state, &scanner->source->db.state, &coll_row_id, &item_row_id);
-        ml_collection_add_item (&scanner->db, &scanner->db.genres, unknown_genre, NULL, coll_row_id, item_row_id);
+        ml_collection_reuse_row_ids(&source_db->genres, ctx->unknown_genre, NULL, &db->state, &source_db->state, &coll_row_id, &item_row_id);
+        ml_collection_add_item (db, &db->genres, ctx->unknown_genre, NULL, coll_row_id, item_row_id);
     }
+}
 
-    deadbeef->metacache_remove_string (unknown_artist);
-    deadbeef->metacache_remove_string (unknown_album);
-    deadbeef->metacache_remove_string (unknown_genre);
-
+static void
+_ml_index_log_stats (ml_db_t *db, struct timeval *tm1, const char *what) {
+    struct timeval tm2;
     int nalb = 0;
     int nart = 0;
     int ngnr = 0;
     ml_collection_tree_node_t *s;
-    for (s = scanner->db.albums.root.children; s; s = s->next, nalb++);
-    for (s = scanner->db.artists.root.children; s; s = s->next, nart++);
-    for (s = scanner->db.genres.root.children; s; s = s->next, ngnr++);
+    for (s = db->albums.root.children; s; s = s->next, nalb++);
+    for (s = db->artists.root.children; s; s = s->next, nart++);
+    for (s = db->genres.root.children; s; s = s->next, ngnr++);
     gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1->tv_sec*1000+tm1->tv_usec/1000);
+
+    fprintf (stderr, "%s time: %f seconds (%d albums, %d artists, %d genres)\n", what, ms / 1000.f, nalb, nart, ngnr);
+}
+
+// This should be called only on pre-existing ml playlist.
+// Subsequent indexing should be done on the fly, using fileadd listener.
+void
+ml_index (scanner_state_t *scanner, const ml_scanner_configuration_t *conf, const ml_fulltext_index_t *prev_fulltext, int can_terminate) {
+    fprintf (stderr, "building index...\n");
+
+    struct timeval tm1;
+    gettimeofday (&tm1, NULL);
+
+    ml_index_context_t ctx;
+    _ml_index_context_init (&ctx, &scanner->db, &scanner->source->db, conf);
+
+    for (int i = 0; i < scanner->track_count && (!can_terminate || !scanner->source->scanner_terminate); i++) {
+        _ml_index_track (&ctx, scanner->tracks[i]);
+    }
+
+    _ml_index_add_unknown (&ctx);
+    _ml_index_context_deinit (&ctx);
 
-    fprintf (stderr, "index build time: %f seconds (%d albums, %d artists, %d genres)\n", ms / 1000.f, nalb, nart, ngnr);
+    ml_db_set_music_paths (&scanner->db, conf->medialib_paths, conf->medialib_paths_count);
+
+    ml_fulltext_build (&scanner->db.fulltext, scanner->tracks, scanner->track_count, prev_fulltext);
+
+    _ml_index_log_stats (&scanner->db, &tm1, "index build");
+}
+
+int
+ml_index_can_update (scanner_state_t *scanner, const ml_scanner_configuration_t *conf) {
+    return scanner->source->db.track_keys != NULL && ml_db_has_music_paths (&scanner->source->db, conf->medialib_paths, conf->medialib_paths_count);
+}
+
+void
+ml_index_update (scanner_state_t *scanner, const ml_scanner_configuration_t *conf) {
+    struct timeval tm1;
+    gettimeofday (&tm1, NULL);
+
+    ml_db_t *db = &scanner->source->db;
+
+    // pointer set of the new tracks
+    uint32_t mask = 1;
+    while (mask < (uint32_t)scanner->track_count * 2) {
+        mask <<= 1;
+    }
+    ddb_playItem_t **track_set = calloc (mask, sizeof (ddb_playItem_t *));
+    mask -= 1;
+    for (int i = 0; i < scanner->track_count; i++) {
+        uint32_t h = ml_db_hash_for_track (scanner->tracks[i]) & mask;
+        while (track_set[h] && track_set[h] != scanner->tracks[i]) {
+            h = (h + 1) & mask;
+        }
+        track_set[h] = scanner->tracks[i];
+    }
+
+    int removed = ml_db_remove_tracks_not_in_set (db, track_set, mask);
+    free (track_set);
+
+    ml_index_context_t ctx;
+    _ml_index_context_init (&ctx, db, db, conf);
+    // the unknown artist / album / genre nodes are never removed
+    ctx.has_unknown_artist = ctx.has_unknown_album = ctx.has_unknown_genre = 1;
+
+    int added = 0;
+    for (int i = 0; i < scanner->track_count; i++) {
+        if (!ml_db_find_track_keys (db, scanner->tracks[i])) {
+            _ml_index_track (&ctx, scanner->tracks[i]);
+            added++;
+        }
+    }
+
+    _ml_index_context_deinit (&ctx);
+
+    fprintf (stderr, "index update: %d tracks removed, %d tracks added\n", removed, added);
+    _ml_index_log_stats (db, &tm1, "index update");
 }
 
 static int
@@ -231,10 +331,19 @@ _status_callback (ddb_insert_file_result_t result, const char *fname, void *user
     return 0;
 }
 
+static void
+_job_append_track (ml_scan_job_t *job, ddb_playItem_t *it) {
+    if (job->track_count == job->track_reserved_count) {
+        job->track_reserved_count = job->track_reserved_count ? job->track_reserved_count * 2 : 16;
+        job->tracks = realloc (job->tracks, job->track_reserved_count * sizeof (ddb_playItem_t *));
+    }
+    job->tracks[job->track_count++] = it;
+}
+
 // NOTE: make sure to run on sync_queue
 /// Returns 1 for the files which need to be included in the scan, based on their timestamp and metadata
 static int
-ml_filter_int (ddb_file_found_data_t *data, time_t mtime, scanner_state_t *state) {
+ml_filter_int (ddb_file_found_data_t *data, time_t mtime, scanner_state_t *state, ml_scan_job_t *job) {
     int res = 0;
 
     const char *s = deadbeef->metacache_get_string (data->filename);
@@ -276,10 +385,10 @@ ml_filter_int (ddb_file_found_data_t *data, time_t mtime, scanner_state_t *state
                 for (ml_collection_track_ref_t *item = node->items; item; item = item->next) {
                     // Because of cuesheets, the same track may get added multiple times,
                     // since all items reference the same filename.
-                    // Check if this track is still in ml_playlist
+                    // These are always found in the same folder.
                     int track_found = 0;
-                    for (int i = state->track_count-1; i >= 0; i--) {
-                        if (state->tracks[i] == item->it) {
+                    for (int i = job->track_count-1; i >= 0; i--) {
+                        if (job->tracks[i] == item->it) {
                             track_found = 1;
                             break;
                         }
@@ -290,9 +399,7 @@ ml_filter_int (ddb_file_found_data_t *data, time_t mtime, scanner_state_t *state
                     }
 
                     deadbeef->pl_item_ref (item->it);
-
-                    // Allocated space precisely matches playlist count, so no check is necessary
-                    state->tracks[state->track_count++] = item->it;
+                    _job_append_track (job, item->it);
                 }
             }
             break;
@@ -325,10 +432,27 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
 
     scanner_state_t *state = user_data;
 
-    if (!user_data || data->plt != state->plt || data->is_dir) {
+    if (!user_data) {
         return 0;
     }
 
+    ml_scan_worker_t *worker = NULL;
+    for (int i = 0; i < state->worker_count; i++) {
+        if (data->plt == state->workers[i].plt) {
+            worker = &state->workers[i];
+            break;
+        }
+    }
+
+    if (worker == NULL || worker->job == NULL) {
+        return 0;
+    }
+
+    // Subfolders are separate jobs
+    if (data->is_dir) {
+        return strcmp (data->filename, worker->job->path) ? -1 : 0;
+    }
+
 #if FILTER_PERF
     struct timeval tm1, tm2;
     gettimeofday (&tm1, NULL);
@@ -343,12 +467,170 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     medialib_source_t *source = state->source;
 
     dispatch_sync(source->sync_queue, ^{
-        res = ml_filter_int(data, mtime, state);
+        res = ml_filter_int(data, mtime, state, worker->job);
     });
 
     return res;
 }
 
+static int
+_is_in_changed_paths (ddb_playItem_t *it, const ml_scanner_configuration_t *conf) {
+    int res = 0;
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    for (size_t i = 0; uri && !res && i < conf->changed_paths_count; i++) {
+        size_t len = strlen (conf->changed_paths[i]);
+        res = !strncmp (conf->changed_paths[i], uri, len) && uri[len] == '/';
+    }
+    for (size_t i = 0; uri && !res && i < conf->changed_folders_count; i++) {
+        size_t len = strlen (conf->changed_folders[i]);
+        res = !strncmp (conf->changed_folders[i], uri, len) && uri[len] == '/' && !strchr (uri + len + 1, '/');
+    }
+    deadbeef->pl_unlock ();
+    return res;
+}
+
+static int
+_dirent_alphasort (const struct dirent **a, const struct dirent **b) {
+    return strcmp ((*a)->d_name, (*b)->d_name);
+}
+
+// Adds a job for the folder, without its subfolders.
+// Returns 0 on success, or -1 if the path is not a folder.
+static int
+_add_scan_job (scanner_state_t *scanner, const char *path) {
+    // Symlinks are not followed, same as plt_insert_dir3 without DDB_INSERT_FILE_FLAG_FOLLOW_SYMLINKS
+    struct stat st;
+    if (lstat (path, &st) || !S_ISDIR (st.st_mode)) {
+        return -1;
+    }
+
+    if (scanner->job_count == scanner->job_reserved_count) {
+        scanner->job_reserved_count = scanner->job_reserved_count ? scanner->job_reserved_count * 2 : 64;
+        scanner->jobs = realloc (scanner->jobs, scanner->job_reserved_count * sizeof (ml_scan_job_t));
+    }
+    ml_scan_job_t *job = &scanner->jobs[scanner->job_count++];
+    memset (job, 0, sizeof (ml_scan_job_t));
+    job->path = strdup (path);
+    return 0;
+}
+
+// Adds a job for the folder and each of its subfolders, in the same order as plt_insert_dir3 visits them
+static void
+_add_scan_jobs (scanner_state_t *scanner, const char *path) {
+    if (scanner->source->scanner_terminate) {
+        return;
+    }
+
+    if (_add_scan_job (scanner, path)) {
+        return;
+    }
+
+    // plt_insert_dir3 builds the subfolder paths from the resolved folder path
+    char resolved[PATH_MAX];
+    if (!realpath (path, resolved)) {
+        return;
+    }
+    size_t len = strlen (resolved);
+    while (len > 0 && resolved[len-1] == '/') {
+        resolved[--len] = 0;
+    }
+
+    struct dirent **namelist = NULL;
+    int n = scandir (len ? resolved : "/", &namelist, NULL, _dirent_alphasort);
+    for (int i = 0; i < n; i++) {
+        if (namelist[i]->d_name[0] != '.' && (namelist[i]->d_type == DT_DIR || namelist[i]->d_type == DT_UNKNOWN)) {
+            char subpath[PATH_MAX];
+            if (snprintf (subpath, sizeof (subpath), "%s/%s", resolved, namelist[i]->d_name) < (int)sizeof (subpath)) {
+                _add_scan_jobs (scanner, subpath);
+            }
+        }
+        free (namelist[i]);
+    }
+    free (namelist);
+}
+
+static void
+_scan_worker (void *ctx) {
+    ml_scan_worker_t *worker = ctx;
+    scanner_state_t *scanner = worker->state;
+    medialib_source_t *source = scanner->source;
+
+    for (;;) {
+        int idx = __atomic_fetch_add (&scanner->next_job, 1, __ATOMIC_SEQ_CST);
+        if (idx >= scanner->job_count || source->scanner_terminate) {
+            break;
+        }
+
+        // The filter is called on this thread, and adds the reused tracks to the job
+        worker->job = &scanner->jobs[idx];
+        deadbeef->plt_insert_dir3 (-1, 0, worker->plt, NULL, worker->job->path, &source->scanner_terminate, _status_callback, NULL);
+
+        time_t timestamp = time(NULL);
+        char stimestamp[100];
+        snprintf (stimestamp, sizeof (stimestamp), "%lld", (int64_t)timestamp);
+        ddb_playItem_t *it = deadbeef->plt_get_head_item (worker->plt, PL_MAIN);
+        while (it) {
+            deadbeef->pl_replace_meta (it, ":MEDIALIB_SCAN_TIME", stimestamp);
+            _job_append_track (worker->job, it);
+            it = deadbeef->pl_get_next (it, PL_MAIN);
+        }
+        deadbeef->plt_clear (worker->plt);
+        worker->job = NULL;
+    }
+}
+
+static int
+_scan_thread_count (void) {
+    int count = deadbeef->conf_get_int ("medialib.scan_threads", 0);
+    if (count <= 0) {
+        long cpu_count = sysconf (_SC_NPROCESSORS_ONLN);
+        count = cpu_count > 0 ? (int)cpu_count : 1;
+    }
+    if (count > ML_SCAN_MAX_THREADS) {
+        count = ML_SCAN_MAX_THREADS;
+    }
+    return count;
+}
+
+// Scans the folders on the worker threads, reading the tags of multiple files at once
+static void
+_run_scan_jobs (scanner_state_t *scanner) {
+    int count = _scan_thread_count ();
+    if (count > scanner->job_count) {
+        count = scanner->job_count;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    scanner->next_job = 0;
+    scanner->workers = calloc (count, sizeof (ml_scan_worker_t));
+    scanner->worker_count = count;
+    for (int i = 0; i < count; i++) {
+        scanner->workers[i].state = scanner;
+        scanner->workers[i].plt = deadbeef->plt_alloc ("medialib");
+    }
+
+    // The calling thread is the first worker
+    for (int i = 1; i < count; i++) {
+        scanner->workers[i].tid = deadbeef->thread_start (_scan_worker, &scanner->workers[i]);
+    }
+    _scan_worker (&scanner->workers[0]);
+    for (int i = 1; i < count; i++) {
+        if (scanner->workers[i].tid) {
+            deadbeef->thread_join (scanner->workers[i].tid);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        deadbeef->plt_unref (scanner->workers[i].plt);
+    }
+    free (scanner->workers);
+    scanner->workers = NULL;
+    scanner->worker_count = 0;
+}
+
 void
 scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
     struct timeval tm1, tm2;
@@ -369,49 +651,77 @@ scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
 
     scanner_state_t scanner = {0};
     scanner.source = source;
-    scanner.plt = deadbeef->plt_alloc("medialib");
     scanner.tracks = calloc (reserve_tracks, sizeof (ddb_playItem_t *));
     scanner.track_count = 0;
     scanner.track_reserved_count = reserve_tracks;
 
-    int filter_id = deadbeef->register_fileadd_filter (ml_fileadd_filter, &scanner);
+    if (conf.changed_paths != NULL || conf.changed_folders != NULL) {
+        // Keep the tracks outside of the changed folders,
+        // the ones inside are either reused by the filter, or rescanned.
+        scanner_state_t *state = &scanner;
+        dispatch_sync(source->sync_queue, ^{
+            if (source->ml_playlist == NULL) {
+                return;
+            }
+            ddb_playItem_t *it = deadbeef->plt_get_head_item (source->ml_playlist, PL_MAIN);
+            while (it) {
+                ddb_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+                if (!_is_in_changed_paths (it, &conf)) {
+                    // the playlist may have grown since the count was taken
+                    if (state->track_count == state->track_reserved_count) {
+                        state->track_reserved_count *= 2;
+                        state->tracks = realloc (state->tracks, state->track_reserved_count * sizeof (ddb_playItem_t *));
+                    }
+                    state->tracks[state->track_count++] = it;
+                }
+                else {
+                    deadbeef->pl_item_unref (it);
+                }
+                it = next;
+            }
+        });
+    }
+
     gettimeofday (&tm1, NULL);
 
-    for (int i = 0; i < conf.medialib_paths_count; i++) {
-        const char *musicdir = conf.medialib_paths[i];
+    int rescan_changed = conf.changed_paths != NULL || conf.changed_folders != NULL;
+    char **scan_paths = rescan_changed ? conf.changed_paths : conf.medialib_paths;
+    size_t scan_paths_count = rescan_changed ? conf.changed_paths_count : conf.medialib_paths_count;
+    for (int i = 0; i < scan_paths_count; i++) {
+        const char *musicdir = scan_paths[i];
         printf ("adding dir: %s\n", musicdir);
-        // Create a new playlist, by looking back into the existing playlist.
-        // The reusable tracks get moved to the new playlist.
-        deadbeef->plt_insert_dir3 (-1, 0, scanner.plt, NULL, musicdir, &source->scanner_terminate, _status_callback, NULL);
+        _add_scan_jobs (&scanner, musicdir);
     }
-    deadbeef->unregister_fileadd_filter (filter_id);
-
-    if (source->scanner_terminate) {
-        goto error;
+    for (int i = 0; i < conf.changed_folders_count; i++) {
+        printf ("adding dir without subfolders: %s\n", conf.changed_folders[i]);
+        _add_scan_job (&scanner, conf.changed_folders[i]);
     }
 
-    // move from playlist to the track list
-    int plt_track_count = deadbeef->plt_get_item_count (scanner.plt, PL_MAIN);
-    if (scanner.track_count + plt_track_count > scanner.track_reserved_count) {
-        scanner.track_reserved_count = scanner.track_count + plt_track_count;
-        scanner.tracks = realloc(scanner.tracks, scanner.track_reserved_count * sizeof (ddb_playItem_t));
-        if (scanner.tracks == NULL) {
-            trace ("medialib: failed to allocate memory for tracks\n");
-            goto error;
+    // Create a new playlist, by looking back into the existing playlist.
+    // The reusable tracks get moved to the new playlist.
+    int filter_id = deadbeef->register_fileadd_filter (ml_fileadd_filter, &scanner);
+    _run_scan_jobs (&scanner);
+    deadbeef->unregister_fileadd_filter (filter_id);
+
+    // Merge in the order of traversal, regardless of which worker scanned the folder
+    for (int i = 0; i < scanner.job_count; i++) {
+        ml_scan_job_t *job = &scanner.jobs[i];
+        if (scanner.track_count + job->track_count > scanner.track_reserved_count) {
+            scanner.track_reserved_count = (scanner.track_count + job->track_count) * 3 / 2;
+            scanner.tracks = realloc (scanner.tracks, scanner.track_reserved_count * sizeof (ddb_playItem_t *));
         }
+        memcpy (scanner.tracks + scanner.track_count, job->tracks, job->track_count * sizeof (ddb_playItem_t *));
+        scanner.track_count += job->track_count;
+        free (job->tracks);
+        free (job->path);
     }
+    free (scanner.jobs);
+    scanner.jobs = NULL;
+    scanner.job_count = 0;
 
-    time_t timestamp = time(NULL);
-    char stimestamp[100];
-    snprintf (stimestamp, sizeof (stimestamp), "%lld", (int64_t)timestamp);
-    ddb_playItem_t *it = deadbeef->plt_get_head_item (scanner.plt, PL_MAIN);
-    while (it) {
-        deadbeef->pl_replace_meta (it, ":MEDIALIB_SCAN_TIME", stimestamp);
-        scanner.tracks[scanner.track_count++] = it;
-        it = deadbeef->pl_get_next (it, PL_MAIN);
+    if (source->scanner_terminate) {
+        goto error;
     }
-    deadbeef->plt_unref (scanner.plt);
-    scanner.plt = NULL;
 
     gettimeofday (&tm2, NULL);
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
@@ -420,28 +730,62 @@ scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
     source->_ml_state = DDB_MEDIASOURCE_STATE_INDEXING;
     ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
 
-    ml_index(&scanner, &conf, 1);
+    // With the same music folders, the current db is updated in place with the added and removed tracks,
+    // otherwise a new one is built from all tracks.
+    int update_in_place = ml_index_can_update (&scanner, &conf);
+    __block ml_fulltext_index_t fulltext = {0};
+    if (update_in_place) {
+        ml_fulltext_build (&fulltext, scanner.tracks, scanner.track_count, &source->db.fulltext);
+    }
+    else {
+        // The trigrams of unchanged tracks are taken from the current index
+        ml_index(&scanner, &conf, &source->db.fulltext, 1);
+    }
     if (source->scanner_terminate) {
+        ml_fulltext_free (&fulltext);
         goto error;
     }
 
     source->_ml_state = DDB_MEDIASOURCE_STATE_SAVING;
     ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
 
+    if (!source->disable_file_operations) {
+        char ftpath[PATH_MAX];
+        snprintf (ftpath, sizeof (ftpath), "%s/medialib.ftidx", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+        ml_fulltext_save (update_in_place ? &fulltext : &scanner.db.fulltext, ftpath);
+    }
+
     // Create playlist from tracks
     ddb_playlist_t *new_plt = deadbeef->plt_alloc("Medialib Playlist");
 
+    // The snapshot is serialized while the db is locked, and written together with the playlist
+    __block void *snapshot = NULL;
+    __block size_t snapshot_size = 0;
+    int disable_file_operations = source->disable_file_operations;
+
+    scanner_state_t *state = &scanner;
     dispatch_sync(source->sync_queue, ^{
         deadbeef->plt_unref (source->ml_playlist);
         source->ml_playlist = new_plt;
-        ml_db_free(&source->db);
-        memcpy (&source->db, &scanner.db, sizeof (ml_db_t));
+        if (update_in_place) {
+            ml_index_update (state, &conf);
+            ml_fulltext_free (&source->db.fulltext);
+            memcpy (&source->db.fulltext, &fulltext, sizeof (ml_fulltext_index_t));
+        }
+        else {
+            ml_db_free(&source->db);
+            memcpy (&source->db, &state->db, sizeof (ml_db_t));
+        }
+
+        if (!disable_file_operations) {
+            ml_snapshot_build (&source->db, state->tracks, state->track_count, &snapshot, &snapshot_size);
+        }
 
         ddb_playItem_t *after = NULL;
-        for (int i = 0; i < scanner.track_count; i++) {
-            after = deadbeef->plt_insert_item(new_plt, after, scanner.tracks[i]);
-            deadbeef->pl_item_unref(scanner.tracks[i]);
-            scanner.tracks[i] = NULL;
+        for (int i = 0; i < state->track_count; i++) {
+            after = deadbeef->plt_insert_item(new_plt, after, state->tracks[i]);
+            deadbeef->pl_item_unref(state->tracks[i]);
+            state->tracks[i] = NULL;
         }
     });
 
@@ -451,10 +795,21 @@ scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf) {
     if (!source->disable_file_operations) {
         char plpath[PATH_MAX];
         snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+        char snappath[PATH_MAX];
+        snprintf (snappath, sizeof (snappath), "%s/medialib.dbsnap", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+
+        // The old snapshot must not be used with the new playlist, even if writing the new one fails
+        unlink (snappath);
         deadbeef->plt_save (new_plt, NULL, NULL, plpath, NULL, NULL, NULL);
+        if (snapshot != NULL) {
+            ml_snapshot_write (snapshot, snapshot_size, snappath);
+        }
     }
+    free (snapshot);
 
     ml_free_music_paths (conf.medialib_paths, conf.medialib_paths_count);
+    ml_free_music_paths (conf.changed_paths, conf.changed_paths_count);
+    ml_free_music_paths (conf.changed_folders, conf.changed_folders_count);
 
     source->_ml_state = DDB_MEDIASOURCE_STATE_IDLE;
     ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
@@ -474,10 +829,8 @@ error:
     ml_db_free (&scanner.db);
     memset (&scanner.db, 0, sizeof (ml_db_t));
 
-    if (scanner.plt) {
-        deadbeef->plt_unref (scanner.plt);
-        scanner.plt = NULL;
-    }
+    ml_free_music_paths (conf.changed_paths, conf.changed_paths_count);
+    ml_free_music_paths (conf.changed_folders, conf.changed_folders_count);
     source->_ml_state = DDB_MEDIASOURCE_STATE_IDLE;
     ml_notify_listeners (source, DDB_MEDIASOURCE_EVENT_STATE_DID_CHANGE);
 }
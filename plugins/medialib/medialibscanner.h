@@ -33,19 +33,57 @@ typedef struct {
     int64_t scanner_index; // can be compared with source.scanner_current_index and source.scanner_terminate_index
     char **medialib_paths;
     size_t medialib_paths_count;
+    char **changed_paths; // if set, only these folders are scanned, and the rest of the tracks are kept as is
+    size_t changed_paths_count;
+    char **changed_folders; // same as changed_paths, but scanned without subfolders
+    size_t changed_folders_count;
 }  ml_scanner_configuration_t;
 
+// A single folder to scan, without its subfolders
 typedef struct {
-    medialib_source_t *source;
+    char *path;
+    ddb_playItem_t **tracks; // Reused and new tracks from the folder, in the order they were found
+    int track_count;
+    int track_reserved_count;
+} ml_scan_job_t;
+
+typedef struct {
+    struct scanner_state_s *state;
     ddb_playlist_t *plt; // The playlist which gets populated with new tracks during scan
+    ml_scan_job_t *job; // The job which is currently processed by this worker
+    intptr_t tid;
+} ml_scan_worker_t;
+
+typedef struct scanner_state_s {
+    medialib_source_t *source;
     ddb_playItem_t **tracks; // The reused tracks from the current medialib playlist
     int track_count; // Current count of tracks
     int track_reserved_count; // Reserved / available space for tracks
     ml_db_t db; // The new db, with reused items transferred from source
+
+    // Folders to scan, in the order of traversal, and the index of the next one to pick up
+    ml_scan_job_t *jobs;
+    int job_count;
+    int job_reserved_count;
+    int next_job;
+
+    ml_scan_worker_t *workers;
+    int worker_count;
 } scanner_state_t;
 
+/// The trigrams of the tracks which didn't change are taken from @c prev_fulltext, which may be NULL
+void
+ml_index (scanner_state_t *scanner, const ml_scanner_configuration_t *conf, const ml_fulltext_index_t *prev_fulltext, int can_terminate);
+
+/// Returns 1 if the current db of the source can be updated by @c ml_index_update
+int
+ml_index_can_update (scanner_state_t *scanner, const ml_scanner_configuration_t *conf);
+
+/// Update the current db of the source in place, removing the tracks which are not in the scanner,
+/// and adding the new ones.
+/// Must be called on sync_queue.
 void
-ml_index (scanner_state_t *scanner, const ml_scanner_configuration_t *conf, int can_terminate);
+ml_index_update (scanner_state_t *scanner, const ml_scanner_configuration_t *conf);
 
 void
 scanner_thread (medialib_source_t *source, ml_scanner_configuration_t conf);
@@ -0,0 +1,703 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "medialibcommon.h"
+#include "medialibsnapshot.h"
+
+// The snapshot is saved in native byte order, next to medialib.dbpl.
+// All sections are 8-byte aligned, so that they're used directly from the memory map.
+#define ML_SNAPSHOT_FILE_MAGIC "DBMS"
+#define ML_SNAPSHOT_FILE_VERSION 1
+#define ML_SNAPSHOT_BYTE_ORDER 0x01020304
+#define ML_SNAPSHOT_NONE UINT32_MAX
+
+// albums, artists, genres, folders, track_uris
+#define ML_SNAPSHOT_COLLECTION_COUNT 5
+
+// album, artist, genre, uri, folder
+#define ML_SNAPSHOT_KEY_COUNT 5
+
+// Folder paths are much shorter than that, it's only a guard against malformed files
+#define ML_SNAPSHOT_MAX_DEPTH 4096
+
+static DB_functions_t *deadbeef;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t track_count;
+    uint64_t row_id;
+    uint32_t string_count;
+    uint32_t string_data_size;
+    uint32_t path_count;
+    uint32_t filename_count;
+    uint32_t node_count[ML_SNAPSHOT_COLLECTION_COUNT];
+    uint32_t item_count[ML_SNAPSHOT_COLLECTION_COUNT];
+} ml_snapshot_header_t;
+
+// Tree nodes are stored in pre-order, starting with the root.
+// The items of each node follow the items of the previous node.
+typedef struct {
+    uint64_t row_id;
+    uint32_t text;
+    uint32_t path;
+    uint32_t child_count;
+    uint32_t item_count;
+} ml_snapshot_node_t;
+
+typedef struct {
+    uint64_t row_id;
+    uint32_t track;
+    uint32_t reserved;
+} ml_snapshot_item_t;
+
+// File offsets of the sections following the header
+typedef struct {
+    uint64_t string_offsets; // uint32_t[string_count]
+    uint64_t string_data; // char[string_data_size]
+    uint64_t paths; // uint32_t[path_count]
+    uint64_t track_uris; // uint32_t[track_count]
+    uint64_t track_keys; // uint32_t[track_count*ML_SNAPSHOT_KEY_COUNT]
+    uint64_t filenames; // uint32_t[filename_count]
+    uint64_t nodes[ML_SNAPSHOT_COLLECTION_COUNT];
+    uint64_t items[ML_SNAPSHOT_COLLECTION_COUNT];
+    uint64_t size;
+} ml_snapshot_layout_t;
+
+#define ML_SNAPSHOT_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+static void
+_snapshot_layout (const ml_snapshot_header_t *header, ml_snapshot_layout_t *layout) {
+    uint64_t offs = sizeof (ml_snapshot_header_t);
+
+    layout->string_offsets = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + (uint64_t)header->string_count * sizeof (uint32_t));
+    layout->string_data = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + header->string_data_size);
+    layout->paths = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + (uint64_t)header->path_count * sizeof (uint32_t));
+    layout->track_uris = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + (uint64_t)header->track_count * sizeof (uint32_t));
+    layout->track_keys = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + (uint64_t)header->track_count * ML_SNAPSHOT_KEY_COUNT * sizeof (uint32_t));
+    layout->filenames = offs;
+    offs = ML_SNAPSHOT_ALIGN (offs + (uint64_t)header->filename_count * sizeof (uint32_t));
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        layout->nodes[c] = offs;
+        offs += (uint64_t)header->node_count[c] * sizeof (ml_snapshot_node_t);
+        layout->items[c] = offs;
+        offs += (uint64_t)header->item_count[c] * sizeof (ml_snapshot_item_t);
+    }
+    layout->size = offs;
+}
+
+static ml_collection_t *
+_db_collection (ml_db_t *db, int index) {
+    switch (index) {
+    case 0:
+        return &db->albums;
+    case 1:
+        return &db->artists;
+    case 2:
+        return &db->genres;
+    case 3:
+        return &db->folders;
+    default:
+        return &db->track_uris;
+    }
+}
+
+#pragma mark - Build
+
+// Open addressing hash, mapping pointers to indexes
+typedef struct {
+    const void **keys;
+    uint32_t *values;
+    uint32_t mask;
+    uint32_t count;
+} ml_snapshot_ptr_map_t;
+
+static uint32_t
+_ptr_hash (const void *ptr) {
+    uint64_t scrambled = 1181783497276652981ULL * (uintptr_t)ptr;
+    return (uint32_t)(scrambled >> 32);
+}
+
+static void
+_ptr_map_init (ml_snapshot_ptr_map_t *map, uint32_t capacity) {
+    uint32_t size = 16;
+    while (size < capacity * 2) {
+        size <<= 1;
+    }
+    map->keys = calloc (size, sizeof (void *));
+    map->values = malloc (size * sizeof (uint32_t));
+    map->mask = size - 1;
+    map->count = 0;
+}
+
+static void
+_ptr_map_free (ml_snapshot_ptr_map_t *map) {
+    free (map->keys);
+    free (map->values);
+    memset (map, 0, sizeof (ml_snapshot_ptr_map_t));
+}
+
+static uint32_t
+_ptr_map_find (const ml_snapshot_ptr_map_t *map, const void *ptr) {
+    for (uint32_t h = _ptr_hash (ptr) & map->mask; map->keys[h]; h = (h + 1) & map->mask) {
+        if (map->keys[h] == ptr) {
+            return map->values[h];
+        }
+    }
+    return ML_SNAPSHOT_NONE;
+}
+
+static void
+_ptr_map_insert (ml_snapshot_ptr_map_t *map, const void *ptr, uint32_t value) {
+    if ((map->count + 1) * 2 > map->mask + 1) {
+        ml_snapshot_ptr_map_t grown;
+        _ptr_map_init (&grown, map->mask + 1);
+        for (uint32_t i = 0; i <= map->mask; i++) {
+            if (map->keys[i]) {
+                _ptr_map_insert (&grown, map->keys[i], map->values[i]);
+            }
+        }
+        _ptr_map_free (map);
+        *map = grown;
+    }
+
+    uint32_t h = _ptr_hash (ptr) & map->mask;
+    while (map->keys[h]) {
+        h = (h + 1) & map->mask;
+    }
+    map->keys[h] = ptr;
+    map->values[h] = value;
+    map->count++;
+}
+
+typedef struct {
+    void *data;
+    uint32_t count;
+    uint32_t reserved_count;
+} ml_snapshot_array_t;
+
+static void *
+_array_append (ml_snapshot_array_t *array, size_t element_size) {
+    if (array->count == array->reserved_count) {
+        array->reserved_count = array->reserved_count ? array->reserved_count * 2 : 64;
+        array->data = realloc (array->data, array->reserved_count * element_size);
+    }
+    return (char *)array->data + element_size * array->count++;
+}
+
+typedef struct {
+    ml_snapshot_ptr_map_t string_map;
+    ml_snapshot_array_t strings; // const char *
+    uint64_t string_data_size;
+
+    ml_snapshot_ptr_map_t track_map;
+
+    ml_snapshot_array_t nodes[ML_SNAPSHOT_COLLECTION_COUNT];
+    ml_snapshot_array_t items[ML_SNAPSHOT_COLLECTION_COUNT];
+    ml_snapshot_array_t filenames;
+
+    int error;
+} ml_snapshot_builder_t;
+
+static uint32_t
+_builder_string (ml_snapshot_builder_t *builder, const char *str) {
+    if (str == NULL) {
+        return ML_SNAPSHOT_NONE;
+    }
+    uint32_t index = _ptr_map_find (&builder->string_map, str);
+    if (index == ML_SNAPSHOT_NONE) {
+        index = builder->strings.count;
+        *(const char **)_array_append (&builder->strings, sizeof (const char *)) = str;
+        builder->string_data_size += strlen (str) + 1;
+        _ptr_map_insert (&builder->string_map, str, index);
+    }
+    return index;
+}
+
+static void
+_builder_add_node (ml_snapshot_builder_t *builder, int coll, ml_collection_tree_node_t *node) {
+    uint32_t child_count = 0;
+    for (ml_collection_tree_node_t *c = node->children; c; c = c->next) {
+        child_count++;
+    }
+    uint32_t item_count = 0;
+    for (ml_collection_track_ref_t *item = node->items; item; item = item->next) {
+        item_count++;
+    }
+
+    ml_snapshot_node_t *sn = _array_append (&builder->nodes[coll], sizeof (ml_snapshot_node_t));
+    sn->row_id = node->row_id;
+    sn->text = _builder_string (builder, node->text);
+    sn->path = _builder_string (builder, node->path);
+    sn->child_count = child_count;
+    sn->item_count = item_count;
+
+    for (ml_collection_track_ref_t *item = node->items; item; item = item->next) {
+        ml_snapshot_item_t *si = _array_append (&builder->items[coll], sizeof (ml_snapshot_item_t));
+        si->row_id = item->row_id;
+        si->track = _ptr_map_find (&builder->track_map, item->it);
+        si->reserved = 0;
+        if (si->track == ML_SNAPSHOT_NONE) {
+            builder->error = 1;
+        }
+    }
+
+    for (ml_collection_tree_node_t *c = node->children; c; c = c->next) {
+        _builder_add_node (builder, coll, c);
+    }
+}
+
+static void
+_write_section (uint8_t *data, uint64_t offset, const void *src, size_t size) {
+    if (size > 0) {
+        memcpy (data + offset, src, size);
+    }
+}
+
+int
+ml_snapshot_build (ml_db_t *db, ddb_playItem_t **tracks, int track_count, void **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+
+    ml_snapshot_builder_t builder;
+    memset (&builder, 0, sizeof (builder));
+    _ptr_map_init (&builder.string_map, 1024);
+    _ptr_map_init (&builder.track_map, (uint32_t)track_count);
+
+    for (int i = 0; i < track_count; i++) {
+        _ptr_map_insert (&builder.track_map, tracks[i], (uint32_t)i);
+    }
+
+    uint32_t *paths = calloc (db->medialib_paths_count ? db->medialib_paths_count : 1, sizeof (uint32_t));
+    for (size_t i = 0; i < db->medialib_paths_count; i++) {
+        paths[i] = _builder_string (&builder, db->medialib_paths[i]);
+    }
+
+    uint32_t *track_uris = malloc ((track_count ? track_count : 1) * sizeof (uint32_t));
+    uint32_t *track_keys = malloc ((track_count ? track_count : 1) * ML_SNAPSHOT_KEY_COUNT * sizeof (uint32_t));
+    for (int i = 0; i < track_count; i++) {
+        track_uris[i] = _builder_string (&builder, deadbeef->pl_find_meta (tracks[i], ":URI"));
+
+        uint32_t *keys_out = track_keys + i * ML_SNAPSHOT_KEY_COUNT;
+        ml_track_keys_t *keys = ml_db_find_track_keys (db, tracks[i]);
+        if (keys == NULL) {
+            for (int k = 0; k < ML_SNAPSHOT_KEY_COUNT; k++) {
+                keys_out[k] = ML_SNAPSHOT_NONE;
+            }
+            continue;
+        }
+        keys_out[0] = _builder_string (&builder, keys->album);
+        keys_out[1] = _builder_string (&builder, keys->artist);
+        keys_out[2] = _builder_string (&builder, keys->genre);
+        keys_out[3] = _builder_string (&builder, keys->uri);
+        keys_out[4] = _builder_string (&builder, keys->folder);
+    }
+
+    for (int i = 0; i < ML_HASH_SIZE; i++) {
+        for (ml_filename_hash_item_t *en = db->filename_hash[i]; en; en = en->bucket_next) {
+            *(uint32_t *)_array_append (&builder.filenames, sizeof (uint32_t)) = _builder_string (&builder, en->file);
+        }
+    }
+
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        _builder_add_node (&builder, c, &_db_collection (db, c)->root);
+    }
+
+    int res = -1;
+    if (builder.error || builder.string_data_size > UINT32_MAX) {
+        goto done;
+    }
+
+    ml_snapshot_header_t header;
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, ML_SNAPSHOT_FILE_MAGIC, 4);
+    header.version = ML_SNAPSHOT_FILE_VERSION;
+    header.byte_order = ML_SNAPSHOT_BYTE_ORDER;
+    header.track_count = (uint32_t)track_count;
+    header.row_id = db->row_id;
+    header.string_count = builder.strings.count;
+    header.string_data_size = (uint32_t)builder.string_data_size;
+    header.path_count = (uint32_t)db->medialib_paths_count;
+    header.filename_count = builder.filenames.count;
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        header.node_count[c] = builder.nodes[c].count;
+        header.item_count[c] = builder.items[c].count;
+    }
+
+    ml_snapshot_layout_t layout;
+    _snapshot_layout (&header, &layout);
+    if (layout.size > SIZE_MAX) {
+        goto done;
+    }
+
+    uint8_t *out = calloc (1, (size_t)layout.size);
+    if (out == NULL) {
+        goto done;
+    }
+
+    memcpy (out, &header, sizeof (header));
+
+    uint32_t *string_offsets = (uint32_t *)(out + layout.string_offsets);
+    char *string_data = (char *)(out + layout.string_data);
+    uint32_t offs = 0;
+    for (uint32_t i = 0; i < builder.strings.count; i++) {
+        const char *str = ((const char **)builder.strings.data)[i];
+        size_t len = strlen (str) + 1;
+        string_offsets[i] = offs;
+        memcpy (string_data + offs, str, len);
+        offs += (uint32_t)len;
+    }
+
+    _write_section (out, layout.paths, paths, header.path_count * sizeof (uint32_t));
+    _write_section (out, layout.track_uris, track_uris, header.track_count * sizeof (uint32_t));
+    _write_section (out, layout.track_keys, track_keys, header.track_count * ML_SNAPSHOT_KEY_COUNT * sizeof (uint32_t));
+    _write_section (out, layout.filenames, builder.filenames.data, header.filename_count * sizeof (uint32_t));
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        _write_section (out, layout.nodes[c], builder.nodes[c].data, header.node_count[c] * sizeof (ml_snapshot_node_t));
+        _write_section (out, layout.items[c], builder.items[c].data, header.item_count[c] * sizeof (ml_snapshot_item_t));
+    }
+
+    *data = out;
+    *size = (size_t)layout.size;
+    res = 0;
+
+done:
+    free (paths);
+    free (track_uris);
+    free (track_keys);
+    free (builder.strings.data);
+    free (builder.filenames.data);
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        free (builder.nodes[c].data);
+        free (builder.items[c].data);
+    }
+    _ptr_map_free (&builder.string_map);
+    _ptr_map_free (&builder.track_map);
+    return res;
+}
+
+typedef struct {
+    const void *data;
+    size_t size;
+} ml_snapshot_buffer_t;
+
+static int
+_snapshot_write (FILE *fp, void *user_data) {
+    const ml_snapshot_buffer_t *buffer = user_data;
+    return fwrite (buffer->data, buffer->size, 1, fp) == 1 ? 0 : -1;
+}
+
+int
+ml_snapshot_write (const void *data, size_t size, const char *fname) {
+    ml_snapshot_buffer_t buffer = { .data = data, .size = size };
+    return ml_write_file_atomic (fname, _snapshot_write, &buffer);
+}
+
+#pragma mark - Load
+
+typedef struct {
+    ml_db_t *db;
+    const uint8_t *data;
+    const ml_snapshot_header_t *header;
+    ml_snapshot_layout_t layout;
+
+    ddb_playItem_t **tracks;
+    const char **strings; // metacache refs
+
+    // position in the node and item arrays of the current collection
+    uint32_t node_pos;
+    uint32_t item_pos;
+} ml_snapshot_reader_t;
+
+/// Returns 0 if the index is valid; NONE is valid only if @c allow_none is set
+static int
+_reader_string (ml_snapshot_reader_t *reader, uint32_t index, int allow_none, const char **str) {
+    if (index == ML_SNAPSHOT_NONE && allow_none) {
+        *str = NULL;
+        return 0;
+    }
+    if (index >= reader->header->string_count) {
+        return -1;
+    }
+    *str = reader->strings[index];
+    return 0;
+}
+
+static int
+_restore_node (ml_snapshot_reader_t *reader, int coll_index, ml_collection_tree_node_t *parent, int depth) {
+    ml_collection_t *coll = _db_collection (reader->db, coll_index);
+    if (reader->node_pos >= reader->header->node_count[coll_index] || depth > ML_SNAPSHOT_MAX_DEPTH) {
+        return -1;
+    }
+    const ml_snapshot_node_t *sn = (const ml_snapshot_node_t *)(reader->data + reader->layout.nodes[coll_index]) + reader->node_pos++;
+
+    const char *text, *path;
+    if (_reader_string (reader, sn->text, parent == NULL, &text)
+        || _reader_string (reader, sn->path, 1, &path)) {
+        return -1;
+    }
+
+    ml_collection_tree_node_t *node;
+    if (parent == NULL) {
+        node = &coll->root;
+    }
+    else {
+        node = calloc (1, sizeof (ml_collection_tree_node_t));
+        if (parent->children_tail) {
+            parent->children_tail->next = node;
+        }
+        else {
+            parent->children = node;
+        }
+        parent->children_tail = node;
+
+        const char *key = path ? path : text;
+        uint32_t h = ml_collection_hash_for_ptr ((void *)key);
+        node->bucket_next = coll->hash[h];
+        coll->hash[h] = node;
+    }
+
+    node->row_id = sn->row_id;
+    node->text = text ? deadbeef->metacache_add_string (text) : NULL;
+    node->path = path ? deadbeef->metacache_add_string (path) : NULL;
+
+    // folder tree nodes don't maintain the items tail and count
+    int is_folder = coll == &reader->db->folders;
+
+    const ml_snapshot_item_t *items = (const ml_snapshot_item_t *)(reader->data + reader->layout.items[coll_index]);
+    ml_collection_track_ref_t *tail = NULL;
+    for (uint32_t i = 0; i < sn->item_count; i++) {
+        if (reader->item_pos >= reader->header->item_count[coll_index]) {
+            return -1;
+        }
+        const ml_snapshot_item_t *si = items + reader->item_pos++;
+        if (si->track >= reader->header->track_count) {
+            return -1;
+        }
+        ml_collection_track_ref_t *item = calloc (1, sizeof (ml_collection_track_ref_t));
+        item->row_id = si->row_id;
+        item->it = reader->tracks[si->track];
+        deadbeef->pl_item_ref (item->it);
+        if (tail) {
+            tail->next = item;
+        }
+        else {
+            node->items = item;
+        }
+        tail = item;
+        if (!is_folder) {
+            node->items_tail = item;
+            node->items_count++;
+        }
+    }
+
+    for (uint32_t i = 0; i < sn->child_count; i++) {
+        if (_restore_node (reader, coll_index, node, depth + 1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+_snapshot_restore (ml_snapshot_reader_t *reader, int track_count, char **medialib_paths, size_t medialib_paths_count) {
+    const ml_snapshot_header_t *header = reader->header;
+    const uint8_t *data = reader->data;
+    ml_db_t *db = reader->db;
+
+    // music folders
+    if (header->path_count != medialib_paths_count) {
+        return -1;
+    }
+    const uint32_t *paths = (const uint32_t *)(data + reader->layout.paths);
+    const uint32_t *string_offsets = (const uint32_t *)(data + reader->layout.string_offsets);
+    const char *string_data = (const char *)(data + reader->layout.string_data);
+    for (size_t i = 0; i < medialib_paths_count; i++) {
+        if (paths[i] == ML_SNAPSHOT_NONE || medialib_paths[i] == NULL) {
+            if (paths[i] != ML_SNAPSHOT_NONE || medialib_paths[i] != NULL) {
+                return -1;
+            }
+            continue;
+        }
+        if (paths[i] >= header->string_count || strcmp (string_data + string_offsets[paths[i]], medialib_paths[i])) {
+            return -1;
+        }
+    }
+
+    for (uint32_t i = 0; i < header->string_count; i++) {
+        reader->strings[i] = deadbeef->metacache_add_string (string_data + string_offsets[i]);
+    }
+
+    // the tracks must be the ones the snapshot was made for
+    const uint32_t *track_uris = (const uint32_t *)(data + reader->layout.track_uris);
+    for (int i = 0; i < track_count; i++) {
+        const char *uri;
+        if (_reader_string (reader, track_uris[i], 0, &uri)
+            || deadbeef->pl_find_meta (reader->tracks[i], ":URI") != uri) {
+            return -1;
+        }
+    }
+
+    for (int c = 0; c < ML_SNAPSHOT_COLLECTION_COUNT; c++) {
+        reader->node_pos = 0;
+        reader->item_pos = 0;
+        if (_restore_node (reader, c, NULL, 0)
+            || reader->node_pos != header->node_count[c]
+            || reader->item_pos != header->item_count[c]) {
+            return -1;
+        }
+    }
+
+    const uint32_t *track_keys = (const uint32_t *)(data + reader->layout.track_keys);
+    for (int i = 0; i < track_count; i++) {
+        const uint32_t *keys = track_keys + i * ML_SNAPSHOT_KEY_COUNT;
+        if (keys[0] == ML_SNAPSHOT_NONE) {
+            continue;
+        }
+        const char *values[ML_SNAPSHOT_KEY_COUNT];
+        for (int k = 0; k < ML_SNAPSHOT_KEY_COUNT; k++) {
+            if (_reader_string (reader, keys[k], 0, &values[k])) {
+                return -1;
+            }
+        }
+        ml_db_add_track_keys (db, reader->tracks[i], values[0], values[1], values[2], values[3], values[4]);
+    }
+
+    const uint32_t *filenames = (const uint32_t *)(data + reader->layout.filenames);
+    for (uint32_t i = 0; i < header->filename_count; i++) {
+        const char *file;
+        if (_reader_string (reader, filenames[i], 0, &file)) {
+            return -1;
+        }
+        uint32_t hash = ml_collection_hash_for_ptr ((void *)file);
+        ml_filename_hash_item_t *en = calloc (1, sizeof (ml_filename_hash_item_t));
+        en->file = deadbeef->metacache_add_string (file);
+        en->bucket_next = db->filename_hash[hash];
+        db->filename_hash[hash] = en;
+    }
+
+    db->row_id = header->row_id;
+    ml_db_set_music_paths (db, medialib_paths, medialib_paths_count);
+    return 0;
+}
+
+static int
+_snapshot_validate (const uint8_t *data, size_t size, int track_count, ml_snapshot_layout_t *layout) {
+    if (size < sizeof (ml_snapshot_header_t)) {
+        return -1;
+    }
+    const ml_snapshot_header_t *header = (const ml_snapshot_header_t *)data;
+    if (memcmp (header->magic, ML_SNAPSHOT_FILE_MAGIC, 4)
+        || header->version != ML_SNAPSHOT_FILE_VERSION
+        || header->byte_order != ML_SNAPSHOT_BYTE_ORDER
+        || header->track_count != (uint32_t)track_count) {
+        return -1;
+    }
+
+    _snapshot_layout (header, layout);
+    if (layout->size != size) {
+        return -1;
+    }
+
+    // all strings must be null-terminated within the string data
+    const uint32_t *string_offsets = (const uint32_t *)(data + layout->string_offsets);
+    const char *string_data = (const char *)(data + layout->string_data);
+    if (header->string_count > 0 && (header->string_data_size == 0 || string_data[header->string_data_size-1] != 0)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < header->string_count; i++) {
+        if (string_offsets[i] >= header->string_data_size) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+ml_snapshot_load (ml_db_t *db, ddb_playItem_t **tracks, int track_count, char **medialib_paths, size_t medialib_paths_count, const char *fname) {
+    memset (db, 0, sizeof (ml_db_t));
+
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat (fd, &st) || st.st_size < (off_t)sizeof (ml_snapshot_header_t) || (uint64_t)st.st_size > SIZE_MAX) {
+        close (fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+
+    void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    ml_snapshot_reader_t reader;
+    memset (&reader, 0, sizeof (reader));
+    reader.db = db;
+    reader.data = map;
+    reader.header = map;
+    reader.tracks = tracks;
+
+    int res = _snapshot_validate (map, size, track_count, &reader.layout);
+    if (!res) {
+        reader.strings = calloc (reader.header->string_count ? reader.header->string_count : 1, sizeof (const char *));
+        res = _snapshot_restore (&reader, track_count, medialib_paths, medialib_paths_count);
+
+        for (uint32_t i = 0; i < reader.header->string_count; i++) {
+            if (reader.strings[i]) {
+                deadbeef->metacache_remove_string (reader.strings[i]);
+            }
+        }
+        free (reader.strings);
+
+        if (res) {
+            ml_db_free (db);
+        }
+    }
+
+    munmap (map, size);
+    return res;
+}
+
+void
+ml_snapshot_init (DB_functions_t *_deadbeef) {
+    deadbeef = _deadbeef;
+}
@@ -0,0 +1,53 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2021 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef medialibsnapshot_h
+#define medialibsnapshot_h
+
+#include <stddef.h>
+#include <deadbeef/deadbeef.h>
+#include "medialibdb.h"
+
+// A snapshot of the built ml_db_t, which allows to skip indexing on startup.
+// Tracks are referenced by their index in the medialib playlist.
+
+/// Serialize the db into a newly allocated buffer, which is then written by @c ml_snapshot_write.
+/// @c tracks must be in the order of the medialib playlist.
+/// Returns 0 on success
+int
+ml_snapshot_build (ml_db_t *db, ddb_playItem_t **tracks, int track_count, void **data, size_t *size);
+
+/// Returns 0 on success
+int
+ml_snapshot_write (const void *data, size_t size, const char *fname);
+
+/// Restore the db from the snapshot, for the tracks of the loaded medialib playlist.
+/// Fails if the snapshot doesn't match the tracks or the music folders.
+/// Returns 0 on success
+int
+ml_snapshot_load (ml_db_t *db, ddb_playItem_t **tracks, int track_count, char **medialib_paths, size_t medialib_paths_count, const char *fname);
+
+void
+ml_snapshot_init (DB_functions_t *_deadbeef);
+
+#endif /* medialibsnapshot_h */
@@ -27,6 +27,7 @@
 #include "medialibcommon.h"
 #include "medialibfilesystem.h"
 #include "medialibscanner.h"
+#include "medialibsnapshot.h"
 #include "medialibsource.h"
 #include "medialibtree.h"
 
@@ -84,8 +85,33 @@ _ml_load_playlist (medialib_source_t *source, const char *plpath) {
     ml_scanner_configuration_t conf;
     conf.medialib_paths = _ml_source_get_music_paths (source, &conf.medialib_paths_count);
 
+    // The saved fulltext index is passed as the previous one,
+    // so that only the tracks which changed since it was saved need to be indexed.
+    __block ml_fulltext_index_t saved_fulltext = {0};
+    char snappath[PATH_MAX] = "";
+    if (!source->disable_file_operations) {
+        char ftpath[PATH_MAX];
+        snprintf (ftpath, sizeof (ftpath), "%s/medialib.ftidx", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+        ml_fulltext_load (&saved_fulltext, ftpath);
+        snprintf (snappath, sizeof (snappath), "%s/medialib.dbsnap", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    }
+
+    const char *snapshot_path = snappath;
     dispatch_sync(source->sync_queue, ^{
-        ml_index (&scanner, &conf, 0);
+        // The snapshot saved with the playlist allows to skip indexing
+        struct timeval tm_snap1, tm_snap2;
+        gettimeofday (&tm_snap1, NULL);
+        if (*snapshot_path && !ml_snapshot_load (&scanner.db, scanner.tracks, scanner.track_count, conf.medialib_paths, conf.medialib_paths_count, snapshot_path)) {
+            ml_fulltext_build (&scanner.db.fulltext, scanner.tracks, scanner.track_count, &saved_fulltext);
+            ml_fulltext_free (&saved_fulltext);
+            gettimeofday (&tm_snap2, NULL);
+            long snap_ms = (tm_snap2.tv_sec*1000+tm_snap2.tv_usec/1000) - (tm_snap1.tv_sec*1000+tm_snap1.tv_usec/1000);
+            fprintf (stderr, "ml snapshot load time: %f seconds\n", snap_ms / 1000.f);
+        }
+        else {
+            ml_index (&scanner, &conf, &saved_fulltext, 0);
+            ml_fulltext_free (&saved_fulltext);
+        }
     });
 
     ml_free_music_paths (conf.medialib_paths, conf.medialib_paths_count);
@@ -322,6 +348,34 @@ ml_refresh (ddb_mediasource_source_t _source) {
     });
 }
 
+void
+ml_rescan_paths (medialib_source_t *source, char **paths, size_t paths_count, char **folders, size_t folders_count) {
+    dispatch_async(source->scanner_queue, ^{
+        __block int cancel = 0;
+        __block ml_scanner_configuration_t conf = {0};
+        dispatch_sync(source->sync_queue, ^{
+            // Skip if a refresh is pending, or the source is being freed
+            if (source->scanner_terminate || !source->enabled || !source->ml_playlist) {
+                cancel = 1;
+                return;
+            }
+            conf.medialib_paths = _ml_source_get_music_paths (source, &conf.medialib_paths_count);
+        });
+
+        if (cancel || conf.medialib_paths == NULL) {
+            ml_free_music_paths (paths, paths_count);
+            ml_free_music_paths (folders, folders_count);
+            return;
+        }
+
+        conf.changed_paths = paths;
+        conf.changed_paths_count = paths_count;
+        conf.changed_folders = folders;
+        conf.changed_folders_count = folders_count;
+        scanner_thread(source, conf);
+    });
+}
+
 void
 ml_source_init (DB_functions_t *_deadbeef) {
     deadbeef = _deadbeef;
@@ -79,6 +79,13 @@ ml_is_source_enabled (ddb_mediasource_source_t _source);
 void
 ml_refresh (ddb_mediasource_source_t _source);
 
+/// Rescan the specified folders with their subfolders, and the @c folders without subfolders,
+/// or the whole library if both are NULL.
+/// Takes ownership of @c paths and @c folders.
+/// Doesn't wait for the sync_queue, so it can be called from the threads which the sync_queue waits for.
+void
+ml_rescan_paths (medialib_source_t *source, char **paths, size_t paths_count, char **folders, size_t folders_count);
+
 struct json_t *
 _ml_get_music_paths (medialib_source_t *source);
 
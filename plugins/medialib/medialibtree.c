@@ -326,7 +326,9 @@ _create_item_tree_from_collection(ml_collection_t *coll, const char *filter, med
     int selected = 0;
     if (filter && source->ml_playlist) {
         deadbeef->plt_search_reset (source->ml_playlist);
-        deadbeef->plt_search_process2 (source->ml_playlist, filter, 1);
+        if (ml_fulltext_select (&source->db.fulltext, filter) < 0) {
+            deadbeef->plt_search_process2 (source->ml_playlist, filter, 1);
+        }
         selected = 1;
     }
 
@@ -28,6 +28,7 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <deadbeef/deadbeef.h>
 #include <deadbeef/strdupa.h>
 #include "mp3.h"
@@ -60,6 +61,214 @@ DB_functions_t *deadbeef;
 static int
 cmp3_seek_sample64 (DB_fileinfo_t *_info, int64_t sample);
 
+// Seek indexes of the recently opened files, shared by the decoder instances,
+// keyed by path, size and modification time.
+// Optionally they are also saved to the cache folder, to survive restarts.
+#define SEEK_INDEX_CACHE_SIZE 8
+#define SEEK_INDEX_FILE_VERSION 1
+
+typedef struct seek_index_cache_s {
+    char *path;
+    int64_t fsize;
+    int64_t mtime;
+    mp3_seek_index_t *index;
+    struct seek_index_cache_s *next;
+} seek_index_cache_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t interval;
+    int64_t fsize;
+    int64_t mtime;
+    int64_t count;
+} seek_index_file_header_t;
+
+static uintptr_t seek_index_mutex;
+static seek_index_cache_t *seek_index_cache; // most recently used first
+
+static mp3_seek_index_t *
+_seek_index_copy (mp3_seek_index_t *index) {
+    mp3_seek_index_t *copy = mp3_seek_index_alloc ();
+    if (index->count > 0) {
+        copy->points = malloc (index->count * sizeof (mp3_seekpoint_t));
+        memcpy (copy->points, index->points, index->count * sizeof (mp3_seekpoint_t));
+        copy->count = copy->capacity = index->count;
+    }
+    return copy;
+}
+
+static void
+_seek_index_disk_path (const char *path, char *out, size_t size) {
+    uint8_t sig[16];
+    char sig_str[33];
+    deadbeef->md5 (sig, path, (int)strlen (path));
+    deadbeef->md5_to_str (sig_str, sig);
+    snprintf (out, size, "%s/mp3seek/%s.idx", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), sig_str);
+}
+
+static mp3_seek_index_t *
+_seek_index_load (const char *path, int64_t fsize, int64_t mtime) {
+    char fname[PATH_MAX];
+    _seek_index_disk_path (path, fname, sizeof (fname));
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return NULL;
+    }
+
+    mp3_seek_index_t *index = NULL;
+    seek_index_file_header_t hdr;
+    if (fread (&hdr, sizeof (hdr), 1, fp) != 1
+        || memcmp (hdr.magic, "DDBMP3SI", 8)
+        || hdr.version != SEEK_INDEX_FILE_VERSION
+        || hdr.interval != MP3_SEEK_INDEX_INTERVAL
+        || hdr.fsize != fsize
+        || hdr.mtime != mtime
+        || hdr.count <= 0
+        || hdr.count > fsize / MP3_SEEK_INDEX_INTERVAL) {
+        goto error;
+    }
+
+    index = mp3_seek_index_alloc ();
+    index->points = malloc (hdr.count * sizeof (mp3_seekpoint_t));
+    index->capacity = (int)hdr.count;
+    if (fread (index->points, sizeof (mp3_seekpoint_t), hdr.count, fp) != hdr.count) {
+        mp3_seek_index_free (index);
+        index = NULL;
+        goto error;
+    }
+    index->count = (int)hdr.count;
+
+error:
+    fclose (fp);
+    return index;
+}
+
+static void
+_seek_index_save (const char *path, int64_t fsize, int64_t mtime, mp3_seek_index_t *index) {
+    char dir[PATH_MAX];
+    snprintf (dir, sizeof (dir), "%s", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE));
+    mkdir (dir, 0755);
+    strncat (dir, "/mp3seek", sizeof (dir) - strlen (dir) - 1);
+    mkdir (dir, 0755);
+
+    char fname[PATH_MAX];
+    _seek_index_disk_path (path, fname, sizeof (fname));
+    char tmp[PATH_MAX];
+    snprintf (tmp, sizeof (tmp), "%s.part", fname);
+    FILE *fp = fopen (tmp, "wb");
+    if (!fp) {
+        return;
+    }
+
+    seek_index_file_header_t hdr = {
+        .version = SEEK_INDEX_FILE_VERSION,
+        .interval = MP3_SEEK_INDEX_INTERVAL,
+        .fsize = fsize,
+        .mtime = mtime,
+        .count = index->count,
+    };
+    memcpy (hdr.magic, "DDBMP3SI", 8);
+    int err = fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+        || fwrite (index->points, sizeof (mp3_seekpoint_t), index->count, fp) != index->count;
+    if (fclose (fp) || err || rename (tmp, fname)) {
+        unlink (tmp);
+    }
+}
+
+// @return a private copy of the cached index for the file, or a new empty index
+static mp3_seek_index_t *
+_seek_index_acquire (const char *path, int64_t fsize, int64_t mtime) {
+    mp3_seek_index_t *index = NULL;
+    deadbeef->mutex_lock (seek_index_mutex);
+    seek_index_cache_t *prev = NULL;
+    for (seek_index_cache_t *c = seek_index_cache; c; prev = c, c = c->next) {
+        if (!strcmp (c->path, path) && c->fsize == fsize && c->mtime == mtime) {
+            index = _seek_index_copy (c->index);
+            if (prev) {
+                prev->next = c->next;
+                c->next = seek_index_cache;
+                seek_index_cache = c;
+            }
+            break;
+        }
+    }
+    deadbeef->mutex_unlock (seek_index_mutex);
+
+    if (!index && deadbeef->conf_get_int ("mp3.seek_index_disk_cache", 0)) {
+        index = _seek_index_load (path, fsize, mtime);
+    }
+    return index ? index : mp3_seek_index_alloc ();
+}
+
+// takes ownership of the index, and keeps it if it has more seek points than the cached one
+static void
+_seek_index_publish (const char *path, int64_t fsize, int64_t mtime, mp3_seek_index_t *index) {
+    deadbeef->mutex_lock (seek_index_mutex);
+    seek_index_cache_t *c = seek_index_cache;
+    seek_index_cache_t *prev = NULL;
+    for (; c; prev = c, c = c->next) {
+        if (!strcmp (c->path, path)) {
+            break;
+        }
+    }
+    if (c) {
+        if (prev) {
+            prev->next = c->next;
+            c->next = seek_index_cache;
+            seek_index_cache = c;
+        }
+        if (c->fsize == fsize && c->mtime == mtime && c->index->count >= index->count) {
+            mp3_seek_index_free (index);
+            index = NULL;
+        }
+        else {
+            mp3_seek_index_free (c->index);
+            c->index = index;
+            c->fsize = fsize;
+            c->mtime = mtime;
+        }
+    }
+    else {
+        c = calloc (1, sizeof (seek_index_cache_t));
+        c->path = strdup (path);
+        c->fsize = fsize;
+        c->mtime = mtime;
+        c->index = index;
+        c->next = seek_index_cache;
+        seek_index_cache = c;
+
+        // drop the least recently used
+        int n = 0;
+        for (seek_index_cache_t *p = seek_index_cache; p; p = p->next) {
+            if (++n == SEEK_INDEX_CACHE_SIZE && p->next) {
+                seek_index_cache_t *last = p->next;
+                p->next = NULL;
+                free (last->path);
+                mp3_seek_index_free (last->index);
+                free (last);
+                break;
+            }
+        }
+    }
+
+    if (index && deadbeef->conf_get_int ("mp3.seek_index_disk_cache", 0)) {
+        _seek_index_save (path, fsize, mtime, index);
+    }
+    deadbeef->mutex_unlock (seek_index_mutex);
+}
+
+static void
+_seek_index_cache_free (void) {
+    while (seek_index_cache) {
+        seek_index_cache_t *next = seek_index_cache->next;
+        free (seek_index_cache->path);
+        mp3_seek_index_free (seek_index_cache->index);
+        free (seek_index_cache);
+        seek_index_cache = next;
+    }
+}
+
 int
 cmp3_seek_stream (DB_fileinfo_t *_info, int64_t sample) {
     mp3_info_t *info = (mp3_info_t *)_info;
@@ -72,7 +281,7 @@ cmp3_seek_stream (DB_fileinfo_t *_info, int64_t sample) {
 #endif
 
     mp3info_t mp3info;
-    int res = mp3_parse_file(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample);
+    int res = mp3_parse_file_indexed(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample, info->seek_index);
 
     if (!res) {
         deadbeef->fseek (info->file, mp3info.packet_offs, SEEK_SET);
@@ -216,8 +425,8 @@ cmp3_set_extra_properties (DB_playItem_t *it, mp3info_t *mp3info, int fake) {
 }
 
 static int
-_mp3_parse_and_validate (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample) {
-    int res = mp3_parse_file(info, flags, fp, fsize, startoffs, endoffs, seek_to_sample);
+_mp3_parse_and_validate (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seek_index_t *index) {
+    int res = mp3_parse_file_indexed(info, flags, fp, fsize, startoffs, endoffs, seek_to_sample, index);
     if (res < 0) {
         return res;
     }
@@ -276,7 +485,18 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         if (info->startoffs > 0) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", info->startoffs, info->endoffs);
         }
-        int res = _mp3_parse_and_validate(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1);
+
+        // only index files which can be identified by modification time
+        struct stat st;
+        if (!stat (uri, &st)) {
+            info->seek_index_path = strdup (uri);
+            info->seek_index_fsize = deadbeef->fgetlength(info->file);
+            info->seek_index_mtime = (int64_t)st.st_mtime;
+            info->seek_index = _seek_index_acquire (uri, info->seek_index_fsize, info->seek_index_mtime);
+            info->seek_index_initial_count = info->seek_index->count;
+        }
+
+        int res = _mp3_parse_and_validate(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1, info->seek_index);
         if (res < 0) {
             trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
             return -1;
@@ -304,7 +524,7 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     else {
         info->startoffs = (uint32_t)deadbeef->junk_get_leading_size(info->file);
         deadbeef->pl_add_meta (it, "title", NULL);
-        int res = _mp3_parse_and_validate(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, 0, -1);
+        int res = _mp3_parse_and_validate(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, 0, -1, NULL);
         if (res < 0) {
             trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
             return -1;
@@ -438,6 +658,15 @@ cmp3_free (DB_fileinfo_t *_info) {
         info->info.file = NULL;
         info->dec->free (info);
     }
+    if (info->seek_index) {
+        if (info->seek_index->count > info->seek_index_initial_count) {
+            _seek_index_publish (info->seek_index_path, info->seek_index_fsize, info->seek_index_mtime, info->seek_index);
+        }
+        else {
+            mp3_seek_index_free (info->seek_index);
+        }
+    }
+    free (info->seek_index_path);
     free (info);
 }
 
@@ -625,7 +854,7 @@ cmp3_insert (ddb_playlist_t *plt, DB_playItem_t *after, const char *fname) {
         mp3flags = MP3_PARSE_ESTIMATE_DURATION;
     }
 
-    int res = _mp3_parse_and_validate(&mp3info, mp3flags, fp, fsize, start, end, -1);
+    int res = _mp3_parse_and_validate(&mp3info, mp3flags, fp, fsize, start, end, -1, NULL);
 
     if (res < 0) {
         trace ("mp3: mp3_parse_file returned error\n");
@@ -722,12 +951,29 @@ cmp3_write_metadata (DB_playItem_t *it) {
     return deadbeef->junk_rewrite_tags (it, junk_flags, id3v2_version, id3v1_encoding);
 }
 
+static int
+cmp3_start (void) {
+    seek_index_mutex = deadbeef->mutex_create ();
+    return 0;
+}
+
+static int
+cmp3_stop (void) {
+    _seek_index_cache_free ();
+    if (seek_index_mutex) {
+        deadbeef->mutex_free (seek_index_mutex);
+        seek_index_mutex = 0;
+    }
+    return 0;
+}
+
 static const char *exts[] = {
 	"mp1", "mp2", "mp3", "mpga", NULL
 };
 
 static const char settings_dlg[] =
     "property \"Force 16 bit output\" checkbox mp3.force16bit 0;\n"
+    "property \"Save seek indexes to disk\" checkbox mp3.seek_index_disk_cache 0;\n"
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     "property \"Backend\" select[2] mp3.backend 0 mpg123 mad;\n"
 #endif
@@ -777,6 +1023,8 @@ static ddb_decoder2_t plugin = {
     ,
     .decoder.plugin.website = "http://deadbeef.sf.net",
     .decoder.plugin.configdialog = settings_dlg,
+    .decoder.plugin.start = cmp3_start,
+    .decoder.plugin.stop = cmp3_stop,
     .decoder.open = cmp3_open,
     .decoder.init = cmp3_init,
     .decoder.free = cmp3_free,
@@ -91,6 +91,13 @@ typedef struct {
     int want_16bit;
     int raw_signal;
     struct mp3_decoder_api_s *dec;
+
+    // private copy of the file's seek index, published to the cache on free
+    mp3_seek_index_t *seek_index;
+    int seek_index_initial_count;
+    char *seek_index_path;
+    int64_t seek_index_fsize;
+    int64_t seek_index_mtime;
 } mp3_info_t;
 
 typedef struct mp3_decoder_api_s {
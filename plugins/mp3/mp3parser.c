@@ -400,8 +400,70 @@ _packet_same_fmt (mp3packet_t *ref_packet, mp3packet_t *packet) {
         && packet->ver == ref_packet->ver;
 }
 
+mp3_seek_index_t *
+mp3_seek_index_alloc (void) {
+    return calloc (1, sizeof (mp3_seek_index_t));
+}
+
+void
+mp3_seek_index_free (mp3_seek_index_t *index) {
+    free (index->points);
+    free (index);
+}
+
+void
+mp3_seek_index_append (mp3_seek_index_t *index, int64_t offs, int64_t sample) {
+    if (index->count == index->capacity) {
+        int capacity = index->capacity ? index->capacity * 2 : 256;
+        mp3_seekpoint_t *points = realloc (index->points, capacity * sizeof (mp3_seekpoint_t));
+        if (!points) {
+            return;
+        }
+        index->points = points;
+        index->capacity = capacity;
+    }
+    index->points[index->count].offs = offs;
+    index->points[index->count].sample = sample;
+    index->count++;
+}
+
+mp3_seekpoint_t *
+mp3_seek_index_find (mp3_seek_index_t *index, int64_t sample) {
+    // the packet at the returned point must not contain the sample,
+    // to stop at the same packet as a scan from the start
+    int lo = 0;
+    int hi = index->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index->points[mid].sample < sample) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? &index->points[lo-1] : NULL;
+}
+
+// adds a seek point for the packet, if it's far enough past the last one
+static void
+_index_packet (mp3_seek_index_t *index, mp3packet_t *packet, int64_t sample) {
+    if (index->count > 0) {
+        mp3_seekpoint_t *last = &index->points[index->count-1];
+        if (sample - last->sample < (int64_t)packet->samples_per_frame * MP3_SEEK_INDEX_INTERVAL) {
+            return;
+        }
+    }
+    mp3_seek_index_append (index, packet->offs, sample);
+}
+
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample) {
+    return mp3_parse_file_indexed (info, flags, fp, fsize, startoffs, endoffs, seek_to_sample, NULL);
+}
+
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seek_index_t *index) {
 #if PERFORMANCE_STATS
     struct timeval start_tv;
     struct timeval end_tv;
@@ -441,6 +503,41 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
     int64_t offs = startoffs;
     int64_t fileoffs = startoffs;
 
+    // sample position of the next packet, counted the same way as pcmsample when seeking
+    int64_t index_sample = 0;
+
+    if (info->is_streaming || fsize <= 0) {
+        index = NULL;
+    }
+
+    mp3_seekpoint_t *resume = NULL;
+    if (index && seek_to_sample > 0) {
+        resume = mp3_seek_index_find (index, seek_to_sample);
+    }
+    if (resume) {
+        // the packet at the seek point becomes the reference for the following ones,
+        // and the file is checked to still have a packet there
+        uint8_t fhdr[4];
+        deadbeef->fseek (fp, resume->offs, SEEK_SET);
+        info->num_seeks++;
+        if (deadbeef->fread (fhdr, 1, sizeof (fhdr), fp) == sizeof (fhdr)
+            && _parse_packet (&info->ref_packet, fhdr) > 0) {
+            info->num_reads++;
+            info->bytes_read += sizeof (fhdr);
+            info->checked_xing_header = 1;
+            info->npackets = 1;
+            info->pcmsample = resume->sample;
+            index_sample = resume->sample;
+            offs = resume->offs;
+            fileoffs = resume->offs + sizeof (fhdr);
+        }
+        else {
+            memset (&info->ref_packet, 0, sizeof (mp3packet_t));
+            deadbeef->fseek (fp, startoffs, SEEK_SET);
+            info->num_seeks++;
+        }
+    }
+
     int prev_br = -1;
     int prev_length = -1;
     int variable_packets = 0;
@@ -560,6 +657,10 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
             }
 
             if (!got_xing) {
+                if (index) {
+                    _index_packet (index, &packet, index_sample);
+                }
+
                 // interrupt if the current packet contains the sample being seeked to
                 if (seek_to_sample > 0 && info->pcmsample+packet.samples_per_frame >= seek_to_sample) {
                     goto end;
@@ -569,6 +670,7 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
                     goto end;
                 }
                 memcpy (&info->prev_packet, &packet, sizeof (packet));
+                index_sample += packet.samples_per_frame;
             }
 
             if (!variable_packets && (prev_br != -1 || prev_length != -1)) {
@@ -103,6 +103,36 @@ typedef struct {
     uint64_t bytes_read;
 } mp3info_t;
 
+// one seek point is added every MP3_SEEK_INDEX_INTERVAL packets
+#define MP3_SEEK_INDEX_INTERVAL 32
+
+typedef struct {
+    int64_t offs; // stream position of the packet
+    int64_t sample; // sample position at the start of the packet, same as mp3info_t.pcmsample
+} mp3_seekpoint_t;
+
+// Sparse map of packet offsets, filled in while scanning the file.
+// Seeks resume scanning from the nearest seek point, instead of the start of the file,
+// and extend the index when they scan past its end.
+typedef struct {
+    mp3_seekpoint_t *points;
+    int count;
+    int capacity;
+} mp3_seek_index_t;
+
+mp3_seek_index_t *
+mp3_seek_index_alloc (void);
+
+void
+mp3_seek_index_free (mp3_seek_index_t *index);
+
+void
+mp3_seek_index_append (mp3_seek_index_t *index, int64_t offs, int64_t sample);
+
+// returns the last seek point before the sample, or NULL if there is none
+mp3_seekpoint_t *
+mp3_seek_index_find (mp3_seek_index_t *index, int64_t sample);
+
 // Params:
 // seek_to_sample: -1 means to the end (scan whole file), otherwise a sample to seek to
 // When seeking, the packet offset returned will be the one containing seek_to_sample, not accounting for delay.
@@ -118,6 +148,12 @@ typedef struct {
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample);
 
+// Same as mp3_parse_file, but seeks start from the nearest point of the index,
+// and the packets scanned past the last seek point are added to it.
+// index may be NULL.
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seek_index_t *index);
+
 #ifdef __cplusplus
 }
 #endif
@@ -887,7 +887,8 @@ project "converter"
     "plugins/converter/converter.c",
     "shared/mp4tagutil.c"
   }
-  links {"mp4p"}
+  buildoptions {"-fblocks"}
+  links {"mp4p", "dispatch", "BlocksRuntime"}
 end
 
 if option ("plugin-shellexec", "jansson") then
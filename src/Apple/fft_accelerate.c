@@ -77,6 +77,13 @@ fft_calculate (const float *data, float *freq, int fft_size) {
     vDSP_vsmul(_sq_mags, 1, &mult, freq, 1, fft_size);
 }
 
+void
+fft_calculate_channels (const float *data, float *freq, int fft_size, int channels) {
+    for (int c = 0; c < channels; c++) {
+        fft_calculate (data + fft_size * 2 * c, freq + fft_size * c, fft_size);
+    }
+}
+
 void
 fft_free (void) {
     free (_input_real);
@@ -95,5 +102,6 @@ fft_free (void) {
     _dft_setup = NULL;
     _output_real = NULL;
     _output_imaginary = NULL;
+    _fft_size = 0;
 }
 
@@ -42,14 +42,211 @@
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
+// Items are kept in a list sorted by key, ignoring case, which is the order of the config file,
+// and indexed by a hash table of the keys.
+// Reading a single value doesn't take the lock: replaced values, removed items and old hash tables
+// are retired, and freed by a writer when no reader is active.
+typedef struct conf_item_s {
+    DB_conf_item_t item;
+    struct conf_item_s *hash_next;
+    uint32_t hash;
+} conf_item_t;
+
+typedef struct {
+    uint32_t mask;
+    conf_item_t *buckets[];
+} conf_hash_t;
+
+#define CONF_HASH_MIN_SIZE 256
+
 static DB_conf_item_t *conf_items;
+static int conf_count;
+static DB_conf_item_t *conf_insert_hint; // the last inserted item, which makes loading a sorted file linear
+static conf_hash_t *conf_hash;
+static uint32_t conf_hash_generation; // odd while the hash chains are rebuilt
+static DB_conf_item_t **conf_sorted; // for prefix lookups, rebuilt on demand
+static int conf_sorted_valid;
+static int conf_readers;
+static void **conf_retired;
+static int conf_retired_count;
+static int conf_retired_size;
 static int changed;
 static uintptr_t mutex;
 static int disable_saving;
 
+static uint32_t
+conf_hash_key (const char *key) {
+    uint32_t hash = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        uint8_t c = *p;
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+static conf_item_t *
+conf_hash_find (const char *key, uint32_t hash) {
+    conf_hash_t *table = __atomic_load_n (&conf_hash, __ATOMIC_ACQUIRE);
+    if (!table) {
+        return NULL;
+    }
+    conf_item_t *it = __atomic_load_n (&table->buckets[hash & table->mask], __ATOMIC_ACQUIRE);
+    for (; it; it = __atomic_load_n (&it->hash_next, __ATOMIC_ACQUIRE)) {
+        if (it->hash == hash && !strcasecmp (key, it->item.key)) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+static void
+conf_retire (void *ptr) {
+    if (conf_retired_count == conf_retired_size) {
+        conf_retired_size = conf_retired_size ? conf_retired_size * 2 : 64;
+        conf_retired = realloc (conf_retired, conf_retired_size * sizeof (void *));
+    }
+    conf_retired[conf_retired_count++] = ptr;
+}
+
+// frees the retired memory if no reader could be using it
+static void
+conf_reclaim (void) {
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (!conf_retired_count || __atomic_load_n (&conf_readers, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    for (int i = 0; i < conf_retired_count; i++) {
+        free (conf_retired[i]);
+    }
+    conf_retired_count = 0;
+}
+
+static void
+conf_read_begin (void) {
+    __atomic_add_fetch (&conf_readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void
+conf_read_end (void) {
+    __atomic_sub_fetch (&conf_readers, 1, __ATOMIC_RELEASE);
+}
+
+// must be called between conf_read_begin and conf_read_end, or with the lock held
+static const char *
+conf_find_value (const char *key) {
+    uint32_t hash = conf_hash_key (key);
+    uint32_t generation = __atomic_load_n (&conf_hash_generation, __ATOMIC_ACQUIRE);
+    conf_item_t *it = conf_hash_find (key, hash);
+    if (it) {
+        return __atomic_load_n (&it->item.value, __ATOMIC_ACQUIRE);
+    }
+    if ((generation & 1) || generation != __atomic_load_n (&conf_hash_generation, __ATOMIC_ACQUIRE)) {
+        // the chains were being rebuilt, look again under the lock
+        conf_lock ();
+        it = conf_hash_find (key, hash);
+        const char *value = it ? it->item.value : NULL;
+        conf_unlock ();
+        return value;
+    }
+    return NULL;
+}
+
+static void
+conf_hash_insert (conf_hash_t *table, conf_item_t *it) {
+    conf_item_t **bucket = &table->buckets[it->hash & table->mask];
+    it->hash_next = *bucket;
+    __atomic_store_n (bucket, it, __ATOMIC_RELEASE);
+}
+
+static void
+conf_hash_resize (uint32_t size) {
+    conf_hash_t *table = calloc (1, sizeof (conf_hash_t) + size * sizeof (conf_item_t *));
+    table->mask = size - 1;
+    conf_hash_t *prev = conf_hash;
+
+    // readers of the previous table may miss items while their chains are relinked
+    __atomic_add_fetch (&conf_hash_generation, 1, __ATOMIC_SEQ_CST);
+    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+        conf_hash_insert (table, (conf_item_t *)it);
+    }
+    __atomic_store_n (&conf_hash, table, __ATOMIC_RELEASE);
+    __atomic_add_fetch (&conf_hash_generation, 1, __ATOMIC_SEQ_CST);
+
+    if (prev) {
+        conf_retire (prev);
+    }
+}
+
+static void
+conf_hash_remove (conf_item_t *it) {
+    conf_item_t **p = &conf_hash->buckets[it->hash & conf_hash->mask];
+    while (*p != it) {
+        p = &(*p)->hash_next;
+    }
+    __atomic_store_n (p, it->hash_next, __ATOMIC_RELEASE);
+}
+
+static void
+conf_item_retire (DB_conf_item_t *it) {
+    conf_retire (it->key);
+    conf_retire (it->value);
+    conf_retire (it);
+}
+
+// unlinks the item from the list and the hash table, prev is the preceding item in the list or NULL
+static void
+conf_item_remove (DB_conf_item_t *prev, DB_conf_item_t *it) {
+    if (prev) {
+        prev->next = it->next;
+    }
+    else {
+        conf_items = it->next;
+    }
+    conf_hash_remove ((conf_item_t *)it);
+    if (conf_insert_hint == it) {
+        conf_insert_hint = NULL;
+    }
+    conf_count--;
+    conf_sorted_valid = 0;
+    conf_item_retire (it);
+}
+
+// returns the first item with a key not less than the given one
+static DB_conf_item_t *
+conf_lower_bound (const char *key) {
+    conf_lock ();
+    if (!conf_sorted_valid) {
+        free (conf_sorted);
+        conf_sorted = malloc ((conf_count + 1) * sizeof (DB_conf_item_t *));
+        int i = 0;
+        for (DB_conf_item_t *it = conf_items; it; it = it->next) {
+            conf_sorted[i++] = it;
+        }
+        conf_sorted_valid = 1;
+    }
+    int lo = 0;
+    int hi = conf_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcasecmp (conf_sorted[mid]->key, key) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    DB_conf_item_t *it = lo < conf_count ? conf_sorted[lo] : NULL;
+    conf_unlock ();
+    return it;
+}
+
 void
 conf_init (void) {
     mutex = mutex_create ();
+    conf_hash_resize (CONF_HASH_MIN_SIZE);
 }
 
 void
@@ -71,6 +268,19 @@ conf_free (void) {
         conf_item_free (it);
     }
     conf_items = NULL;
+    conf_count = 0;
+    conf_insert_hint = NULL;
+    for (int i = 0; i < conf_retired_count; i++) {
+        free (conf_retired[i]);
+    }
+    free (conf_retired);
+    conf_retired = NULL;
+    conf_retired_count = conf_retired_size = 0;
+    free (conf_hash);
+    conf_hash = NULL;
+    free (conf_sorted);
+    conf_sorted = NULL;
+    conf_sorted_valid = 0;
     changed = 0;
     mutex_unlock (mutex);
     mutex_free (mutex);
@@ -255,18 +465,17 @@ conf_item_free (DB_conf_item_t *it) {
 
 const char *
 conf_get_str_fast (const char *key, const char *def) {
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        if (!strcasecmp (key, it->key)) {
-            return it->value;
-        }
-    }
-    return def;
+    conf_item_t *it = conf_hash_find (key, conf_hash_key (key));
+    return it ? it->item.value : def;
 }
 
 void
 conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
-    conf_lock ();
-    const char *out = conf_get_str_fast (key, def);
+    conf_read_begin ();
+    const char *out = conf_find_value (key);
+    if (!out) {
+        out = def;
+    }
     if (out) {
         size_t n = strlen (out)+1;
         n = min (n, buffer_size);
@@ -276,43 +485,43 @@ conf_get_str (const char *key, const char *def, char *buffer, int buffer_size) {
     else {
         *buffer = 0;
     }
-    conf_unlock ();
+    conf_read_end ();
 }
 
 float
 conf_get_float (const char *key, float def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_find_value (key);
     float res = v ? (float)atof (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
 int
 conf_get_int (const char *key, int def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_find_value (key);
     int res = v ? atoi (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
 int64_t
 conf_get_int64 (const char *key, int64_t def) {
-    conf_lock ();
-    const char *v = conf_get_str_fast (key, NULL);
+    conf_read_begin ();
+    const char *v = conf_find_value (key);
     int64_t res = v ? atoll (v) : def;
-    conf_unlock ();
+    conf_read_end ();
     return res;
 }
 
 DB_conf_item_t *
 conf_find (const char *group, DB_conf_item_t *prev) {
     size_t l = strlen (group);
-    for (DB_conf_item_t *it = prev ? prev->next : conf_items; it; it = it->next) {
-        if (!strncasecmp (group, it->key, l)) {
-            return it;
-        }
+    // the list is sorted, so the items starting with the group are adjacent
+    DB_conf_item_t *it = prev ? prev->next : conf_lower_bound (group);
+    if (it && !strncasecmp (group, it->key, l)) {
+        return it;
     }
     return NULL;
 }
@@ -320,55 +529,67 @@ conf_find (const char *group, DB_conf_item_t *prev) {
 void
 conf_set_str (const char *key, const char *val) {
     conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    for (DB_conf_item_t *it = conf_items; it; it = it->next) {
-        int cmp = strcasecmp (key, it->key);
-        if (!cmp) {
-            if (val == NULL) {
-                if (prev != NULL) {
-                    prev->next = it->next;
-                }
-                else {
-                    conf_items = it->next;
-                }
-                conf_item_free (it);
-                conf_unlock ();
-                return;
-            }
-
-            if (!strcmp (it->value, val)) {
-                conf_unlock ();
-                return;
+    uint32_t hash = conf_hash_key (key);
+    conf_item_t *found = conf_hash_find (key, hash);
+    if (found) {
+        if (val == NULL) {
+            DB_conf_item_t *prev = NULL;
+            for (DB_conf_item_t *it = conf_items; it != &found->item; it = it->next) {
+                prev = it;
             }
-            free (it->value);
-            it->value = strdup (val);
-            conf_unlock ();
-            changed = 1;
-            return;
+            conf_item_remove (prev, &found->item);
         }
-        else if (cmp < 0) {
-            break;
+        else if (strcmp (found->item.value, val)) {
+            char *value = found->item.value;
+            __atomic_store_n (&found->item.value, strdup (val), __ATOMIC_RELEASE);
+            conf_retire (value);
+            changed = 1;
         }
-        prev = it;
+        conf_reclaim ();
+        conf_unlock ();
+        return;
     }
     if (!val) {
         conf_unlock ();
         return;
     }
-    DB_conf_item_t *it = malloc (sizeof (DB_conf_item_t));
-    memset (it, 0, sizeof (DB_conf_item_t));
+
+    // find the preceding item in the sorted list
+    DB_conf_item_t *prev = NULL;
+    DB_conf_item_t *next = conf_items;
+    if (conf_insert_hint && strcasecmp (conf_insert_hint->key, key) < 0) {
+        prev = conf_insert_hint;
+        next = prev->next;
+    }
+    while (next && strcasecmp (next->key, key) < 0) {
+        prev = next;
+        next = next->next;
+    }
+
+    conf_item_t *item = calloc (1, sizeof (conf_item_t));
+    DB_conf_item_t *it = &item->item;
     it->key = strdup (key);
     it->value = strdup (val);
-    changed = 1;
+    item->hash = hash;
+    it->next = next;
     if (prev) {
-        DB_conf_item_t *next = prev->next;
         prev->next = it;
-        it->next = next;
     }
     else {
-        it->next = conf_items;
         conf_items = it;
     }
+    conf_insert_hint = it;
+    conf_count++;
+    conf_sorted_valid = 0;
+    changed = 1;
+
+    if ((uint32_t)conf_count > conf_hash->mask + 1) {
+        conf_hash_resize ((conf_hash->mask + 1) * 2);
+    }
+    else {
+        conf_hash_insert (conf_hash, item);
+    }
+    conf_reclaim ();
     conf_unlock ();
 }
 
@@ -407,28 +628,19 @@ void
 conf_remove_items (const char *key) {
     size_t l = strlen (key);
     conf_lock ();
-    DB_conf_item_t *prev = NULL;
-    DB_conf_item_t *it;
-    for (it = conf_items; it; prev = it, it = it->next) {
-        if (!strncasecmp (key, it->key, l)) {
-            changed = 1;
-            break;
+    DB_conf_item_t *first = conf_lower_bound (key);
+    if (first && !strncasecmp (key, first->key, l)) {
+        DB_conf_item_t *prev = NULL;
+        for (DB_conf_item_t *it = conf_items; it != first; it = it->next) {
+            prev = it;
         }
-    }
-    DB_conf_item_t *next = NULL;
-    while (it) {
-        next = it->next;
-        conf_item_free (it);
-        it = next;
-        if (!it || strncasecmp (key, it->key, l)) {
-            break;
+        while (first && !strncasecmp (key, first->key, l)) {
+            DB_conf_item_t *next = first->next;
+            conf_item_remove (prev, first);
+            first = next;
         }
-    }
-    if (prev) {
-        prev->next = next;
-    }
-    else {
-        conf_items = next;
+        changed = 1;
+        conf_reclaim ();
     }
     conf_unlock ();
 }
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <dispatch/dispatch.h>
 #include <deadbeef/deadbeef.h>
 #include "dsp.h"
 #include "streamer.h"
@@ -33,6 +34,7 @@
 #include "plugins.h"
 #include "conf.h"
 #include "premix.h"
+#include "threading.h"
 
 static ddb_dsp_context_t *_current_dsp_chain;
 static DB_dsp_t *_eqplug;
@@ -45,14 +47,61 @@ static int _dsp_input_buffer_size;
 static char *_dsp_temp_buffer;
 static int _dsp_temp_buffer_size;
 
+// Pipelined mode: the enabled DSPs are split into stages, each running on its own worker thread,
+// and the block is processed in chunks, so that the stages work on different chunks at the same time.
+// Each stage waits on its semaphore, processes the next chunk in place, and signals the next stage.
+// dsp_apply waits for the last chunk, so the output is complete when it returns, and no latency is added.
+// dsp_apply is called on the output thread, which may be realtime, so the workers are started
+// with the priority of the calling thread, to avoid priority inversion while it waits.
+// The stages work in lockstep within each block: the first and the last stages idle
+// while the pipeline fills and drains, so the speedup stays below the number of stages,
+// and the slowest stage bounds it. Each chunk costs a semaphore round trip per stage,
+// which may outweigh the gain for blocks just above 512 frames, split into two chunks.
+#define DSP_PIPELINE_MAX_STAGES 8
+#define DSP_PIPELINE_MAX_CHUNKS 16
+#define DSP_PIPELINE_MIN_CHUNK_FRAMES 256
+
+typedef struct {
+    char *buffer;
+    int size;
+    int nframes;
+    int maxframes;
+    float ratio;
+    ddb_waveformat_t fmt;
+} dsp_chunk_t;
+
+typedef struct {
+    // range of the chain processed by the stage, end is exclusive
+    ddb_dsp_context_t *first;
+    ddb_dsp_context_t *end;
+    int next_chunk;
+} dsp_stage_t;
+
+static int _pipeline_enabled;
+static int _pipeline_nthreads;
+static int _pipeline_terminate;
+static intptr_t _pipeline_tids[DSP_PIPELINE_MAX_STAGES];
+// _pipeline_ready[i] is signaled when a chunk is ready for stage i
+static dispatch_semaphore_t _pipeline_ready[DSP_PIPELINE_MAX_STAGES];
+// signaled by the last stage when a chunk is done
+static dispatch_semaphore_t _pipeline_done;
+static dsp_stage_t _pipeline_stages[DSP_PIPELINE_MAX_STAGES];
+static int _pipeline_nstages;
+static dsp_chunk_t _pipeline_chunks[DSP_PIPELINE_MAX_CHUNKS];
+
 void
 streamer_dsp_postinit (void);
 
 static void
 free_dsp_buffers (void);
 
+static void
+_pipeline_stop (void);
+
 void
 dsp_free (void) {
+    _pipeline_stop ();
+
     dsp_chain_free (_current_dsp_chain);
     _current_dsp_chain = NULL;
 
@@ -112,6 +161,187 @@ static void
 free_dsp_buffers (void) {
     ensure_dsp_input_buffer (0);
     ensure_dsp_temp_buffer (0);
+    for (int i = 0; i < DSP_PIPELINE_MAX_CHUNKS; i++) {
+        free (_pipeline_chunks[i].buffer);
+        _pipeline_chunks[i].buffer = NULL;
+        _pipeline_chunks[i].size = 0;
+    }
+}
+
+static void
+_pipeline_worker (void *ctx) {
+    int stage_index = (int)(intptr_t)ctx;
+    for (;;) {
+        dispatch_semaphore_wait (_pipeline_ready[stage_index], DISPATCH_TIME_FOREVER);
+        if (__atomic_load_n (&_pipeline_terminate, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        dsp_stage_t *stage = &_pipeline_stages[stage_index];
+        dsp_chunk_t *chunk = &_pipeline_chunks[stage->next_chunk++];
+        for (ddb_dsp_context_t *dsp = stage->first; dsp != stage->end; dsp = dsp->next) {
+            if (dsp->enabled) {
+                float r = 1;
+                chunk->nframes = dsp->plugin->process (dsp, (float *)chunk->buffer, chunk->nframes, chunk->maxframes, &chunk->fmt, &r);
+                chunk->ratio *= r;
+            }
+        }
+        if (stage_index + 1 < _pipeline_nstages) {
+            dispatch_semaphore_signal (_pipeline_ready[stage_index + 1]);
+        }
+        else {
+            dispatch_semaphore_signal (_pipeline_done);
+        }
+    }
+}
+
+// Starts the worker threads, if less than nthreads are running.
+// @return the number of running threads
+static int
+_pipeline_start (int nthreads) {
+    if (_pipeline_nthreads == 0) {
+        for (int i = 0; i < DSP_PIPELINE_MAX_STAGES; i++) {
+            _pipeline_ready[i] = dispatch_semaphore_create (0);
+        }
+        _pipeline_done = dispatch_semaphore_create (0);
+    }
+    while (_pipeline_nthreads < nthreads) {
+        intptr_t tid = thread_start_with_caller_priority (_pipeline_worker, (void *)(intptr_t)_pipeline_nthreads);
+        if (!tid) {
+            break;
+        }
+        _pipeline_tids[_pipeline_nthreads++] = tid;
+    }
+    return _pipeline_nthreads;
+}
+
+static void
+_pipeline_stop (void) {
+    if (_pipeline_nthreads == 0) {
+        return;
+    }
+    __atomic_store_n (&_pipeline_terminate, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < _pipeline_nthreads; i++) {
+        dispatch_semaphore_signal (_pipeline_ready[i]);
+    }
+    for (int i = 0; i < _pipeline_nthreads; i++) {
+        thread_join (_pipeline_tids[i]);
+    }
+    for (int i = 0; i < DSP_PIPELINE_MAX_STAGES; i++) {
+        dispatch_release (_pipeline_ready[i]);
+        _pipeline_ready[i] = NULL;
+    }
+    dispatch_release (_pipeline_done);
+    _pipeline_done = NULL;
+    _pipeline_nthreads = 0;
+    _pipeline_terminate = 0;
+}
+
+// Splits the enabled DSPs into stages, and starts the worker threads for them.
+// @return the number of stages, 0 if the chain should run on the calling thread
+static int
+_pipeline_setup_stages (void) {
+    int nenabled = 0;
+    for (ddb_dsp_context_t *dsp = _current_dsp_chain; dsp; dsp = dsp->next) {
+        if (dsp->enabled) {
+            nenabled++;
+        }
+    }
+
+    int nstages = nenabled;
+    if (nstages > DSP_PIPELINE_MAX_STAGES) {
+        nstages = DSP_PIPELINE_MAX_STAGES;
+    }
+    if (nstages < 2 || _pipeline_start (nstages) < nstages) {
+        return 0;
+    }
+
+    // distribute the enabled DSPs evenly
+    ddb_dsp_context_t *dsp = _current_dsp_chain;
+    int assigned = 0;
+    for (int i = 0; i < nstages; i++) {
+        int count = (nenabled - assigned) / (nstages - i);
+        dsp_stage_t *stage = &_pipeline_stages[i];
+        stage->first = dsp;
+        stage->next_chunk = 0;
+        while (count > 0) {
+            if (dsp->enabled) {
+                count--;
+                assigned++;
+            }
+            dsp = dsp->next;
+        }
+        stage->end = dsp;
+    }
+    // disabled DSPs at the end of the chain
+    _pipeline_stages[nstages - 1].end = NULL;
+    _pipeline_nstages = nstages;
+    return nstages;
+}
+
+// Runs the DSP chain on nframes of float data in the buffer, using the worker threads.
+// Returns the number of output frames, written to the same buffer, which may be reallocated.
+static int
+_pipeline_process (char **buffer, int *buffer_size, int nframes, ddb_waveformat_t *fmt, float *ratio) {
+    int samplesize = fmt->channels * sizeof (float);
+
+    int nchunks = _pipeline_nstages * 2;
+    if (nchunks > DSP_PIPELINE_MAX_CHUNKS) {
+        nchunks = DSP_PIPELINE_MAX_CHUNKS;
+    }
+    if (nchunks > nframes / DSP_PIPELINE_MIN_CHUNK_FRAMES) {
+        nchunks = nframes / DSP_PIPELINE_MIN_CHUNK_FRAMES;
+    }
+    if (nchunks < 1) {
+        nchunks = 1;
+    }
+
+    // feed the first stage
+    int pos = 0;
+    for (int i = 0; i < nchunks; i++) {
+        dsp_chunk_t *chunk = &_pipeline_chunks[i];
+        int chunk_frames = (nframes - pos) / (nchunks - i);
+        int size = chunk_frames * samplesize * MAX_DSP_RATIO;
+        if (chunk->size < size) {
+            free (chunk->buffer);
+            chunk->buffer = malloc (size);
+            chunk->size = size;
+        }
+        memcpy (chunk->buffer, *buffer + pos * samplesize, chunk_frames * samplesize);
+        chunk->nframes = chunk_frames;
+        chunk->maxframes = chunk->size / samplesize;
+        chunk->ratio = 1;
+        chunk->fmt = *fmt;
+        pos += chunk_frames;
+        dispatch_semaphore_signal (_pipeline_ready[0]);
+    }
+
+    // collect the output in order, the input is no longer needed
+    int outsize = 0;
+    for (int i = 0; i < nchunks; i++) {
+        dispatch_semaphore_wait (_pipeline_done, DISPATCH_TIME_FOREVER);
+        dsp_chunk_t *chunk = &_pipeline_chunks[i];
+        int chunk_size = chunk->nframes * chunk->fmt.channels * (int)sizeof (float);
+        if (outsize + chunk_size > *buffer_size) {
+            *buffer = ensure_dsp_temp_buffer (outsize + chunk_size);
+            *buffer_size = outsize + chunk_size;
+        }
+        memcpy (*buffer + outsize, chunk->buffer, chunk_size);
+        outsize += chunk_size;
+    }
+
+    dsp_chunk_t *last = &_pipeline_chunks[nchunks - 1];
+    *fmt = last->fmt;
+    *ratio = last->ratio;
+    return outsize / (fmt->channels * (int)sizeof (float));
+}
+
+void
+dsp_configchanged (void) {
+    int enabled = conf_get_int ("streamer.dsp_pipeline", 0);
+    if (!enabled) {
+        _pipeline_stop ();
+    }
+    _pipeline_enabled = enabled;
 }
 
 ddb_dsp_context_t *
@@ -448,16 +678,25 @@ dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
     // convert to float
     /*int tempsize = */pcm_convert (input_fmt, input, &dspfmt, tempbuf, inputsize);
     int nframes = inputsize / inputsamplesize;
-    ddb_dsp_context_t *dsp = _current_dsp_chain;
     float ratio = 1.f;
-    int maxframes = tempbuf_size / dspsamplesize;
-    while (dsp) {
-        if (dsp->enabled) {
-            float r = 1;
-            nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
-            ratio *= r;
+    int nstages = 0;
+    if (_pipeline_enabled && nframes >= DSP_PIPELINE_MIN_CHUNK_FRAMES * 2) {
+        nstages = _pipeline_setup_stages ();
+    }
+    if (nstages > 0) {
+        nframes = _pipeline_process (&tempbuf, &tempbuf_size, nframes, &dspfmt, &ratio);
+    }
+    else {
+        ddb_dsp_context_t *dsp = _current_dsp_chain;
+        int maxframes = tempbuf_size / dspsamplesize;
+        while (dsp) {
+            if (dsp->enabled) {
+                float r = 1;
+                nframes = dsp->plugin->process (dsp, (float *)tempbuf, nframes, maxframes, &dspfmt, &r);
+                ratio *= r;
+            }
+            dsp = dsp->next;
         }
-        dsp = dsp->next;
     }
 
     *out_dsp_ratio = ratio;
@@ -70,6 +70,10 @@ dsp_apply (ddb_waveformat_t *input_fmt, char *input, int inputsize,
 void
 dsp_get_output_format (ddb_waveformat_t *in_fmt, ddb_waveformat_t *out_fmt);
 
+// Reads streamer.dsp_pipeline, and starts or stops the pipelined DSP mode
+void
+dsp_configchanged (void);
+
 int
 dsp_apply_simple_downsampler (int input_samplerate, int channels, char *input, int inputsize, int output_samplerate, char **out_bytes, int *out_numbytes);
 
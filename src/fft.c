@@ -23,17 +23,35 @@
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
-#include <complex.h>
 #include "fft.h"
 #include <math.h>
 #include <stdlib.h>
 
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define FFT_SIMD_NEON 1
+#include <arm_neon.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define FFT_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// The input is real, so the N-point transform is computed as an N/2-point complex FFT
+// of the even/odd sample pairs, followed by a post-twiddle pass which separates the two halves.
+// The complex data is kept in separate real and imaginary arrays, so that the butterflies
+// can be vectorized.
+
 static int _fft_size;
 static float *_hamming;          /* hamming window, scaled to sum to 1 */
-static int *_reversed;           /* bit-reversal table */
-static float complex *_roots;    /* N-th roots of unity */
-static int LOGN;                 /* log N (base 2) */
+static int *_reversed;           /* bit-reversal table for M points */
+static float *_twiddle_re;       /* per-stage roots of unity, stage with half-size h starts at h-1 */
+static float *_twiddle_im;
+static float *_post_re;          /* N-th roots of unity for the post-twiddle pass */
+static float *_post_im;
+static float *_work_re;          /* M-point complex work buffer */
+static float *_work_im;
+static int LOGM;                 /* log M (base 2) */
 static int N;                    /* _fft_size * 2 */
+static int M;                    /* N / 2, size of the complex transform */
 
 #ifndef HAVE_LOG2
 static inline float log2(float x) {return (float)log(x)/M_LN2;}
@@ -43,20 +61,30 @@ static void
 _free_buffers (void) {
     free (_hamming);
     free (_reversed);
-    free (_roots);
+    free (_twiddle_re);
+    free (_twiddle_im);
+    free (_post_re);
+    free (_post_im);
+    free (_work_re);
+    free (_work_im);
     _hamming = NULL;
     _reversed = NULL;
-    _roots = NULL;
+    _twiddle_re = NULL;
+    _twiddle_im = NULL;
+    _post_re = NULL;
+    _post_im = NULL;
+    _work_re = NULL;
+    _work_im = NULL;
 }
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+/* Reverse the order of the lowest LOGM bits in an integer. */
 
 static int
 _bit_reverse (int x)
 {
     int y = 0;
 
-    for (int n = LOGN; n --; )
+    for (int n = LOGM; n --; )
     {
         y = (y << 1) | (x & 1);
         x >>= 1;
@@ -72,10 +100,23 @@ _generate_tables (void)
 {
     for (int n = 0; n < N; n ++)
         _hamming[n] = 1 - 0.85f * cosf (2 * (float)M_PI * n / N);
-    for (int n = 0; n < N; n ++)
+    for (int n = 0; n < M; n ++)
         _reversed[n] = _bit_reverse (n);
-    for (int n = 0; n < N / 2; n ++)
-        _roots[n] = cexpf (2 * (float)M_PI * I * n / N);
+    for (int half = 1; half < M; half <<= 1)
+    {
+        for (int b = 0; b < half; b ++)
+        {
+            double a = -M_PI * b / half;
+            _twiddle_re[half - 1 + b] = (float)cos (a);
+            _twiddle_im[half - 1 + b] = (float)sin (a);
+        }
+    }
+    for (int k = 0; k < M; k ++)
+    {
+        double a = -2 * M_PI * k / N;
+        _post_re[k] = (float)cos (a);
+        _post_im[k] = (float)sin (a);
+    }
 }
 
 static void
@@ -84,59 +125,176 @@ _init_buffers (int fft_size) {
         _free_buffers();
         _fft_size = fft_size;
         N = fft_size * 2;
+        M = fft_size;
         _hamming = calloc (N, sizeof (float));
-        _reversed = calloc (N, sizeof (float));
-        _roots = calloc (fft_size, sizeof (float complex));
-        LOGN = (int)log2(N);
+        _reversed = calloc (M, sizeof (int));
+        _twiddle_re = calloc (M, sizeof (float));
+        _twiddle_im = calloc (M, sizeof (float));
+        _post_re = calloc (M, sizeof (float));
+        _post_im = calloc (M, sizeof (float));
+        _work_re = calloc (M, sizeof (float));
+        _work_im = calloc (M, sizeof (float));
+        LOGM = (int)log2(M);
         _generate_tables();
     }
 }
 
+// Butterflies of one stage for b in [start, half)
+static inline void
+_do_butterflies (float *re, float *im, int half, int start) {
+    const float *wre = _twiddle_re + half - 1;
+    const float *wim = _twiddle_im + half - 1;
+
+    /* loop through groups */
+    for (int g = 0; g < M; g += half << 1)
+    {
+        float *ere = re + g, *eim = im + g;
+        float *ore = re + g + half, *oim = im + g + half;
+
+        /* loop through butterflies */
+        for (int b = start; b < half; b ++)
+        {
+            float tre = ore[b] * wre[b] - oim[b] * wim[b];
+            float tim = ore[b] * wim[b] + oim[b] * wre[b];
+            ore[b] = ere[b] - tre;
+            oim[b] = eim[b] - tim;
+            ere[b] += tre;
+            eim[b] += tim;
+        }
+    }
+}
+
+#if FFT_SIMD_X86
+
 static void
-_do_fft (float complex *a)
-{
-    int half = 1;       /* (2^s)/2 */
-    int inv = N / 2;    /* N/(2^s) */
+_do_butterflies_simd (float *re, float *im, int half) {
+    const float *wre = _twiddle_re + half - 1;
+    const float *wim = _twiddle_im + half - 1;
 
-    /* loop through steps */
-    while (inv)
+    for (int g = 0; g < M; g += half << 1)
+    {
+        float *ere = re + g, *eim = im + g;
+        float *ore = re + g + half, *oim = im + g + half;
+
+        for (int b = 0; b < half; b += 4)
+        {
+            __m128 w_r = _mm_loadu_ps (wre + b);
+            __m128 w_i = _mm_loadu_ps (wim + b);
+            __m128 odd_r = _mm_loadu_ps (ore + b);
+            __m128 odd_i = _mm_loadu_ps (oim + b);
+            __m128 even_r = _mm_loadu_ps (ere + b);
+            __m128 even_i = _mm_loadu_ps (eim + b);
+            __m128 t_r = _mm_sub_ps (_mm_mul_ps (odd_r, w_r), _mm_mul_ps (odd_i, w_i));
+            __m128 t_i = _mm_add_ps (_mm_mul_ps (odd_r, w_i), _mm_mul_ps (odd_i, w_r));
+            _mm_storeu_ps (ore + b, _mm_sub_ps (even_r, t_r));
+            _mm_storeu_ps (oim + b, _mm_sub_ps (even_i, t_i));
+            _mm_storeu_ps (ere + b, _mm_add_ps (even_r, t_r));
+            _mm_storeu_ps (eim + b, _mm_add_ps (even_i, t_i));
+        }
+    }
+}
+
+#elif FFT_SIMD_NEON
+
+static void
+_do_butterflies_simd (float *re, float *im, int half) {
+    const float *wre = _twiddle_re + half - 1;
+    const float *wim = _twiddle_im + half - 1;
+
+    for (int g = 0; g < M; g += half << 1)
     {
-        /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
+        float *ere = re + g, *eim = im + g;
+        float *ore = re + g + half, *oim = im + g + half;
+
+        for (int b = 0; b < half; b += 4)
         {
-            /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b ++, r += inv)
-            {
-                float complex even = a[g + b];
-                float complex odd = _roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
-            }
+            float32x4_t w_r = vld1q_f32 (wre + b);
+            float32x4_t w_i = vld1q_f32 (wim + b);
+            float32x4_t odd_r = vld1q_f32 (ore + b);
+            float32x4_t odd_i = vld1q_f32 (oim + b);
+            float32x4_t even_r = vld1q_f32 (ere + b);
+            float32x4_t even_i = vld1q_f32 (eim + b);
+            float32x4_t t_r = vmlsq_f32 (vmulq_f32 (odd_r, w_r), odd_i, w_i);
+            float32x4_t t_i = vmlaq_f32 (vmulq_f32 (odd_r, w_i), odd_i, w_r);
+            vst1q_f32 (ore + b, vsubq_f32 (even_r, t_r));
+            vst1q_f32 (oim + b, vsubq_f32 (even_i, t_i));
+            vst1q_f32 (ere + b, vaddq_f32 (even_r, t_r));
+            vst1q_f32 (eim + b, vaddq_f32 (even_i, t_i));
         }
+    }
+}
 
-        half <<= 1;
-        inv >>= 1;
+#endif
+
+static void
+_do_fft (float *re, float *im)
+{
+    /* loop through steps */
+    for (int half = 1; half < M; half <<= 1)
+    {
+#if FFT_SIMD_X86 || FFT_SIMD_NEON
+        if (half >= 4) {
+            _do_butterflies_simd (re, im, half);
+            continue;
+        }
+#endif
+        _do_butterflies (re, im, half, 0);
     }
 }
 
+static void
+_calculate_channel (const float *data, float *freq) {
+    float *re = _work_re;
+    float *im = _work_im;
+
+    // pack the windowed even/odd samples into complex numbers, in bit-reversed order
+    for (int m = 0; m < M; m ++) {
+        int r = _reversed[m];
+        re[r] = data[2 * m] * _hamming[2 * m];
+        im[r] = data[2 * m + 1] * _hamming[2 * m + 1];
+    }
+    _do_fft(re, im);
+
+    // post-twiddle: X[k] = E[k] + W^k * O[k], where E and O are the spectra of the even and odd samples,
+    // E[k] = (Z[k] + conj(Z[M-k])) / 2, O[k] = (Z[k] - conj(Z[M-k])) / 2i
+    const float scale = 2.f / N;
+    for (int k = 1; k < M; k ++) {
+        float zre = re[k], zim = im[k];
+        float cre = re[M - k], cim = -im[M - k];
+        float ere = (zre + cre) * 0.5f;
+        float eim = (zim + cim) * 0.5f;
+        float dre = (zre - cre) * 0.5f;
+        float dim = (zim - cim) * 0.5f;
+        // O = D / i = (dim, -dre)
+        float ore = dim, oim = -dre;
+        float xre = ere + ore * _post_re[k] - oim * _post_im[k];
+        float xim = eim + ore * _post_im[k] + oim * _post_re[k];
+        freq[k - 1] = scale * sqrtf (xre * xre + xim * xim);
+    }
+    // X[M] is real
+    freq[M - 1] = fabsf (re[0] - im[0]) / N;
+}
+
 void
 fft_calculate (const float *data, float *freq, int fft_size) {
-    _init_buffers(fft_size);
+    fft_calculate_channels (data, freq, fft_size, 1);
+}
 
-    // fft code shamelessly stolen from audacious
-    // thanks, John
-    float complex a[N];
-    for (int n = 0; n < N; n ++) {
-        a[_reversed[n]] = data[n] * _hamming[n];
+void
+fft_calculate_channels (const float *data, float *freq, int fft_size, int channels) {
+    if (fft_size <= 0) {
+        return;
     }
-    _do_fft(a);
+    _init_buffers(fft_size);
 
-    for (int n = 0; n < N / 2 - 1; n ++)
-        freq[n] = 2 * cabsf (a[1 + n]) / N;
-    freq[N / 2 - 1] = cabsf(a[N / 2]) / N;
+    // the channels are transformed one after another, only the table setup is shared
+    for (int c = 0; c < channels; c++) {
+        _calculate_channel (data + N * c, freq + M * c);
+    }
 }
 
 void
 fft_free (void) {
     _free_buffers();
+    _fft_size = 0;
 }
@@ -26,12 +26,17 @@
 
 #ifdef __cplusplus
 extern "C" {
-}
 #endif
 
+// Calculates the magnitude spectrum of fft_size * 2 real samples into fft_size bins.
 void
 fft_calculate (const float *data, float *freq, int fft_size);
 
+// Convenience wrapper, which calls fft_calculate for each channel in turn.
+// The data is planar, fft_size * 2 samples per channel, and freq receives fft_size bins per channel.
+void
+fft_calculate_channels (const float *data, float *freq, int fft_size, int channels);
+
 void
 fft_free (void);
 
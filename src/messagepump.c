@@ -33,30 +33,174 @@
 #include "playlist.h"
 #include <deadbeef/common.h>
 
+// Messages are passed through a lock-free multiple producer, single consumer queue.
+// The nodes come from a pool, which grows in chunks when it runs out of free nodes.
 typedef struct message_s {
     uint32_t id;
     uintptr_t ctx;
     uint32_t p1;
     uint32_t p2;
     struct message_s *next;
+    uint32_t index; // position in the pool
+    uint32_t free_next; // index+1 of the next free node, 0 for none
 } message_t;
 
-enum { MAX_MESSAGES = 100 };
-static message_t pool[MAX_MESSAGES];
-static message_t *mfree;
+enum {
+    MESSAGE_CHUNK_SIZE = 256,
+    MAX_MESSAGE_CHUNKS = 1024, // messages are dropped when 256K are waiting
+};
+
+static message_t *chunks[MAX_MESSAGE_CHUNKS];
+static int nchunks;
+
+// index+1 of the first free node in the low 32 bits, and a counter in the high 32 bits, against ABA
+static uint64_t mfree;
+
+// the consumer takes messages from the head, producers append to the tail
+static message_t stub;
 static message_t *mqueue;
 static message_t *mqtail;
-static uintptr_t mutex;
+
+static uintptr_t mutex; // serializes pool growth, and is used for waiting
 static uintptr_t cond;
 
+static uint32_t queued_count;
+static uint32_t peak_count;
+static uint64_t dropped_count;
+static uint64_t coalesced_count;
+
 static void
 messagepump_reset (void);
 
+static inline message_t *
+message_at (uint32_t index) {
+    message_t *chunk = __atomic_load_n (&chunks[index / MESSAGE_CHUNK_SIZE], __ATOMIC_ACQUIRE);
+    return &chunk[index % MESSAGE_CHUNK_SIZE];
+}
+
+// links messages [first,last] into the free list
+static void
+message_free_list_push (message_t *first, message_t *last) {
+    uint64_t head = __atomic_load_n (&mfree, __ATOMIC_RELAXED);
+    uint64_t newhead;
+    do {
+        __atomic_store_n (&last->free_next, (uint32_t)head, __ATOMIC_RELAXED);
+        newhead = (((head >> 32) + 1) << 32) | (first->index + 1);
+    } while (!__atomic_compare_exchange_n (&mfree, &head, newhead, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static message_t *
+message_free_list_pop (void) {
+    uint64_t head = __atomic_load_n (&mfree, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t index = (uint32_t)head;
+        if (!index) {
+            return NULL;
+        }
+        message_t *msg = message_at (index - 1);
+        uint32_t next = __atomic_load_n (&msg->free_next, __ATOMIC_RELAXED);
+        uint64_t newhead = (((head >> 32) + 1) << 32) | next;
+        if (__atomic_compare_exchange_n (&mfree, &head, newhead, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return msg;
+        }
+    }
+}
+
+// returns -1 if the pool can't grow anymore
+static int
+message_pool_grow (void) {
+    mutex_lock (mutex);
+    // someone else might have grown it while we waited
+    if ((uint32_t)__atomic_load_n (&mfree, __ATOMIC_ACQUIRE)) {
+        mutex_unlock (mutex);
+        return 0;
+    }
+    if (nchunks == MAX_MESSAGE_CHUNKS) {
+        mutex_unlock (mutex);
+        return -1;
+    }
+    message_t *chunk = calloc (MESSAGE_CHUNK_SIZE, sizeof (message_t));
+    for (int i = 0; i < MESSAGE_CHUNK_SIZE; i++) {
+        chunk[i].index = nchunks * MESSAGE_CHUNK_SIZE + i;
+        chunk[i].free_next = i < MESSAGE_CHUNK_SIZE - 1 ? chunk[i].index + 2 : 0;
+    }
+    __atomic_store_n (&chunks[nchunks], chunk, __ATOMIC_RELEASE);
+    nchunks++;
+    message_free_list_push (&chunk[0], &chunk[MESSAGE_CHUNK_SIZE - 1]);
+    mutex_unlock (mutex);
+    return 0;
+}
+
+static void
+message_enqueue (message_t *msg) {
+    __atomic_store_n (&msg->next, NULL, __ATOMIC_RELAXED);
+    message_t *prev = __atomic_exchange_n (&mqtail, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+// single consumer; returns NULL if the queue is empty, or a producer hasn't finished linking its message yet
+static message_t *
+message_dequeue (void) {
+    message_t *head = mqueue;
+    message_t *next = __atomic_load_n (&head->next, __ATOMIC_ACQUIRE);
+    if (head == &stub) {
+        if (!next) {
+            return NULL;
+        }
+        mqueue = head = next;
+        next = __atomic_load_n (&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        mqueue = next;
+        return head;
+    }
+    if (head != __atomic_load_n (&mqtail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    message_enqueue (&stub);
+    next = __atomic_load_n (&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        mqueue = next;
+        return head;
+    }
+    return NULL;
+}
+
+// notifications which are redundant when the same one follows in the queue
+static int
+message_is_coalescable (uint32_t id) {
+    switch (id) {
+    case DB_EV_CONFIGCHANGED:
+    case DB_EV_PLAYLISTCHANGED:
+    case DB_EV_VOLUMECHANGED:
+    case DB_EV_PLAYLISTSWITCHED:
+    case DB_EV_ACTIONSCHANGED:
+    case DB_EV_DSPCHAINCHANGED:
+    case DB_EV_SELCHANGED:
+    case DB_EV_TRACKINFOCHANGED:
+        return 1;
+    }
+    return 0;
+}
+
+static int
+message_is_same (const message_t *a, const message_t *b) {
+    if (a->id != b->id || a->p1 != b->p1 || a->p2 != b->p2) {
+        return 0;
+    }
+    if (a->id == DB_EV_TRACKINFOCHANGED) {
+        const ddb_event_track_t *ea = (const ddb_event_track_t *)a->ctx;
+        const ddb_event_track_t *eb = (const ddb_event_track_t *)b->ctx;
+        return ea && eb && ea->track == eb->track;
+    }
+    return a->ctx == b->ctx;
+}
+
 int
 messagepump_init (void) {
-    messagepump_reset ();
     mutex = mutex_create ();
     cond = cond_create ();
+    messagepump_reset ();
     return 0;
 }
 
@@ -66,6 +210,9 @@ messagepump_free (void) {
 
     // this helps catching any ref leaks caused by messages sent at exit
     for (message_t *m = mqueue; m; m = m->next) {
+        if (m == &stub) {
+            continue;
+        }
         switch (m->id) {
         case DB_EV_SONGCHANGED:
         case DB_EV_SONGSTARTED:
@@ -77,7 +224,11 @@ messagepump_free (void) {
         }
     }
 
-    messagepump_reset ();
+    for (int i = 0; i < nchunks; i++) {
+        free (chunks[i]);
+        chunks[i] = NULL;
+    }
+    nchunks = 0;
     mutex_unlock (mutex);
     mutex_free (mutex);
     cond_free (cond);
@@ -86,43 +237,43 @@ messagepump_free (void) {
 
 static void
 messagepump_reset (void) {
-    mqueue = NULL;
-    mfree = NULL;
-    mqtail = NULL;
-    memset (pool, 0, sizeof (pool));
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        pool[i].next = mfree;
-        mfree = &pool[i];
-    }
+    mfree = 0;
+    stub.next = NULL;
+    mqueue = mqtail = &stub;
+    queued_count = 0;
+    peak_count = 0;
+    dropped_count = 0;
+    coalesced_count = 0;
+    message_pool_grow ();
 }
 
 int
 messagepump_push (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
-    mutex_lock (mutex);
-    if (!mfree) {
-        mutex_unlock (mutex);
-        //fprintf (stderr, "WARNING: message queue is full! message ignored (%d %p %d %d)\n", id, (void*)ctx, p1, p2);
-        if (id >= DB_EV_FIRST && ctx) {
-            messagepump_event_free ((ddb_event_t *)ctx);
+    message_t *msg;
+    while (!(msg = message_free_list_pop ())) {
+        if (message_pool_grow () < 0) {
+            __atomic_add_fetch (&dropped_count, 1, __ATOMIC_RELAXED);
+            if (id >= DB_EV_FIRST && ctx) {
+                messagepump_event_free ((ddb_event_t *)ctx);
+            }
+            return -1;
         }
-        return -1;
-    }
-    message_t *msg = mfree;
-    mfree = mfree->next;
-    if (mqtail) {
-        mqtail->next = msg;
-    }
-    mqtail = msg;
-    if (!mqueue) {
-        mqueue = msg;
     }
 
-    msg->next = NULL;
     msg->id = id;
     msg->ctx = ctx;
     msg->p1 = p1;
     msg->p2 = p2;
-    mutex_unlock (mutex);
+
+    uint32_t count = __atomic_add_fetch (&queued_count, 1, __ATOMIC_RELAXED);
+    uint32_t peak = __atomic_load_n (&peak_count, __ATOMIC_RELAXED);
+    while (count > peak) {
+        if (__atomic_compare_exchange_n (&peak_count, &peak, count, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    message_enqueue (msg);
     cond_signal (cond);
     return 0;
 }
@@ -135,29 +286,59 @@ messagepump_wait (void) {
 
 int
 messagepump_pop (uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
-    mutex_lock (mutex);
-    if (!mqueue) {
-        mutex_unlock (mutex);
-        return -1;
-    }
-    *id = mqueue->id;
-    *ctx = mqueue->ctx;
-    *p1 = mqueue->p1;
-    *p2 = mqueue->p2;
-    message_t *next = mqueue->next;
-    mqueue->next = mfree;
-    mfree = mqueue;
-    mqueue = next;
-    if (!mqueue) {
-        mqtail = NULL;
+    message_t *msg;
+    for (;;) {
+        msg = message_dequeue ();
+        if (!msg) {
+            return -1;
+        }
+        __atomic_sub_fetch (&queued_count, 1, __ATOMIC_RELAXED);
+
+        // skip the message if the next one is the same
+        message_t *next = mqueue;
+        if (next == &stub) {
+            next = __atomic_load_n (&stub.next, __ATOMIC_ACQUIRE);
+        }
+        if (!next || !message_is_coalescable (msg->id) || !message_is_same (msg, next)) {
+            break;
+        }
+        if (msg->id >= DB_EV_FIRST && msg->ctx) {
+            messagepump_event_free ((ddb_event_t *)msg->ctx);
+        }
+        message_free_list_push (msg, msg);
+        __atomic_add_fetch (&coalesced_count, 1, __ATOMIC_RELAXED);
     }
-    mutex_unlock (mutex);
+
+    *id = msg->id;
+    *ctx = msg->ctx;
+    *p1 = msg->p1;
+    *p2 = msg->p2;
+    message_free_list_push (msg, msg);
     return 0;
 }
 
 int
 messagepump_hasmessages (void) {
-    return mqueue ? 1 : 0;
+    return __atomic_load_n (&queued_count, __ATOMIC_RELAXED) ? 1 : 0;
+}
+
+void
+messagepump_get_stats (ddb_messagepump_stats_t *stats) {
+    ddb_messagepump_stats_t s = {
+        ._size = sizeof (ddb_messagepump_stats_t),
+        .queued = __atomic_load_n (&queued_count, __ATOMIC_RELAXED),
+        .peak = __atomic_load_n (&peak_count, __ATOMIC_RELAXED),
+        .dropped = __atomic_load_n (&dropped_count, __ATOMIC_RELAXED),
+        .coalesced = __atomic_load_n (&coalesced_count, __ATOMIC_RELAXED),
+    };
+    // a size which doesn't even cover the _size field is invalid, and nothing is written
+    if (stats->_size < (int)sizeof (int)) {
+        return;
+    }
+    // older callers may pass a smaller struct
+    size_t size = stats->_size < (int)sizeof (s) ? (size_t)stats->_size : sizeof (s);
+    memcpy (stats, &s, size);
+    stats->_size = (int)size;
 }
 
 ddb_event_t *
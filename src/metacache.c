@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include "metacache.h"
 
@@ -146,6 +147,17 @@ metacache_ref (const char *str) {
     (*refc)++;
 }
 
+void
+metacache_release_value (const char *value, size_t valuesize) {
+    metacache_str_t *data = (metacache_str_t *)(value - offsetof (metacache_str_t, str));
+    if (data->refcount > 1) {
+        data->refcount--;
+    }
+    else {
+        metacache_remove_value (value, valuesize);
+    }
+}
+
 // DEPRECATED_113
 void
 metacache_unref (const char *str) {
@@ -158,6 +170,14 @@ metacache_get_string (const char *str) {
     return metacache_get_value (str, strlen (str)+1);
 }
 
+const char *
+metacache_lookup_string (const char *str) {
+    size_t len = strlen (str) + 1;
+    uint32_t h = metacache_get_hash_sdbm (str, len);
+    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), str, len);
+    return data ? data->str : NULL;
+}
+
 const char *
 metacache_get_value (const char *value, size_t len) {
     uint32_t h = metacache_get_hash_sdbm (value, len);
@@ -35,6 +35,10 @@ metacache_add_string (const char *str);
 const char *
 metacache_get_string (const char *str);
 
+// Returns an existing NULL-terminated string without adding a reference, or NULL if it doesn't exist
+const char *
+metacache_lookup_string (const char *str);
+
 // Removes an existing string, ignoring refcount
 void
 metacache_remove_string (const char *str);
@@ -59,4 +63,8 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Decreases reference count of the specified value, and removes it when it's no longer referenced
+void
+metacache_release_value (const char *value, size_t valuesize);
+
 #endif
@@ -256,6 +256,327 @@ pl_unlock (void) {
 static void
 pl_item_free (playItem_t *it);
 
+// The index chunks are split when full, and merged with or rebalanced against a neighbour
+// when less than a quarter full, so an insert or a removal moves at most PLT_INDEX_CHUNK_SIZE items,
+// and updates O(log n) nodes of the tree.
+// Adding or removing a chunk renumbers the chunks after it and rebuilds the tree,
+// which takes at least PLT_INDEX_CHUNK_MIN edits of the same chunk.
+#define PLT_INDEX_CHUNK_MIN (PLT_INDEX_CHUNK_SIZE / 4)
+// how full the chunks are filled by a rebuild, leaving room for inserts
+#define PLT_INDEX_CHUNK_FILL (PLT_INDEX_CHUNK_SIZE * 3 / 4)
+
+static void
+_plt_index_tree_add (plt_index_t *index, int ordinal, int delta) {
+    for (int i = ordinal + 1; i <= index->nchunks; i += i & -i) {
+        index->tree[i] += delta;
+    }
+}
+
+// returns the number of items in the chunks before the ordinal
+static int
+_plt_index_tree_prefix (plt_index_t *index, int ordinal) {
+    int sum = 0;
+    for (int i = ordinal; i > 0; i -= i & -i) {
+        sum += index->tree[i];
+    }
+    return sum;
+}
+
+// renumbers the chunks starting from the ordinal, and rebuilds the whole tree
+static void
+_plt_index_tree_rebuild (plt_index_t *index, int from) {
+    for (int i = from; i < index->nchunks; i++) {
+        index->chunks[i]->ordinal = i;
+    }
+    for (int i = 1; i <= index->nchunks; i++) {
+        index->tree[i] = index->chunks[i - 1]->count;
+    }
+    for (int i = 1; i <= index->nchunks; i++) {
+        int parent = i + (i & -i);
+        if (parent <= index->nchunks) {
+            index->tree[parent] += index->tree[i];
+        }
+    }
+}
+
+static void
+_plt_index_reserve (plt_index_t *index, int nchunks) {
+    if (nchunks <= index->size) {
+        return;
+    }
+    int size = index->size ? index->size : 16;
+    while (size < nchunks) {
+        size *= 2;
+    }
+    index->chunks = realloc (index->chunks, size * sizeof (plt_index_chunk_t *));
+    index->tree = realloc (index->tree, (size + 1) * sizeof (int));
+    index->size = size;
+}
+
+// inserts an empty chunk at the ordinal, reusing a spare one if available;
+// the caller rebuilds the tree
+static plt_index_chunk_t *
+_plt_index_insert_chunk (plt_index_t *index, int ordinal) {
+    _plt_index_reserve (index, index->nchunks + 1);
+    plt_index_chunk_t *chunk;
+    if (index->nallocated > index->nchunks) {
+        chunk = index->chunks[index->nchunks];
+    }
+    else {
+        chunk = malloc (sizeof (plt_index_chunk_t));
+        index->nallocated++;
+    }
+    memmove (index->chunks + ordinal + 1, index->chunks + ordinal, (index->nchunks - ordinal) * sizeof (plt_index_chunk_t *));
+    index->chunks[ordinal] = chunk;
+    index->nchunks++;
+    chunk->count = 0;
+    return chunk;
+}
+
+// moves the empty chunk to the spare ones; the caller rebuilds the tree
+static void
+_plt_index_remove_chunk (plt_index_t *index, int ordinal) {
+    plt_index_chunk_t *chunk = index->chunks[ordinal];
+    memmove (index->chunks + ordinal, index->chunks + ordinal + 1, (index->nchunks - ordinal - 1) * sizeof (plt_index_chunk_t *));
+    index->nchunks--;
+    index->chunks[index->nchunks] = chunk;
+}
+
+// points the items starting from pos back to the chunk
+static void
+_plt_index_renumber (plt_index_chunk_t *chunk, int iter, int from) {
+    for (int pos = from; pos < chunk->count; pos++) {
+        chunk->items[pos]->index_chunk[iter] = chunk;
+        chunk->items[pos]->index[iter] = pos;
+    }
+}
+
+// the item may belong to another playlist, in which case its chunk is not in this index
+static int
+_plt_index_contains (plt_index_t *index, playItem_t *it, int iter) {
+    plt_index_chunk_t *chunk = it->index_chunk[iter];
+    int pos = it->index[iter];
+    return chunk
+        && chunk->ordinal >= 0 && chunk->ordinal < index->nchunks && index->chunks[chunk->ordinal] == chunk
+        && pos >= 0 && pos < chunk->count && chunk->items[pos] == it;
+}
+
+static void
+_plt_index_rebuild (playlist_t *playlist, int iter) {
+    plt_index_t *index = &playlist->index[iter];
+    int nchunks = (playlist->count[iter] + PLT_INDEX_CHUNK_FILL - 1) / PLT_INDEX_CHUNK_FILL;
+    _plt_index_reserve (index, nchunks);
+    while (index->nallocated < nchunks) {
+        index->chunks[index->nallocated++] = malloc (sizeof (plt_index_chunk_t));
+    }
+    index->nchunks = nchunks;
+
+    playItem_t *it = playlist->head[iter];
+    for (int i = 0; i < nchunks; i++) {
+        plt_index_chunk_t *chunk = index->chunks[i];
+        chunk->count = 0;
+        for (; it && chunk->count < PLT_INDEX_CHUNK_FILL; it = it->next[iter]) {
+            chunk->items[chunk->count++] = it;
+        }
+        _plt_index_renumber (chunk, iter, 0);
+    }
+    assert (it == NULL);
+    _plt_index_tree_rebuild (index, 0);
+    index->dirty = 0;
+}
+
+// returns the item at idx without adding a reference, or NULL if out of range
+static playItem_t *
+_plt_index_get_item (playlist_t *playlist, int idx, int iter) {
+    if (idx < 0 || idx >= playlist->count[iter]) {
+        return NULL;
+    }
+    plt_index_t *index = &playlist->index[iter];
+    if (index->dirty) {
+        _plt_index_rebuild (playlist, iter);
+    }
+    // descend the tree to the chunk containing idx
+    int ordinal = 0;
+    int step = 1;
+    while (step * 2 <= index->nchunks) {
+        step *= 2;
+    }
+    for (; step > 0; step >>= 1) {
+        if (ordinal + step <= index->nchunks && index->tree[ordinal + step] <= idx) {
+            ordinal += step;
+            idx -= index->tree[ordinal];
+        }
+    }
+    assert (ordinal < index->nchunks && idx < index->chunks[ordinal]->count);
+    return index->chunks[ordinal]->items[idx];
+}
+
+// returns the index of the item, or -1 if it's not in the list
+static int
+_plt_index_get_idx (playlist_t *playlist, playItem_t *it, int iter) {
+    plt_index_t *index = &playlist->index[iter];
+    if (index->dirty) {
+        _plt_index_rebuild (playlist, iter);
+    }
+    if (!_plt_index_contains (index, it, iter)) {
+        return -1;
+    }
+    return _plt_index_tree_prefix (index, it->index_chunk[iter]->ordinal) + it->index[iter];
+}
+
+// called after the item was linked after its prev, and the count was incremented
+static void
+_plt_index_insert (playlist_t *playlist, playItem_t *it, int iter) {
+    plt_index_t *index = &playlist->index[iter];
+    if (index->dirty) {
+        return;
+    }
+    playItem_t *prev = it->prev[iter];
+    plt_index_chunk_t *chunk;
+    int pos;
+    if (prev) {
+        if (!_plt_index_contains (index, prev, iter)) {
+            index->dirty = 1;
+            return;
+        }
+        chunk = prev->index_chunk[iter];
+        pos = prev->index[iter] + 1;
+    }
+    else {
+        if (index->nchunks == 0) {
+            _plt_index_insert_chunk (index, 0);
+            _plt_index_tree_rebuild (index, 0);
+        }
+        chunk = index->chunks[0];
+        pos = 0;
+    }
+
+    if (chunk->count == PLT_INDEX_CHUNK_SIZE) {
+        int ordinal = chunk->ordinal;
+        plt_index_chunk_t *next = _plt_index_insert_chunk (index, ordinal + 1);
+        if (pos == PLT_INDEX_CHUNK_SIZE) {
+            // appending after a full chunk starts a new one, leaving the full one as is
+            chunk = next;
+            pos = 0;
+        }
+        else {
+            int half = PLT_INDEX_CHUNK_SIZE / 2;
+            memcpy (next->items, chunk->items + half, (chunk->count - half) * sizeof (playItem_t *));
+            next->count = chunk->count - half;
+            chunk->count = half;
+            _plt_index_renumber (next, iter, 0);
+            if (pos > half) {
+                chunk = next;
+                pos -= half;
+            }
+        }
+        _plt_index_tree_rebuild (index, ordinal + 1);
+    }
+
+    memmove (chunk->items + pos + 1, chunk->items + pos, (chunk->count - pos) * sizeof (playItem_t *));
+    chunk->items[pos] = it;
+    chunk->count++;
+    _plt_index_renumber (chunk, iter, pos);
+    _plt_index_tree_add (index, chunk->ordinal, 1);
+}
+
+// merges the chunk with a neighbour, or moves items between them, so that both stay at least a quarter full
+static void
+_plt_index_balance (plt_index_t *index, int iter, plt_index_chunk_t *chunk) {
+    if (index->nchunks == 1) {
+        return;
+    }
+    plt_index_chunk_t *left = chunk;
+    plt_index_chunk_t *right;
+    if (chunk->ordinal + 1 < index->nchunks) {
+        right = index->chunks[chunk->ordinal + 1];
+    }
+    else {
+        left = index->chunks[chunk->ordinal - 1];
+        right = chunk;
+    }
+    int left_count = left->count;
+    int right_count = right->count;
+    int total = left_count + right_count;
+
+    if (total <= PLT_INDEX_CHUNK_FILL) {
+        memcpy (left->items + left_count, right->items, right_count * sizeof (playItem_t *));
+        left->count = total;
+        right->count = 0;
+        _plt_index_renumber (left, iter, left_count);
+        _plt_index_remove_chunk (index, right->ordinal);
+        _plt_index_tree_rebuild (index, left->ordinal);
+        return;
+    }
+
+    int half = total / 2;
+    if (left_count < half) {
+        int n = half - left_count;
+        memcpy (left->items + left_count, right->items, n * sizeof (playItem_t *));
+        memmove (right->items, right->items + n, (right_count - n) * sizeof (playItem_t *));
+        left->count = half;
+        right->count = right_count - n;
+        _plt_index_renumber (left, iter, left_count);
+    }
+    else {
+        int n = left_count - half;
+        memmove (right->items + n, right->items, right_count * sizeof (playItem_t *));
+        memcpy (right->items, left->items + half, n * sizeof (playItem_t *));
+        left->count = half;
+        right->count = right_count + n;
+    }
+    _plt_index_renumber (right, iter, 0);
+    _plt_index_tree_add (index, left->ordinal, left->count - left_count);
+    _plt_index_tree_add (index, right->ordinal, right->count - right_count);
+}
+
+// called after the count was decremented
+static void
+_plt_index_remove (playlist_t *playlist, playItem_t *it, int iter) {
+    plt_index_t *index = &playlist->index[iter];
+    if (index->dirty) {
+        it->index_chunk[iter] = NULL;
+        return;
+    }
+    if (!_plt_index_contains (index, it, iter)) {
+        it->index_chunk[iter] = NULL;
+        index->dirty = 1;
+        return;
+    }
+    plt_index_chunk_t *chunk = it->index_chunk[iter];
+    int pos = it->index[iter];
+    it->index_chunk[iter] = NULL;
+
+    chunk->count--;
+    memmove (chunk->items + pos, chunk->items + pos + 1, (chunk->count - pos) * sizeof (playItem_t *));
+    _plt_index_renumber (chunk, iter, pos);
+    _plt_index_tree_add (index, chunk->ordinal, -1);
+    if (chunk->count < PLT_INDEX_CHUNK_MIN) {
+        _plt_index_balance (index, iter, chunk);
+    }
+}
+
+// Marks the index for a rebuild, if that is cheaper than updating it for each of the count changed items.
+// The index stays dirty until the next lookup, so the changes which follow don't update it either.
+static void
+_plt_index_begin_bulk_change (playlist_t *playlist, int iter, int count) {
+    if ((int64_t)count * PLT_INDEX_CHUNK_SIZE > playlist->count[iter]) {
+        playlist->index[iter].dirty = 1;
+    }
+}
+
+// the items must have been unlinked from the list, so that none of them points to the chunks
+static void
+_plt_index_free (playlist_t *playlist, int iter) {
+    plt_index_t *index = &playlist->index[iter];
+    for (int i = 0; i < index->nallocated; i++) {
+        free (index->chunks[i]);
+    }
+    free (index->chunks);
+    free (index->tree);
+    memset (index, 0, sizeof (plt_index_t));
+}
+
 static void
 plt_gen_conf (void) {
     if (_plt_loading) {
@@ -717,6 +1038,9 @@ plt_free (playlist_t *plt) {
         free (m);
     }
 
+    _plt_index_free (plt, PL_MAIN);
+    _plt_index_free (plt, PL_SEARCH);
+
     free (plt);
     UNLOCK;
 }
@@ -863,8 +1187,14 @@ void
 plt_clear (playlist_t *plt) {
     pl_lock ();
     while (plt->head[PL_MAIN]) {
+        // the index is dropped at the end, instead of being updated for each removal;
+        // a lookup from the remove notifications may have rebuilt it
+        plt->index[PL_MAIN].dirty = 1;
+        plt->index[PL_SEARCH].dirty = 1;
         plt_remove_item (plt, plt->head[PL_MAIN]);
     }
+    _plt_index_free (plt, PL_MAIN);
+    _plt_index_free (plt, PL_SEARCH);
     plt->current_row[PL_MAIN] = -1;
     plt->current_row[PL_SEARCH] = -1;
     plt_modified (plt);
@@ -1500,9 +1830,12 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
     // remove from both lists
     LOCK;
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
-        if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
-            playlist->count[iter]--;
+        // the item may be in the main list only, e.g. while the search results are published
+        if (!it->prev[iter] && !it->next[iter] && playlist->head[iter] != it && playlist->tail[iter] != it) {
+            continue;
         }
+        playlist->count[iter]--;
+        _plt_index_remove (playlist, it, iter);
 
         playItem_t *next = it->next[iter];
         playItem_t *prev = it->prev[iter];
@@ -1589,14 +1922,7 @@ pl_getselcount (void) {
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
     LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
-    }
+    playItem_t *it = _plt_index_get_item (playlist, idx, iter);
     if (it) {
         pl_item_ref (it);
     }
@@ -1620,16 +1946,11 @@ pl_get_for_idx (int idx) {
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
     LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
+    if (!it || !playlist->count[iter]) {
         UNLOCK;
         return -1;
     }
+    int idx = _plt_index_get_idx (playlist, it, iter);
     UNLOCK;
     return idx;
 }
@@ -1647,6 +1968,29 @@ pl_get_idx_of_iter (playItem_t *it, int iter) {
     return idx;
 }
 
+void
+plt_relink_items (playlist_t *playlist, int iter, playItem_t **items, int count) {
+    LOCK;
+    playItem_t *prev = NULL;
+    playlist->head[iter] = NULL;
+    for (int idx = 0; idx < count; idx++) {
+        playItem_t *it = items[idx];
+        it->prev[iter] = prev;
+        it->next[iter] = NULL;
+        if (!prev) {
+            playlist->head[iter] = it;
+        }
+        else {
+            prev->next[iter] = it;
+        }
+        prev = it;
+    }
+    playlist->tail[iter] = prev;
+
+    _plt_index_rebuild (playlist, iter);
+    UNLOCK;
+}
+
 playItem_t *
 plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     LOCK;
@@ -1676,6 +2020,7 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     it->in_playlist = 1;
 
     playlist->count[PL_MAIN]++;
+    _plt_index_insert (playlist, it, PL_MAIN);
 
     // shuffle
     playItem_t *prev = it->prev[PL_MAIN];
@@ -1741,12 +2086,22 @@ pl_item_copy (playItem_t *out, playItem_t *it) {
     UNLOCK;
 }
 
+// a new track never reuses the modification index of a freed track at the same address
+static uint64_t pl_modification_idx;
+
+void
+pl_item_bump_modification_idx (playItem_t *it) {
+    uint64_t idx = __atomic_add_fetch (&pl_modification_idx, 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&it->_modification_idx, idx, __ATOMIC_RELEASE);
+}
+
 playItem_t *
 pl_item_alloc (void) {
     playItem_t *it = malloc (sizeof (playItem_t));
     memset (it, 0, sizeof (playItem_t));
     it->_duration = -1;
     it->_refc = 1;
+    pl_item_bump_modification_idx (it);
     return it;
 }
 
@@ -1769,10 +2124,9 @@ pl_item_free (playItem_t *it) {
     LOCK;
     if (it) {
         while (it->meta) {
-            pl_meta_free_values (it->meta);
             DB_metaInfo_t *m = it->meta;
             it->meta = m->next;
-            free (m);
+            pl_meta_free (m);
         }
 
         free (it);
@@ -1801,6 +2155,8 @@ plt_delete_selected (playlist_t *playlist) {
         UNLOCK;
         return -1;
     }
+    _plt_index_begin_bulk_change (playlist, PL_MAIN, count);
+    _plt_index_begin_bulk_change (playlist, PL_SEARCH, count);
     playItem_t **items_to_delete = calloc(count, sizeof (playItem_t *));
     playItem_t *next = NULL;
     int i = 0;
@@ -1849,6 +2205,8 @@ plt_crop_selected (playlist_t *playlist) {
         UNLOCK;
         return;
     }
+    _plt_index_begin_bulk_change (playlist, PL_MAIN, count);
+    _plt_index_begin_bulk_change (playlist, PL_SEARCH, count);
     playItem_t **items_to_delete = calloc(count, sizeof (playItem_t *));
     playItem_t *next = NULL;
     int i = 0;
@@ -3487,6 +3845,10 @@ plt_move_items (playlist_t *to, int iter, playlist_t *from, playItem_t *drop_bef
     // don't let streamer think that current song was removed
     no_remove_notify = 1;
 
+    _plt_index_begin_bulk_change (from, PL_MAIN, count);
+    _plt_index_begin_bulk_change (from, PL_SEARCH, count);
+    _plt_index_begin_bulk_change (to, PL_MAIN, count);
+
     // unlink items from from, and link together
     int processed = 0;
     int idx = 0;
@@ -3538,10 +3900,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = _plt_index_get_item (from, indices[i], iter);
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3572,10 +3931,14 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
         }
         playlist->head[PL_SEARCH]->next[PL_SEARCH] = NULL;
         playlist->head[PL_SEARCH]->prev[PL_SEARCH] = NULL;
+        playlist->head[PL_SEARCH]->index_chunk[PL_SEARCH] = NULL;
         playlist->head[PL_SEARCH] = next;
     }
     playlist->tail[PL_SEARCH] = NULL;
     playlist->count[PL_SEARCH] = 0;
+    // the chunks are kept for the next search
+    playlist->index[PL_SEARCH].nchunks = 0;
+    playlist->index[PL_SEARCH].dirty = 0;
     UNLOCK;
 }
 
@@ -3599,12 +3962,173 @@ _plsearch_append (playlist_t *plt, playItem_t *it, int select_results) {
         pl_set_selected_in_playlist(plt, it, 1);
     }
     plt->count[PL_SEARCH]++;
+    _plt_index_insert (plt, it, PL_SEARCH);
+}
+
+// The search takes a snapshot of the searchable values of all tracks under the lock,
+// compares them in chunks without holding the lock, and publishes the results of each chunk
+// as soon as it and the chunks before it are done, so that the other threads are only blocked
+// for short periods, and see the first results before the search is finished.
+// The results are published by the calling thread, which may hold the lock,
+// so the worker threads of thread_parallel_for never take it.
+
+// playlists below this size are searched on the calling thread
+#define PLSEARCH_PARALLEL_MIN_ITEMS 10000
+#define PLSEARCH_CHUNK_SIZE 2048
+
+// Memoized comparison results are stored in the metacache string headers, which are shared by all playlists,
+// so every search gets its own index, including the concurrent searches of different playlists.
+static int _search_cmpidx;
+
+typedef struct {
+    const char *value; // metacache string, referenced until the search is finished
+    int valuesize;
+    int start; // where the comparison starts, after the last '/' for :URI
+} plsearch_value_t;
+
+typedef struct {
+    playItem_t **items; // referenced until the search is finished
+    int count;
+    int *first_value; // count+1 offsets into values
+    plsearch_value_t *values;
+    int nvalues;
+    int values_size;
+    uint8_t *matches;
+    uint8_t *chunk_done;
+    int nchunks;
+    int published; // chunks published so far
+    playlist_t *playlist;
+    int select_results;
+    pthread_t caller; // the thread which publishes the results
+    const char *lc;
+    int lc_is_valid_u8;
+    int cmpidx;
+    int *pgeneration;
+    int generation;
+} plsearch_job_t;
+
+// called under the lock
+static void
+_plsearch_snapshot_item (plsearch_job_t *job, playItem_t *it) {
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        int is_uri = !strcmp (m->key, ":URI");
+        if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+            break;
+        }
+        if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+            continue;
+        }
+
+        int start = 0;
+        if (is_uri) {
+            const char *slash = strrchr (m->value, '/');
+            if (slash) {
+                start = (int)(slash + 1 - m->value);
+            }
+        }
+
+        if (job->nvalues == job->values_size) {
+            job->values_size = job->values_size ? job->values_size * 2 : 1024;
+            job->values = realloc (job->values, job->values_size * sizeof (plsearch_value_t));
+        }
+        metacache_ref (m->value);
+        job->values[job->nvalues++] = (plsearch_value_t){ m->value, m->valuesize, start };
+    }
+}
+
+// returns 1 if any of the values contains lc,
+// memoizing per-value results in the metacache string headers using cmpidx
+static int
+_plsearch_match_values (const plsearch_value_t *values, int count, const char *lc, int lc_is_valid_u8, int cmpidx) {
+    for (int i = 0; i < count; i++) {
+        const char *value = values[i].value + values[i].start;
+        const char *end = values[i].value + values[i].valuesize;
+
+        // the same string can be shared by tracks checked on different threads,
+        // which may only ever store the same result into it
+        char *pcmp = (char *)values[i].value-1;
+        char cmp = __atomic_load_n (pcmp, __ATOMIC_RELAXED);
+
+        if (abs (cmp) == cmpidx) { // string was already compared in this search
+            if (cmp > 0) { // it's a match
+                return 1;
+            }
+        }
+        else {
+            int match = -cmpidx; // assume no match
+            do {
+                int len = (int)strlen(value);
+                if (lc_is_valid_u8 && u8_valid(value, len, NULL) && utfcasestr_fast (value, lc)) {
+                    match = cmpidx; // it's a match
+                    break;
+                }
+                value += len+1;
+            } while (value < end);
+            __atomic_store_n (pcmp, (char)match, __ATOMIC_RELAXED);
+            if (match > 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Publishes the finished chunks which follow the published ones, in playlist order,
+// unless a newer search made them obsolete.
+// The tracks which were removed from the playlist during the search are skipped.
+// called under the lock, on the calling thread of the search
+static void
+_plsearch_publish (plsearch_job_t *job) {
+    playlist_t *playlist = job->playlist;
+    while (job->published < job->nchunks && __atomic_load_n (&job->chunk_done[job->published], __ATOMIC_ACQUIRE)) {
+        int first = job->published * PLSEARCH_CHUNK_SIZE;
+        int last = min (first + PLSEARCH_CHUNK_SIZE, job->count);
+        int current = __atomic_load_n (&playlist->search_generation, __ATOMIC_SEQ_CST) == job->generation;
+        for (int idx = first; idx < last; idx++) {
+            playItem_t *it = job->items[idx];
+            if (current && plt_get_item_idx (playlist, it, PL_MAIN) >= 0) {
+                if (job->select_results) {
+                    pl_set_selected_in_playlist(playlist, it, 0);
+                }
+                if (job->matches[idx]) {
+                    _plsearch_append (playlist, it, job->select_results);
+                }
+            }
+            for (int v = job->first_value[idx]; v < job->first_value[idx+1]; v++) {
+                metacache_release_value (job->values[v].value, job->values[v].valuesize);
+            }
+            pl_item_unref (it);
+        }
+        job->published++;
+    }
+}
+
+static void
+_plsearch_process_chunk (void *ctx, int chunk) {
+    plsearch_job_t *job = ctx;
+    int first = chunk * PLSEARCH_CHUNK_SIZE;
+    int last = min (first + PLSEARCH_CHUNK_SIZE, job->count);
+    for (int i = first; i < last; i++) {
+        if (__atomic_load_n (job->pgeneration, __ATOMIC_RELAXED) != job->generation) {
+            break;
+        }
+        const plsearch_value_t *values = job->values + job->first_value[i];
+        int count = job->first_value[i+1] - job->first_value[i];
+        job->matches[i] = (uint8_t)_plsearch_match_values (values, count, job->lc, job->lc_is_valid_u8, job->cmpidx);
+    }
+    __atomic_store_n (&job->chunk_done[chunk], 1, __ATOMIC_RELEASE);
+
+    if (pthread_equal (pthread_self (), job->caller)) {
+        LOCK;
+        _plsearch_publish (job);
+        UNLOCK;
+    }
 }
 
 void
 plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
-    LOCK;
-    plt_search_reset_int (playlist, select_results);
+    // a search of the same playlist which is still running on another thread will see this and stop early
+    int generation = __atomic_add_fetch (&playlist->search_generation, 1, __ATOMIC_SEQ_CST);
 
     // convert text to lowercase, to save some cycles
     char lc[1000];
@@ -3626,69 +4150,61 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
     }
     *out = 0;
 
-    int lc_is_valid_u8 = u8_valid (lc, (int)strlen (lc), NULL);
-
-    playlist->search_cmpidx++;
-    if (playlist->search_cmpidx > 127) {
-        playlist->search_cmpidx = 1;
-    }
+    LOCK;
+    plt_search_reset_int (playlist, select_results);
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+    if (!*text) {
         if (select_results) {
-            pl_set_selected_in_playlist(playlist, it, 0);
+            for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                pl_set_selected_in_playlist(playlist, it, 0);
+            }
         }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
-                    continue;
-                }
-
-                const char *value = m->value;
-                const char *end = value + m->valuesize;
+        UNLOCK;
+        return;
+    }
 
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
-                }
+    int count = playlist->count[PL_MAIN];
+    int nchunks = (count + PLSEARCH_CHUNK_SIZE - 1) / PLSEARCH_CHUNK_SIZE;
+    plsearch_job_t job = {
+        .items = malloc (count * sizeof (playItem_t *)),
+        .count = count,
+        .first_value = malloc ((count + 1) * sizeof (int)),
+        .matches = calloc (count, 1),
+        .chunk_done = calloc (nchunks, 1),
+        .nchunks = nchunks,
+        .playlist = playlist,
+        .select_results = select_results,
+        .caller = pthread_self (),
+        .lc = lc,
+        .lc_is_valid_u8 = u8_valid (lc, (int)strlen (lc), NULL),
+        .cmpidx = __atomic_add_fetch (&_search_cmpidx, 1, __ATOMIC_SEQ_CST) % 127 + 1,
+        .pgeneration = &playlist->search_generation,
+        .generation = generation,
+    };
+    int idx = 0;
+    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        pl_item_ref (it);
+        job.items[idx] = it;
+        job.first_value[idx] = job.nvalues;
+        _plsearch_snapshot_item (&job, it);
+    }
+    job.first_value[count] = job.nvalues;
+    UNLOCK;
 
-                char cmp = *(m->value-1);
+    int nthreads = count >= PLSEARCH_PARALLEL_MIN_ITEMS ? thread_get_cpu_count () : 1;
+    thread_parallel_for (nchunks, nthreads, _plsearch_process_chunk, &job);
 
-                if (abs (cmp) == playlist->search_cmpidx) { // string was already compared in this search
-                    if (cmp > 0) { // it's a match -- append to search results
-                        _plsearch_append (playlist, it, select_results);
-                        break;
-                    }
-                }
-                else {
-                    int match = -playlist->search_cmpidx; // assume no match
-                    do {
-                        int len = (int)strlen(value);
-                        if (lc_is_valid_u8 && u8_valid(value, len, NULL) && utfcasestr_fast (value, lc)) {
-                            _plsearch_append (playlist, it, select_results);
-                            match = playlist->search_cmpidx; // it's a match
-                            break;
-                        }
-                        value += len+1;
-                    } while (value < end);
-                    *((char *)m->value-1) = (int8_t)match;
-                    if (match > 0) {
-                        break;
-                    }
-                }
-            }
-        }
-    }
+    // the chunks which were finished last by the other threads
+    LOCK;
+    _plsearch_publish (&job);
+    assert (job.published == nchunks);
     UNLOCK;
+
+    free (job.items);
+    free (job.first_value);
+    free (job.values);
+    free (job.matches);
+    free (job.chunk_done);
 }
 
 void
@@ -44,6 +44,11 @@ extern "C" {
 // :TRACKNUM - subsong index (sid, nsf, cue, etc)
 // :DURATION - length in seconds
 
+// number of items which fit in a chunk of the playlist index
+#define PLT_INDEX_CHUNK_SIZE 256
+
+struct plt_index_chunk_s;
+
 typedef struct playItem_s {
     int32_t startsample;
     int32_t endsample;
@@ -55,9 +60,12 @@ typedef struct playItem_s {
     float _duration;
     uint32_t _flags;
     int _refc;
+    uint64_t _modification_idx; // changes each time the metadata changes, unique across all tracks; see pl_item_bump_modification_idx
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct plt_index_chunk_s *index_chunk[PL_MAX_ITERATORS]; // chunk of the owning playlist index, NULL when not in the list
+    int index[PL_MAX_ITERATORS]; // position in the index chunk, valid while the playlist index is up to date
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -65,6 +73,24 @@ typedef struct playItem_s {
     unsigned has_endsample64 : 1;
 } playItem_t;
 
+// a run of consecutive items of the playlist index
+typedef struct plt_index_chunk_s {
+    int ordinal; // position of the chunk in the index
+    int count;
+    playItem_t *items[PLT_INDEX_CHUNK_SIZE];
+} plt_index_chunk_t;
+
+// Items in list order, split into chunks, with a Fenwick tree over the chunk sizes,
+// so that both the lookups and the updates on insert and remove take O(log n)
+typedef struct {
+    plt_index_chunk_t **chunks; // the chunks in use, followed by the spare ones
+    int *tree; // 1-based Fenwick tree of the chunk item counts
+    int nchunks; // chunks in use
+    int nallocated; // allocated chunks, including the spare ones
+    int size; // number of elements in chunks, and tree without the unused [0]
+    int dirty; // index needs to be rebuilt before use
+} plt_index_t;
+
 typedef struct playlist_s {
     char *title;
     struct playlist_s *next;
@@ -84,8 +110,12 @@ typedef struct playlist_s {
     int64_t cue_numsamples;
     int cue_samplerate;
 
-    int search_cmpidx;
-    
+    int search_generation; // incremented when a new search starts, used for cancelling the previous one
+
+    // items in list order, allowing lookups by index in O(log n);
+    // updated in place on inserts and removals, and rebuilt lazily after bulk changes
+    plt_index_t index[PL_MAX_ITERATORS];
+
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
     unsigned recalc_seltime : 1;
@@ -241,6 +271,11 @@ pl_item_unref (playItem_t *it);
 void
 pl_item_copy (playItem_t *out, playItem_t *it);
 
+// Must be called after each change of the track metadata or properties,
+// to invalidate the cached title formatting results
+void
+pl_item_bump_modification_idx (playItem_t *it);
+
 int
 pl_getcount (int iter);
 
@@ -271,6 +306,11 @@ pl_get_idx_of (playItem_t *it);
 int
 pl_get_idx_of_iter (playItem_t *it, int iter);
 
+// relink the list `iter` in the order of the `items` array,
+// which must contain all items of the list exactly once
+void
+plt_relink_items (playlist_t *playlist, int iter, playItem_t **items, int count);
+
 playItem_t *
 plt_insert_cue_from_buffer (playlist_t *plt, playItem_t *after, playItem_t *origin, const uint8_t *buffer, int buffersize, int numsamples, int samplerate);
 
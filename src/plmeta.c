@@ -34,40 +34,127 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
-DB_metaInfo_t *
-pl_meta_for_key_with_override (playItem_t *it, const char *key) {
-    pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
+// Item metadata entries carry the case-folded version of their key, interned in metacache.
+// This turns key lookups into a single hash lookup of the requested key,
+// followed by pointer comparisons.
+typedef struct {
+    DB_metaInfo_t meta;
+    const char *key_atom; // NULL if the key is too long to be folded
+} pl_metaInfo_t;
+
+#define MAX_KEY_ATOM_LEN 256
+
+// writes ascii-lowercase prefix+key into out, returns 0 if it doesn't fit
+static int
+_fold_key (char prefix, const char *key, char *out, size_t outsize) {
+    char *e = out + outsize - 1;
+    if (prefix) {
+        *out++ = prefix;
+    }
+    for (; *key; key++) {
+        if (out == e) {
+            return 0;
+        }
+        char c = *key;
+        *out++ = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    *out = 0;
+    return 1;
+}
 
-    // try to find an override
-    while (m) {
-        if (m->key[0] == '!' && !strcasecmp (key, m->key+1)) {
-            return m;
+// find the entry with a key equal to prefix+key, ignoring case
+static DB_metaInfo_t *
+_meta_for_key (playItem_t *it, char prefix, const char *key) {
+    if (!key) {
+        return NULL;
+    }
+    char folded[MAX_KEY_ATOM_LEN];
+    if (!_fold_key (prefix, key, folded, sizeof (folded))) {
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (prefix && m->key[0] != prefix) {
+                continue;
+            }
+            if (!strcasecmp (key, prefix ? m->key + 1 : m->key)) {
+                return m;
+            }
         }
-        m = m->next;
+        return NULL;
     }
 
-    m = it->meta;
-    while (m) {
-        if (key && !strcasecmp (key, m->key)) {
+    const char *atom = metacache_lookup_string (folded);
+    if (!atom) {
+        // no track has such key
+        return NULL;
+    }
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (((pl_metaInfo_t *)m)->key_atom == atom) {
             return m;
         }
-        m = m->next;
     }
-    return NULL;}
+    return NULL;
+}
+
+DB_metaInfo_t *
+pl_meta_for_key_with_override (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    // try to find an override
+    DB_metaInfo_t *m = _meta_for_key (it, '!', key);
+    if (m) {
+        return m;
+    }
+    return _meta_for_key (it, 0, key);
+}
+
 
+int
+pl_meta_key_handle_init (pl_meta_key_handle_t *handle, const char *key) {
+    char folded[MAX_KEY_ATOM_LEN];
+    char override_folded[MAX_KEY_ATOM_LEN];
+    if (!_fold_key (0, key, folded, sizeof (folded))
+        || !_fold_key ('!', key, override_folded, sizeof (override_folded))) {
+        memset (handle, 0, sizeof (pl_meta_key_handle_t));
+        return 0;
+    }
+    LOCK;
+    handle->override_atom = metacache_add_string (override_folded);
+    handle->atom = metacache_add_string (folded);
+    UNLOCK;
+    return 1;
+}
+
+void
+pl_meta_key_handle_free (pl_meta_key_handle_t *handle) {
+    LOCK;
+    if (handle->override_atom) {
+        metacache_remove_string (handle->override_atom);
+    }
+    if (handle->atom) {
+        metacache_remove_string (handle->atom);
+    }
+    UNLOCK;
+    memset (handle, 0, sizeof (pl_meta_key_handle_t));
+}
 
 DB_metaInfo_t *
-pl_meta_for_key (playItem_t *it, const char *key) {
+pl_meta_for_key_handle_with_override (playItem_t *it, const pl_meta_key_handle_t *handle) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
+    DB_metaInfo_t *found = NULL;
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        const char *atom = ((pl_metaInfo_t *)m)->key_atom;
+        if (atom == handle->override_atom) {
             return m;
         }
-        m = m->next;
+        if (!found && atom == handle->atom) {
+            found = m;
+        }
     }
-    return NULL;
+    return found;
+}
+
+DB_metaInfo_t *
+pl_meta_for_key (playItem_t *it, const char *key) {
+    pl_ensure_lock ();
+    return _meta_for_key (it, 0, key);
 }
 
 void
@@ -77,16 +164,36 @@ pl_meta_free_values (DB_metaInfo_t *meta) {
     meta->valuesize = 0;
 }
 
+void
+pl_meta_free (DB_metaInfo_t *meta) {
+    const char *atom = ((pl_metaInfo_t *)meta)->key_atom;
+    if (atom) {
+        metacache_remove_string (atom);
+    }
+    metacache_remove_string (meta->key);
+    pl_meta_free_values (meta);
+    free (meta);
+}
+
 DB_metaInfo_t *
 pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
+    char folded[MAX_KEY_ATOM_LEN];
+    const char *atom = NULL;
+    if (_fold_key (0, key, folded, sizeof (folded))) {
+        atom = metacache_add_string (folded);
+    }
+
     // check if it's already set
     DB_metaInfo_t *normaltail = NULL;
     DB_metaInfo_t *propstart = NULL;
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (atom ? ((pl_metaInfo_t *)m)->key_atom == atom : !strcasecmp (key, m->key)) {
             // duplicate key
+            if (atom) {
+                metacache_remove_string (atom);
+            }
             return NULL;
         }
         // find end of normal metadata
@@ -102,8 +209,9 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
         m = m->next;
     }
     // add
-    m = calloc (1, sizeof (DB_metaInfo_t));
+    m = calloc (1, sizeof (pl_metaInfo_t));
     m->key = metacache_add_string (key);
+    ((pl_metaInfo_t *)m)->key_atom = atom;
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
         if (tail) {
@@ -123,6 +231,7 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
         }
     }
 
+    pl_item_bump_modification_idx (it);
     return m;
 }
 
@@ -184,6 +293,7 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
     }
 
     _meta_set_value (meta, value, valuesize);
+    pl_item_bump_modification_idx (it);
 }
 
 void
@@ -250,6 +360,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
 
     if (!m->value) {
         _meta_set_value (m, value, size);
+        pl_item_bump_modification_idx (it);
         pl_unlock ();
         return;
     }
@@ -266,6 +377,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
     free (buf);
+    pl_item_bump_modification_idx (it);
     pl_unlock ();
 }
 
@@ -285,6 +397,7 @@ pl_replace_meta (playItem_t *it, const char *key, const char *value) {
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
         m->valuesize = l;
+        pl_item_bump_modification_idx (it);
         UNLOCK;
         return;
     }
@@ -318,23 +431,9 @@ pl_set_meta_float (playItem_t *it, const char *key, float value) {
 void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
-    DB_metaInfo_t *prev = NULL;
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
-            break;
-        }
-        prev = m;
-        m = m->next;
+    DB_metaInfo_t *m = _meta_for_key (it, 0, key);
+    if (m) {
+        pl_delete_metadata (it, m);
     }
     pl_unlock ();
 }
@@ -342,26 +441,17 @@ pl_delete_meta (playItem_t *it, const char *key) {
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
+    DB_metaInfo_t *m = NULL;
 
     if (key && key[0] == ':') {
         // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
+        m = _meta_for_key (it, '!', key+1);
     }
 
-    m = it->meta;
-    while (m) {
-        if (key && !strcasecmp (key, m->key)) {
-            return m->value;
-        }
-        m = m->next;
+    if (!m) {
+        m = _meta_for_key (it, 0, key);
     }
-    return NULL;
+    return m ? m->value : NULL;
 }
 
 const char *
@@ -425,9 +515,8 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
             else {
                 it->meta = m->next;
             }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
+            pl_meta_free (m);
+            pl_item_bump_modification_idx (it);
             break;
         }
         prev = m;
@@ -453,12 +542,11 @@ pl_delete_all_meta (playItem_t *it) {
             else {
                 it->meta = next;
             }
-            metacache_remove_string (m->key);
-            pl_meta_free_values (m);
-            free (m);
+            pl_meta_free (m);
         }
         m = next;
     }
+    pl_item_bump_modification_idx (it);
 
     // delete replaygain fields
     extern const char *ddb_internal_rg_keys[];
@@ -540,4 +628,5 @@ pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta) {
 
     m->value = metacache_add_value (meta->value, meta->valuesize);
     m->valuesize = meta->valuesize;
+    pl_item_bump_modification_idx (it);
 }
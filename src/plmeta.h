@@ -72,6 +72,23 @@ pl_meta_for_key (playItem_t *it, const char *key);
 DB_metaInfo_t *
 pl_meta_for_key_with_override (playItem_t *it, const char *key);
 
+// A metadata key resolved in advance, for repeated lookups without hashing the key
+typedef struct {
+    const char *override_atom;
+    const char *atom;
+} pl_meta_key_handle_t;
+
+// returns 0 if the key can't be resolved in advance, e.g. because it's too long
+int
+pl_meta_key_handle_init (pl_meta_key_handle_t *handle, const char *key);
+
+void
+pl_meta_key_handle_free (pl_meta_key_handle_t *handle);
+
+// same as pl_meta_for_key_with_override, for a resolved key
+DB_metaInfo_t *
+pl_meta_for_key_handle_with_override (playItem_t *it, const pl_meta_key_handle_t *handle);
+
 int
 pl_get_meta_with_override (playItem_t *it, const char *key, char *val, size_t size);
 
@@ -81,6 +98,10 @@ pl_find_meta_with_override (playItem_t *it, const char *key);
 void
 pl_meta_free_values (DB_metaInfo_t *meta);
 
+// Frees the metadata entry previously unlinked from an item, including its key and values
+void
+pl_meta_free (DB_metaInfo_t *meta);
+
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
 
@@ -0,0 +1,131 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "prefetch.h"
+#include "threading.h"
+
+#ifndef __linux__
+#define O_LARGEFILE 0
+#endif
+
+// the beginning of the file is always prefetched, since it contains the headers and tags
+#define PREFETCH_MIN_BYTES (256*1024)
+#define PREFETCH_CHUNK_SIZE (64*1024)
+
+typedef struct {
+    char *fname;
+    float portion;
+    int generation;
+} prefetch_request_t;
+
+// incremented on each new request, which makes the older ones stop
+static int prefetch_generation;
+static int64_t prefetch_bytes_read;
+
+static void
+prefetch_thread (void *ctx) {
+    prefetch_request_t *req = ctx;
+
+    int fd = open (req->fname, O_RDONLY | O_LARGEFILE);
+    if (fd == -1) {
+        goto done;
+    }
+
+    struct stat st;
+    if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode)) {
+        goto done;
+    }
+
+    int64_t size = (int64_t)(st.st_size * req->portion) + PREFETCH_MIN_BYTES;
+    if (size > st.st_size) {
+        size = st.st_size;
+    }
+
+    // let the kernel start the readahead, then read the data anyway,
+    // since the advice is ignored by some network filesystems
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise (fd, 0, size, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct radvisory ra = { .ra_offset = 0, .ra_count = size < INT32_MAX ? (int)size : INT32_MAX };
+    fcntl (fd, F_RDADVISE, &ra);
+#endif
+
+    char *buffer = malloc (PREFETCH_CHUNK_SIZE);
+    if (!buffer) {
+        goto done;
+    }
+    int64_t pos = 0;
+    while (pos < size && __atomic_load_n (&prefetch_generation, __ATOMIC_ACQUIRE) == req->generation) {
+        ssize_t rd = read (fd, buffer, PREFETCH_CHUNK_SIZE);
+        if (rd <= 0) {
+            break;
+        }
+        pos += rd;
+        __atomic_fetch_add (&prefetch_bytes_read, rd, __ATOMIC_RELAXED);
+    }
+    free (buffer);
+
+done:
+    if (fd != -1) {
+        close (fd);
+    }
+    free (req->fname);
+    free (req);
+}
+
+void
+prefetch_file (const char *fname, float portion) {
+    if (!strncasecmp (fname, "file://", 7)) {
+        fname += 7;
+    }
+
+    prefetch_request_t *req = calloc (1, sizeof (prefetch_request_t));
+    req->fname = strdup (fname);
+    req->portion = portion;
+    req->generation = __atomic_add_fetch (&prefetch_generation, 1, __ATOMIC_ACQ_REL);
+
+    intptr_t tid = thread_start_low_priority (prefetch_thread, req);
+    if (tid) {
+        thread_detach (tid);
+    }
+    else {
+        free (req->fname);
+        free (req);
+    }
+}
+
+void
+prefetch_cancel (void) {
+    __atomic_add_fetch (&prefetch_generation, 1, __ATOMIC_ACQ_REL);
+}
+
+int64_t
+prefetch_get_bytes_read (void) {
+    return __atomic_load_n (&prefetch_bytes_read, __ATOMIC_RELAXED);
+}
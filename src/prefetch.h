@@ -0,0 +1,51 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2024 Oleksiy Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef prefetch_h
+#define prefetch_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts reading the first portion (0..1) of a local file in the background,
+// to get it into the page cache before it's opened for playback.
+// Cancels the previous prefetch, if still running.
+void
+prefetch_file (const char *fname, float portion);
+
+// Cancels the running prefetch, if any.
+void
+prefetch_cancel (void);
+
+// Returns the number of bytes read by all prefetches so far.
+int64_t
+prefetch_get_bytes_read (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* prefetch_h */
@@ -26,12 +26,22 @@
 */
 
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <deadbeef/deadbeef.h>
 #include <deadbeef/fastftoi.h>
 #include "premix.h"
 
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define PCM_SIMD_NEON 1
+#include <arm_neon.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define PCM_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
 
@@ -528,6 +538,460 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+#pragma mark - Vectorized conversion with identity channelmap
+
+// When every input channel goes to the same output channel, the samples of all channels
+// are converted as one flat array, which allows to process several samples per instruction.
+// The results are identical to the scalar remappers above.
+
+typedef void (*pcm_flat_fn_t) (const char * restrict input, char * restrict output, int count);
+
+static int pcm_max_simd_level = INT_MAX;
+
+// Scalar code for the remaining samples, starting at index i
+
+static inline void
+pcm_flat_16_to_float (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        ((float *)output)[i] = ((int16_t *)input)[i] / (float)0x8000;
+    }
+}
+
+static inline void
+pcm_flat_16_to_32 (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        ((int32_t *)output)[i] = (int32_t)((uint32_t)(uint16_t)((int16_t *)input)[i] << 16);
+    }
+}
+
+static inline void
+pcm_flat_24_to_float (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        const char *in = input + 3 * i;
+        int32_t sample = ((unsigned char)in[0]) | ((unsigned char)in[1]<<8) | ((signed char)in[2]<<16);
+        ((float *)output)[i] = sample / (float)0x800000;
+    }
+}
+
+static inline void
+pcm_flat_24_to_32 (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        const char *in = input + 3 * i;
+        char *out = output + 4 * i;
+        out[0] = 0;
+        out[1] = in[0];
+        out[2] = in[1];
+        out[3] = in[2];
+    }
+}
+
+static inline void
+pcm_flat_32_to_16 (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        ((int16_t *)output)[i] = (int16_t)(((int32_t *)input)[i] >> 16);
+    }
+}
+
+static inline void
+pcm_flat_32_to_float (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        ((float *)output)[i] = ((int32_t *)input)[i] / (float)0x80000000;
+    }
+}
+
+static inline void
+pcm_flat_float_to_16 (const char * restrict input, char * restrict output, int i, int count) {
+    for (; i < count; i++) {
+        int isample = ftoi (((float *)input)[i] * 0x8000);
+        if (isample > 0x7fff) {
+            isample = 0x7fff;
+        }
+        else if (isample < -0x8000) {
+            isample = -0x8000;
+        }
+        ((int16_t *)output)[i] = (int16_t)isample;
+    }
+}
+
+#if PCM_SIMD_X86
+
+// SSE2 is always available when the compiler is allowed to use it,
+// AVX2 is detected at runtime.
+// The float to int conversions truncate, which matches ftoi on x86.
+
+static void
+pcm_flat_16_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    pcm_flat_16_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_16_to_32_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    const __m128i zero = _mm_setzero_si128 ();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_unpacklo_epi16 (zero, v));
+        _mm_storeu_si128 ((__m128i *)(out + i + 4), _mm_unpackhi_epi16 (zero, v));
+    }
+    pcm_flat_16_to_32 (input, output, i, count);
+}
+
+// 4 packed 24-bit samples from the first 12 bytes, shifted left by 8 bits.
+// Reads 16 bytes.
+static inline __m128i
+pcm_load_24_sse2 (const char *in) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)in);
+    __m128i s01 = _mm_unpacklo_epi32 (v, _mm_srli_si128 (v, 3));
+    __m128i s23 = _mm_unpacklo_epi32 (_mm_srli_si128 (v, 6), _mm_srli_si128 (v, 9));
+    return _mm_slli_epi32 (_mm_unpacklo_epi64 (s01, s23), 8);
+}
+
+static void
+pcm_flat_24_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x800000);
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        __m128i v = _mm_srai_epi32 (pcm_load_24_sse2 (input + 3 * i), 8);
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+    pcm_flat_24_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_24_to_32_sse2 (const char * restrict input, char * restrict output, int count) {
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        _mm_storeu_si128 ((__m128i *)(out + i), pcm_load_24_sse2 (input + 3 * i));
+    }
+    pcm_flat_24_to_32 (input, output, i, count);
+}
+
+static void
+pcm_flat_32_to_16_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)), 16);
+        __m128i b = _mm_srai_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i + 4)), 16);
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (a, b));
+    }
+    pcm_flat_32_to_16 (input, output, i, count);
+}
+
+static void
+pcm_flat_32_to_float_sse2 (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(in + i));
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+    pcm_flat_32_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_float_to_16_sse2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m128 scale = _mm_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // out of range values convert to INT_MIN, same as ftoi, and then saturate to -0x8000
+        __m128i a = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (in + i), scale));
+        __m128i b = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (in + i + 4), scale));
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (a, b));
+    }
+    pcm_flat_float_to_16 (input, output, i, count);
+}
+
+#define PCM_AVX2 __attribute__((target("avx2")))
+
+static PCM_AVX2 void
+pcm_flat_16_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_flat_16_to_float (input, output, i, count);
+}
+
+static PCM_AVX2 void
+pcm_flat_16_to_32_avx2 (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        _mm256_storeu_si256 ((__m256i *)(out + i), _mm256_slli_epi32 (v, 16));
+    }
+    pcm_flat_16_to_32 (input, output, i, count);
+}
+
+// 8 packed 24-bit samples from the first 24 bytes, shifted left by 8 bits.
+// Reads 28 bytes.
+static PCM_AVX2 inline __m256i
+pcm_load_24_avx2 (const char *in) {
+    const __m256i shuffle = _mm256_setr_epi8 (
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    __m256i v = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)in));
+    v = _mm256_inserti128_si256 (v, _mm_loadu_si128 ((const __m128i *)(in + 12)), 1);
+    return _mm256_shuffle_epi8 (v, shuffle);
+}
+
+static PCM_AVX2 void
+pcm_flat_24_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x800000);
+    int i = 0;
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+        __m256i v = _mm256_srai_epi32 (pcm_load_24_avx2 (input + 3 * i), 8);
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_flat_24_to_float (input, output, i, count);
+}
+
+static PCM_AVX2 void
+pcm_flat_24_to_32_avx2 (const char * restrict input, char * restrict output, int count) {
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+        _mm256_storeu_si256 ((__m256i *)(out + i), pcm_load_24_avx2 (input + 3 * i));
+    }
+    pcm_flat_24_to_32 (input, output, i, count);
+}
+
+static PCM_AVX2 void
+pcm_flat_32_to_16_avx2 (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(in + i)), 16);
+        __m256i b = _mm256_srai_epi32 (_mm256_loadu_si256 ((const __m256i *)(in + i + 8)), 16);
+        // packing is done within 128-bit lanes
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(out + i), packed);
+    }
+    pcm_flat_32_to_16 (input, output, i, count);
+}
+
+static PCM_AVX2 void
+pcm_flat_32_to_float_avx2 (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(in + i));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_flat_32_to_float (input, output, i, count);
+}
+
+static PCM_AVX2 void
+pcm_flat_float_to_16_avx2 (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = _mm256_cvttps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (in + i), scale));
+        __m256i b = _mm256_cvttps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (in + i + 8), scale));
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(out + i), packed);
+    }
+    pcm_flat_float_to_16 (input, output, i, count);
+}
+
+#endif // PCM_SIMD_X86
+
+#if PCM_SIMD_NEON
+
+// The float to int conversions round half up, which matches ftoi on arm64.
+
+static void
+pcm_flat_16_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16 (in + i);
+        vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))), 1.f / 0x8000));
+        vst1q_f32 (out + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))), 1.f / 0x8000));
+    }
+    pcm_flat_16_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_16_to_32_neon (const char * restrict input, char * restrict output, int count) {
+    const int16_t *in = (const int16_t *)input;
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16 (in + i);
+        vst1q_s32 (out + i, vshll_n_s16 (vget_low_s16 (v), 16));
+        vst1q_s32 (out + i + 4, vshll_n_s16 (vget_high_s16 (v), 16));
+    }
+    pcm_flat_16_to_32 (input, output, i, count);
+}
+
+// 4 packed 24-bit samples from the first 12 bytes, shifted left by 8 bits.
+// Reads 16 bytes.
+static inline int32x4_t
+pcm_load_24_neon (const char *in) {
+    static const uint8_t shuffle[16] = {
+        0xff, 0, 1, 2, 0xff, 3, 4, 5, 0xff, 6, 7, 8, 0xff, 9, 10, 11
+    };
+    return vreinterpretq_s32_u8 (vqtbl1q_u8 (vld1q_u8 ((const uint8_t *)in), vld1q_u8 (shuffle)));
+}
+
+static void
+pcm_flat_24_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    float *out = (float *)output;
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        int32x4_t v = vshrq_n_s32 (pcm_load_24_neon (input + 3 * i), 8);
+        vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (v), 1.f / 0x800000));
+    }
+    pcm_flat_24_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_24_to_32_neon (const char * restrict input, char * restrict output, int count) {
+    int32_t *out = (int32_t *)output;
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        vst1q_s32 (out + i, pcm_load_24_neon (input + 3 * i));
+    }
+    pcm_flat_24_to_32 (input, output, i, count);
+}
+
+static void
+pcm_flat_32_to_16_neon (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    int16_t *out = (int16_t *)output;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x4_t a = vshrn_n_s32 (vld1q_s32 (in + i), 16);
+        int16x4_t b = vshrn_n_s32 (vld1q_s32 (in + i + 4), 16);
+        vst1q_s16 (out + i, vcombine_s16 (a, b));
+    }
+    pcm_flat_32_to_16 (input, output, i, count);
+}
+
+static void
+pcm_flat_32_to_float_neon (const char * restrict input, char * restrict output, int count) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (vld1q_s32 (in + i)), 1.f / 0x80000000));
+    }
+    pcm_flat_32_to_float (input, output, i, count);
+}
+
+static void
+pcm_flat_float_to_16_neon (const char * restrict input, char * restrict output, int count) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const float32x4_t half = vdupq_n_f32 (.5f);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // floor (x + .5), saturated
+        int32x4_t a = vcvtmq_s32_f32 (vaddq_f32 (vmulq_n_f32 (vld1q_f32 (in + i), 0x8000), half));
+        int32x4_t b = vcvtmq_s32_f32 (vaddq_f32 (vmulq_n_f32 (vld1q_f32 (in + i + 4), 0x8000), half));
+        vst1q_s16 (out + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+    }
+    pcm_flat_float_to_16 (input, output, i, count);
+}
+
+#endif // PCM_SIMD_NEON
+
+static int
+pcm_supported_simd_level (void) {
+#if PCM_SIMD_X86
+    if (__builtin_cpu_supports ("avx2")) {
+        return PCM_SIMD_LEVEL_AVX2;
+    }
+    return PCM_SIMD_LEVEL_BASE;
+#elif PCM_SIMD_NEON
+    return PCM_SIMD_LEVEL_BASE;
+#else
+    return PCM_SIMD_LEVEL_NONE;
+#endif
+}
+
+int
+pcm_get_simd_level (void) {
+    int level = pcm_supported_simd_level ();
+    return level < pcm_max_simd_level ? level : pcm_max_simd_level;
+}
+
+void
+pcm_set_max_simd_level (int level) {
+    pcm_max_simd_level = level;
+}
+
+static pcm_flat_fn_t
+pcm_get_flat_converter (int inidx, int outidx) {
+    int level = pcm_get_simd_level ();
+    if (level == PCM_SIMD_LEVEL_NONE) {
+        return NULL;
+    }
+
+#if PCM_SIMD_X86
+    int avx2 = level >= PCM_SIMD_LEVEL_AVX2;
+#define PCM_FLAT(name) (avx2 ? name##_avx2 : name##_sse2)
+#elif PCM_SIMD_NEON
+#define PCM_FLAT(name) name##_neon
+#endif
+
+#ifdef PCM_FLAT
+    switch (inidx << 3 | outidx) {
+    case 1 << 3 | 3:
+        return PCM_FLAT (pcm_flat_16_to_32);
+    case 1 << 3 | 7:
+        return PCM_FLAT (pcm_flat_16_to_float);
+    case 2 << 3 | 3:
+        return PCM_FLAT (pcm_flat_24_to_32);
+    case 2 << 3 | 7:
+        return PCM_FLAT (pcm_flat_24_to_float);
+    case 3 << 3 | 1:
+        return PCM_FLAT (pcm_flat_32_to_16);
+    case 3 << 3 | 7:
+        return PCM_FLAT (pcm_flat_32_to_float);
+    case 7 << 3 | 1:
+        return PCM_FLAT (pcm_flat_float_to_16);
+    }
+#undef PCM_FLAT
+#endif
+
+    return NULL;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -582,7 +1046,20 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
-        if (remappers[inidx][outidx]) {
+
+        int identity = inputfmt->channels == outputfmt->channels;
+        for (int c = 0; identity && c < outputfmt->channels; c++) {
+            identity = channelmap[c] == c;
+        }
+
+        pcm_flat_fn_t flat = identity ? pcm_get_flat_converter (inidx, outidx) : NULL;
+        if (identity && inidx == outidx) {
+            memcpy (output, input, nsamples * outputsamplesize);
+        }
+        else if (flat) {
+            flat (input, output, nsamples * outputfmt->channels);
+        }
+        else if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
         else {
@@ -592,3 +1069,436 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     return nsamples * outputsamplesize;
 }
 
+
+#pragma mark - Gain
+
+// The samples are multiplied by the gain in float domain (double for 32 bit), rounded to nearest and saturated.
+// The vectorized kernels are only used for the constant gain, and give identical results.
+
+typedef void (*pcm_gain_fn_t) (char *bytes, int count, float gain);
+
+// Scalar code for the samples from index i
+
+static inline void
+pcm_gain_8 (char *bytes, int i, int count, float gain) {
+    int8_t *samples = (int8_t *)bytes;
+    for (; i < count; i++) {
+        long sample = lrintf (samples[i] * gain);
+        samples[i] = (int8_t)(sample > 0x7f ? 0x7f : sample < -0x80 ? -0x80 : sample);
+    }
+}
+
+static inline void
+pcm_gain_16 (char *bytes, int i, int count, float gain) {
+    int16_t *samples = (int16_t *)bytes;
+    for (; i < count; i++) {
+        long sample = lrintf (samples[i] * gain);
+        samples[i] = (int16_t)(sample > 0x7fff ? 0x7fff : sample < -0x8000 ? -0x8000 : sample);
+    }
+}
+
+static inline void
+pcm_gain_24 (char *bytes, int i, int count, float gain) {
+    for (; i < count; i++) {
+        char *stream = bytes + 3 * i;
+        int32_t sample = ((unsigned char)stream[0]) | ((unsigned char)stream[1]<<8) | ((signed char)stream[2]<<16);
+        long newsample = lrintf (sample * gain);
+        if (newsample > 0x7fffff) {
+            newsample = 0x7fffff;
+        }
+        else if (newsample < -0x800000) {
+            newsample = -0x800000;
+        }
+        stream[0] = (newsample&0x0000ff);
+        stream[1] = (newsample&0x00ff00)>>8;
+        stream[2] = (newsample&0xff0000)>>16;
+    }
+}
+
+static inline void
+pcm_gain_32 (char *bytes, int i, int count, float gain) {
+    int32_t *samples = (int32_t *)bytes;
+    for (; i < count; i++) {
+        double sample = samples[i] * (double)gain;
+        if (sample > (double)INT32_MAX) {
+            sample = (double)INT32_MAX;
+        }
+        else if (sample < (double)INT32_MIN) {
+            sample = (double)INT32_MIN;
+        }
+        samples[i] = (int32_t)lrint (sample);
+    }
+}
+
+static inline void
+pcm_gain_float (char *bytes, int i, int count, float gain) {
+    float *samples = (float *)bytes;
+    for (; i < count; i++) {
+        samples[i] *= gain;
+    }
+}
+
+static void
+pcm_gain_samples (const ddb_waveformat_t *fmt, char *bytes, int i, int count, float gain) {
+    switch (fmt->bps) {
+    case 8:
+        pcm_gain_8 (bytes, i, count, gain);
+        break;
+    case 16:
+        pcm_gain_16 (bytes, i, count, gain);
+        break;
+    case 24:
+        pcm_gain_24 (bytes, i, count, gain);
+        break;
+    case 32:
+        if (fmt->is_float) {
+            pcm_gain_float (bytes, i, count, gain);
+        }
+        else {
+            pcm_gain_32 (bytes, i, count, gain);
+        }
+        break;
+    }
+}
+
+#if PCM_SIMD_X86
+
+static void
+pcm_gain_8_sse2 (char *bytes, int count, float gain) {
+    int8_t *samples = (int8_t *)bytes;
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(samples + i));
+        __m128i w[2] = {
+            _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8),
+            _mm_srai_epi16 (_mm_unpackhi_epi8 (v, v), 8),
+        };
+        __m128i r[2];
+        for (int k = 0; k < 2; k++) {
+            __m128 lo = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (w[k], w[k]), 16));
+            __m128 hi = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (w[k], w[k]), 16));
+            r[k] = _mm_packs_epi32 (_mm_cvtps_epi32 (_mm_mul_ps (lo, g)), _mm_cvtps_epi32 (_mm_mul_ps (hi, g)));
+        }
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm_packs_epi16 (r[0], r[1]));
+    }
+    pcm_gain_8 (bytes, i, count, gain);
+}
+
+// 8 bit samples are rare, and the SSE2 kernel is used for them at the AVX2 level as well
+#define pcm_gain_8_avx2 pcm_gain_8_sse2
+
+static void
+pcm_gain_16_sse2 (char *bytes, int count, float gain) {
+    int16_t *samples = (int16_t *)bytes;
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(samples + i));
+        __m128 lo = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16));
+        __m128i a = _mm_cvtps_epi32 (_mm_mul_ps (lo, g));
+        __m128i b = _mm_cvtps_epi32 (_mm_mul_ps (hi, g));
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm_packs_epi32 (a, b));
+    }
+    pcm_gain_16 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_24_sse2 (char *bytes, int count, float gain) {
+    const __m128 g = _mm_set1_ps (gain);
+    const __m128 min = _mm_set1_ps (-0x800000);
+    const __m128 max = _mm_set1_ps (0x7fffff);
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        char *stream = bytes + 3 * i;
+        __m128 v = _mm_cvtepi32_ps (_mm_srai_epi32 (pcm_load_24_sse2 (stream), 8));
+        v = _mm_min_ps (_mm_max_ps (_mm_mul_ps (v, g), min), max);
+
+        // SSE2 has no byte shuffle, so the samples are packed one by one
+        int32_t out[4];
+        _mm_storeu_si128 ((__m128i *)out, _mm_cvtps_epi32 (v));
+        for (int k = 0; k < 4; k++) {
+            stream[3*k+0] = (out[k]&0x0000ff);
+            stream[3*k+1] = (out[k]&0x00ff00)>>8;
+            stream[3*k+2] = (out[k]&0xff0000)>>16;
+        }
+    }
+    pcm_gain_24 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_32_sse2 (char *bytes, int count, float gain) {
+    int32_t *samples = (int32_t *)bytes;
+    const __m128d g = _mm_set1_pd (gain);
+    const __m128d min = _mm_set1_pd ((double)INT32_MIN);
+    const __m128d max = _mm_set1_pd ((double)INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(samples + i));
+        __m128d lo = _mm_mul_pd (_mm_cvtepi32_pd (v), g);
+        __m128d hi = _mm_mul_pd (_mm_cvtepi32_pd (_mm_srli_si128 (v, 8)), g);
+        lo = _mm_min_pd (_mm_max_pd (lo, min), max);
+        hi = _mm_min_pd (_mm_max_pd (hi, min), max);
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm_unpacklo_epi64 (_mm_cvtpd_epi32 (lo), _mm_cvtpd_epi32 (hi)));
+    }
+    pcm_gain_32 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_float_sse2 (char *bytes, int count, float gain) {
+    float *samples = (float *)bytes;
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps (samples + i, _mm_mul_ps (_mm_loadu_ps (samples + i), g));
+    }
+    pcm_gain_float (bytes, i, count, gain);
+}
+
+static PCM_AVX2 void
+pcm_gain_16_avx2 (char *bytes, int count, float gain) {
+    int16_t *samples = (int16_t *)bytes;
+    const __m256 g = _mm256_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(samples + i)));
+        __m256i r = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_cvtepi32_ps (v), g));
+        __m128i packed = _mm_packs_epi32 (_mm256_castsi256_si128 (r), _mm256_extracti128_si256 (r, 1));
+        _mm_storeu_si128 ((__m128i *)(samples + i), packed);
+    }
+    pcm_gain_16 (bytes, i, count, gain);
+}
+
+static PCM_AVX2 void
+pcm_gain_24_avx2 (char *bytes, int count, float gain) {
+    const __m256i unpack = _mm256_setr_epi8 (
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    const __m256i pack = _mm256_setr_epi8 (
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i keep = _mm256_setr_epi32 (0, 0, 0, -1, 0, 0, 0, -1);
+    const __m256 g = _mm256_set1_ps (gain);
+    const __m256 min = _mm256_set1_ps (-0x800000);
+    const __m256 max = _mm256_set1_ps (0x7fffff);
+    int i = 0;
+    for (; (i + 8) * 3 + 4 <= count * 3; i += 8) {
+        char *stream = bytes + 3 * i;
+        __m256i raw = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)stream));
+        raw = _mm256_inserti128_si256 (raw, _mm_loadu_si128 ((const __m128i *)(stream + 12)), 1);
+
+        __m256 v = _mm256_cvtepi32_ps (_mm256_srai_epi32 (_mm256_shuffle_epi8 (raw, unpack), 8));
+        v = _mm256_min_ps (_mm256_max_ps (_mm256_mul_ps (v, g), min), max);
+
+        // each lane is stored as 12 bytes of samples, followed by the 4 bytes which were loaded after them
+        __m256i out = _mm256_shuffle_epi8 (_mm256_cvtps_epi32 (v), pack);
+        out = _mm256_or_si256 (out, _mm256_and_si256 (raw, keep));
+        _mm_storeu_si128 ((__m128i *)stream, _mm256_castsi256_si128 (out));
+        _mm_storeu_si128 ((__m128i *)(stream + 12), _mm256_extracti128_si256 (out, 1));
+    }
+    pcm_gain_24 (bytes, i, count, gain);
+}
+
+static PCM_AVX2 void
+pcm_gain_32_avx2 (char *bytes, int count, float gain) {
+    int32_t *samples = (int32_t *)bytes;
+    const __m256d g = _mm256_set1_pd (gain);
+    const __m256d min = _mm256_set1_pd ((double)INT32_MIN);
+    const __m256d max = _mm256_set1_pd ((double)INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d v = _mm256_mul_pd (_mm256_cvtepi32_pd (_mm_loadu_si128 ((const __m128i *)(samples + i))), g);
+        v = _mm256_min_pd (_mm256_max_pd (v, min), max);
+        _mm_storeu_si128 ((__m128i *)(samples + i), _mm256_cvtpd_epi32 (v));
+    }
+    pcm_gain_32 (bytes, i, count, gain);
+}
+
+static PCM_AVX2 void
+pcm_gain_float_avx2 (char *bytes, int count, float gain) {
+    float *samples = (float *)bytes;
+    const __m256 g = _mm256_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps (samples + i, _mm256_mul_ps (_mm256_loadu_ps (samples + i), g));
+    }
+    pcm_gain_float (bytes, i, count, gain);
+}
+
+#endif // PCM_SIMD_X86
+
+#if PCM_SIMD_NEON
+
+static void
+pcm_gain_8_neon (char *bytes, int count, float gain) {
+    int8_t *samples = (int8_t *)bytes;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        int8x16_t v = vld1q_s8 (samples + i);
+        int16x8_t w[2] = { vmovl_s8 (vget_low_s8 (v)), vmovl_s8 (vget_high_s8 (v)) };
+        int16x8_t r[2];
+        for (int k = 0; k < 2; k++) {
+            int32x4_t a = vcvtnq_s32_f32 (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (w[k]))), gain));
+            int32x4_t b = vcvtnq_s32_f32 (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (w[k]))), gain));
+            r[k] = vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b));
+        }
+        vst1q_s8 (samples + i, vcombine_s8 (vqmovn_s16 (r[0]), vqmovn_s16 (r[1])));
+    }
+    pcm_gain_8 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_16_neon (char *bytes, int count, float gain) {
+    int16_t *samples = (int16_t *)bytes;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16 (samples + i);
+        int32x4_t a = vcvtnq_s32_f32 (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))), gain));
+        int32x4_t b = vcvtnq_s32_f32 (vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))), gain));
+        vst1q_s16 (samples + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+    }
+    pcm_gain_16 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_24_neon (char *bytes, int count, float gain) {
+    static const uint8_t unpack[16] = {
+        0xff, 0, 1, 2, 0xff, 3, 4, 5, 0xff, 6, 7, 8, 0xff, 9, 10, 11
+    };
+    // 12 bytes of samples, followed by the 4 bytes which were loaded after them
+    static const uint8_t pack[16] = {
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 28, 29, 30, 31
+    };
+    const float32x4_t min = vdupq_n_f32 (-0x800000);
+    const float32x4_t max = vdupq_n_f32 (0x7fffff);
+    int i = 0;
+    for (; (i + 4) * 3 + 4 <= count * 3; i += 4) {
+        uint8_t *stream = (uint8_t *)bytes + 3 * i;
+        uint8x16_t raw = vld1q_u8 (stream);
+        int32x4_t v = vshrq_n_s32 (vreinterpretq_s32_u8 (vqtbl1q_u8 (raw, vld1q_u8 (unpack))), 8);
+        float32x4_t f = vminq_f32 (vmaxq_f32 (vmulq_n_f32 (vcvtq_f32_s32 (v), gain), min), max);
+        uint8x16x2_t table = { { vreinterpretq_u8_s32 (vcvtnq_s32_f32 (f)), raw } };
+        vst1q_u8 (stream, vqtbl2q_u8 (table, vld1q_u8 (pack)));
+    }
+    pcm_gain_24 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_32_neon (char *bytes, int count, float gain) {
+    int32_t *samples = (int32_t *)bytes;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t v = vld1q_s32 (samples + i);
+        float64x2_t lo = vmulq_n_f64 (vcvtq_f64_s64 (vmovl_s32 (vget_low_s32 (v))), gain);
+        float64x2_t hi = vmulq_n_f64 (vcvtq_f64_s64 (vmovl_s32 (vget_high_s32 (v))), gain);
+        vst1q_s32 (samples + i, vcombine_s32 (vqmovn_s64 (vcvtnq_s64_f64 (lo)), vqmovn_s64 (vcvtnq_s64_f64 (hi))));
+    }
+    pcm_gain_32 (bytes, i, count, gain);
+}
+
+static void
+pcm_gain_float_neon (char *bytes, int count, float gain) {
+    float *samples = (float *)bytes;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32 (samples + i, vmulq_n_f32 (vld1q_f32 (samples + i), gain));
+    }
+    pcm_gain_float (bytes, i, count, gain);
+}
+
+#endif // PCM_SIMD_NEON
+
+static pcm_gain_fn_t
+pcm_get_gain_kernel (const ddb_waveformat_t *fmt) {
+    int level = pcm_get_simd_level ();
+    if (level == PCM_SIMD_LEVEL_NONE) {
+        return NULL;
+    }
+
+#if PCM_SIMD_X86
+    int avx2 = level >= PCM_SIMD_LEVEL_AVX2;
+#define PCM_GAIN(name) (avx2 ? name##_avx2 : name##_sse2)
+#elif PCM_SIMD_NEON
+#define PCM_GAIN(name) name##_neon
+#endif
+
+#ifdef PCM_GAIN
+    switch (fmt->bps) {
+    case 8:
+        return PCM_GAIN (pcm_gain_8);
+    case 16:
+        return PCM_GAIN (pcm_gain_16);
+    case 24:
+        return PCM_GAIN (pcm_gain_24);
+    case 32:
+        return fmt->is_float ? PCM_GAIN (pcm_gain_float) : PCM_GAIN (pcm_gain_32);
+    }
+#undef PCM_GAIN
+#endif
+
+    return NULL;
+}
+
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float from_gain, float to_gain, int ramp_frames) {
+    int samplesize = fmt->bps >> 3;
+    if (samplesize == 0 || fmt->channels <= 0) {
+        return;
+    }
+    int nframes = size / (samplesize * fmt->channels);
+    if (from_gain == to_gain || ramp_frames < 0) {
+        ramp_frames = 0;
+    }
+    if (ramp_frames > nframes) {
+        ramp_frames = nframes;
+    }
+
+    // the gain reaches to_gain at the last frame of the ramp
+    for (int f = 0; f < ramp_frames; f++) {
+        float gain = from_gain + (to_gain - from_gain) * (f + 1) / ramp_frames;
+        pcm_gain_samples (fmt, bytes, f * fmt->channels, (f + 1) * fmt->channels, gain);
+    }
+
+    if (to_gain == 1.f) {
+        return;
+    }
+
+    char *stream = bytes + ramp_frames * fmt->channels * samplesize;
+    int count = (nframes - ramp_frames) * fmt->channels;
+    pcm_gain_fn_t kernel = pcm_get_gain_kernel (fmt);
+    if (kernel) {
+        kernel (stream, count, to_gain);
+    }
+    else {
+        pcm_gain_samples (fmt, stream, 0, count, to_gain);
+    }
+}
+
+void
+pcm_clip_float (float *samples, int count, float limit) {
+    int i = 0;
+    if (pcm_get_simd_level () != PCM_SIMD_LEVEL_NONE) {
+#if PCM_SIMD_X86
+        const __m128 max = _mm_set1_ps (limit);
+        const __m128 min = _mm_set1_ps (-limit);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps (samples + i, _mm_min_ps (_mm_max_ps (_mm_loadu_ps (samples + i), min), max));
+        }
+#elif PCM_SIMD_NEON
+        const float32x4_t max = vdupq_n_f32 (limit);
+        const float32x4_t min = vdupq_n_f32 (-limit);
+        for (; i + 4 <= count; i += 4) {
+            vst1q_f32 (samples + i, vminq_f32 (vmaxq_f32 (vld1q_f32 (samples + i), min), max));
+        }
+#endif
+    }
+    for (; i < count; i++) {
+        if (samples[i] > limit) {
+            samples[i] = limit;
+        }
+        else if (samples[i] < -limit) {
+            samples[i] = -limit;
+        }
+    }
+}
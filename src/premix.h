@@ -39,6 +39,30 @@ extern "C" {
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// Multiply the samples by the gain, in place.
+// The gain changes linearly from @c from_gain to @c to_gain over the first @c ramp_frames frames,
+// and stays at @c to_gain for the rest of the buffer.
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float from_gain, float to_gain, int ramp_frames);
+
+// Clamp float samples to the [-limit, limit] range, in place.
+void
+pcm_clip_float (float *samples, int count, float limit);
+
+// Instruction sets used by pcm_convert, pcm_apply_gain and pcm_clip_float
+#define PCM_SIMD_LEVEL_NONE 0 // scalar code only
+#define PCM_SIMD_LEVEL_BASE 1 // SSE2 on x86, NEON on arm64
+#define PCM_SIMD_LEVEL_AVX2 2
+
+// @returns the instruction set level in use
+int
+pcm_get_simd_level (void);
+
+// Limit the instruction set level, e.g. to compare against the scalar code.
+// The best supported level is used by default.
+void
+pcm_set_max_simd_level (int level);
+
 #ifdef __cplusplus
 }
 #endif
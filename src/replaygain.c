@@ -24,6 +24,7 @@
 
   Oleksiy Yakovenko waker@users.sourceforge.net
 */
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include "streamer.h"
@@ -33,42 +34,261 @@
 #include <deadbeef/common.h>
 #include "playmodes.h"
 #include "plmeta.h"
+#include "premix.h"
+
+#define LIMITER_ATTACK_MS 5
+#define LIMITER_RELEASE_MS 100
+#define LIMITER_MAX_CHANNELS 32
 
 static ddb_replaygain_settings_t current_settings;
 
-void
-replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_waveformat_t *fmt, char *bytes, int numbytes) {
-    if (settings->processing_flags == 0) {
+// The gains of the current settings are calculated once per track, for both source modes,
+// since the mode which follows the playback order can change during the track.
+static float current_track_gain = 1.f;
+static float current_album_gain = 1.f;
+
+// The per-block limiter replaces the prevent clipping gain reduction, when enabled by replaygain.limiter
+static int current_limiter;
+
+typedef struct {
+    float envelope; // gain reduction at the end of the previous block
+    int channels;
+    float history[LIMITER_MAX_CHANNELS]; // the last frame of the previous block, before the gain
+    float *buffer; // float copy of the integer samples
+    int buffer_size;
+    float *gains; // gain reduction per frame
+    int gains_size;
+} rg_block_limiter_t;
+
+static rg_block_limiter_t limiter = { .envelope = 1.f };
+
+static int
+_get_source_mode (int mode) {
+    if (mode != DDB_RG_SOURCE_MODE_PLAYBACK_ORDER) {
+        return mode;
+    }
+    ddb_shuffle_t shuffle = streamer_get_shuffle ();
+    if (shuffle == DDB_SHUFFLE_ALBUMS || shuffle == DDB_SHUFFLE_OFF) {
+        return DDB_RG_SOURCE_MODE_ALBUM;
+    }
+    else {
+        return DDB_RG_SOURCE_MODE_TRACK;
+    }
+}
+
+static float
+_get_gain (const ddb_replaygain_settings_t *settings, int mode, int prevent_clipping) {
+    float gain;
+    float peak;
+    switch (mode) {
+    case DDB_RG_SOURCE_MODE_TRACK:
+        gain = settings->has_track_gain ? settings->preamp_with_rg * settings->trackgain : settings->preamp_without_rg;
+        peak = settings->trackpeak;
+        break;
+    case DDB_RG_SOURCE_MODE_ALBUM:
+        gain = settings->has_album_gain ? settings->preamp_with_rg * settings->albumgain : settings->preamp_without_rg;
+        peak = settings->albumpeak;
+        break;
+    default:
+        return 1.f;
+    }
+    if (prevent_clipping && gain * peak > 1.f) {
+        gain = 1.f / peak;
+    }
+    return gain;
+}
+
+float
+replaygain_get_gain (const ddb_replaygain_settings_t *settings) {
+    return _get_gain (settings, _get_source_mode (settings->source_mode), settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING);
+}
+
+// Float samples are clipped, the same way as the integer samples are saturated by pcm_apply_gain
+static void
+_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int numbytes, float gain) {
+    if (gain == 1.f) {
         return;
     }
-    if (fmt->flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
+    pcm_apply_gain (fmt, bytes, numbytes, gain, gain, 0);
+    if (fmt->bps == 32 && fmt->is_float) {
+        pcm_clip_float ((float *)bytes, numbytes / 4, 1.f);
+    }
+}
+
+#pragma mark - Per-block limiter
+
+// The blocks are processed in place, so the output is not delayed, and there is no delay line to look ahead across blocks:
+// the gain goes down linearly before a peak within the block, but a peak at the start of the block reduces it immediately.
+// Only the envelope and the last frame are carried over to the next block.
+// Inter-sample peaks are estimated at the midpoints between the frames, by cubic interpolation.
+
+static const float *
+_block_limiter_frame (const float *samples, int nframes, int channels, int frame) {
+    if (frame < 0) {
+        return limiter.history;
+    }
+    if (frame >= nframes) {
+        frame = nframes - 1;
+    }
+    return samples + frame * channels;
+}
+
+// The peak of the frame x1, or of the midpoint between x1 and x2
+static inline float
+_block_limiter_peak (const float *x0, const float *x1, const float *x2, const float *x3, int channels) {
+    float peak = 0;
+    for (int c = 0; c < channels; c++) {
+        float sample = fabsf (x1[c]);
+        float mid = fabsf ((9.f * (x1[c] + x2[c]) - (x0[c] + x3[c])) * (1.f / 16.f));
+        if (sample > peak) {
+            peak = sample;
+        }
+        if (mid > peak) {
+            peak = mid;
+        }
+    }
+    return peak;
+}
+
+static void
+_block_limiter_process (float *samples, int nframes, int channels, int samplerate, float gain) {
+    float *gains = limiter.gains;
+
+    for (int i = 0; i < nframes; i++) {
+        const float *x0 = _block_limiter_frame (samples, nframes, channels, i - 1);
+        const float *x2 = _block_limiter_frame (samples, nframes, channels, i + 1);
+        const float *x3 = _block_limiter_frame (samples, nframes, channels, i + 2);
+        float level = _block_limiter_peak (x0, samples + i * channels, x2, x3, channels) * gain;
+        gains[i] = level > LIMITER_CEILING ? LIMITER_CEILING / level : 1.f;
+    }
+    memcpy (limiter.history, samples + (nframes - 1) * channels, channels * sizeof (float));
+
+    // the gain reaches each reduction at its peak, going down by at most 1/attack_frames per frame,
+    // starting no earlier than the start of the block
+    int attack_frames = samplerate * LIMITER_ATTACK_MS / 1000;
+    float attack = 1.f / (attack_frames > 0 ? attack_frames : 1);
+    for (int i = nframes - 2; i >= 0; i--) {
+        float g = gains[i + 1] + attack;
+        if (g < gains[i]) {
+            gains[i] = g;
+        }
+    }
+
+    float release = 1.f - expf (-1000.f / ((samplerate > 0 ? samplerate : 44100) * (float)LIMITER_RELEASE_MS));
+    float envelope = limiter.envelope;
+    for (int i = 0; i < nframes; i++) {
+        envelope += (1.f - envelope) * release;
+        if (envelope > gains[i]) {
+            envelope = gains[i];
+        }
+        float g = gain * envelope;
+        float *frame = samples + i * channels;
+        for (int c = 0; c < channels; c++) {
+            frame[c] *= g;
+        }
+    }
+
+    // close enough to let the next blocks skip the limiter
+    limiter.envelope = envelope > 0.999f ? 1.f : envelope;
+}
+
+static void
+_block_limiter_apply (const ddb_waveformat_t *fmt, char *bytes, int numbytes, float gain, float peak) {
+    int samplesize = fmt->bps >> 3;
+    int channels = fmt->channels;
+    // nothing to limit, if the tagged peak can't reach the ceiling, and the gain has recovered from the previous peaks
+    if (samplesize == 0 || channels <= 0 || channels > LIMITER_MAX_CHANNELS
+        || (gain * peak <= LIMITER_CEILING && limiter.envelope >= 1.f)) {
+        _apply_gain (fmt, bytes, numbytes, gain);
         return;
     }
-    if (fmt->bps == 16) {
-        apply_replay_gain_int16 (settings, bytes, numbytes);
+    int nframes = numbytes / (samplesize * channels);
+    if (nframes == 0) {
+        return;
     }
-    else if (fmt->bps == 24) {
-        apply_replay_gain_int24 (settings, bytes, numbytes);
+
+    if (channels != limiter.channels) {
+        limiter.channels = channels;
+        memset (limiter.history, 0, sizeof (limiter.history));
     }
-    else if (fmt->bps == 8) {
-        apply_replay_gain_int8 (settings, bytes, numbytes);
+
+    if (limiter.gains_size < nframes) {
+        free (limiter.gains);
+        limiter.gains = malloc (nframes * sizeof (float));
+        limiter.gains_size = nframes;
     }
-    else if (fmt->bps == 32 && !fmt->is_float) {
-        apply_replay_gain_int32 (settings, bytes, numbytes);
+
+    if (fmt->bps == 32 && fmt->is_float) {
+        _block_limiter_process ((float *)bytes, nframes, channels, fmt->samplerate, gain);
+        return;
     }
-    else if (fmt->bps == 32 && fmt->is_float) {
-        apply_replay_gain_float32 (settings, bytes, numbytes);
+
+    // the channel mask is rebuilt, so that the conversion keeps all channels even with a bad mask
+    ddb_waveformat_t intfmt = *fmt;
+    intfmt.channelmask = channels == 32 ? 0xffffffff : (1u << channels) - 1;
+    ddb_waveformat_t floatfmt = intfmt;
+    floatfmt.bps = 32;
+    floatfmt.is_float = 1;
+
+    int count = nframes * channels;
+    if (limiter.buffer_size < count) {
+        free (limiter.buffer);
+        limiter.buffer = malloc (count * sizeof (float));
+        limiter.buffer_size = count;
     }
+
+    pcm_convert (&intfmt, bytes, &floatfmt, (char *)limiter.buffer, nframes * samplesize * channels);
+    _block_limiter_process (limiter.buffer, nframes, channels, fmt->samplerate, gain);
+    pcm_convert (&floatfmt, (char *)limiter.buffer, &intfmt, bytes, count * (int)sizeof (float));
+}
+
+#pragma mark -
+
+void
+replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_waveformat_t *fmt, char *bytes, int numbytes) {
+    if (settings->processing_flags == 0) {
+        return;
+    }
+    if (fmt->flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
+        return;
+    }
+    _apply_gain (fmt, bytes, numbytes, replaygain_get_gain (settings));
 }
 
 void
 replaygain_apply (ddb_waveformat_t *fmt, char *bytes, int numbytes) {
-    replaygain_apply_with_settings(&current_settings, fmt, bytes, numbytes);
+    if (current_settings.processing_flags == 0) {
+        return;
+    }
+    if (fmt->flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
+        return;
+    }
+
+    int mode = _get_source_mode (current_settings.source_mode);
+    if (mode != DDB_RG_SOURCE_MODE_TRACK && mode != DDB_RG_SOURCE_MODE_ALBUM) {
+        return;
+    }
+    int track = mode == DDB_RG_SOURCE_MODE_TRACK;
+    float gain = track ? current_track_gain : current_album_gain;
+    if (current_limiter) {
+        _block_limiter_apply (fmt, bytes, numbytes, gain, track ? current_settings.trackpeak : current_settings.albumpeak);
+    }
+    else {
+        _apply_gain (fmt, bytes, numbytes, gain);
+    }
 }
 
 void
 replaygain_set_current (ddb_replaygain_settings_t *settings) {
     memcpy (&current_settings, settings, sizeof (ddb_replaygain_settings_t));
+
+    int prevent_clipping = settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING;
+    current_limiter = prevent_clipping && conf_get_int ("replaygain.limiter", 0);
+    current_track_gain = _get_gain (settings, DDB_RG_SOURCE_MODE_TRACK, prevent_clipping && !current_limiter);
+    current_album_gain = _get_gain (settings, DDB_RG_SOURCE_MODE_ALBUM, prevent_clipping && !current_limiter);
+
+    limiter.envelope = 1.f;
+    limiter.channels = 0;
 }
 
 void
@@ -132,180 +352,37 @@ replaygain_init_settings (ddb_replaygain_settings_t *settings, playItem_t *it) {
     pl_unlock ();
 }
 
-static int
-_get_source_mode (int mode) {
-    if (mode != DDB_RG_SOURCE_MODE_PLAYBACK_ORDER) {
-        return mode;
-    }
-    ddb_shuffle_t shuffle = streamer_get_shuffle ();
-    if (shuffle == DDB_SHUFFLE_ALBUMS || shuffle == DDB_SHUFFLE_OFF) {
-        return DDB_RG_SOURCE_MODE_ALBUM;
-    }
-    else {
-        return DDB_RG_SOURCE_MODE_TRACK;
-    }
-}
-
-static inline int
-get_int_volume (ddb_replaygain_settings_t *settings) {
-    int vol = 1000;
-
-    int mode = _get_source_mode (settings->source_mode);
-    switch (mode) {
-    case DDB_RG_SOURCE_MODE_TRACK:
-        if (!settings->has_track_gain) {
-            vol = (int)(settings->preamp_without_rg * 1000);
-        } else {
-            vol = (int)(settings->preamp_with_rg * settings->trackgain * 1000);
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->trackpeak > 1000) {
-                vol = (int)(1000 / settings->trackpeak);
-            }
-        }
-        break;
-    case DDB_RG_SOURCE_MODE_ALBUM:
-        if (!settings->has_album_gain) {
-            vol = (int)(settings->preamp_without_rg *  1000);
-        } else {
-            vol = (int)(settings->preamp_with_rg * settings->albumgain * 1000);
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->albumpeak > 1000) {
-                vol = (int)(1000 / settings->albumpeak);
-            }
-        }
-        break;
-    default:
-        break;
-    }
-    return vol == 1000 ? -1 : vol;
+static void
+_apply_replay_gain (ddb_replaygain_settings_t *settings, int bps, int is_float, char *bytes, int size) {
+    ddb_waveformat_t fmt = {
+        .bps = bps,
+        .channels = 1,
+        .is_float = is_float,
+    };
+    _apply_gain (&fmt, bytes, size, replaygain_get_gain (settings));
 }
 
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int8_t *s = (int8_t*)bytes;
-    for (int j = 0; j < size; j++) {
-        int32_t sample = ((int8_t)(*s)) * vol / 1000;
-        if (sample > 0x7f) {
-            sample = 0x7f;
-        }
-        else if (sample < -0x80) {
-            sample = -0x80;
-        }
-        *s = (int8_t)sample;
-        s++;
-    }
+    _apply_replay_gain (settings, 8, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int16 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int16_t *s = (int16_t*)bytes;
-    for (int j = 0; j < size/2; j++) {
-        int32_t sample = ((int32_t)(*s)) * vol / 1000;
-        if (sample > 0x7fff) {
-            sample = 0x7fff;
-        }
-        else if (sample < -0x8000) {
-            sample = -0x8000;
-        }
-        *s = (int16_t)sample;
-        s++;
-    }
+    _apply_replay_gain (settings, 16, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int24 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int64_t vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    char *s = (char*)bytes;
-    for (int j = 0; j < size/3; j++) {
-        int32_t sample = ((unsigned char)s[0]) | ((unsigned char)s[1]<<8) | ((signed char)s[2]<<16);
-        sample = (int32_t)(sample * vol / 1000);
-        if (sample > 0x7fffff) {
-            sample = 0x7fffff;
-        }
-        else if (sample < -0x800000) {
-            sample = -0x800000;
-        }
-        s[0] = (sample&0x0000ff);
-        s[1] = (sample&0x00ff00)>>8;
-        s[2] = (sample&0xff0000)>>16;
-        s += 3;
-    }
+    _apply_replay_gain (settings, 24, 0, bytes, size);
 }
 
 void
 apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    int64_t vol = get_int_volume (settings);
-    if (vol < 0) {
-        return;
-    }
-    int32_t *s = (int32_t*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        int64_t sample = ((int32_t)(*s)) * vol / 1000;
-        *s = (int32_t)sample;
-        s++;
-    }
+    _apply_replay_gain (settings, 32, 0, bytes, size);
 }
 
 void
 apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
-    float vol = 1.f;
-    int mode = _get_source_mode (settings->source_mode);
-    switch (mode) {
-    case DDB_RG_SOURCE_MODE_TRACK:
-        if (!settings->has_track_gain) {
-            vol = settings->preamp_without_rg;
-        } else {
-            vol = settings->preamp_with_rg * settings->trackgain;
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->trackpeak > 1.f) {
-                vol = 1.f / settings->trackpeak;
-            }
-        }
-        break;
-    case DDB_RG_SOURCE_MODE_ALBUM:
-        if (!settings->has_album_gain) {
-            vol = settings->preamp_without_rg;
-        } else {
-            vol = settings->preamp_with_rg * settings->albumgain;
-        }
-        if (settings->processing_flags & DDB_RG_PROCESSING_PREVENT_CLIPPING) {
-            if (vol * settings->albumpeak > 1.f) {
-                vol = 1.f / settings->albumpeak;
-            }
-        }
-        break;
-    default:
-        break;
-    }
-
-    if (vol == 1) {
-        return;
-    }
-
-    float *s = (float*)bytes;
-    for (int j = 0; j < size/4; j++) {
-        float sample = ((float)*s) * vol;
-        if (sample > 1.f) {
-            sample = 1.f;
-        }
-        else if (sample < -1.f) {
-            sample = -1.f;
-        }
-        *s = sample;
-        s++;
-    }
+    _apply_replay_gain (settings, 32, 1, bytes, size);
 }
@@ -28,6 +28,15 @@
 #define __REPLAYGAIN_H
 
 #include <deadbeef/deadbeef.h>
+#include "playlist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The ceiling of the per-block limiter, enabled by replaygain.limiter:
+// -1 dBTP, which leaves room for the inter-sample peaks which are not caught by the estimate
+#define LIMITER_CEILING 0.891251f
 
 void
 replaygain_init_settings (ddb_replaygain_settings_t *settings, playItem_t *it);
@@ -38,9 +47,17 @@ replaygain_apply (ddb_waveformat_t *fmt, char *bytes, int numbytes);
 void
 replaygain_apply_with_settings (ddb_replaygain_settings_t *settings, ddb_waveformat_t *fmt, char *bytes, int numbytes);
 
+// Set the settings used by replaygain_apply, normally once per track.
+// The gain is calculated here, and the per-block limiter is reset.
 void
 replaygain_set_current (ddb_replaygain_settings_t *settings);
 
+// @returns the linear gain for the settings, limited by the peak in the prevent clipping mode
+float
+replaygain_get_gain (const ddb_replaygain_settings_t *settings);
+
+// The following functions apply the gain to samples of a single format, ignoring the processing flags
+
 void
 apply_replay_gain_int8 (ddb_replaygain_settings_t *settings, char *bytes, int size);
 
@@ -56,4 +73,8 @@ apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int s
 void
 apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
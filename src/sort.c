@@ -21,7 +21,6 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
-#include <sys/time.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,6 +30,7 @@
 #include "pltmeta.h"
 #include "plmeta.h"
 #include "messagepump.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -49,94 +49,410 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
     plt_sort_internal (playlist, iter, id, format, order, 0);
 }
 
-static int pl_sort_is_duration;
-static int pl_sort_is_track;
-static int pl_sort_ascending;
-static int pl_sort_id;
-static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
-static const char *pl_sort_format;
-static char *pl_sort_tf_bytecode;
-static ddb_tf_context_t pl_sort_tf_ctx;
+// The sort key of each track is evaluated once, before sorting.
+// Text is stored in the key arena as a sequence of lowercased characters, each prefixed with its length,
+// so that comparing two keys with memcmp gives the same order as u8_strcasecmp.
+// A leading number is parsed into the number field, and compared before the rest of the text.
+typedef struct {
+    playItem_t *it;
+    int index; // position before sorting, to keep the order of equal tracks
+    int has_number;
+    int64_t number;
+    const char *text;
+    size_t text_offset; // offset in the arena, while the arena can grow
+    int text_len;
+    int rest; // offset of the text after the leading number, relative to text
+} sort_key_t;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} sort_arena_t;
+
+// playlists below this size are sorted on the calling thread
+#define PLSORT_PARALLEL_MIN_ITEMS 10000
+#define PLSORT_CHUNK_SIZE 2048
+
+typedef struct {
+    int id;
+    int version; // 0: use format, 1: use tf_bytecode
+    int ascending;
+    int is_duration;
+    int is_track;
+    const char *format;
+    char *tf_bytecode;
+    playlist_t *plt;
+    int tf_flags;
+
+    sort_key_t *keys;
+    int count;
+    int chunk_size; // keys are evaluated in chunks, each with its own arena
+    sort_arena_t *arenas;
+
+    // merge sort state
+    int nthreads;
+    int run_size;
+    int parts_per_merge;
+    const sort_key_t *src;
+    sort_key_t *dst;
+} sort_ctx_t;
+
+// qsort has no context argument
+static const sort_ctx_t *pl_sort_ctx;
+
+static int pl_sort_thread_count;
 
-static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
-        }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
-        }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+static void
+sort_arena_append (sort_arena_t *arena, const char *bytes, size_t size) {
+    if (arena->size + size > arena->capacity) {
+        size_t capacity = arena->capacity ? arena->capacity * 2 : 65536;
+        while (capacity < arena->size + size) {
+            capacity *= 2;
         }
-        return anum - bnum;
+        arena->data = realloc (arena->data, capacity);
+        arena->capacity = capacity;
     }
-    return u8_strcasecmp (a,b);
+    memcpy (arena->data + arena->size, bytes, size);
+    arena->size += size;
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        int64_t dur_a = (int64_t)((double)a->_duration * 100000);
-        int64_t dur_b = (int64_t)((double)b->_duration * 100000);
-        return !pl_sort_ascending ? (int)(dur_b - dur_a) : (int)(dur_a - dur_b);
-    }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
-        if (t && !isdigit (*t)) {
-            t1 = 999999;
+static void
+sort_key_set_text (sort_arena_t *arena, sort_key_t *key, const char *text) {
+    key->has_number = 0;
+    key->number = 0;
+    key->text_offset = arena->size;
+    key->rest = 0;
+
+    // leading number
+    const char *p = text;
+    if (isdigit (*p)) {
+        key->has_number = 1;
+        while (*p && isdigit (*p)) {
+            if (key->number < INT64_MAX / 10 - 9) {
+                key->number = key->number * 10 + (*p - '0');
+            }
+            p++;
+        }
+        key->rest = (int)(p - text) * 2;
+    }
+
+    p = text;
+    while (*p) {
+        int32_t i = 0;
+        u8_nextchar (p, &i);
+        char lower[12];
+        int l;
+        if (i <= 8) {
+            l = u8_tolower ((const signed char *)p, i, lower + 1);
         }
         else {
-            t1 = t ? atoi (t) : -1;
+            // malformed sequence, compared as is
+            l = i > 10 ? 10 : i;
+            memcpy (lower + 1, p, l);
         }
-        t = pl_find_meta_raw (b, "track");
-        if (t && !isdigit (*t)) {
-            t2 = 999999;
+        lower[0] = (char)l;
+        sort_arena_append (arena, lower, l + 1);
+        p += i;
+    }
+    key->text_len = (int)(arena->size - key->text_offset);
+}
+
+static void
+sort_key_init (sort_ctx_t *ctx, ddb_tf_context_t *tf_ctx, sort_arena_t *arena, sort_key_t *key, playItem_t *it, int index) {
+    key->it = it;
+    key->index = index;
+    if (ctx->is_duration || ctx->is_track) {
+        key->has_number = 1;
+        key->text_offset = 0;
+        key->text_len = 0;
+        key->rest = 0;
+        if (ctx->is_duration) {
+            key->number = (int64_t)((double)it->_duration * 100000);
         }
         else {
-            t2 = t ? atoi (t) : -1;
+            const char *t = pl_find_meta_raw (it, "track");
+            if (t && !isdigit (*t)) {
+                key->number = 999999;
+            }
+            else {
+                key->number = t ? atoi (t) : -1;
+            }
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        char tmp[1024];
+        if (ctx->version == 0) {
+            pl_format_title (it, -1, tmp, sizeof (tmp), ctx->id, ctx->format);
         }
         else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
-        }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+            tf_ctx->it = (ddb_playItem_t *)it;
+            tf_eval (tf_ctx, ctx->tf_bytecode, tmp, sizeof (tmp));
         }
+        sort_key_set_text (arena, key, tmp);
+    }
+}
+
+static void
+sort_eval_chunk (void *_ctx, int chunk) {
+    sort_ctx_t *ctx = _ctx;
+    int first = chunk * ctx->chunk_size;
+    int last = first + ctx->chunk_size;
+    if (last > ctx->count) {
+        last = ctx->count;
+    }
+
+    ddb_tf_context_t tf_ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .flags = ctx->tf_flags,
+        .plt = (ddb_playlist_t *)ctx->plt,
+        .idx = -1,
+        .id = ctx->id,
+    };
+    sort_arena_t *arena = &ctx->arenas[chunk];
+    for (int i = first; i < last; i++) {
+        sort_key_init (ctx, &tf_ctx, arena, &ctx->keys[i], ctx->keys[i].it, i);
+    }
+
+    // the arena doesn't move anymore
+    for (int i = first; i < last; i++) {
+        ctx->keys[i].text = arena->data + ctx->keys[i].text_offset;
+    }
+}
+
+static int
+sort_key_compare_text (const char *a, int alen, const char *b, int blen) {
+    int res = memcmp (a, b, alen < blen ? alen : blen);
+    if (res) {
         return res;
     }
+    return alen - blen;
+}
+
+static int
+sort_key_compare (const sort_ctx_t *ctx, const sort_key_t *a, const sort_key_t *b) {
+    int res;
+    if (a->has_number && b->has_number) {
+        if (a->number != b->number) {
+            res = a->number < b->number ? -1 : 1;
+        }
+        else {
+            res = sort_key_compare_text (a->text + a->rest, a->text_len - a->rest, b->text + b->rest, b->text_len - b->rest);
+        }
+    }
+    else {
+        res = sort_key_compare_text (a->text, a->text_len, b->text, b->text_len);
+    }
+    if (!ctx->ascending) {
+        res = -res;
+    }
+    if (!res) {
+        res = a->index - b->index;
+    }
+    return res;
 }
 
 static int
 qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+    return sort_key_compare (pl_sort_ctx, a, b);
+}
+
+#pragma mark - Parallel merge sort
+
+// Keys never compare equal, thanks to the index, so any correct sort gives the same order as the serial one.
+
+static void
+sort_run (void *_ctx, int run) {
+    sort_ctx_t *ctx = _ctx;
+    int first = run * ctx->run_size;
+    int count = ctx->run_size;
+    if (first + count > ctx->count) {
+        count = ctx->count - first;
+    }
+    qsort (ctx->keys + first, count, sizeof (sort_key_t), qsort_cmp_func);
+}
+
+// Returns how many items of a are among the first d items of the merge of a and b
+static int
+sort_merge_split (const sort_ctx_t *ctx, const sort_key_t *a, int na, const sort_key_t *b, int nb, int d) {
+    int lo = d > nb ? d - nb : 0;
+    int hi = d < na ? d : na;
+    while (lo < hi) {
+        int i = lo + (hi - lo) / 2;
+        int j = d - i;
+        if (sort_key_compare (ctx, &a[i], &b[j-1]) < 0) {
+            lo = i + 1;
+        }
+        else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+// Merges a part of two neighbouring runs; each merge is split into parts_per_merge parts of equal output size
+static void
+sort_merge_part (void *_ctx, int task) {
+    sort_ctx_t *ctx = _ctx;
+    int merge = task / ctx->parts_per_merge;
+    int part = task % ctx->parts_per_merge;
+
+    int first = merge * ctx->run_size * 2;
+    int mid = first + ctx->run_size;
+    int last = mid + ctx->run_size;
+    if (mid > ctx->count) {
+        mid = ctx->count;
+    }
+    if (last > ctx->count) {
+        last = ctx->count;
+    }
+
+    const sort_key_t *a = ctx->src + first;
+    const sort_key_t *b = ctx->src + mid;
+    int na = mid - first;
+    int nb = last - mid;
+    int total = na + nb;
+
+    int d0 = (int)((int64_t)total * part / ctx->parts_per_merge);
+    int d1 = (int)((int64_t)total * (part + 1) / ctx->parts_per_merge);
+    int i = sort_merge_split (ctx, a, na, b, nb, d0);
+    int j = d0 - i;
+    int i1 = sort_merge_split (ctx, a, na, b, nb, d1);
+    int j1 = d1 - i1;
+
+    sort_key_t *out = ctx->dst + first + d0;
+    while (i < i1 && j < j1) {
+        if (sort_key_compare (ctx, &a[i], &b[j]) < 0) {
+            *out++ = a[i++];
+        }
+        else {
+            *out++ = b[j++];
+        }
+    }
+    memcpy (out, a + i, (i1 - i) * sizeof (sort_key_t));
+    out += i1 - i;
+    memcpy (out, b + j, (j1 - j) * sizeof (sort_key_t));
+}
+
+// Sorts runs of keys on nthreads threads, then merges them pairwise, splitting the merges between the threads.
+static void
+sort_keys_parallel (sort_ctx_t *ctx) {
+    int nthreads = ctx->nthreads;
+    ctx->run_size = (ctx->count + nthreads - 1) / nthreads;
+    int nruns = (ctx->count + ctx->run_size - 1) / ctx->run_size;
+    thread_parallel_for (nruns, nthreads, sort_run, ctx);
+
+    sort_key_t *tmp = malloc (ctx->count * sizeof (sort_key_t));
+    sort_key_t *src = ctx->keys;
+    sort_key_t *dst = tmp;
+    while (ctx->run_size < ctx->count) {
+        int nmerges = (ctx->count + ctx->run_size * 2 - 1) / (ctx->run_size * 2);
+        ctx->parts_per_merge = nmerges < nthreads ? (nthreads + nmerges - 1) / nmerges : 1;
+        ctx->src = src;
+        ctx->dst = dst;
+        thread_parallel_for (nmerges * ctx->parts_per_merge, nthreads, sort_merge_part, ctx);
+
+        sort_key_t *swap = src;
+        src = dst;
+        dst = swap;
+        ctx->run_size *= 2;
+    }
+
+    if (src != ctx->keys) {
+        memcpy (ctx->keys, src, ctx->count * sizeof (sort_key_t));
+    }
+    free (tmp);
+}
+
+#pragma mark - Sorting
+
+// Sorts the tracks in place.
+// version 0: title formatting v1
+// version 1: title formatting v2
+static void
+sort_tracks (playlist_t *playlist, playItem_t **tracks, int count, int id, const char *format, int ascending, int version) {
+    sort_ctx_t ctx;
+    memset (&ctx, 0, sizeof (ctx));
+    ctx.id = id;
+    ctx.version = version;
+    ctx.ascending = ascending;
+    ctx.plt = playlist;
+
+    if (version == 0) {
+        ctx.format = format;
+    }
+    else {
+        ctx.tf_bytecode = tf_compile (format);
+    }
+
+    if (id == -1
+        && ((version == 0 && !strcmp (format, "%l"))
+            || (version == 1 && !strcmp (format, "%length%")))
+        ) {
+        ctx.is_duration = 1;
+    }
+    if (id == -1
+        && ((version == 0 && !strcmp (format, "%n"))
+            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
+        ) {
+        ctx.is_track = 1;
+    }
+
+    ctx.keys = malloc (count * sizeof (sort_key_t));
+    ctx.count = count;
+    for (int i = 0; i < count; i++) {
+        ctx.keys[i].it = tracks[i];
+    }
+
+    ctx.nthreads = 1;
+    if (count >= PLSORT_PARALLEL_MIN_ITEMS) {
+        ctx.nthreads = pl_sort_thread_count > 0 ? pl_sort_thread_count : thread_get_cpu_count ();
+    }
+
+    // The lock is held by this thread for the whole sort, so the tracks can't change.
+    // The worker threads can read the metadata, as long as the format doesn't need anything which takes the lock.
+    int parallel_keys = ctx.nthreads > 1
+        && (ctx.is_duration || ctx.is_track || (version == 1 && !tf_code_needs_lock (ctx.tf_bytecode)));
+    // Each track is evaluated once, so the result cache of the script would only take its lock,
+    // and evict the results cached for the playlist view.
+    ctx.tf_flags = DDB_TF_CONTEXT_NO_CACHE;
+    if (parallel_keys) {
+        ctx.tf_flags |= DDB_TF_CONTEXT_NO_MUTEX_LOCK;
+        ctx.chunk_size = PLSORT_CHUNK_SIZE;
+    }
+    else {
+        ctx.chunk_size = count;
+    }
+    int nchunks = (count + ctx.chunk_size - 1) / ctx.chunk_size;
+    ctx.arenas = calloc (nchunks, sizeof (sort_arena_t));
+    if (parallel_keys) {
+        thread_parallel_for (nchunks, ctx.nthreads, sort_eval_chunk, &ctx);
+    }
+    else {
+        sort_eval_chunk (&ctx, 0);
+    }
+
+    pl_sort_ctx = &ctx;
+    if (ctx.nthreads > 1) {
+        sort_keys_parallel (&ctx);
+    }
+    else {
+        qsort (ctx.keys, count, sizeof (sort_key_t), qsort_cmp_func);
+    }
+    pl_sort_ctx = NULL;
+
+    for (int i = 0; i < count; i++) {
+        tracks[i] = ctx.keys[i].it;
+    }
+
+    for (int i = 0; i < nchunks; i++) {
+        free (ctx.arenas[i].data);
+    }
+    free (ctx.arenas);
+    free (ctx.keys);
+    if (ctx.tf_bytecode) {
+        tf_free (ctx.tf_bytecode);
+    }
 }
 
 void
@@ -168,21 +484,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
 
     }
 
-    playItem_t *prev = NULL;
-    playlist->head[iter] = 0;
-    for (idx = 0; idx < count; idx++) {
-        playItem_t *it = array[idx];
-        it->prev[iter] = prev;
-        it->next[iter] = NULL;
-        if (!prev) {
-            playlist->head[iter] = it;
-        }
-        else {
-            prev->next[iter] = it;
-        }
-        prev = it;
-    }
-    playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_relink_items (playlist, iter, array, count);
 
     free (array);
 
@@ -210,46 +512,6 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         return;
     }
     pl_lock ();
-    struct timeval tm1;
-    gettimeofday (&tm1, NULL);
-    pl_sort_ascending = ascending;
-    trace ("ascending: %d\n", ascending);
-    pl_sort_id = id;
-
-    pl_sort_version = version;
-    if (version == 0) {
-        pl_sort_format = format;
-        pl_sort_tf_bytecode = NULL;
-    }
-    else {
-        pl_sort_format = NULL;
-        pl_sort_tf_bytecode = tf_compile (format);
-        pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-        pl_sort_tf_ctx.it = NULL;
-        pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-        pl_sort_tf_ctx.idx = -1;
-        pl_sort_tf_ctx.id = id;
-    }
-
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%l"))
-            || (version == 1 && !strcmp (format, "%length%")))
-        ) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%n"))
-            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
-        ) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
-
     int cursor = plt_get_cursor (playlist, PL_MAIN);
     playItem_t *track_under_cursor = NULL;
     if (cursor != -1) {
@@ -261,27 +523,8 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         array[idx] = it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
-    playItem_t *prev = NULL;
-    playlist->head[iter] = 0;
-    for (idx = 0; idx < playlist->count[iter]; idx++) {
-        playItem_t *it = array[idx];
-        it->prev[iter] = prev;
-        it->next[iter] = NULL;
-        if (!prev) {
-            playlist->head[iter] = it;
-        }
-        else {
-            prev->next[iter] = it;
-        }
-        prev = it;
-    }
-
-    playlist->tail[iter] = array[playlist->count[iter]-1];
+    sort_tracks (playlist, array, playlist->count[iter], id, format, ascending, version);
+    plt_relink_items (playlist, iter, array, playlist->count[iter]);
 
     free (array);
 
@@ -293,16 +536,6 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
 
     plt_modified (playlist);
 
-    if (version == 0) {
-        pl_sort_format = NULL;
-    }
-
-    if (version == 1) {
-        tf_free (pl_sort_tf_bytecode);
-        pl_sort_tf_bytecode = NULL;
-        memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
-    }
-
     pl_unlock ();
 }
 
@@ -319,46 +552,15 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
     }
 
     pl_lock ();
-    pl_sort_ascending = ascending;
-    pl_sort_id = -1;
-
-    pl_sort_version = 1;
-    pl_sort_format = NULL;
-    pl_sort_tf_bytecode = tf_compile (format);
-    pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-    pl_sort_tf_ctx.it = NULL;
-    pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-    pl_sort_tf_ctx.idx = -1;
-    pl_sort_tf_ctx.id = -1;
-
-    if (format
-        && !strcmp (format, "%length%")) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format
-        && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
-
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
-
-    tf_free (pl_sort_tf_bytecode);
-    pl_sort_tf_bytecode = NULL;
-    memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
-
+    sort_tracks (playlist, tracks, num_tracks, -1, format, ascending, 1);
     pl_unlock ();
 }
 
+void
+sort_set_thread_count (int count) {
+    pl_sort_thread_count = count;
+}
+
 void
 plt_autosort (playlist_t *plt) {
     int autosort_enabled = plt_find_meta_int (plt, "autosort_enabled", 0);
@@ -26,6 +26,10 @@
 
 #include "playlist.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 void
 plt_sort_v2 (playlist_t *plt, int iter, int id, const char *format, int order);
 
@@ -35,4 +39,12 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
 void
 plt_autosort (playlist_t *plt);
 
+// Sets the number of threads used for sorting large playlists, 0 to use one per CPU core
+void
+sort_set_thread_count (int count);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* defined(__deadbeef__sort__) */
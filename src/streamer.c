@@ -59,6 +59,7 @@
 #include "tf.h"
 #include "viz.h"
 #include "fft.h"
+#include "prefetch.h"
 #ifdef __APPLE__
 #include "coreaudio.h"
 #endif
@@ -93,6 +94,7 @@ static int conf_streamer_samplerate_mult_48 = 48000;
 static int conf_streamer_samplerate_mult_44 = 44100;
 static float conf_format_silence = -1.f;
 static float conf_playback_buffer_size = 0.3f;
+static float conf_prefetch_seconds = 10.f;
 
 static int trace_bufferfill = 0;
 
@@ -136,6 +138,23 @@ static DB_fileinfo_t *new_fileinfo;
 static uint64_t new_fileinfo_file_identifier;
 static DB_vfs_t *new_fileinfo_file_vfs;
 
+// The next track gets prefetched when the streaming track gets within conf_prefetch_seconds of its end:
+// its file is read into the page cache in the background, and its decoder is opened ahead of time.
+// The decoder is opened on a separate thread, which hands it back under the streamer lock,
+// so that a slow open doesn't stop the streamer thread from filling the buffer.
+// Protected by the streamer lock.
+static playItem_t *prefetch_source; // the streaming track which triggered the prefetch
+static playItem_t *prefetch_track;
+static DB_fileinfo_t *prefetch_fileinfo;
+static int prefetch_generation; // incremented on discard, so that the decoder being opened gets dropped
+static int prefetch_decoders_running;
+
+typedef struct {
+    DB_decoder_t *dec;
+    playItem_t *it;
+    int generation;
+} prefetch_decoder_request_t;
+
 // This counter is incremented by one for each streamer_read call, which returns -1,
 // which means audio should stop, but we need to wait a bit until buffered data has finished playing,
 // so we wait AUDIO_STALL_WAIT periods
@@ -339,10 +358,17 @@ streamer_set_streaming_track(playItem_t *it) {
 
 playItem_t *
 streamer_get_streaming_track (void) {
-    if (streaming_track) {
-        pl_item_ref (streaming_track);
+    // decoders may call this while being opened ahead of time on another thread
+    if (mutex == 0) {
+        return NULL;
+    }
+    streamer_lock();
+    playItem_t *it = streaming_track;
+    if (it) {
+        pl_item_ref (it);
     }
-    return streaming_track;
+    streamer_unlock();
+    return it;
 }
 
 playItem_t *
@@ -557,8 +583,10 @@ get_random_track (void) {
     return plt_get_item_for_idx (plt, r, PL_MAIN);
 }
 
+// When peek is set, returns the track which is expected to play next,
+// without reshuffling the playlist or picking a random track.
 static playItem_t *
-get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+_get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat, int peek) {
     pl_lock ();
 
     if (next_track_to_play != NULL) {
@@ -612,7 +640,7 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
                 }
             }
             it = pmin;
-            if (!it) {
+            if (!it && !peek) {
                 // all songs played, reshuffle and try again
                 if (repeat == DDB_REPEAT_ALL) { // loop
                     plt_reshuffle (streamer_playlist, &it, NULL);
@@ -636,6 +664,10 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
                 }
             }
             it = pmin;
+            if (!it && peek) {
+                pl_unlock ();
+                return NULL;
+            }
             if (!it) {
                 // all songs played, reshuffle and try again
                 if (repeat == DDB_REPEAT_ALL) { // loop
@@ -691,7 +723,7 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
         pl_unlock ();
         return it;
     }
-    else if (shuffle == DDB_SHUFFLE_RANDOM) { // random
+    else if (shuffle == DDB_SHUFFLE_RANDOM && !peek) { // random
         pl_unlock ();
         return get_random_track ();
     }
@@ -699,6 +731,11 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
     return NULL;
 }
 
+static playItem_t *
+get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    return _get_next_track (curr, shuffle, repeat, 0);
+}
+
 static playItem_t *
 get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
     pl_lock ();
@@ -979,6 +1016,154 @@ fileinfo_free (DB_fileinfo_t *fileinfo) {
     }
 }
 
+static void
+_streamer_prefetch_discard (void) {
+    streamer_lock ();
+    prefetch_generation++;
+    if (prefetch_fileinfo) {
+        fileinfo_free (prefetch_fileinfo);
+        prefetch_fileinfo = NULL;
+    }
+    if (prefetch_track) {
+        pl_item_unref (prefetch_track);
+        prefetch_track = NULL;
+    }
+    if (prefetch_source) {
+        pl_item_unref (prefetch_source);
+        prefetch_source = NULL;
+    }
+    streamer_unlock ();
+}
+
+// Returns the decoder opened ahead of time for the track, if it's ready, and discards the rest of the prefetch state
+static DB_fileinfo_t *
+_streamer_prefetch_take (playItem_t *it) {
+    DB_fileinfo_t *fileinfo = NULL;
+    streamer_lock ();
+    if (it && it == prefetch_track) {
+        fileinfo = prefetch_fileinfo;
+        prefetch_fileinfo = NULL;
+    }
+    _streamer_prefetch_discard ();
+    streamer_unlock ();
+    return fileinfo;
+}
+
+static void
+_streamer_prefetch_decoder_thread (void *ctx) {
+    prefetch_decoder_request_t *req = ctx;
+
+    DB_fileinfo_t *fileinfo = dec_open (req->dec, STREAMER_HINTS, req->it);
+    if (fileinfo && req->dec->init (fileinfo, DB_PLAYITEM (req->it)) != 0) {
+        req->dec->free (fileinfo);
+        fileinfo = NULL;
+    }
+
+    streamer_lock ();
+    if (fileinfo && req->generation == prefetch_generation && req->it == prefetch_track) {
+        prefetch_fileinfo = fileinfo;
+        fileinfo = NULL;
+    }
+    streamer_unlock ();
+
+    if (fileinfo) {
+        fileinfo_free (fileinfo);
+    }
+    pl_item_unref (req->it);
+    free (req);
+    __atomic_sub_fetch (&prefetch_decoders_running, 1, __ATOMIC_ACQ_REL);
+}
+
+// Waits until all decoders being opened ahead of time are handed back or dropped
+static void
+_streamer_prefetch_wait (void) {
+    while (__atomic_load_n (&prefetch_decoders_running, __ATOMIC_ACQUIRE) > 0) {
+        usleep (1000);
+    }
+}
+
+static void
+_streamer_prefetch_next (ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    if (conf_prefetch_seconds <= 0 || !streaming_track || !fileinfo_curr || prefetch_source == streaming_track || stop_after_current) {
+        return;
+    }
+
+    float duration = pl_get_item_duration (streaming_track);
+    if (duration <= 0 || duration - fileinfo_curr->readpos > conf_prefetch_seconds) {
+        return;
+    }
+
+    _streamer_prefetch_discard ();
+    streamer_lock ();
+    prefetch_source = streaming_track;
+    pl_item_ref (prefetch_source);
+    streamer_unlock ();
+
+    playItem_t *next;
+    if (repeat == DDB_REPEAT_SINGLE) {
+        next = streaming_track;
+        pl_item_ref (next);
+    }
+    else {
+        next = _get_next_track (streaming_track, shuffle, repeat, 1);
+    }
+    if (!next) {
+        return;
+    }
+
+    char uri[PATH_MAX];
+    char decoder_id[100] = "";
+    pl_lock ();
+    const char *next_uri = pl_find_meta (next, ":URI");
+    const char *curr_uri = pl_find_meta (streaming_track, ":URI");
+    const char *dec_id = pl_find_meta (next, ":DECODER");
+    int same_file = next_uri && curr_uri && !strcmp (next_uri, curr_uri);
+    snprintf (uri, sizeof (uri), "%s", next_uri ? next_uri : "");
+    if (dec_id) {
+        snprintf (decoder_id, sizeof (decoder_id), "%s", dec_id);
+    }
+    pl_unlock ();
+
+    if (!uri[0] || !plug_is_local_file (uri)) {
+        pl_item_unref (next);
+        return;
+    }
+
+    // subtracks of the same file are already in the cache
+    if (!same_file) {
+        float next_duration = pl_get_item_duration (next);
+        prefetch_file (uri, next_duration > 0 ? conf_prefetch_seconds / next_duration : 0);
+    }
+
+    // the decoder search and the error handling are left to stream_track
+    DB_decoder_t *dec = decoder_id[0] ? plug_get_decoder_for_id (decoder_id) : NULL;
+    if (!dec) {
+        pl_item_unref (next);
+        return;
+    }
+
+    prefetch_decoder_request_t *req = calloc (1, sizeof (prefetch_decoder_request_t));
+    req->dec = dec;
+    req->it = next;
+    pl_item_ref (next);
+
+    streamer_lock ();
+    prefetch_track = next;
+    req->generation = prefetch_generation;
+    streamer_unlock ();
+
+    __atomic_add_fetch (&prefetch_decoders_running, 1, __ATOMIC_ACQ_REL);
+    intptr_t tid = thread_start (_streamer_prefetch_decoder_thread, req);
+    if (tid) {
+        thread_detach (tid);
+    }
+    else {
+        __atomic_sub_fetch (&prefetch_decoders_running, 1, __ATOMIC_ACQ_REL);
+        pl_item_unref (req->it);
+        free (req);
+    }
+}
+
 static int
 stream_track (playItem_t *it, int startpaused) {
     streamer_lock();
@@ -993,9 +1178,13 @@ stream_track (playItem_t *it, int startpaused) {
     int err = 0;
     playItem_t *from = NULL;
     playItem_t *to = NULL;
+    DB_fileinfo_t *prefetched = _streamer_prefetch_take (it);
 
     if (first_failed_track && first_failed_track == it) {
         // looped to the first failed track
+        if (prefetched) {
+            fileinfo_free (prefetched);
+        }
         _handle_playback_stopped();
         goto error;
     }
@@ -1022,6 +1211,19 @@ stream_track (playItem_t *it, int startpaused) {
         goto success;
     }
 
+    if (prefetched) {
+        trace ("using prefetched decoder for %s\n", pl_find_meta (it, ":URI"));
+        streamer_lock();
+        new_fileinfo = prefetched;
+        if (new_fileinfo->file) {
+            new_fileinfo_file_vfs = new_fileinfo->file->vfs;
+            new_fileinfo_file_identifier = vfs_get_identifier (new_fileinfo->file);
+        }
+        streamer_set_streaming_track (it);
+        streamer_unlock();
+        goto success;
+    }
+
     char decoder_id[100] = "";
     char filetype[100] = "";
     pl_lock ();
@@ -1764,6 +1966,7 @@ streamer_thread (void *unused) {
         }
 
         if (output->state () == DDB_PLAYBACK_STATE_STOPPED) {
+            _streamer_prefetch_discard ();
             if (!handler_hasmessages (handler)) {
                 usleep (50000);
             }
@@ -1825,6 +2028,10 @@ streamer_thread (void *unused) {
             streamer_unlock ();
         }
 
+        if (res >= 0 && !last) {
+            _streamer_prefetch_next (shuffle, repeat);
+        }
+
         if (res < 0 || last) {
             // error or eof
 
@@ -1862,6 +2069,10 @@ streamer_thread (void *unused) {
     // drain event queue
     while (!handler_pop (handler, &id, &ctx, &p1, &p2));
 
+    _streamer_prefetch_discard ();
+    prefetch_cancel ();
+    _streamer_prefetch_wait ();
+
     // stop streaming song
     streamer_lock ();
     if (fileinfo_curr) {
@@ -2109,6 +2320,11 @@ process_output_block (streamblock_t *block, char *bytes, int bytes_available_siz
 
 static float (*streamer_volume_modifier) (float delta_time);
 
+#define SOFT_VOLUME_RAMP_MS 20
+
+// gain applied to the previous buffer, -1 if soft volume was not applied
+static float soft_volume_last_gain = -1;
+
 // used in android branch, do not delete
 void
 streamer_set_volume_modifier (float (*modifier) (float delta_time)) {
@@ -2119,81 +2335,46 @@ static void
 streamer_apply_soft_volume (char *bytes, int sz) {
     if (audio_is_mute ()) {
         memset (bytes, 0, sz);
+        // ramp up from silence when unmuted
+        soft_volume_last_gain = 0;
         return;
     }
     DB_output_t *output = plug_get_output ();
     if (output->has_volume) {
+        soft_volume_last_gain = -1;
         return;
     }
 
     if (output->fmt.flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
+        soft_volume_last_gain = -1;
+        return;
+    }
+
+    int framesize = (output->fmt.bps >> 3) * output->fmt.channels;
+    if (framesize == 0 || output->fmt.samplerate <= 0) {
         return;
     }
+    int frames = sz / framesize;
 
     float mod = 1.f;
 
     if (streamer_volume_modifier) {
-        float dt = sz * (output->fmt.bps >> 3) / output->fmt.channels / (float)output->fmt.samplerate;
+        float dt = frames / (float)output->fmt.samplerate;
         mod = streamer_volume_modifier (dt);
     }
 
     float vol = volume_get_amp () * mod;
 
-    char *stream = bytes;
-    int bytesread = sz;
-    if (output->fmt.bps == 16) {
-        int16_t ivolume = (int16_t)(vol * 1000);
-        if (ivolume != 1000) {
-            int half = bytesread/2;
-            for (int i = 0; i < half; i++) {
-                int16_t sample = *((int16_t*)stream);
-                *((int16_t*)stream) = (int16_t)(((int32_t)sample) * ivolume / 1000);
-                stream += 2;
-            }
-        }
-    }
-    else if (output->fmt.bps == 8) {
-        int16_t ivolume = (int16_t)(vol * 255);
-        if (ivolume != 255) {
-            for (int i = 0; i < bytesread; i++) {
-                *stream = (int8_t)(((int32_t)(*stream)) * ivolume / 255);
-                stream++;
-            }
-        }
-    }
-    else if (output->fmt.bps == 24) {
-        int16_t ivolume = (int16_t)(vol * 1000);
-        if (ivolume != 1000) {
-            int third = bytesread/3;
-            for (int i = 0; i < third; i++) {
-                int32_t sample = ((unsigned char)stream[0]) | ((unsigned char)stream[1]<<8) | ((signed char)stream[2]<<16);
-                int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                stream[0] = (newsample&0x0000ff);
-                stream[1] = (newsample&0x00ff00)>>8;
-                stream[2] = (newsample&0xff0000)>>16;
-                stream += 3;
-            }
-        }
-    }
-    else if (output->fmt.bps == 32 && !output->fmt.is_float) {
-        int16_t ivolume = (int16_t)(vol * 1000);
-        if (ivolume != 1000) {
-            for (int i = 0; i < bytesread/4; i++) {
-                int32_t sample = *((int32_t*)stream);
-                int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                *((int32_t*)stream) = newsample;
-                stream += 4;
-            }
-        }
-    }
-    else if (output->fmt.bps == 32 && output->fmt.is_float) {
-        if (vol != 1.f) {
-            for (int i = 0; i < bytesread/4; i++) {
-                *((float*)stream) = (*((float*)stream)) * vol;
-                stream += 4;
-            }
-        }
+    // ramp from the previous gain, to avoid zipper noise on volume changes
+    float from = vol;
+    int ramp_frames = 0;
+    if (soft_volume_last_gain >= 0 && soft_volume_last_gain != vol) {
+        from = soft_volume_last_gain;
+        ramp_frames = output->fmt.samplerate * SOFT_VOLUME_RAMP_MS / 1000;
     }
+    soft_volume_last_gain = vol;
+
+    pcm_apply_gain (&output->fmt, bytes, frames * framesize, from, vol, ramp_frames);
 }
 
 static int
@@ -2503,6 +2684,10 @@ streamer_configchanged (void) {
     }
     conf_playback_buffer_size = playback_buffer_size / 1000.f;
 
+    conf_prefetch_seconds = conf_get_float ("streamer.prefetch_seconds", 10.f);
+
+    dsp_configchanged ();
+
     streamreader_configchanged ();
 
     streamer_unlock ();
@@ -40,6 +40,10 @@
 //   len:int32, data
 //  5: text dimming block
 //   dim_amount:int8, len:int32, data
+//  6: function call folded by the optimizer
+//   is_true:byte, min_outlen:int32, text_len:int32, call_len:int32, text, original call block
+//  7: meta field with the key resolved by the optimizer
+//   key:pl_meta_key_handle_t *
 // !0: plain text
 
 #ifdef HAVE_CONFIG_H
@@ -66,6 +70,7 @@
 #include "gettext.h"
 #include "plugins.h"
 #include "junklib.h"
+#include "threading.h"
 #include "external/wcwidth/wcwidth.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
@@ -75,6 +80,8 @@
 
 #define TEMP_BUFFER_SIZE 1000
 #define TF_INTERNAL_FLAG_LOCKED (1<<16)
+// set when the result depends on something besides the track, and can't be cached
+#define TF_INTERNAL_FLAG_DYNAMIC (1<<17)
 
 typedef struct {
     ddb_tf_context_t _ctx;
@@ -137,6 +144,112 @@ static playlist_t empty_playlist;
 // empty code is used when "code" argument is null
 static char empty_code[4] = {0};
 
+#pragma mark - Result cache
+
+// Each compiled script has a direct-mapped cache of results, indexed by track.
+// An entry is valid while the track's modification index and the evaluation parameters stay the same.
+// Results of scripts using dynamic fields, such as %playback_time% or %list_index%, are not cached.
+#define TF_CACHE_SIZE 512 // must be a power of 2
+
+typedef struct {
+    playItem_t *it; // only compared, never dereferenced
+    uint64_t modification_idx;
+    uint32_t flags;
+    int outlen;
+    int len;
+    int dimmed;
+    char *text;
+    int text_size;
+} tf_cache_entry_t;
+
+// metadata key resolved by the optimizer, the bytecode points to it
+typedef struct tf_key_s {
+    pl_meta_key_handle_t handle;
+    struct tf_key_s *next;
+} tf_key_t;
+
+typedef struct {
+    uintptr_t mutex;
+    tf_cache_entry_t *entries; // allocated on first use
+    tf_key_t *keys; // owned by the script, released together with the cache
+} tf_cache_t;
+
+// the cache pointer is stored after the bytecode and its padding
+static tf_cache_t *
+tf_cache_for_code (const char *code) {
+    int32_t size;
+    memcpy (&size, code, sizeof (size));
+    tf_cache_t *cache;
+    memcpy (&cache, code + 4 + size + 4, sizeof (cache));
+    return cache;
+}
+
+static inline tf_cache_entry_t *
+tf_cache_entry (tf_cache_t *cache, playItem_t *it) {
+    uintptr_t hash = ((uintptr_t)it >> 4) * 2654435761u;
+    return &cache->entries[(hash >> 8) & (TF_CACHE_SIZE - 1)];
+}
+
+// returns the length of the cached result, or -1
+static int
+tf_cache_lookup (tf_cache_t *cache, playItem_t *it, uint64_t modification_idx, uint32_t flags, char *out, int outlen, int *dimmed) {
+    int res = -1;
+    mutex_lock (cache->mutex);
+    if (cache->entries) {
+        tf_cache_entry_t *e = tf_cache_entry (cache, it);
+        if (e->it == it && e->modification_idx == modification_idx && e->flags == flags && e->outlen == outlen) {
+            memcpy (out, e->text, e->len + 1);
+            *dimmed = e->dimmed;
+            res = e->len;
+        }
+    }
+    mutex_unlock (cache->mutex);
+    return res;
+}
+
+static void
+tf_cache_store (tf_cache_t *cache, playItem_t *it, uint64_t modification_idx, uint32_t flags, const char *text, int len, int outlen, int dimmed) {
+    mutex_lock (cache->mutex);
+    if (!cache->entries) {
+        cache->entries = calloc (TF_CACHE_SIZE, sizeof (tf_cache_entry_t));
+    }
+    tf_cache_entry_t *e = tf_cache_entry (cache, it);
+    if (e->text_size < len + 1) {
+        free (e->text);
+        e->text_size = len + 1;
+        e->text = malloc (e->text_size);
+    }
+    memcpy (e->text, text, len);
+    e->text[len] = 0;
+    e->it = it;
+    e->modification_idx = modification_idx;
+    e->flags = flags;
+    e->outlen = outlen;
+    e->len = len;
+    e->dimmed = dimmed;
+    mutex_unlock (cache->mutex);
+}
+
+static void
+tf_cache_free (tf_cache_t *cache) {
+    if (cache->entries) {
+        for (int i = 0; i < TF_CACHE_SIZE; i++) {
+            free (cache->entries[i].text);
+        }
+        free (cache->entries);
+    }
+    while (cache->keys) {
+        tf_key_t *next = cache->keys->next;
+        pl_meta_key_handle_free (&cache->keys->handle);
+        free (cache->keys);
+        cache->keys = next;
+    }
+    mutex_free (cache->mutex);
+    free (cache);
+}
+
+#pragma mark -
+
 static int
 snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
     va_list ap;
@@ -184,16 +297,39 @@ tf_eval (ddb_tf_context_t *_ctx, const char *code, char *out, int outlen) {
         ctx._ctx.plt = (ddb_playlist_t *)&empty_playlist;
     }
 
+    int has_dimmed = _ctx->_size >= (char *)&_ctx->dimmed - (char *)_ctx + sizeof(_ctx->dimmed);
+
+    int id = -1;
+    if (_ctx->flags & DDB_TF_CONTEXT_HAS_ID) {
+        id = _ctx->id;
+    }
+
+    // the index must be read before the evaluation, so that a concurrent change invalidates the stored result
+    tf_cache_t *cache = NULL;
+    uint64_t modification_idx = 0;
+    if (code != empty_code && ctx._ctx.it != (ddb_playItem_t *)&empty_track
+        && id != DB_COLUMN_FILENUMBER && id != DB_COLUMN_PLAYING && outlen > 0
+        && !(_ctx->flags & DDB_TF_CONTEXT_NO_CACHE)) {
+        cache = tf_cache_for_code (code);
+    }
+    if (cache) {
+        modification_idx = __atomic_load_n (&((playItem_t *)ctx._ctx.it)->_modification_idx, __ATOMIC_ACQUIRE);
+        int dimmed = 0;
+        int l = tf_cache_lookup (cache, (playItem_t *)ctx._ctx.it, modification_idx, _ctx->flags, out, outlen, &dimmed);
+        if (l >= 0) {
+            if (has_dimmed) {
+                _ctx->dimmed = dimmed;
+            }
+            return l;
+        }
+    }
+
     int32_t codelen = *((int32_t *)code);
     code += 4;
     memset (out, 0, outlen);
     int l = 0;
 
     int bool_out = 0;
-    int id = -1;
-    if (_ctx->flags & DDB_TF_CONTEXT_HAS_ID) {
-        id = _ctx->id;
-    }
 
     switch (id) {
     case DB_COLUMN_FILENUMBER:
@@ -216,18 +352,22 @@ tf_eval (ddb_tf_context_t *_ctx, const char *code, char *out, int outlen) {
 
     if (!(ctx._ctx.flags & DDB_TF_CONTEXT_MULTILINE)) {
         // replace any unprintable char with '_'
-        for (; *out; out++) {
-            if ((uint8_t)(*out) < ' ') {
-                if (*out == '\033' && (ctx._ctx.flags & DDB_TF_CONTEXT_TEXT_DIM)) {
+        for (char *p = out; *p; p++) {
+            if ((uint8_t)(*p) < ' ') {
+                if (*p == '\033' && (ctx._ctx.flags & DDB_TF_CONTEXT_TEXT_DIM)) {
                     continue;
                 }
-                *out = '_';
+                *p = '_';
             }
         }
     }
 
+    if (cache && !(ctx._ctx.flags & TF_INTERNAL_FLAG_DYNAMIC) && ctx._ctx.update == _ctx->update) {
+        tf_cache_store (cache, (playItem_t *)ctx._ctx.it, modification_idx, _ctx->flags, out, l, outlen, ctx._ctx.dimmed);
+    }
+
     _ctx->update = ctx._ctx.update;
-    if (_ctx->_size >= (char *)&_ctx->dimmed - (char *)_ctx + sizeof(_ctx->dimmed)) {
+    if (has_dimmed) {
         _ctx->dimmed = ctx._ctx.dimmed;
     }
 
@@ -1091,7 +1231,7 @@ tf_func_pad_impl (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, cons
     int nb_pad_char=1;
 
     // get expr
-    char str[outlen];
+    char str[outlen + 1];
     TF_EVAL_CHECK(str_len, ctx, args, arglens[0], str, outlen, fail_on_undef);
 
     // get len
@@ -1666,6 +1806,12 @@ tf_func_directory (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, con
             return -1;
         }
 
+        if (end == out) {
+            // the path is at the root, there's no directory name
+            *out = 0;
+            return 0;
+        }
+
         // find another delimiter
         start = end - 1;
         while (start > out && *start != '/') {
@@ -1951,6 +2097,7 @@ tf_func_rand (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const ch
         return -1;
     }
 
+    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
     int outval = rand ();
 
     int res = snprintf_clip (out, outlen, "%d", outval);
@@ -2590,9 +2737,7 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
 };
 
 static const char *
-_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free, int item_index) {
-    DB_metaInfo_t *meta = pl_meta_for_key_with_override (it, key);
-
+_tf_get_combined_meta_value (DB_metaInfo_t *meta, int *needs_free, int item_index) {
     if (!meta) {
         *needs_free = 0;
         return NULL;
@@ -2647,6 +2792,11 @@ _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free, int it
     return out;
 }
 
+static const char *
+_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free, int item_index) {
+    return _tf_get_combined_meta_value (pl_meta_for_key_with_override (it, key), needs_free, item_index);
+}
+
 static int
 format_playback_time (char *out, int outlen, float t) {
     int daystotal = (int)t / (3600*24);
@@ -2871,6 +3021,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = pl_find_meta_raw (it, ":SAMPLERATE");
                 }
                 else if (!strcmp (name, "playback_bitrate")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (ctx->flags & TF_INTERNAL_FLAG_LOCKED) {
                         pl_unlock();
                     }
@@ -2941,6 +3092,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
                 }
                 else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds")) || (tmp_e = !strcmp (name, "playback_time_ms"))) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (ctx->flags & TF_INTERNAL_FLAG_LOCKED) {
                         pl_unlock();
                     }
@@ -3051,6 +3203,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     skip_out = 1;
                 }
                 else if (!strcmp (name, "isplaying")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (ctx->flags & TF_INTERNAL_FLAG_LOCKED) {
                         pl_unlock();
                     }
@@ -3070,6 +3223,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 else if (!strcmp (name, "ispaused")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (ctx->flags & TF_INTERNAL_FLAG_LOCKED) {
                         pl_unlock();
                     }
@@ -3136,6 +3290,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 else if (!strcmp (name, "last_modified")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         if (!strncmp (v, "file://", 7)) {
@@ -3226,6 +3381,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // index of track in playlist (zero-padded)
                 else if (!strcmp (name, "list_index")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (it) {
                         int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                         int digits = 0;
@@ -3249,6 +3405,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // total number of tracks in playlist
                 else if (!strcmp (name, "list_total")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     int total_tracks = -1;
                     if (ctx->plt) {
                         total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
@@ -3269,6 +3426,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // index of track in queue
                 else if (!strcmp (name, "queue_index")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3281,6 +3439,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // indexes of track in queue
                 else if (!strcmp (name, "queue_indexes")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3305,6 +3464,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 }
                 // total amount of tracks in queue
                 else if (!strcmp (name, "queue_total")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     int count = playqueue_getcount ();
                     if (count >= 0) {
                         int l = snprintf_clip (out, outlen, "%d", count);
@@ -3317,9 +3477,11 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     val = VERSION;
                 }
                 else if (!strcmp (name, "_playlist_name")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     val = ((playlist_t *)ctx->plt)->title;
                 }
                 else if (!strcmp (name, "selection_playback_time")) {
+                    ctx->flags |= TF_INTERNAL_FLAG_DYNAMIC;
                     float seltime = plt_get_selection_playback_time((playlist_t *)ctx->plt);
 
                     int l = format_playback_time (out, outlen, seltime);
@@ -3448,6 +3610,81 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     outlen -= undimlen;
                 }
             }
+            else if (*code == 6) { // function result folded by the optimizer
+                code++;
+                size--;
+                int is_true = *code;
+                code++;
+                size--;
+                int32_t min_outlen, textlen, calllen;
+                memcpy (&min_outlen, code, 4);
+                memcpy (&textlen, code + 4, 4);
+                memcpy (&calllen, code + 8, 4);
+                code += 12;
+                size -= 12;
+
+                if (outlen >= min_outlen) {
+                    memcpy (out, code, textlen);
+                    out += textlen;
+                    outlen -= textlen;
+                    if (is_true) {
+                        *bool_out = 1;
+                    }
+                }
+                else {
+                    // not enough space for the folded result, run the original call
+                    int call_bool_out = 0;
+                    int res = tf_eval_int (ctx, code + textlen, calllen, out, outlen, &call_bool_out, fail_on_undef);
+                    if (res < 0) {
+                        return -1;
+                    }
+                    if (call_bool_out) {
+                        *bool_out = 1;
+                    }
+                    out += res;
+                    outlen -= res;
+                }
+                code += textlen + calllen;
+                size -= textlen + calllen;
+            }
+            else if (*code == 7) { // metadata field with the key resolved by the optimizer
+                code++;
+                size--;
+                const pl_meta_key_handle_t *key;
+                memcpy (&key, code, sizeof (key));
+                code += sizeof (key);
+                size -= sizeof (key);
+
+                int pl_locked = 0;
+                if (!(ctx->flags&DDB_TF_CONTEXT_NO_MUTEX_LOCK)
+                    && !(ctx->flags&TF_INTERNAL_FLAG_LOCKED)) {
+                    pl_lock ();
+                    ctx->flags |= TF_INTERNAL_FLAG_LOCKED;
+                    pl_locked = 1;
+                }
+
+                int needs_free = 0;
+                const char *val = _tf_get_combined_meta_value (pl_meta_for_key_handle_with_override (it, key), &needs_free, tf_item_index_for_context (ctx));
+
+                if (val || out > init_out) {
+                    *bool_out = 1;
+                }
+                if (val) {
+                    int32_t l = u8_strnbcpy (out, val, outlen);
+                    out += l;
+                    outlen -= l;
+                }
+                if (pl_locked) {
+                    pl_unlock ();
+                    ctx->flags &= ~TF_INTERNAL_FLAG_LOCKED;
+                }
+                if (!val && fail_on_undef) {
+                    return -1;
+                }
+                if (val && needs_free) {
+                    free ((char *)val);
+                }
+            }
             else {
                 return -1;
             }
@@ -3760,6 +3997,275 @@ tf_compile_plain (tf_compiler_t *c) {
     return 0;
 }
 
+#pragma mark - Optimizer
+
+// The optimizer rewrites the compiled bytecode:
+// calls to functions which only depend on their arguments are evaluated once if all arguments are constant,
+// and metadata fields are looked up by keys resolved in advance, skipping the special field names.
+
+// fields handled by the special cases of the field evaluation, which must stay as they are
+static const char *tf_special_fields[] = {
+    "album artist", "artist", "album", "track artist", "tracknumber", "title", "discnumber", "totaldiscs",
+    "track number", "date", "samplerate", "playback_bitrate", "bitrate", "filesize", "filesize_natural",
+    "channels", "codec", "replaygain_album_gain", "replaygain_album_peak", "replaygain_track_gain",
+    "replaygain_track_peak", "playback_time", "playback_time_seconds", "playback_time_remaining",
+    "playback_time_remaining_seconds", "playback_time_ms", "length", "length_ex", "length_seconds",
+    "length_seconds_fp", "length_samples", "isplaying", "ispaused", "filename", "filename_ext",
+    "directoryname", "last_modified", "_path_raw", "path", "list_index", "list_total", "queue_index",
+    "queue_indexes", "queue_total", "_deadbeef_version", "_playlist_name", "selection_playback_time", NULL
+};
+
+// functions which read the track, the context or global state, which can't be folded
+static const tf_func_ptr_t tf_context_funcs[] = {
+    tf_func_rand, tf_func_meta, tf_func_channels, tf_func_rgb, tf_func_itematindex, NULL
+};
+
+// longer folded results are left for evaluation
+#define TF_FOLD_BUFFER_SIZE 1024
+
+static int tf_optimize_enabled = 1;
+
+typedef struct {
+    char *data;
+    int size;
+    int capacity;
+} tf_code_buffer_t;
+
+static void
+tf_code_append (tf_code_buffer_t *b, const void *data, int len) {
+    if (b->size + len > b->capacity) {
+        b->capacity = b->capacity * 2;
+        if (b->capacity < b->size + len) {
+            b->capacity = b->size + len;
+        }
+        b->data = realloc (b->data, b->capacity);
+    }
+    memcpy (b->data + b->size, data, len);
+    b->size += len;
+}
+
+static int
+tf_field_is_special (const char *name) {
+    for (int i = 0; tf_special_fields[i]; i++) {
+        if (!strcmp (name, tf_special_fields[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+tf_func_is_foldable (tf_func_ptr_t func) {
+    for (int i = 0; tf_context_funcs[i]; i++) {
+        if (func == tf_context_funcs[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// returns 1 if the code consists of plain text and folded function results
+static int
+tf_code_is_constant (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+        }
+        else if (code[1] == 6) {
+            int32_t textlen, calllen;
+            memcpy (&textlen, code + 7, 4);
+            memcpy (&calllen, code + 11, 4);
+            code += 15 + textlen + calllen;
+            size -= 15 + textlen + calllen;
+        }
+        else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// evaluates the function call with both values of fail_on_undef, returns -1 if it fails or the results differ
+static int
+tf_fold_eval (const char *code, int size, char *out, int outlen, int *is_true) {
+    char text[TF_FOLD_BUFFER_SIZE];
+    int len[2];
+    int bool_out[2];
+    for (int fail_on_undef = 0; fail_on_undef < 2; fail_on_undef++) {
+        ddb_tf_context_int_t ctx = {0};
+        ctx._ctx._size = sizeof (ddb_tf_context_t);
+        ctx._ctx.it = (ddb_playItem_t *)&empty_track;
+        ctx._ctx.plt = (ddb_playlist_t *)&empty_playlist;
+        ctx._ctx.flags = DDB_TF_CONTEXT_NO_MUTEX_LOCK;
+        len[fail_on_undef] = tf_eval_int (&ctx._ctx, code, size, fail_on_undef ? text : out, outlen, &bool_out[fail_on_undef], fail_on_undef);
+        if (len[fail_on_undef] < 0 || ctx._ctx.flags != DDB_TF_CONTEXT_NO_MUTEX_LOCK || ctx._ctx.dimmed) {
+            return -1;
+        }
+    }
+    if (len[0] != len[1] || bool_out[0] != bool_out[1] || memcmp (out, text, len[0])) {
+        return -1;
+    }
+    *is_true = bool_out[0];
+    return len[0];
+}
+
+// replaces the function call at the end of the buffer with its result
+static void
+tf_fold_call (tf_code_buffer_t *b, int start) {
+    int32_t calllen = b->size - start;
+
+    // same padding as in the compiled script, the evaluation may read past the end of the code
+    static const char padding[4] = {0};
+    tf_code_append (b, padding, sizeof (padding));
+    b->size -= sizeof (padding);
+
+    char text[TF_FOLD_BUFFER_SIZE];
+    int is_true;
+    int32_t textlen = tf_fold_eval (b->data + start, calllen, text, TF_FOLD_BUFFER_SIZE - 1, &is_true);
+    if (textlen < 0 || textlen >= TF_FOLD_BUFFER_SIZE - 1) {
+        return;
+    }
+
+    // some functions fail when there's not enough space, e.g. $left(abc,5) with outlen < 5,
+    // so find the output length from which the result is the same
+    int32_t min_outlen = textlen;
+    while (min_outlen < TF_FOLD_BUFFER_SIZE - 1) {
+        char t[TF_FOLD_BUFFER_SIZE];
+        int t_is_true;
+        int l = tf_fold_eval (b->data + start, calllen, t, min_outlen, &t_is_true);
+        if (l == textlen && t_is_true == is_true && !memcmp (t, text, textlen)) {
+            break;
+        }
+        min_outlen = min (min_outlen * 2 + 16, TF_FOLD_BUFFER_SIZE - 1);
+    }
+
+    // 0 6 is_true min_outlen textlen calllen text call
+    char *call = malloc (calllen);
+    memcpy (call, b->data + start, calllen);
+    b->size = start;
+    char header[3] = { 0, 6, is_true ? 1 : 0 };
+    tf_code_append (b, header, 3);
+    tf_code_append (b, &min_outlen, 4);
+    tf_code_append (b, &textlen, 4);
+    tf_code_append (b, &calllen, 4);
+    tf_code_append (b, text, textlen);
+    tf_code_append (b, call, calllen);
+    free (call);
+}
+
+static int
+tf_optimize_block (tf_cache_t *cache, const char *code, int size, tf_code_buffer_t *b) {
+    while (size > 0) {
+        if (*code) {
+            // plain text
+            tf_code_append (b, code, 1);
+            code++;
+            size--;
+            continue;
+        }
+        if (size < 2) {
+            return -1;
+        }
+        if (code[1] == 1) {
+            // 0 1 funcidx numargs arglens args
+            int start = b->size;
+            uint8_t numargs = code[3];
+            uint16_t arglens[numargs + 1];
+            memcpy (arglens, code + 4, numargs * sizeof (uint16_t));
+            tf_code_append (b, code, 4 + numargs * sizeof (uint16_t));
+            const char *args = code + 4 + numargs * sizeof (uint16_t);
+            int blocksize = 4 + numargs * sizeof (uint16_t);
+            int is_constant = 1;
+            for (int i = 0; i < numargs; i++) {
+                int argstart = b->size;
+                if (tf_optimize_block (cache, args, arglens[i], b) < 0) {
+                    return -1;
+                }
+                int len = b->size - argstart;
+                if (len > 0xffff) {
+                    return -1;
+                }
+                uint16_t len16 = (uint16_t)len;
+                memcpy (b->data + start + 4 + i * sizeof (uint16_t), &len16, sizeof (uint16_t));
+                if (!tf_code_is_constant (b->data + argstart, len)) {
+                    is_constant = 0;
+                }
+                args += arglens[i];
+                blocksize += arglens[i];
+            }
+            if (is_constant && tf_func_is_foldable (tf_funcs[(uint8_t)code[2]].func)) {
+                tf_fold_call (b, start);
+            }
+            code += blocksize;
+            size -= blocksize;
+        }
+        else if (code[1] == 2) {
+            // 0 2 len name
+            uint8_t len = code[2];
+            char name[len + 1];
+            memcpy (name, code + 3, len);
+            name[len] = 0;
+            tf_key_t *key = NULL;
+            if (!tf_field_is_special (name)) {
+                key = calloc (1, sizeof (tf_key_t));
+                if (pl_meta_key_handle_init (&key->handle, name)) {
+                    key->next = cache->keys;
+                    cache->keys = key;
+                }
+                else {
+                    free (key);
+                    key = NULL;
+                }
+            }
+            if (key) {
+                // 0 7 handle
+                char header[2] = { 0, 7 };
+                const pl_meta_key_handle_t *handle = &key->handle;
+                tf_code_append (b, header, 2);
+                tf_code_append (b, &handle, sizeof (handle));
+            }
+            else {
+                tf_code_append (b, code, 3 + len);
+            }
+            code += 3 + len;
+            size -= 3 + len;
+        }
+        else if (code[1] == 3 || code[1] == 5) {
+            // 0 3 len code, or 0 5 amount len code
+            int headerlen = code[1] == 3 ? 2 : 3;
+            int32_t len;
+            memcpy (&len, code + headerlen, 4);
+            int start = b->size;
+            tf_code_append (b, code, headerlen + 4);
+            if (tf_optimize_block (cache, code + headerlen + 4, len, b) < 0) {
+                return -1;
+            }
+            int32_t newlen = b->size - start - headerlen - 4;
+            memcpy (b->data + start + headerlen, &newlen, 4);
+            code += headerlen + 4 + len;
+            size -= headerlen + 4 + len;
+        }
+        else if (code[1] == 4) {
+            // 0 4 len text
+            int32_t len;
+            memcpy (&len, code + 2, 4);
+            tf_code_append (b, code, 6 + len);
+            code += 6 + len;
+            size -= 6 + len;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void
+tf_set_optimize (int enable) {
+    tf_optimize_enabled = enable;
+}
+
 char *
 tf_compile (const char *script) {
     tf_compiler_t c;
@@ -3769,7 +4275,8 @@ tf_compile (const char *script) {
 
     size_t len = strlen(script);
     if (len == 0) {
-        return calloc(1,4);
+        // zero size, padding, and no cache
+        return calloc(1, 8 + sizeof (tf_cache_t *));
     }
     uint8_t *code = calloc(len * 3, 1);
 
@@ -3785,19 +4292,144 @@ tf_compile (const char *script) {
         }
     }
 
+    tf_cache_t *cache = calloc (1, sizeof (tf_cache_t));
+    cache->mutex = mutex_create_nonrecursive ();
+
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    tf_code_buffer_t optimized = {0};
+    if (tf_optimize_enabled && size > 0 && !tf_optimize_block (cache, (const char *)code, (int)size, &optimized)) {
+        free (code);
+        code = (uint8_t *)optimized.data;
+        size = optimized.size;
+    }
+    else {
+        free (optimized.data);
+    }
+
+    char *out = malloc (size + 8 + sizeof (tf_cache_t *));
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
     *((int32_t *)out) = (int32_t)(size);
+    memcpy (out + 4 + size + 4, &cache, sizeof (cache));
 
     free (code);
 
     return out;
 }
 
+// fields which read the playback state, the play queue or the playlist, or take the playlist lock
+static const char *tf_locking_fields[] = {
+    "playback_bitrate", "playback_time", "playback_time_seconds", "playback_time_remaining",
+    "playback_time_remaining_seconds", "playback_time_ms", "codec", "length", "length_ex",
+    "length_seconds", "length_seconds_fp", "length_samples", "isplaying", "ispaused",
+    "list_index", "list_total", "queue_index", "queue_indexes", "queue_total",
+    "_playlist_name", "selection_playback_time", NULL
+};
+
+static int
+tf_field_needs_lock (const char *name, int len) {
+    for (int i = 0; tf_locking_fields[i]; i++) {
+        if (strlen (tf_locking_fields[i]) == len && !strncasecmp (tf_locking_fields[i], name, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// walks the bytecode the same way as tf_optimize_block, so the quoted text is never taken for a field
+static int
+tf_code_block_needs_lock (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+            continue;
+        }
+        if (size < 2) {
+            return 1;
+        }
+        if (code[1] == 1) {
+            // 0 1 funcidx numargs arglens args
+            uint8_t numargs = code[3];
+            uint16_t arglens[numargs + 1];
+            memcpy (arglens, code + 4, numargs * sizeof (uint16_t));
+            const char *args = code + 4 + numargs * sizeof (uint16_t);
+            int blocksize = 4 + numargs * sizeof (uint16_t);
+            for (int i = 0; i < numargs; i++) {
+                if (tf_code_block_needs_lock (args, arglens[i])) {
+                    return 1;
+                }
+                args += arglens[i];
+                blocksize += arglens[i];
+            }
+            code += blocksize;
+            size -= blocksize;
+        }
+        else if (code[1] == 2) {
+            // 0 2 len name
+            uint8_t len = code[2];
+            if (tf_field_needs_lock (code + 3, len)) {
+                return 1;
+            }
+            code += 3 + len;
+            size -= 3 + len;
+        }
+        else if (code[1] == 3 || code[1] == 5) {
+            // 0 3 len code, or 0 5 amount len code
+            int headerlen = code[1] == 3 ? 2 : 3;
+            int32_t len;
+            memcpy (&len, code + headerlen, 4);
+            if (tf_code_block_needs_lock (code + headerlen + 4, len)) {
+                return 1;
+            }
+            code += headerlen + 4 + len;
+            size -= headerlen + 4 + len;
+        }
+        else if (code[1] == 4) {
+            // 0 4 len text
+            int32_t len;
+            memcpy (&len, code + 2, 4);
+            code += 6 + len;
+            size -= 6 + len;
+        }
+        else if (code[1] == 6) {
+            // 0 6 is_true min_outlen textlen calllen text call: folded from constant arguments
+            int32_t textlen, calllen;
+            memcpy (&textlen, code + 7, 4);
+            memcpy (&calllen, code + 11, 4);
+            code += 15 + textlen + calllen;
+            size -= 15 + textlen + calllen;
+        }
+        else if (code[1] == 7) {
+            // 0 7 handle: a metadata field, which is never one of the special fields
+            code += 2 + sizeof (pl_meta_key_handle_t *);
+            size -= 2 + sizeof (pl_meta_key_handle_t *);
+        }
+        else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+tf_code_needs_lock (const char *code) {
+    if (!code) {
+        return 1;
+    }
+    int32_t size;
+    memcpy (&size, code, 4);
+    return tf_code_block_needs_lock (code + 4, size);
+}
+
 void
 tf_free (char *code) {
+    if (code) {
+        tf_cache_t *cache = tf_cache_for_code (code);
+        if (cache) {
+            tf_cache_free (cache);
+        }
+    }
     free (code);
 }
 
@@ -39,6 +39,18 @@ tf_compile (const char *script);
 void
 tf_free (char *code);
 
+// enables constant folding and metadata key resolution in tf_compile, which is the default.
+// For testing.
+void
+tf_set_optimize (int enable);
+
+// returns 1 if the bytecode created by tf_compile reads anything besides the track metadata,
+// such as the playback state or the playlist.
+// Other scripts can be evaluated with DDB_TF_CONTEXT_NO_MUTEX_LOCK on worker threads,
+// while the thread which started them holds the playlist lock.
+int
+tf_code_needs_lock (const char *code);
+
 // evaluate the titleformatting script in a given context
 // ctx: a pointer to ddb_tf_context_t structure initialized by the caller
 // code: the bytecode data created by tf_compile
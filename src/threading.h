@@ -39,6 +39,12 @@ thread_start (void (*fn)(void *ctx), void *ctx);
 intptr_t
 thread_start_low_priority (void (*fn)(void *ctx), void *ctx);
 
+// Starts the thread with the scheduling policy and priority of the calling thread,
+// so that a realtime thread can wait on it without priority inversion.
+// Falls back to thread_start, if the priority can't be set.
+intptr_t
+thread_start_with_caller_priority (void (*fn)(void *ctx), void *ctx);
+
 int
 thread_join (intptr_t tid);
 
@@ -48,6 +54,16 @@ thread_detach (intptr_t tid);
 void
 thread_exit (void *retval);
 
+// Returns the number of online CPU cores, at least 1
+int
+thread_get_cpu_count (void);
+
+// Calls fn for every idx in [0, count), spreading the calls over up to max_threads threads,
+// one of which is the calling thread, and the others are taken from a persistent pool.
+// Returns when all calls are finished.
+void
+thread_parallel_for (int count, int max_threads, void (*fn)(void *ctx, int idx), void *ctx);
+
 uintptr_t
 mutex_create (void);
 
@@ -29,7 +29,12 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include "threading.h"
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -83,20 +88,73 @@ thread_start_low_priority (void (*fn)(void *ctx), void *ctx) {
         return 0;
     }
 #if !STATICLINK && __GLIBC__ >= 2 && __GLIBC_MINOR__ >= 4
+    // the thread is already running, and may even have finished (ESRCH),
+    // so keep it, and don't report a failure to the caller, who would then free the thread's context
     s = pthread_setschedprio (tid, minprio);
-    if (s != 0) {
+    if (s != 0 && s != ESRCH) {
         fprintf (stderr, "pthread_setschedprio failed: %s\n", strerror (s));
-        pthread_cancel (tid);
-        return 0;
     }
 #endif
 
     s = pthread_attr_destroy (&attr);
     if (s != 0) {
         fprintf (stderr, "pthread_attr_destroy failed: %s\n", strerror (s));
-        pthread_cancel (tid);
+    }
+    return (intptr_t)tid;
+#else
+    return thread_start (fn, ctx);
+#endif
+}
+
+intptr_t
+thread_start_with_caller_priority (void (*fn)(void *ctx), void *ctx) {
+#ifdef __APPLE__
+    // CoreAudio threads use the time constraint policy, which is not visible through pthread
+    thread_time_constraint_policy_data_t tc;
+    mach_msg_type_number_t count = THREAD_TIME_CONSTRAINT_POLICY_COUNT;
+    boolean_t get_default = 0;
+    kern_return_t kr = thread_policy_get (pthread_mach_thread_np (pthread_self ()), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&tc, &count, &get_default);
+    if (kr == KERN_SUCCESS && !get_default) {
+        intptr_t tid = thread_start (fn, ctx);
+        if (tid) {
+            kr = thread_policy_set (pthread_mach_thread_np ((pthread_t)tid), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&tc, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+            if (kr != KERN_SUCCESS) {
+                fprintf (stderr, "thread_policy_set failed: %d\n", kr);
+            }
+        }
+        return tid;
+    }
+#endif
+#if !STATICLINK
+    int policy;
+    struct sched_param param;
+    int s = pthread_getschedparam (pthread_self (), &policy, &param);
+    if (s != 0) {
+        fprintf (stderr, "pthread_getschedparam failed: %s\n", strerror (s));
+        return thread_start (fn, ctx);
+    }
+    if (policy == SCHED_OTHER) {
+        return thread_start (fn, ctx);
+    }
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    s = pthread_attr_init (&attr);
+    if (s != 0) {
+        fprintf (stderr, "pthread_attr_init failed: %s\n", strerror (s));
         return 0;
     }
+    pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy (&attr, policy);
+    pthread_attr_setschedparam (&attr, &param);
+
+    s = pthread_create (&tid, &attr, (void *(*)(void *))fn, (void*)ctx);
+    pthread_attr_destroy (&attr);
+    if (s != 0) {
+        // e.g. EPERM, when the realtime priority was granted to the calling thread only
+        fprintf (stderr, "pthread_create with realtime priority failed: %s\n", strerror (s));
+        return thread_start (fn, ctx);
+    }
     return (intptr_t)tid;
 #else
     return thread_start (fn, ctx);
@@ -129,6 +187,129 @@ thread_exit (void *retval) {
     pthread_exit (retval);
 }
 
+int
+thread_get_cpu_count (void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf (_SC_NPROCESSORS_ONLN);
+    if (count > 0) {
+        return (int)count;
+    }
+#endif
+    return 1;
+}
+
+#define MAX_PARALLEL_FOR_THREADS 64
+
+// The threads of thread_parallel_for are kept in a persistent pool, so that frequent calls,
+// such as a search on each keystroke, don't pay for starting and joining threads.
+// Each call posts a job, which up to max_threads-1 idle pool threads join,
+// and waits for the ones which joined before returning. Concurrent calls share the pool.
+
+typedef struct parallel_for_s {
+    int count;
+    int next_idx;
+    void (*fn)(void *ctx, int idx);
+    void *ctx;
+    int slots; // how many more pool threads may join
+    int running; // pool threads working on the job
+    struct parallel_for_s *next;
+} parallel_for_t;
+
+static pthread_mutex_t _pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _pool_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _pool_done_cond = PTHREAD_COND_INITIALIZER;
+static parallel_for_t *_pool_jobs;
+static int _pool_nthreads;
+
+static void
+_parallel_for_worker (parallel_for_t *pf) {
+    for (;;) {
+        int idx = __atomic_fetch_add (&pf->next_idx, 1, __ATOMIC_SEQ_CST);
+        if (idx >= pf->count) {
+            break;
+        }
+        pf->fn (pf->ctx, idx);
+    }
+}
+
+static void
+_pool_thread (void *unused) {
+    pthread_mutex_lock (&_pool_mutex);
+    for (;;) {
+        parallel_for_t *pf = _pool_jobs;
+        while (pf && pf->slots == 0) {
+            pf = pf->next;
+        }
+        if (!pf) {
+            pthread_cond_wait (&_pool_job_cond, &_pool_mutex);
+            continue;
+        }
+        pf->slots--;
+        pf->running++;
+        pthread_mutex_unlock (&_pool_mutex);
+
+        _parallel_for_worker (pf);
+
+        pthread_mutex_lock (&_pool_mutex);
+        pf->running--;
+        if (pf->running == 0) {
+            pthread_cond_broadcast (&_pool_done_cond);
+        }
+    }
+}
+
+void
+thread_parallel_for (int count, int max_threads, void (*fn)(void *ctx, int idx), void *ctx) {
+    int nthreads = max_threads;
+    if (nthreads > count) {
+        nthreads = count;
+    }
+    if (nthreads > MAX_PARALLEL_FOR_THREADS) {
+        nthreads = MAX_PARALLEL_FOR_THREADS;
+    }
+
+    parallel_for_t pf = {
+        .count = count,
+        .next_idx = 0,
+        .fn = fn,
+        .ctx = ctx,
+        .slots = nthreads - 1,
+    };
+
+    if (nthreads > 1) {
+        pthread_mutex_lock (&_pool_mutex);
+        while (_pool_nthreads < pf.slots) {
+            intptr_t tid = thread_start (_pool_thread, NULL);
+            if (!tid) {
+                break;
+            }
+            thread_detach (tid);
+            _pool_nthreads++;
+        }
+        pf.next = _pool_jobs;
+        _pool_jobs = &pf;
+        pthread_cond_broadcast (&_pool_job_cond);
+        pthread_mutex_unlock (&_pool_mutex);
+    }
+
+    // the calling thread takes its share, and picks up everything if no pool threads are available
+    _parallel_for_worker (&pf);
+
+    if (nthreads > 1) {
+        pthread_mutex_lock (&_pool_mutex);
+        pf.slots = 0;
+        parallel_for_t **prev = &_pool_jobs;
+        while (*prev != &pf) {
+            prev = &(*prev)->next;
+        }
+        *prev = pf.next;
+        while (pf.running > 0) {
+            pthread_cond_wait (&_pool_done_cond, &_pool_mutex);
+        }
+        pthread_mutex_unlock (&_pool_mutex);
+    }
+}
+
 uintptr_t
 mutex_create_nonrecursive (void) {
     pthread_mutex_t *mtx = malloc (sizeof (pthread_mutex_t));
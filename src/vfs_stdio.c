@@ -33,6 +33,10 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#endif
 
 #ifndef __linux__
 #define O_LARGEFILE 0
@@ -42,9 +46,18 @@
 #define USE_BUFFERING
 
 #ifndef USE_STDIO
-#define BUFSIZE 1024
+// the read-ahead window starts small, since tag readers do short reads all over the file,
+// and doubles with each sequential refill
+#define READAHEAD_MIN 4096
+#define READAHEAD_MAX (256*1024)
 #endif
 
+// values of the vfs.stdio.mode config option
+enum {
+    STDIO_MODE_READAHEAD = 0,
+    STDIO_MODE_MMAP = 1,
+};
+
 static DB_functions_t *deadbeef;
 typedef struct {
     DB_vfs_t *vfs;
@@ -54,17 +67,73 @@ typedef struct {
     int stream;
     int64_t offs;
 #ifdef USE_BUFFERING
-    uint8_t buffer[BUFSIZE];
-    uint8_t *bufptr;
-    int bufremaining;
+    uint8_t *map;
+    uint8_t *buffer;
+    int bufsize; // allocated size of buffer
+    int window; // size of the next refill
+    int64_t bufoffs; // file offset of buffer[0]
+    int buflen;
+    int64_t nextoffs; // offset following the last read from the file, to detect sequential access
 #endif
     int have_size;
-    size_t size;
+    int64_t size;
+    int is_regular; // pipes and devices are read sequentially, without pread and mmap
+    int64_t fdoffs; // position of the descriptor, when it's not a regular file
 #endif
 } STDIO_FILE;
 
 static DB_vfs_t plugin;
 
+#ifdef XCTEST
+// number of system calls made by the plugin, checked by the tests
+static uint64_t stdio_syscalls;
+
+#define COUNT_SYSCALL() __atomic_fetch_add (&stdio_syscalls, 1, __ATOMIC_RELAXED)
+
+uint64_t
+vfs_stdio_get_syscall_count (void) {
+    return __atomic_load_n (&stdio_syscalls, __ATOMIC_RELAXED);
+}
+#else
+#define COUNT_SYSCALL()
+#endif
+
+#ifndef USE_STDIO
+static int64_t
+stdio_fstat_size (STDIO_FILE *f) {
+    struct stat st;
+    COUNT_SYSCALL ();
+    if (fstat (f->stream, &st) == -1) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+#if defined(HAVE_MMAP) && defined(USE_BUFFERING)
+static void
+stdio_map (STDIO_FILE *f, int64_t size) {
+    if (size <= 0 || (uint64_t)size > SIZE_MAX) {
+        return;
+    }
+
+    COUNT_SYSCALL ();
+    void *map = mmap (NULL, (size_t)size, PROT_READ, MAP_PRIVATE, f->stream, 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    COUNT_SYSCALL ();
+    madvise (map, (size_t)size, MADV_SEQUENTIAL);
+    COUNT_SYSCALL ();
+    madvise (map, size < READAHEAD_MAX ? (size_t)size : READAHEAD_MAX, MADV_WILLNEED);
+
+    f->map = map;
+    f->size = size;
+    f->have_size = 1;
+}
+#endif
+#endif
+
 static DB_FILE *
 stdio_open (const char *fname) {
     if (!memcmp (fname, "file://", 7)) {
@@ -76,6 +145,7 @@ stdio_open (const char *fname) {
         return NULL;
     }
 #else
+    COUNT_SYSCALL ();
     int file = open (fname, O_LARGEFILE);
     if (file == -1) {
         return NULL;
@@ -85,6 +155,21 @@ stdio_open (const char *fname) {
     memset (fp, 0, sizeof (STDIO_FILE));
     fp->vfs = &plugin;
     fp->stream = file;
+#ifndef USE_STDIO
+    struct stat st;
+    COUNT_SYSCALL ();
+    fp->is_regular = !fstat (file, &st) && S_ISREG (st.st_mode);
+#ifdef USE_BUFFERING
+    fp->window = READAHEAD_MIN;
+    fp->nextoffs = -1;
+#ifdef HAVE_MMAP
+    // falls back to read-ahead for anything which can't be mapped, e.g. empty files
+    if (fp->is_regular && deadbeef->conf_get_int ("vfs.stdio.mode", STDIO_MODE_READAHEAD) == STDIO_MODE_MMAP) {
+        stdio_map (fp, st.st_size);
+    }
+#endif
+#endif
+#endif
     return (DB_FILE*)fp;
 }
 
@@ -94,25 +179,91 @@ stdio_close (DB_FILE *stream) {
 #ifdef USE_STDIO
     fclose (((STDIO_FILE *)stream)->stream);
 #else
-    close (((STDIO_FILE *)stream)->stream);
+    STDIO_FILE *f = (STDIO_FILE *)stream;
+#ifdef USE_BUFFERING
+#ifdef HAVE_MMAP
+    if (f->map) {
+        COUNT_SYSCALL ();
+        munmap (f->map, (size_t)f->size);
+    }
+#endif
+    free (f->buffer);
+#endif
+    COUNT_SYSCALL ();
+    close (f->stream);
 #endif
     free (stream);
 }
 
 #ifndef USE_STDIO
 #ifdef USE_BUFFERING
+// moves the position of a non-regular file, if it's possible
+static int
+stdio_fdseek (STDIO_FILE *f, int64_t offs) {
+    if (offs != f->fdoffs) {
+        COUNT_SYSCALL ();
+        if (lseek (f->stream, offs, SEEK_SET) == -1) {
+            return -1;
+        }
+        f->fdoffs = offs;
+    }
+    return 0;
+}
+
+// read at the given offset; regular files are read without moving the file position
+static ssize_t
+stdio_pread (STDIO_FILE *f, void *ptr, size_t size, int64_t offs) {
+    ssize_t res;
+#ifndef __MINGW32__
+    if (f->is_regular) {
+        COUNT_SYSCALL ();
+        res = pread (f->stream, ptr, size, offs);
+    }
+    else
+#endif
+    {
+        // pread fails on pipes and character devices
+        if (stdio_fdseek (f, offs)) {
+            return -1;
+        }
+        COUNT_SYSCALL ();
+        res = read (f->stream, ptr, size);
+        if (res > 0) {
+            f->fdoffs += res;
+        }
+    }
+    if (res > 0) {
+        f->nextoffs = offs + res;
+    }
+    return res;
+}
+
 static int
 fillbuffer (STDIO_FILE *f) {
-    assert (f->bufremaining >= 0);
-    if (f->bufremaining == 0) {
-        f->bufremaining = (int)read (f->stream, f->buffer, BUFSIZE);
-        if (f->bufremaining < 0) {
-            f->bufremaining = 0;
+    if (f->offs == f->nextoffs) {
+        if (f->window < READAHEAD_MAX) {
+            f->window *= 2;
+        }
+    }
+    else {
+        f->window = READAHEAD_MIN;
+    }
+
+    if (f->bufsize < f->window) {
+        free (f->buffer);
+        f->buffer = malloc (f->window);
+        if (!f->buffer) {
+            f->bufsize = 0;
+            f->buflen = 0;
             return -1;
         }
-        f->bufptr = f->buffer;
+        f->bufsize = f->window;
     }
-    return f->bufremaining;
+
+    f->bufoffs = f->offs;
+    ssize_t res = stdio_pread (f, f->buffer, f->window, f->offs);
+    f->buflen = res > 0 ? (int)res : 0;
+    return res < 0 ? -1 : f->buflen;
 }
 #endif
 #endif
@@ -128,20 +279,44 @@ stdio_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
 
     size_t nb = size * nmemb;
 #ifdef USE_BUFFERING
+    if (f->map) {
+        int64_t avail = f->offs < f->size ? f->size - f->offs : 0;
+        if (nb > avail) {
+            nb = (size_t)avail;
+        }
+        memcpy (ptr, f->map + f->offs, nb);
+        f->offs += nb;
+        return nb / size;
+    }
+
     while (nb > 0) {
+        if (f->offs >= f->bufoffs && f->offs < f->bufoffs + f->buflen) {
+            int64_t r = f->bufoffs + f->buflen - f->offs;
+            if (r > nb) {
+                r = nb;
+            }
+            memcpy (ptr, f->buffer + (f->offs - f->bufoffs), r);
+            ptr += r;
+            f->offs += r;
+            nb -= r;
+            continue;
+        }
+
+        // reads larger than the whole window go straight to the caller's memory
+        if (nb >= READAHEAD_MAX) {
+            ssize_t res = stdio_pread (f, ptr, nb, f->offs);
+            if (res <= 0) {
+                break;
+            }
+            ptr += res;
+            f->offs += res;
+            nb -= res;
+            continue;
+        }
+
         if (fillbuffer (f) <= 0) {
             break;
         }
-        int r = f->bufremaining;
-        if (r > nb) {
-            r = (int)nb;
-        }
-        memcpy (ptr, f->bufptr, r);
-        f->bufremaining -= r;
-        f->bufptr += r;
-        ptr += r;
-        f->offs += r;
-        nb -= r;
     }
     size_t ret = ((size * nmemb) - nb) / size;
 #else
@@ -156,25 +331,53 @@ stdio_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
 #endif
 }
 
+static int64_t stdio_getlength (DB_FILE *stream);
+
 static int
 stdio_seek (DB_FILE *stream, int64_t offset, int whence) {
     assert (stream);
 #ifdef USE_STDIO
     return fseek (((STDIO_FILE *)stream)->stream, offset, whence);
+#else
+    STDIO_FILE *f = (STDIO_FILE *)stream;
+#ifdef USE_BUFFERING
+    // reads are positioned, so seeking doesn't need to touch the file
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += f->offs;
+        break;
+    case SEEK_END: {
+        int64_t size = stdio_getlength (stream);
+        if (size < 0) {
+            return -1;
+        }
+        offset += size;
+        break;
+    }
+    default:
+        return -1;
+    }
+    if (offset < 0) {
+        return -1;
+    }
+    // report the seeks which a pipe can't do, unless the data is still in the buffer
+    if (!f->is_regular && (offset < f->bufoffs || offset >= f->bufoffs + f->buflen) && stdio_fdseek (f, offset)) {
+        return -1;
+    }
+    f->offs = offset;
 #else
     // convert offset to absolute
     if (whence == SEEK_CUR) {
         whence = SEEK_SET;
-        offset = ((STDIO_FILE*)stream)->offs + offset;
+        offset = f->offs + offset;
     }
-    off_t res = lseek (((STDIO_FILE *)stream)->stream, offset, whence);
+    off_t res = lseek (f->stream, offset, whence);
     if (res == -1) {
         return -1;
     }
-//    printf ("lseek res: %lld (%lld, %d, prev=%lld)\n", res, offset, whence,  ((STDIO_FILE*)stream)->offs);
-    ((STDIO_FILE*)stream)->offs = res;
-#ifdef USE_BUFFERING
-    ((STDIO_FILE*)stream)->bufremaining = 0;
+    f->offs = res;
 #endif
 #endif
     return 0;
@@ -212,11 +415,22 @@ stdio_getlength (DB_FILE *stream) {
     return l;
 #else
     if (!f->have_size) {
-        int64_t size = lseek (f->stream, 0, SEEK_END);
-        lseek (f->stream, f->offs, SEEK_SET);
-#ifdef USE_BUFFERING
-        f->bufremaining = 0;
-#endif
+        int64_t size;
+        if (f->is_regular) {
+            size = stdio_fstat_size (f);
+        }
+        else {
+            // fstat reports 0 for block devices, and pipes fail here
+            COUNT_SYSCALL ();
+            size = lseek (f->stream, 0, SEEK_END);
+            COUNT_SYSCALL ();
+            if (size >= 0 && lseek (f->stream, f->fdoffs, SEEK_SET) == -1) {
+                size = -1;
+            }
+        }
+        if (size < 0) {
+            return -1;
+        }
         f->have_size = 1;
         f->size = size;
     }
@@ -267,6 +481,7 @@ static DB_vfs_t plugin = {
         "Oleksiy Yakovenko waker@users.sourceforge.net\n"
     ,
     .plugin.website = "http://deadbeef.sf.net",
+    .plugin.configdialog = "property \"Local file access\" select[2] vfs.stdio.mode 0 \"Read-ahead\" \"Memory-mapped\";\n",
     .open = stdio_open,
     .close = stdio_close,
     .read = stdio_read,
@@ -30,8 +30,43 @@
 #include "threading.h"
 #include "viz.h"
 
+// The output thread converts each block into one of the preallocated analysis frames,
+// and hands it over to the viz thread, which runs the FFT and the listener callbacks.
+// If all the frames are still in use by the listeners, the block is dropped,
+// so the output thread never allocates memory, or waits for the listeners.
+#define VIZ_FRAME_COUNT 4
+
+// initial frame size, enough for 4096-point fft of stereo audio
+#define VIZ_FRAME_DEFAULT_CAPACITY (4096 * 2 * 2)
+
+enum {
+    VIZ_FRAME_FREE,
+    VIZ_FRAME_WRITING,
+    VIZ_FRAME_READY,
+    VIZ_FRAME_PROCESSING,
+};
+
+typedef struct {
+    int state; // VIZ_FRAME_*, accessed atomically
+    uint64_t seq; // order in which the frames were written
+    ddb_waveformat_t fmt;
+    float *data; // interleaved samples
+    int capacity; // number of floats in data
+    int fft_size;
+    int wave_size;
+    int reset;
+} viz_frame_t;
+
+static viz_frame_t _frames[VIZ_FRAME_COUNT];
+static uint64_t _next_seq;
+static int _requested_capacity; // set by the output thread when a frame is too small
+static uint64_t _dropped_frames;
+
+static dispatch_semaphore_t _frame_semaphore;
+static intptr_t _viz_tid;
+static int _viz_terminate;
+
 static dispatch_queue_t sync_queue;
-static dispatch_queue_t process_queue;
 
 // Listeners
 typedef struct wavedata_listener_s {
@@ -42,9 +77,11 @@ typedef struct wavedata_listener_s {
 
 static wavedata_listener_t *waveform_listeners;
 static wavedata_listener_t *spectrum_listeners;
+static int _listener_count; // lets the output thread skip the work without locking
 
 //#define HISTORY_FRAMES 100000
 
+// fft state, only accessed from the viz thread
 static int _fft_size = 0;
 static float *_freq_data;
 static float *_audio_data;
@@ -71,15 +108,129 @@ _init_buffers (int fft_size) {
     }
 }
 
+// reallocates the free frames which are smaller than requested by the output thread
+static void
+_grow_frames (void) {
+    int capacity = __atomic_load_n (&_requested_capacity, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < VIZ_FRAME_COUNT; i++) {
+        viz_frame_t *frame = &_frames[i];
+        if (frame->capacity >= capacity) {
+            continue;
+        }
+        int state = VIZ_FRAME_FREE;
+        if (!__atomic_compare_exchange_n (&frame->state, &state, VIZ_FRAME_PROCESSING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        free (frame->data);
+        frame->data = calloc (capacity, sizeof (float));
+        frame->capacity = capacity;
+        __atomic_store_n (&frame->state, VIZ_FRAME_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+// @return the oldest frame ready for processing, or NULL
+static viz_frame_t *
+_next_ready_frame (void) {
+    viz_frame_t *next = NULL;
+    for (int i = 0; i < VIZ_FRAME_COUNT; i++) {
+        viz_frame_t *frame = &_frames[i];
+        if (__atomic_load_n (&frame->state, __ATOMIC_ACQUIRE) == VIZ_FRAME_READY
+            && (!next || frame->seq < next->seq)) {
+            next = frame;
+        }
+    }
+    return next;
+}
+
+static void
+_process_frame (viz_frame_t *frame) {
+    _init_buffers (frame->fft_size);
+
+    ddb_audio_data_t waveform_data = {
+        .fmt = &frame->fmt,
+        .data = frame->data,
+        .nframes = frame->wave_size,
+    };
+
+    dispatch_sync(sync_queue, ^{
+        if (frame->reset || frame->fmt.channels != audio_data_channels || !spectrum_listeners) {
+            // reset
+            audio_data_channels = frame->fmt.channels;
+            memset (_freq_data, 0, sizeof (float) * _fft_size * DDB_FREQ_MAX_CHANNELS);
+            memset (_audio_data, 0, sizeof (float) * _fft_size * 2 * DDB_FREQ_MAX_CHANNELS);
+        }
+
+        if (spectrum_listeners && audio_data_channels <= DDB_FREQ_MAX_CHANNELS) {
+            // convert samples in planar layout
+            const int fft_nframes = _fft_size * 2;
+            for (int c = 0; c < audio_data_channels; c++) {
+                float *channel = &_audio_data[_fft_size * 2 * c];
+                for (int s = 0; s < fft_nframes; s++) {
+                    channel[s] = frame->data[s * audio_data_channels + c];
+                }
+            }
+
+            // calc fft
+            if (_audio_data != NULL) {
+                fft_calculate_channels (_audio_data, _freq_data, _fft_size, audio_data_channels);
+            }
+            ddb_audio_data_t spectrum_data = {
+                .fmt = &frame->fmt,
+                .data = _freq_data,
+                .nframes = _fft_size
+            };
+            for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
+                l->callback (l->ctx, &spectrum_data);
+            }
+        }
+
+        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+            l->callback (l->ctx, &waveform_data);
+        }
+    });
+}
+
+static void
+_viz_thread (void *ctx) {
+    for (;;) {
+        dispatch_semaphore_wait (_frame_semaphore, DISPATCH_TIME_FOREVER);
+        if (__atomic_load_n (&_viz_terminate, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        _grow_frames ();
+        viz_frame_t *frame;
+        while ((frame = _next_ready_frame ())) {
+            __atomic_store_n (&frame->state, VIZ_FRAME_PROCESSING, __ATOMIC_RELAXED);
+            _process_frame (frame);
+            __atomic_store_n (&frame->state, VIZ_FRAME_FREE, __ATOMIC_RELEASE);
+        }
+    }
+}
+
 void
 viz_init (void) {
     sync_queue = dispatch_queue_create("Viz Sync Queue", NULL);
-    process_queue = dispatch_queue_create("Viz Process Queue", NULL);
+    for (int i = 0; i < VIZ_FRAME_COUNT; i++) {
+        _frames[i].data = calloc (VIZ_FRAME_DEFAULT_CAPACITY, sizeof (float));
+        _frames[i].capacity = VIZ_FRAME_DEFAULT_CAPACITY;
+        _frames[i].state = VIZ_FRAME_FREE;
+    }
+    _frame_semaphore = dispatch_semaphore_create (0);
+    _viz_terminate = 0;
+    _viz_tid = thread_start (_viz_thread, NULL);
 }
 
 void
 viz_free (void) {
-    dispatch_release(process_queue);
+    __atomic_store_n (&_viz_terminate, 1, __ATOMIC_RELEASE);
+    dispatch_semaphore_signal (_frame_semaphore);
+    thread_join (_viz_tid);
+    _viz_tid = 0;
+    dispatch_release(_frame_semaphore);
+    for (int i = 0; i < VIZ_FRAME_COUNT; i++) {
+        free (_frames[i].data);
+        memset (&_frames[i], 0, sizeof (viz_frame_t));
+    }
     dispatch_release(sync_queue);
     _free_buffers();
 }
@@ -93,6 +244,7 @@ viz_waveform_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data
         l->callback = callback;
         l->next = waveform_listeners;
         waveform_listeners = l;
+        __atomic_add_fetch (&_listener_count, 1, __ATOMIC_RELEASE);
     });
 }
 
@@ -109,6 +261,7 @@ viz_waveform_unlisten (void *ctx) {
                     waveform_listeners = l->next;
                 }
                 free (l);
+                __atomic_sub_fetch (&_listener_count, 1, __ATOMIC_RELEASE);
                 break;
             }
         }
@@ -124,6 +277,7 @@ viz_spectrum_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data
         l->callback = callback;
         l->next = spectrum_listeners;
         spectrum_listeners = l;
+        __atomic_add_fetch (&_listener_count, 1, __ATOMIC_RELEASE);
     });
 }
 
@@ -140,6 +294,7 @@ viz_spectrum_unlisten (void *ctx) {
                     spectrum_listeners = l->next;
                 }
                 free (l);
+                __atomic_sub_fetch (&_listener_count, 1, __ATOMIC_RELEASE);
                 break;
             }
         }
@@ -148,99 +303,76 @@ viz_spectrum_unlisten (void *ctx) {
 
 void
 viz_reset (void) {
-    dispatch_sync(sync_queue, ^{
-        _need_reset = 1;
-    });
+    __atomic_store_n (&_need_reset, 1, __ATOMIC_RELEASE);
+}
+
+uint64_t
+viz_get_dropped_frames (void) {
+    return __atomic_load_n (&_dropped_frames, __ATOMIC_RELAXED);
 }
 
 void
-viz_process (char * restrict _bytes, int _bytes_size, DB_output_t *output, int fft_size, int wave_size) {
-    dispatch_sync(sync_queue, ^{
-        _init_buffers(fft_size);
-        if (!waveform_listeners && !spectrum_listeners) {
-            return;
-        }
+viz_process (char * restrict bytes, int bytes_size, DB_output_t *output, int fft_size, int wave_size) {
+    if (!__atomic_load_n (&_listener_count, __ATOMIC_ACQUIRE)) {
+        return;
+    }
 
-        char *bytes = _bytes;
-        if (output->fmt.flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
-            bytes = NULL;
-        }
-        
-        // convert to float
-        ddb_waveformat_t *out_fmt = calloc (1, sizeof (ddb_waveformat_t));
-        out_fmt->bps = 32;
-        out_fmt->channels = output->fmt.channels;
-        out_fmt->samplerate = output->fmt.samplerate;
-        out_fmt->channelmask = output->fmt.channelmask;
-        out_fmt->is_float = 1;
-
-        const int fft_nframes = fft_size * 2;
-
-        // calculate the size which can fit either the FFT input, or the wave data.
-        const int output_nframes = fft_nframes > wave_size ? fft_nframes : wave_size;
-
-        const int final_output_size = output_nframes * out_fmt->channels * sizeof (float);
-        const int final_input_size = output_nframes * output->fmt.channels * (output->fmt.bps/8);
-        float *data = calloc(1, final_output_size);
-
-        if (bytes != NULL) {
-            // take only as much bytes as we have available.
-            const int convert_size = _bytes_size < final_input_size ? _bytes_size : final_input_size;
-
-            // After this runs, we'll have a buffer with enough samples for FFT, padded with 0s if needed.
-            pcm_convert (&output->fmt, bytes, out_fmt, (char *)data, convert_size);
-        }
+    if (output->fmt.flags & DDB_WAVEFORMAT_FLAG_IS_DOP) {
+        bytes = NULL;
+    }
 
-        ddb_audio_data_t *waveform_data = calloc(1, sizeof(ddb_audio_data_t));
-        waveform_data->fmt = out_fmt;
-        waveform_data->data = data;
-        waveform_data->nframes = wave_size;
+    const int fft_nframes = fft_size * 2;
 
-        if (_need_reset || out_fmt->channels != audio_data_channels || !spectrum_listeners) {
-            // reset
-            audio_data_channels = out_fmt->channels;
-            memset (_freq_data, 0, sizeof (float) * _fft_size * DDB_FREQ_MAX_CHANNELS);
-            memset (_audio_data, 0, sizeof (float) * _fft_size * 2 * DDB_FREQ_MAX_CHANNELS);
-            _need_reset = 0;
-        }
+    // calculate the size which can fit either the FFT input, or the wave data.
+    const int output_nframes = fft_nframes > wave_size ? fft_nframes : wave_size;
+    const int output_nsamples = output_nframes * output->fmt.channels;
 
-        if (spectrum_listeners) {
-            // convert samples in planar layout
-            assert (fft_nframes == _fft_size * 2);
-            for (int c = 0; c < audio_data_channels; c++) {
-                float *channel = &_audio_data[_fft_size * 2 * c];
-                for (int s = 0; s < fft_nframes; s++) {
-                    channel[s] = data[s * audio_data_channels + c];
-                }
-            }
-
-            // calc fft
-            if (_audio_data != NULL) {
-                for (int c = 0; c < audio_data_channels; c++) {
-                    fft_calculate (&_audio_data[_fft_size * 2 * c], &_freq_data[_fft_size * c], _fft_size);
-                }
-            }
-            ddb_audio_data_t spectrum_data = {
-                .fmt = out_fmt,
-                .data = _freq_data,
-                .nframes = _fft_size
-            };
-            for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
-                l->callback (l->ctx, &spectrum_data);
-            }
+    // grab a free frame, or drop the block if the listeners are behind
+    viz_frame_t *frame = NULL;
+    for (int i = 0; i < VIZ_FRAME_COUNT; i++) {
+        int state = VIZ_FRAME_FREE;
+        if (__atomic_compare_exchange_n (&_frames[i].state, &state, VIZ_FRAME_WRITING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            frame = &_frames[i];
+            break;
         }
+    }
+    if (frame && frame->capacity < output_nsamples) {
+        // the viz thread will reallocate the frames
+        int requested = __atomic_load_n (&_requested_capacity, __ATOMIC_RELAXED);
+        while (requested < output_nsamples && !__atomic_compare_exchange_n (&_requested_capacity, &requested, output_nsamples, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        __atomic_store_n (&frame->state, VIZ_FRAME_FREE, __ATOMIC_RELEASE);
+        frame = NULL;
+        dispatch_semaphore_signal (_frame_semaphore);
+    }
+    if (!frame) {
+        __atomic_add_fetch (&_dropped_frames, 1, __ATOMIC_RELAXED);
+        return;
+    }
 
-        // Pass to async queue for processing and callbacks
-        dispatch_async (process_queue, ^{
-            for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-                l->callback (l->ctx, waveform_data);
-            }
-
-            free (data);
-            free (out_fmt);
-            free (waveform_data);
-        });
+    // convert to float
+    frame->fmt = (ddb_waveformat_t){
+        .bps = 32,
+        .channels = output->fmt.channels,
+        .samplerate = output->fmt.samplerate,
+        .channelmask = output->fmt.channelmask,
+        .is_float = 1,
+    };
+    frame->fft_size = fft_size;
+    frame->wave_size = wave_size;
+    frame->reset = __atomic_exchange_n (&_need_reset, 0, __ATOMIC_ACQ_REL);
+
+    const int final_input_size = output_nframes * output->fmt.channels * (output->fmt.bps/8);
+    int converted = 0;
+    if (bytes != NULL) {
+        // take only as much bytes as we have available.
+        const int convert_size = bytes_size < final_input_size ? bytes_size : final_input_size;
+
+        // After this runs, we'll have a buffer with enough samples for FFT, padded with 0s if needed.
+        converted = pcm_convert (&output->fmt, bytes, &frame->fmt, (char *)frame->data, convert_size);
+    }
+    memset ((char *)frame->data + converted, 0, output_nsamples * sizeof (float) - converted);
 
-    });
+    frame->seq = __atomic_fetch_add (&_next_seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&frame->state, VIZ_FRAME_READY, __ATOMIC_RELEASE);
+    dispatch_semaphore_signal (_frame_semaphore);
 }
-
@@ -49,4 +49,8 @@ viz_spectrum_listen (void *ctx, void (*callback)(void *ctx, const ddb_audio_data
 void
 viz_spectrum_unlisten (void *ctx);
 
+// number of blocks skipped because all the analysis frames were busy
+uint64_t
+viz_get_dropped_frames (void);
+
 #endif /* viz_h */